@@ -0,0 +1,63 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * Atomic operations for mips, using LL/SC. See include/atomic.h.
+ *
+ * As with spinlock_data_testandset (see machine/spinlock.h) there
+ * must be no other memory accesses between the LL and the SC, so each
+ * whole retry loop is written in assembler. If the SC fails because
+ * another CPU stored to the word, or we took a trap, we go back and
+ * reload. The nop after each LL covers the load delay on CPUs that
+ * have one.
+ */
+
+ATOMIC_INLINE
+unsigned
+atomic_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+	unsigned prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"nop;"
+		"bne %0, %3, 2f;"	/*   if (prev != old) give up */
+		"move %1, %4;"		/*   (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   lost it; try again */
+		"nop;"			/*   (delay slot) */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_fetchadd(volatile unsigned *p, unsigned delta)
+{
+	unsigned prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"nop;"
+		"addu %1, %0, %3;"	/*   tmp = prev + delta */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   lost it; try again */
+		"nop;"			/*   (delay slot) */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (delta)
+		: "memory");
+	return prev;
+}
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -114,14 +114,17 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
+ * A shootdown names a range of user pages in whatever address space
+ * the target CPU is running. (The TLB is flushed on every context
+ * switch, so a CPU can only hold mappings for the process it's
+ * running right now.)
+ *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_start;	/* first page */
+	vaddr_t ts_end;		/* end of the range, exclusive */
 };
 
 #define TLBSHOOTDOWN_MAX 16
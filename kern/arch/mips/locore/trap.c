@@ -40,6 +40,7 @@
 #include <mainbus.h>
 #include <syscall.h>
 #include <kern/process_syscalls.h>
+#include <kern/thread_syscalls.h>
 
 
 /* in exception-*.S */
@@ -197,6 +198,17 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If this interrupted user code of a process that is
+		 * exiting, the thread leaves instead of going back.
+		 * Only do it if the interrupt came in at spl 0, which
+		 * is always the case from user mode; then nothing is
+		 * held and it's safe to sleep.
+		 */
+		if (!iskern && doadjust) {
+			uthread_checkexit();
+		}
 		goto done2;
 	}
 
@@ -317,6 +329,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* Likewise on the way back from a system call or page fault. */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -32,14 +32,411 @@
 #include <kern/syscall.h>
 #include <kern/file_syscalls.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 #include <mips/trapframe.h>
 #include <thread.h>
+#include <trace.h>
 #include <current.h>
 #include <syscall.h>
 #include <copyinout.h>
 #include <kern/process_syscalls.h>
+#include <kern/futex_syscalls.h>
+#include <kern/thread_syscalls.h>
+#include <kern/affinity_syscalls.h>
+#include <kern/ioring_syscalls.h>
+#include <kern/shm_syscalls.h>
 #include <proc.h>
 
+/*
+ * The system call table.
+ *
+ * Each entry says what arguments the call takes, what it returns, and
+ * which function to hand the decoded arguments to. syscall() decodes
+ * the arguments per the calling conventions described below, so the
+ * handlers don't deal with registers or the user stack; most are just
+ * one line adapting to the sys_* function's own signature.
+ *
+ * To add a system call, give it a number in <kern/syscall.h>, write a
+ * SYSCALL_ADAPT line, and add a table entry.
+ */
+
+#define SYSCALL_MAXARGS	6
+
+/* Argument kinds */
+#define SA_NONE		0	/* end of list */
+#define SA_WORD		1	/* 32 bits: an int, a size, a pointer */
+#define SA_DWORD	2	/* 64 bits, in an aligned register pair */
+
+/* Return kinds */
+#define SR_32		0	/* in v0 */
+#define SR_64		1	/* in v0 (high) and v1 (low) */
+
+/* A decoded argument. */
+union sysarg {
+	int32_t i;
+	uint32_t u;
+	userptr_t p;
+	int64_t d;
+};
+
+/*
+ * Handler: gets the decoded arguments, puts any return value in *RV,
+ * and returns an error code. Only calls that need the trapframe
+ * itself (fork and friends) look at TF.
+ */
+typedef int (*syscall_fn)(struct trapframe *tf, const union sysarg *a,
+			  int64_t *rv);
+
+struct sysent {
+	const char *sy_name;
+	syscall_fn sy_call;
+	unsigned char sy_ret;				/* SR_* */
+	unsigned char sy_args[SYSCALL_MAXARGS];		/* SA_* */
+};
+
+/*
+ * Adapters. EXPR is evaluated with the arguments in a[] and its value
+ * becomes the return value; it should leave an error in err.
+ */
+#define SYSCALL_ADAPT(name, expr)					\
+	static								\
+	int								\
+	sy_##name(struct trapframe *tf, const union sysarg *a,		\
+		  int64_t *rv)						\
+	{								\
+		int err = 0;						\
+		(void)tf;						\
+		(void)a;						\
+		*rv = (expr);						\
+		return err;						\
+	}
+
+/* For sys_* functions that return an error code instead. */
+#define SYSCALL_ERR(call)	(err = (call), 0)
+/* For those that don't return at all. */
+#define SYSCALL_VOID(call)	((call), 0)
+
+SYSCALL_ADAPT(fork,		sys_fork(tf, &err))
+SYSCALL_ADAPT(vfork,		sys_vfork(tf, &err))
+SYSCALL_ADAPT(execv,		sys_execv((char *)a[0].p, (char **)a[1].p,
+					  &err))
+SYSCALL_ADAPT(_exit,		SYSCALL_VOID(sys_exit(a[0].i, false)))
+SYSCALL_ADAPT(waitpid,		sys_waitpid(a[0].i, (int *)a[1].p, a[2].i,
+					    &err))
+SYSCALL_ADAPT(getpid,		sys_getpid())
+SYSCALL_ADAPT(sbrk,		(intptr_t)sys_sbrk(a[0].i, &err))
+SYSCALL_ADAPT(open,		sys_open((char *)a[0].p, a[1].i, a[2].u, &err))
+SYSCALL_ADAPT(dup2,		sys_dup2(a[0].i, a[1].i, &err))
+SYSCALL_ADAPT(pipe,		sys_pipe(a[0].p, 0, &err))
+SYSCALL_ADAPT(pipe2,		sys_pipe(a[0].p, a[1].i, &err))
+SYSCALL_ADAPT(close,		sys_close(a[0].i, &err))
+SYSCALL_ADAPT(read,		sys_read(a[0].i, (void *)a[1].p, a[2].u, &err))
+SYSCALL_ADAPT(write,		sys_write(a[0].i, (void *)a[1].p, a[2].u,
+					  &err))
+SYSCALL_ADAPT(pread,		sys_pread(a[0].i, (void *)a[1].p, a[2].u,
+					  a[3].d, &err))
+SYSCALL_ADAPT(pwrite,		sys_pwrite(a[0].i, (void *)a[1].p, a[2].u,
+					   a[3].d, &err))
+SYSCALL_ADAPT(readv,		sys_readv(a[0].i, a[1].p, a[2].i, &err))
+SYSCALL_ADAPT(writev,		sys_writev(a[0].i, a[1].p, a[2].i, &err))
+SYSCALL_ADAPT(preadv,		sys_preadv(a[0].i, a[1].p, a[2].i, a[3].d,
+					   &err))
+SYSCALL_ADAPT(pwritev,		sys_pwritev(a[0].i, a[1].p, a[2].i, a[3].d,
+					    &err))
+SYSCALL_ADAPT(select,		sys_select(a[0].i, a[1].p, a[2].p, a[3].p,
+					   a[4].p, &err))
+SYSCALL_ADAPT(poll,		sys_poll(a[0].p, a[1].u, a[2].i, &err))
+SYSCALL_ADAPT(copy_file_range,
+	      sys_copy_file_range(a[0].i, a[1].p, a[2].i, a[3].p, a[4].u,
+				  a[5].u, &err))
+SYSCALL_ADAPT(lseek,		sys_lseek(a[0].i, a[1].d, a[2].i, &err))
+SYSCALL_ADAPT(chdir,		sys_chdir((char *)a[0].p, &err))
+SYSCALL_ADAPT(__getcwd,		sys___getcwd((char *)a[0].p, a[1].u, &err))
+SYSCALL_ADAPT(getdirentry,	sys_getdirentry(a[0].i, a[1].p, a[2].u, &err))
+SYSCALL_ADAPT(getdirentries,	sys_getdirentries(a[0].i, a[1].p, a[2].u,
+						  &err))
+SYSCALL_ADAPT(fsync,		sys_fsync(a[0].i, &err))
+SYSCALL_ADAPT(stat,		sys_stat(a[0].p, a[1].p, &err))
+SYSCALL_ADAPT(fstat,		sys_fstat(a[0].i, a[1].p, &err))
+SYSCALL_ADAPT(lstat,		sys_stat(a[0].p, a[1].p, &err))
+SYSCALL_ADAPT(remove,		sys_remove(a[0].p, &err))
+SYSCALL_ADAPT(rename,		sys_rename(a[0].p, a[1].p, &err))
+SYSCALL_ADAPT(__time,		SYSCALL_ERR(sys___time(a[0].p, a[1].p)))
+SYSCALL_ADAPT(nanosleep,	SYSCALL_ERR(sys_nanosleep(a[0].p, a[1].p)))
+SYSCALL_ADAPT(reboot,		SYSCALL_ERR(sys_reboot(a[0].i)))
+SYSCALL_ADAPT(futex_wait,	sys_futex_wait(a[0].p, a[1].i, &err))
+SYSCALL_ADAPT(futex_wake,	sys_futex_wake(a[0].p, a[1].i, &err))
+SYSCALL_ADAPT(__thread_create,	sys___thread_create(tf, a[0].p, a[1].p,
+						    a[2].p, &err))
+SYSCALL_ADAPT(thread_exit,	SYSCALL_VOID(sys_thread_exit(a[0].p)))
+SYSCALL_ADAPT(thread_join,	sys_thread_join(a[0].i, a[1].p, &err))
+SYSCALL_ADAPT(setaffinity,	sys_setaffinity(a[0].i, a[1].u, &err))
+SYSCALL_ADAPT(getaffinity,	sys_getaffinity(a[0].i, a[1].p, &err))
+SYSCALL_ADAPT(thread_setaffinity, sys_thread_setaffinity(a[0].u, &err))
+SYSCALL_ADAPT(thread_getaffinity, sys_thread_getaffinity(a[0].p, &err))
+SYSCALL_ADAPT(spawn,		sys_spawn((char *)a[0].p, (char **)a[1].p,
+					  a[2].p, a[3].i, &err))
+SYSCALL_ADAPT(ioring_setup,	sys_ioring_setup(a[0].p, a[1].u, &err))
+SYSCALL_ADAPT(ioring_enter,	sys_ioring_enter(a[0].u, &err))
+SYSCALL_ADAPT(shmget,		sys_shmget(a[0].p, a[1].u, a[2].i, &err))
+SYSCALL_ADAPT(shmat,		(intptr_t)sys_shmat(a[0].i, &err))
+SYSCALL_ADAPT(shmdt,		sys_shmdt(a[0].p, &err))
+SYSCALL_ADAPT(shmrm,		sys_shmrm(a[0].i, &err))
+
+#define W	SA_WORD
+#define DW	SA_DWORD
+#define SYSENT(name, ret, ...) \
+	[SYS_##name] = { #name, sy_##name, ret, { __VA_ARGS__ } }
+
+static const struct sysent sysent[] = {
+	SYSENT(fork,			SR_32),
+	SYSENT(vfork,			SR_32),
+	SYSENT(execv,			SR_32, W, W),
+	SYSENT(_exit,			SR_32, W),
+	SYSENT(waitpid,			SR_32, W, W, W),
+	SYSENT(getpid,			SR_32),
+	SYSENT(sbrk,			SR_32, W),
+	SYSENT(open,			SR_32, W, W, W),
+	SYSENT(dup2,			SR_32, W, W),
+	SYSENT(pipe,			SR_32, W),
+	SYSENT(pipe2,			SR_32, W, W),
+	SYSENT(close,			SR_32, W),
+	SYSENT(read,			SR_32, W, W, W),
+	SYSENT(write,			SR_32, W, W, W),
+	SYSENT(pread,			SR_32, W, W, W, DW),
+	SYSENT(pwrite,			SR_32, W, W, W, DW),
+	SYSENT(readv,			SR_32, W, W, W),
+	SYSENT(writev,			SR_32, W, W, W),
+	SYSENT(preadv,			SR_32, W, W, W, DW),
+	SYSENT(pwritev,			SR_32, W, W, W, DW),
+	SYSENT(copy_file_range,		SR_32, W, W, W, W, W, W),
+	SYSENT(lseek,			SR_64, W, DW, W),
+	SYSENT(select,			SR_32, W, W, W, W, W),
+	SYSENT(poll,			SR_32, W, W, W),
+	SYSENT(chdir,			SR_32, W),
+	SYSENT(__getcwd,		SR_32, W, W),
+	SYSENT(getdirentry,		SR_32, W, W, W),
+	SYSENT(getdirentries,		SR_32, W, W, W),
+	SYSENT(fsync,			SR_32, W),
+	SYSENT(stat,			SR_32, W, W),
+	SYSENT(fstat,			SR_32, W, W),
+	SYSENT(lstat,			SR_32, W, W),
+	SYSENT(remove,			SR_32, W),
+	SYSENT(rename,			SR_32, W, W),
+	SYSENT(__time,			SR_32, W, W),
+	SYSENT(nanosleep,		SR_32, W, W),
+	SYSENT(reboot,			SR_32, W),
+	SYSENT(futex_wait,		SR_32, W, W),
+	SYSENT(futex_wake,		SR_32, W, W),
+	SYSENT(__thread_create,		SR_32, W, W, W),
+	SYSENT(thread_exit,		SR_32, W),
+	SYSENT(thread_join,		SR_32, W, W),
+	SYSENT(setaffinity,		SR_32, W, W),
+	SYSENT(getaffinity,		SR_32, W, W),
+	SYSENT(thread_setaffinity,	SR_32, W),
+	SYSENT(thread_getaffinity,	SR_32, W),
+	SYSENT(spawn,			SR_32, W, W, W, W),
+	SYSENT(ioring_setup,		SR_32, W, W),
+	SYSENT(ioring_enter,		SR_32, W),
+	SYSENT(shmget,			SR_32, W, W, W),
+	SYSENT(shmat,			SR_32, W),
+	SYSENT(shmdt,			SR_32, W),
+	SYSENT(shmrm,			SR_32, W),
+};
+
+#undef W
+#undef DW
+
+#define NSYSENT		(sizeof(sysent) / sizeof(sysent[0]))
+
+/*
+ * Decode the arguments for SY from TF into A. Arguments past the four
+ * argument registers come from the user stack.
+ */
+static
+int
+syscall_getargs(const struct sysent *sy, struct trapframe *tf,
+		union sysarg *a)
+{
+	uint32_t regs[4];
+	uint32_t hi, lo;
+	unsigned i, slot;
+	int result;
+
+	regs[0] = tf->tf_a0;
+	regs[1] = tf->tf_a1;
+	regs[2] = tf->tf_a2;
+	regs[3] = tf->tf_a3;
+
+	slot = 0;
+	for (i=0; i<SYSCALL_MAXARGS && sy->sy_args[i] != SA_NONE; i++) {
+		if (sy->sy_args[i] == SA_DWORD) {
+			/* Aligned pair; big-endian, so high word first. */
+			slot = ROUNDUP(slot, 2);
+			if (slot < 4) {
+				hi = regs[slot];
+				lo = regs[slot+1];
+			}
+			else {
+				result = copyin((const_userptr_t)
+						(tf->tf_sp + 16 + (slot-4)*4),
+						&hi, sizeof(hi));
+				if (result == 0) {
+					result = copyin((const_userptr_t)
+						(tf->tf_sp + 16 + (slot-3)*4),
+						&lo, sizeof(lo));
+				}
+				if (result) {
+					return result;
+				}
+			}
+			a[i].d = ((int64_t)hi << 32) | lo;
+			slot += 2;
+		}
+		else {
+			if (slot < 4) {
+				a[i].u = regs[slot];
+			}
+			else {
+				result = copyin((const_userptr_t)
+						(tf->tf_sp + 16 + (slot-4)*4),
+						&a[i].u, sizeof(a[i].u));
+				if (result) {
+					return result;
+				}
+			}
+			slot++;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Statistics, kept per CPU so counting doesn't need a lock; a CPU's
+ * counters are only updated on that CPU at splhigh. Time is measured
+ * in cycles from entry to return, so calls that sleep include the
+ * sleep. The histogram has one bucket per power of 2 cycles, from
+ * SYSSTAT_HISTMIN up; the first and last collect anything beyond.
+ */
+#define SYSSTAT_HISTBUCKETS	16
+#define SYSSTAT_HISTMINBITS	8	/* first bucket: < 512 cycles */
+
+struct sysstat {
+	uint32_t ss_calls;
+	uint32_t ss_errors;
+	uint64_t ss_cycles;
+	uint32_t ss_hist[SYSSTAT_HISTBUCKETS];
+};
+
+static struct sysstat *sysstats[MAXCPUS];
+
+void
+syscall_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<num_cpus; i++) {
+		sysstats[i] = kmalloc(NSYSENT * sizeof(struct sysstat));
+		if (sysstats[i] == NULL) {
+			panic("syscall_bootstrap: out of memory\n");
+		}
+		bzero(sysstats[i], NSYSENT * sizeof(struct sysstat));
+	}
+}
+
+static
+void
+syscall_count(int callno, int err, uint32_t cycles)
+{
+	struct sysstat *ss;
+	unsigned bucket;
+	int spl;
+
+	spl = splhigh();
+	if (sysstats[curcpu->c_number] != NULL) {
+		ss = &sysstats[curcpu->c_number][callno];
+		ss->ss_calls++;
+		if (err) {
+			ss->ss_errors++;
+		}
+		ss->ss_cycles += cycles;
+
+		cycles >>= SYSSTAT_HISTMINBITS + 1;
+		for (bucket = 0; cycles != 0 && bucket < SYSSTAT_HISTBUCKETS-1;
+		     bucket++) {
+			cycles >>= 1;
+		}
+		ss->ss_hist[bucket]++;
+	}
+	splx(spl);
+}
+
+void
+syscall_printstats(void)
+{
+	struct sysstat sum;
+	unsigned i, j, k;
+	uint32_t lim;
+
+	kprintf("%-20s %10s %10s %14s %10s\n",
+		"syscall", "calls", "errors", "cycles", "avg");
+	for (i=0; i<NSYSENT; i++) {
+		if (sysent[i].sy_call == NULL) {
+			continue;
+		}
+		bzero(&sum, sizeof(sum));
+		for (j=0; j<MAXCPUS; j++) {
+			if (sysstats[j] == NULL) {
+				continue;
+			}
+			sum.ss_calls += sysstats[j][i].ss_calls;
+			sum.ss_errors += sysstats[j][i].ss_errors;
+			sum.ss_cycles += sysstats[j][i].ss_cycles;
+			for (k=0; k<SYSSTAT_HISTBUCKETS; k++) {
+				sum.ss_hist[k] += sysstats[j][i].ss_hist[k];
+			}
+		}
+		if (sum.ss_calls == 0) {
+			continue;
+		}
+		kprintf("%-20s %10u %10u %14llu %10llu\n",
+			sysent[i].sy_name, sum.ss_calls, sum.ss_errors,
+			(unsigned long long)sum.ss_cycles,
+			(unsigned long long)(sum.ss_cycles / sum.ss_calls));
+
+		/* The histogram, as "<limit:count" for nonempty buckets */
+		kprintf("%20s", "");
+		lim = 1U << (SYSSTAT_HISTMINBITS + 1);
+		for (k=0; k<SYSSTAT_HISTBUCKETS; k++, lim <<= 1) {
+			if (sum.ss_hist[k] == 0) {
+				continue;
+			}
+			if (k == SYSSTAT_HISTBUCKETS-1) {
+				kprintf(" >=%u:%u", lim >> 1, sum.ss_hist[k]);
+			}
+			else {
+				kprintf(" <%u:%u", lim, sum.ss_hist[k]);
+			}
+		}
+		kprintf("\n");
+	}
+}
+
+void
+syscall_resetstats(void)
+{
+	unsigned i;
+
+	/* Racy against syscalls in progress, which is fine for this. */
+	for (i=0; i<MAXCPUS; i++) {
+		if (sysstats[i] != NULL) {
+			bzero(sysstats[i], NSYSENT * sizeof(struct sysstat));
+		}
+	}
+}
+
 /*
  * System call dispatcher.
  *
@@ -81,8 +478,11 @@
 void
 syscall(struct trapframe *tf)
 {
+	const struct sysent *sy;
+	union sysarg args[SYSCALL_MAXARGS];
+	uint32_t start;
 	int callno;
-	int32_t retval;
+	int64_t retval;
 	int err;
 
 	KASSERT(curthread != NULL);
@@ -90,6 +490,8 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	TRACE(TRACE_SYSENTER, callno, 0, NULL);
+	start = cpu_getcycles();
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -101,91 +503,26 @@ syscall(struct trapframe *tf)
 	 */
 
 	retval = 0;
-	int64_t retval64 = 0;
-	int64_t pos64;
-	int whence;
-
 	err = 0;
 
-	switch (callno) {
-		case SYS_reboot:
-			err = sys_reboot(tf->tf_a0);
-			break;
-
-		case SYS___time:
-			err = sys___time((userptr_t)tf->tf_a0,
-							 (userptr_t)tf->tf_a1);
-			break;
-
-		/* Add stuff here */
-		case SYS_fork:
-			retval = sys_fork(tf, &err);
-			break;
-
-		case SYS_execv:
-			retval = sys_execv((char *)tf->tf_a0, (char **)tf->tf_a1, &err);
-			break;
-
-		case SYS__exit:
-			sys_exit((int)tf->tf_a0, false);
-			break;
-
-		case SYS_waitpid:
-			retval = sys_waitpid((pid_t)tf->tf_a0, (int *)tf->tf_a1, (int)tf->tf_a2, &err);
-			break;
-
-		case SYS_getpid:
-			retval = sys_getpid();
-			break;
-
-		case SYS_open:
-			retval = sys_open((char *)tf->tf_a0, (int)tf->tf_a1, (mode_t)tf->tf_a2, &err);
-			break;
-
-		case SYS_read:
-			retval = sys_read((int)tf->tf_a0, (void *)tf->tf_a1, (size_t)tf->tf_a2, &err);
-			break;
-
-		case SYS_write:
-			retval = sys_write((int)tf->tf_a0, (void *)tf->tf_a1, (size_t)tf->tf_a2, &err);
-			break;
-
-		case SYS_close:
-			retval = sys_close((int)tf->tf_a0, &err);
-			break;
-
-		case SYS_dup2:
-			retval = sys_dup2((int)tf->tf_a0, (int)tf->tf_a1, &err);
-			break;
-
-		case SYS_chdir:
-			retval = sys_chdir((char *)tf->tf_a0, &err);
-			break;
-
-		case SYS___getcwd:
-			retval = sys___getcwd((char *)tf->tf_a0, (int)tf->tf_a1, &err);
-			break;
-
-		case SYS_lseek:
-			pos64 = tf->tf_a2;
-			pos64 <<= 32;
-			pos64 |= tf->tf_a3;
-
-			copyin((const_userptr_t) (tf->tf_sp + 16), &whence, sizeof(whence));
-			retval64 = sys_lseek((int)tf->tf_a0, (off_t)pos64, whence, &err);
-			tf->tf_v1 = 0;
-			break;
-
-		case SYS_sbrk:
-			retval = (int) sys_sbrk((intptr_t)tf->tf_a0, &err);
-			break;
-
-		default:
-			kprintf("Unknown syscall %d\n", callno);
-			err = ENOSYS;
-			break;
+	if (callno < 0 || (unsigned)callno >= NSYSENT ||
+	    sysent[callno].sy_call == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		sy = NULL;
+		err = ENOSYS;
+	}
+	else {
+		sy = &sysent[callno];
+		err = syscall_getargs(sy, tf, args);
+		if (!err) {
+			err = sy->sy_call(tf, args, &retval);
+		}
 	}
 
+	TRACE(TRACE_SYSEXIT, callno, err, NULL);
+	if (sy != NULL) {
+		syscall_count(callno, err, cpu_getcycles() - start);
+	}
 
 	if (err) {
 		/*
@@ -198,13 +535,13 @@ syscall(struct trapframe *tf)
 	}
 	else {
 		/* Success. */
-
-		if (retval64 > 0){
-			retval = (int32_t)(retval64 >> 32);
-			tf->tf_v1 = (int32_t)retval64;
+		if (sy->sy_ret == SR_64) {
+			tf->tf_v0 = (int32_t)(retval >> 32);
+			tf->tf_v1 = (int32_t)retval;
+		}
+		else {
+			tf->tf_v0 = (int32_t)retval;
 		}
-
-		tf->tf_v0 = retval;
 		tf->tf_a3 = 0;      /* signal no error */
 	}
 
@@ -168,6 +168,18 @@ cpu_identify(char *buf, size_t max)
 	}
 }
 
+/*
+ * Read the cycle counter (coprocessor 0 register 9).
+ */
+uint32_t
+cpu_getcycles(void)
+{
+	uint32_t count;
+
+	__asm volatile("mfc0 %0,$9" : "=r" (count));
+	return count;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <trace.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -161,6 +162,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	TRACE(TRACE_VMFAULT, faulttype, faultaddress, NULL);
 
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
@@ -398,6 +400,30 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	vaddr_t stackbase;
+
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+
+	if (vaddr >= as->as_vbase1 &&
+	    vaddr < as->as_vbase1 + as->as_npages1 * PAGE_SIZE) {
+		*ret = (vaddr - as->as_vbase1) + as->as_pbase1;
+	}
+	else if (vaddr >= as->as_vbase2 &&
+		 vaddr < as->as_vbase2 + as->as_npages2 * PAGE_SIZE) {
+		*ret = (vaddr - as->as_vbase2) + as->as_pbase2;
+	}
+	else if (vaddr >= stackbase && vaddr < USERSTACK) {
+		*ret = (vaddr - stackbase) + as->as_stackpbase;
+	}
+	else {
+		return EFAULT;
+	}
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -39,6 +39,8 @@
 #include <vm.h>
 #include <addrspace.h>
 #include <synch.h>
+#include <trace.h>
+#include <kern/shm_syscalls.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -120,6 +122,7 @@ getppages(unsigned long npages)
 
 		if (count == 1) {
 			coremap[i].chunk_size = npages;
+			coremap[i].refcount = 1;
 			break;
 		}
 		i--;
@@ -158,6 +161,7 @@ free_kpages(vaddr_t addr)
 	int pages = coremap[index].chunk_size;
 
 	coremap[index].chunk_size = 0;
+	coremap[index].refcount = 0;
 
 	for (int i = 0; i < pages; i++) {
 		coremap[index + i].state = FREE;
@@ -191,17 +195,108 @@ coremap_used_bytes() {
 	return count * PAGE_SIZE;
 }
 
+void
+page_ref(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&mem_lock);
+	KASSERT(coremap[index].chunk_size == 1);
+	KASSERT(coremap[index].refcount > 0);
+	coremap[index].refcount++;
+	spinlock_release(&mem_lock);
+}
+
+void
+page_unref(paddr_t paddr)
+{
+	unsigned long index = paddr / PAGE_SIZE;
+
+	spinlock_acquire(&mem_lock);
+	KASSERT(coremap[index].chunk_size == 1);
+	KASSERT(coremap[index].refcount > 0);
+	if (--coremap[index].refcount == 0) {
+		coremap[index].chunk_size = 0;
+		coremap[index].state = FREE;
+	}
+	spinlock_release(&mem_lock);
+}
+
+/*
+ * Drop any TLB entries on this CPU for user pages [START, END). For
+ * more pages than the TLB holds it's quicker to drop everything.
+ */
+static
+void
+tlb_invalidate_range(vaddr_t start, vaddr_t end)
+{
+	vaddr_t va;
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	if ((end - start) / PAGE_SIZE > NUM_TLB) {
+		for (i=0; i<NUM_TLB; i++) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+	else {
+		for (va = start; va < end; va += PAGE_SIZE) {
+			i = tlb_probe(va, 0);
+			if (i >= 0) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+		}
+	}
+
+	splx(spl);
+}
+
 void
 vm_tlbshootdown_all(void)
 {
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_invalidate_range(0, USERSPACETOP);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	tlb_invalidate_range(ts->ts_start, ts->ts_end);
+}
+
+void
+vm_tlbshootdown_range(vaddr_t start, vaddr_t end)
+{
+	struct tlbshootdown ts;
+
+	start &= PAGE_FRAME;
+	ts.ts_start = start;
+	ts.ts_end = end;
+
+	tlb_invalidate_range(start, end);
+	ipi_tlbshootdown_proc(curproc, &ts);
+}
+
+/*
+ * Get the frame behind shared memory address VADDR for the page table,
+ * with a reference taken for it.
+ */
+static
+int
+shm_fault(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	struct shmmap *sm;
+
+	for (sm = as->as_shm; sm != NULL; sm = sm->sm_next) {
+		if (vaddr >= sm->sm_start &&
+		    vaddr < sm->sm_start + sm->sm_npages * PAGE_SIZE) {
+			return shm_getpage(sm->sm_seg,
+					   (vaddr - sm->sm_start) / PAGE_SIZE,
+					   ret);
+		}
+	}
+	return EFAULT;
 }
 
 int
@@ -210,11 +305,12 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	paddr_t paddr;
 	uint32_t ehi, elo;
 	struct addrspace *as;
-	int spl;
+	int spl, result;
 
 	faultaddress &= PAGE_FRAME;
 
 	DEBUG(DB_VM, "mipsvm: fault: 0x%x\n", faultaddress);
+	TRACE(TRACE_VMFAULT, faulttype, faultaddress, NULL);
 
 	if (curproc == NULL) {
 		/*
@@ -247,7 +343,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		case VM_FAULT_WRITE: {
 
 			/* Bad Call Checks */
-			if (faultaddress >= as->heap_end && faultaddress < USERSTACK - 1024 * PAGE_SIZE)
+			if (faultaddress >= as->heap_end && faultaddress < USHM_ZONE_BOTTOM)
 				return EFAULT;
 
 			if (faultaddress >= USERSTACK)
@@ -268,6 +364,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 				}
 			}
 
+			/* Other threads in the process may be faulting too. */
+			lock_acquire(as->as_lock);
+			temp = as->page_table_entry;
+			last_page = as->page_table_entry;
+
 			while (temp != NULL) {
 				if (faultaddress >= temp->vpn && faultaddress < temp->vpn + PAGE_SIZE) {
 					found = true;
@@ -281,17 +382,32 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 			if (!found) {
 				temp = (struct page_table *) kmalloc(sizeof(struct page_table));
 
-				if (temp == NULL)
+				if (temp == NULL) {
+					lock_release(as->as_lock);
 					return ENOMEM;
+				}
 
 				temp->vpn = faultaddress;
-				temp->ppn = getppages(1);
 
-				if (temp->ppn == 0) {
-					return ENOMEM;
-				}
+				if (USHM_INZONE(faultaddress)) {
+					result = shm_fault(as, faultaddress,
+							   &temp->ppn);
+					if (result) {
+						kfree(temp);
+						lock_release(as->as_lock);
+						return result;
+					}
+				} else {
+					temp->ppn = getppages(1);
+
+					if (temp->ppn == 0) {
+						kfree(temp);
+						lock_release(as->as_lock);
+						return ENOMEM;
+					}
 
-				as_zero_region(temp->ppn, 1);
+					as_zero_region(temp->ppn, 1);
+				}
 				temp->next = NULL;
 				found = true;
 
@@ -303,13 +419,14 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 				}
 			}
 
+			paddr = temp->ppn;
+			lock_release(as->as_lock);
 			break;
 		}
 		default:
 			return EINVAL;
 	}
 
-	paddr = temp->ppn;
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
@@ -333,10 +450,17 @@ as_create(void)
 		return NULL;
 	}
 
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+
 	as->addr_regions = NULL;
 	as->heap_start = 0;
 	as->heap_end = 0;
 	as->page_table_entry = NULL;
+	as->as_shm = NULL;
 
 	return as;
 }
@@ -353,16 +477,25 @@ as_destroy(struct addrspace *as) {
 		address_temp = addr_temp;
 	}
 
+	struct shmmap *sm;
+	while (as->as_shm != NULL) {
+		sm = as->as_shm;
+		as->as_shm = sm->sm_next;
+		shm_release(sm->sm_seg);
+		kfree(sm);
+	}
+
 	struct page_table *temp = as->page_table_entry;
 	struct page_table *page_temp;
 	while (temp != NULL) {
 		page_temp = temp->next;
 
-		kfree((void *)PADDR_TO_KVADDR(temp->ppn));
+		page_unref(temp->ppn);
 		kfree(temp);
 		temp = page_temp;
 	}
 
+	lock_destroy(as->as_lock);
 	kfree(as);
 }
 
@@ -465,6 +598,43 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	struct page_table *pte;
+	int result = EFAULT;
+
+	lock_acquire(as->as_lock);
+	for (pte = as->page_table_entry; pte != NULL; pte = pte->next) {
+		if (vaddr >= pte->vpn && vaddr < pte->vpn + PAGE_SIZE) {
+			*ret = pte->ppn | (vaddr & ~(vaddr_t)PAGE_FRAME);
+			result = 0;
+			break;
+		}
+	}
+	lock_release(as->as_lock);
+	return result;
+}
+
+int
+as_pin(struct addrspace *as, vaddr_t vaddr, paddr_t *ret)
+{
+	struct page_table *pte;
+	int result = EFAULT;
+
+	lock_acquire(as->as_lock);
+	for (pte = as->page_table_entry; pte != NULL; pte = pte->next) {
+		if (vaddr >= pte->vpn && vaddr < pte->vpn + PAGE_SIZE) {
+			page_ref(pte->ppn);
+			*ret = pte->ppn | (vaddr & ~(vaddr_t)PAGE_FRAME);
+			result = 0;
+			break;
+		}
+	}
+	lock_release(as->as_lock);
+	return result;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -477,6 +647,15 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 	target->page_table_entry = NULL;
 
+	/* Other threads of the old process may still be running. */
+	lock_acquire(old->as_lock);
+
+	/*
+	 * target's lists stay whole as they're built, so if we run out of
+	 * memory as_destroy can give back what was copied so far,
+	 * including the references taken on shared frames and segments.
+	 */
+
 	struct page_table *new_pg_table;
 	struct page_table *old_pg_table = old->page_table_entry;
 	struct page_table *page_table_last = NULL;
@@ -487,20 +666,34 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		new_pg_table = kmalloc(sizeof(struct page_table));
 
 		if (new_pg_table == NULL) {
+			lock_release(old->as_lock);
+			as_destroy(target);
 			return ENOMEM;
 		}
 
 		new_pg_table->vpn = old_pg_table->vpn;
-		address = getppages(1);
 
-		if (address == 0)
-			return ENOMEM;
+		if (USHM_INZONE(old_pg_table->vpn)) {
+			/* Shared memory stays shared. */
+			page_ref(old_pg_table->ppn);
+			new_pg_table->ppn = old_pg_table->ppn;
+		} else {
+			address = getppages(1);
 
-		new_pg_table->ppn = address;
-		as_zero_region(address, 1);
+			if (address == 0) {
+				kfree(new_pg_table);
+				lock_release(old->as_lock);
+				as_destroy(target);
+				return ENOMEM;
+			}
+
+			new_pg_table->ppn = address;
+			as_zero_region(address, 1);
 
-		memmove((void *) PADDR_TO_KVADDR(new_pg_table->ppn),
-				(const void *) PADDR_TO_KVADDR(old_pg_table->ppn), PAGE_SIZE);
+			memmove((void *) PADDR_TO_KVADDR(new_pg_table->ppn),
+				(const void *) PADDR_TO_KVADDR(old_pg_table->ppn),
+				PAGE_SIZE);
+		}
 
 		new_pg_table->next = NULL;
 		old_pg_table = old_pg_table->next;
@@ -527,6 +720,8 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		new_region = kmalloc(sizeof(struct region));
 
 		if(new_region == NULL){
+			lock_release(old->as_lock);
+			as_destroy(target);
 			return ENOMEM;
 		}
 
@@ -550,8 +745,29 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		}
 	}
 
+	struct shmmap *new_sm;
+	struct shmmap *old_sm;
+	struct shmmap **sm_last = &target->as_shm;
+
+	for (old_sm = old->as_shm; old_sm != NULL; old_sm = old_sm->sm_next) {
+		new_sm = kmalloc(sizeof(struct shmmap));
+
+		if (new_sm == NULL) {
+			lock_release(old->as_lock);
+			as_destroy(target);
+			return ENOMEM;
+		}
+
+		*new_sm = *old_sm;
+		new_sm->sm_next = NULL;
+		shm_ref(new_sm->sm_seg);
+		*sm_last = new_sm;
+		sm_last = &new_sm->sm_next;
+	}
+
 	target->heap_start = old->heap_start;
 	target->heap_end = old->heap_end;
+	lock_release(old->as_lock);
 
 	*ret = target;
 	return 0;
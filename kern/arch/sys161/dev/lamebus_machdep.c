@@ -39,6 +39,7 @@
 #include <current.h>
 #include <membar.h>
 #include <synch.h>
+#include <prof.h>
 #include <mainbus.h>
 #include <sys161/bus.h>
 #include <lamebus/lamebus.h>
@@ -306,6 +307,8 @@ mainbus_interrupt(struct trapframe *tf)
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
 		mips_timer_set(CPU_FREQUENCY / HZ);
+		/* sample for the profiler */
+		PROF_SAMPLE(tf->tf_epc);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
@@ -174,6 +174,12 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars_head = nexthead;
 
 	V(cs->cs_rsem);
+
+	/* Reads return a line at a time; see con_poll. */
+	nexthead = (nexthead + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+	if (ch == '\r' || ch == '\n' || nexthead == cs->cs_gotchars_tail) {
+		pollwakeup(&cs->cs_pollhead);
+	}
 }
 
 /*
@@ -302,10 +308,45 @@ con_ioctl(struct device *dev, int op, userptr_t data)
 	return EINVAL;
 }
 
+/*
+ * A read waits for a whole line, so the console is readable once a
+ * line is in the buffer, or the buffer is full and nothing more can
+ * come until someone reads. Writing is always allowed.
+ */
+static
+int
+con_poll(struct device *dev, int events, struct poller *pl)
+{
+	struct con_softc *cs = dev->d_data;
+	unsigned head, i;
+	int ret;
+
+	pollwait(pl, &cs->cs_pollhead);
+
+	ret = events & POLLOUT;
+	if (events & POLLIN) {
+		head = cs->cs_gotchars_head;
+		i = cs->cs_gotchars_tail;
+		if ((head + 1) % CONSOLE_INPUT_BUFFER_SIZE == i) {
+			ret |= POLLIN;
+		}
+		for (; i != head;
+		     i = (i + 1) % CONSOLE_INPUT_BUFFER_SIZE) {
+			if (cs->cs_gotchars[i] == '\r' ||
+			    cs->cs_gotchars[i] == '\n') {
+				ret |= POLLIN;
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
 static const struct device_ops console_devops = {
 	.devop_eachopen = con_eachopen,
 	.devop_io = con_io,
 	.devop_ioctl = con_ioctl,
+	.devop_poll = con_poll,
 };
 
 static
@@ -386,6 +427,7 @@ config_con(struct con_softc *cs, int unit)
 	cs->cs_wsem = wsem;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	pollhead_init(&cs->cs_pollhead);
 
 	the_console = cs;
 	con_userlock_read = rlk;
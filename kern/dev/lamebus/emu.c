@@ -52,6 +52,7 @@
 #include <lamebus/emu.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <poll.h>
 #include <emufs.h>
 #include "autoconf.h"
 
@@ -571,16 +572,22 @@ emufs_read(struct vnode *v, struct uio *uio)
 
 /*
  * VOP_READDIR
+ *
+ * The emulator only gives us names; there are no inode numbers, and
+ * the type would take a lookup.
  */
 static
 int
-emufs_getdirentry(struct vnode *v, struct uio *uio)
+emufs_getdirentry(struct vnode *v, struct uio *uio, ino_t *ino, mode_t *type)
 {
 	struct emufs_vnode *ev = v->vn_data;
 	uint32_t amt;
 
 	KASSERT(uio->uio_rw==UIO_READ);
 
+	*ino = 0;
+	*type = 0;
+
 	amt = uio->uio_resid;
 	if (amt > EMU_MAXIO) {
 		amt = EMU_MAXIO;
@@ -1080,7 +1087,7 @@ static const struct vnode_ops emufs_fileops = {
 
 	.vop_read = emufs_read,
 	.vop_readlink = emufs_readlink_notlink,
-	.vop_getdirentry = emufs_uio_op_notdir,
+	.vop_getdirentry = vopfail_getdirentry_notdir,
 	.vop_write = emufs_write,
 	.vop_ioctl = emufs_ioctl,
 	.vop_stat = emufs_stat,
@@ -1090,6 +1097,7 @@ static const struct vnode_ops emufs_fileops = {
 	.vop_mmap = emufs_mmap,
 	.vop_truncate = emufs_truncate,
 	.vop_namefile = emufs_uio_op_notdir,
+	.vop_poll = vop_poll_ready,
 
 	.vop_creat = emufs_creat_notdir,
 	.vop_symlink = emufs_symlink_notdir,
@@ -1124,6 +1132,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_mmap = emufs_void_op_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
+	.vop_poll = vop_poll_ready,
 
 	.vop_creat = emufs_creat,
 	.vop_symlink = emufs_symlink,
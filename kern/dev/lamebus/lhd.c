@@ -39,6 +39,7 @@
 #include <synch.h>
 #include <platform/bus.h>
 #include <vfs.h>
+#include <trace.h>
 #include <lamebus/lhd.h>
 #include "autoconf.h"
 
@@ -104,6 +105,7 @@ void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
 	lh->lh_result = err;
+	TRACE(TRACE_DISKDONE, lh->lh_unit, err, NULL);
 	V(lh->lh_done);
 }
 
@@ -235,6 +237,8 @@ lhd_io(struct device *d, struct uio *uio)
 		lhd_wreg(lh, LHD_REG_SECT, sector+i);
 
 		/* and start the operation. */
+		TRACE(uio->uio_rw == UIO_WRITE ? TRACE_DISKWRITE : TRACE_DISKREAD,
+		      lh->lh_unit, sector+i, NULL);
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
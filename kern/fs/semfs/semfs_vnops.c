@@ -136,7 +136,7 @@ semfs_getsem(struct semfs_vnode *semv)
  * Wakeup helper. We only need to wake up if there are sleepers, which
  * should only be the case if the old count is 0; and we only
  * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * will be more than 1. Pollers are waiting for the same thing.
  */
 static
 void
@@ -151,6 +151,7 @@ semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 	else {
 		cv_broadcast(sem->sems_cv, sem->sems_lock);
 	}
+	pollwakeup(&sem->sems_pollhead);
 }
 
 /*
@@ -255,6 +256,31 @@ semfs_write(struct vnode *vn, struct uio *uio)
 	return 0;
 }
 
+/*
+ * Poll. A read (P) of one won't block if the count isn't zero; a
+ * write (V) never blocks.
+ */
+static
+int
+semfs_poll(struct vnode *vn, int events, struct poller *pl)
+{
+	struct semfs_vnode *semv = vn->vn_data;
+	struct semfs_sem *sem;
+	int ret;
+
+	sem = semfs_getsem(semv);
+
+	lock_acquire(sem->sems_lock);
+	pollwait(pl, &sem->sems_pollhead);
+	ret = events & POLLOUT;
+	if (sem->sems_count > 0) {
+		ret |= events & POLLIN;
+	}
+	lock_release(sem->sems_lock);
+
+	return ret;
+}
+
 /*
  * Truncate. Set the count to the specified value.
  *
@@ -300,7 +326,8 @@ semfs_truncate(struct vnode *vn, off_t len)
  */
 static
 int
-semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
+semfs_getdirentry(struct vnode *dirvn, struct uio *uio, ino_t *ino,
+		  mode_t *type)
 {
 	struct semfs_vnode *dirsemv = dirvn->vn_data;
 	struct semfs *semfs = dirsemv->semv_semfs;
@@ -322,6 +349,10 @@ semfs_getdirentry(struct vnode *dirvn, struct uio *uio)
 		dent = semfs_direntryarray_get(semfs->semfs_dents, pos);
 		result = uiomove(dent->semd_name, strlen(dent->semd_name),
 				 uio);
+		/* The offset is the slot number, not a byte count */
+		uio->uio_offset = pos + 1;
+		*ino = dent->semd_semnum;
+		*type = S_IFREG;
 	}
 
 	lock_release(semfs->semfs_dirlock);
@@ -666,6 +697,7 @@ static const struct vnode_ops semfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = semfs_namefile,
+	.vop_poll = vop_poll_ready,
 
 	.vop_creat = semfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
@@ -689,7 +721,7 @@ static const struct vnode_ops semfs_semops = {
 
 	.vop_read = semfs_read,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentry = vopfail_getdirentry_notdir,
 	.vop_write = semfs_write,
 	.vop_ioctl = semfs_ioctl,
 	.vop_stat = semfs_semstat,
@@ -699,6 +731,7 @@ static const struct vnode_ops semfs_semops = {
 	.vop_mmap = vopfail_mmap_perm,
 	.vop_truncate = semfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = semfs_poll,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -146,6 +146,33 @@ sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 	return found ? 0 : ENOENT;
 }
 
+/*
+ * Find the first entry in use at or after slot *SLOT, and return it
+ * in SD and its slot in *SLOT. Returns ENOENT if there isn't one.
+ */
+int
+sfs_dir_nextentry(struct sfs_vnode *sv, int *slot, struct sfs_direntry *sd)
+{
+	int nentries, i, result;
+
+	nentries = sfs_dir_nentries(sv);
+
+	for (i = *slot; i < nentries; i++) {
+		result = sfs_readdir(sv, i, sd);
+		if (result) {
+			return result;
+		}
+		if (sd->sfd_ino != SFS_NOINO) {
+			/* Ensure null termination, just in case */
+			sd->sfd_name[sizeof(sd->sfd_name)-1] = 0;
+			*slot = i;
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
 /*
  * Create a link in a directory to the specified inode by number, with
  * the specified name, and optionally hand back the slot.
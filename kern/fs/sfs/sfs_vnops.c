@@ -39,6 +39,7 @@
 #include <lib.h>
 #include <uio.h>
 #include <vfs.h>
+#include <poll.h>
 #include <sfs.h>
 #include "sfsprivate.h"
 
@@ -171,6 +172,8 @@ sfs_stat(struct vnode *v, struct stat *statbuf)
 	statbuf->st_blocks = 0;
 
 	/* Fill in other fields as desired/possible... */
+	statbuf->st_ino = sv->sv_ino;
+	statbuf->st_blksize = SFS_BLOCKSIZE;
 
 	return 0;
 }
@@ -254,6 +257,50 @@ sfs_truncate(struct vnode *v, off_t len)
 	return sfs_itrunc(sv, len);
 }
 
+/*
+ * Read a directory entry. The offset is the slot number. There are no
+ * subdirectories, so everything in here is a file except for . and
+ * .., which are the root.
+ */
+static
+int
+sfs_getdirentry(struct vnode *v, struct uio *uio, ino_t *ino, mode_t *type)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_direntry sd;
+	int slot, result;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	vfs_biglock_acquire();
+
+	if (uio->uio_offset < 0 || uio->uio_offset >=
+	    sv->sv_i.sfi_size / sizeof(struct sfs_direntry)) {
+		/* No such slot; call it EOF */
+		vfs_biglock_release();
+		return 0;
+	}
+	slot = uio->uio_offset;
+
+	result = sfs_dir_nextentry(sv, &slot, &sd);
+	if (result == ENOENT) {
+		vfs_biglock_release();
+		return 0;
+	}
+	if (result) {
+		vfs_biglock_release();
+		return result;
+	}
+
+	result = uiomove(sd.sfd_name, strlen(sd.sfd_name), uio);
+	uio->uio_offset = slot + 1;
+	*ino = sd.sfd_ino;
+	*type = sd.sfd_ino == SFS_ROOTDIR_INO ? S_IFDIR : S_IFREG;
+
+	vfs_biglock_release();
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -592,7 +639,7 @@ const struct vnode_ops sfs_fileops = {
 
 	.vop_read = sfs_read,
 	.vop_readlink = vopfail_uio_notdir,
-	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentry = vopfail_getdirentry_notdir,
 	.vop_write = sfs_write,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
@@ -602,6 +649,7 @@ const struct vnode_ops sfs_fileops = {
 	.vop_mmap = sfs_mmap,
 	.vop_truncate = sfs_truncate,
 	.vop_namefile = vopfail_uio_notdir,
+	.vop_poll = vop_poll_ready,
 
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
@@ -626,7 +674,7 @@ const struct vnode_ops sfs_dirops = {
 
 	.vop_read = vopfail_uio_isdir,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_nosys,
+	.vop_getdirentry = sfs_getdirentry,
 	.vop_write = vopfail_uio_isdir,
 	.vop_ioctl = sfs_ioctl,
 	.vop_stat = sfs_stat,
@@ -636,6 +684,7 @@ const struct vnode_ops sfs_dirops = {
 	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = vopfail_truncate_isdir,
 	.vop_namefile = sfs_namefile,
+	.vop_poll = vop_poll_ready,
 
 	.vop_creat = sfs_creat,
 	.vop_symlink = vopfail_symlink_nosys,
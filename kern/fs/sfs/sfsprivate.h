@@ -55,6 +55,8 @@ int sfs_itrunc(struct sfs_vnode *sv, off_t len);
 /* Functions in sfs_dir.c */
 int sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		uint32_t *ino, int *slot, int *emptyslot);
+int sfs_dir_nextentry(struct sfs_vnode *sv, int *slot,
+		struct sfs_direntry *sd);
 int sfs_dir_link(struct sfs_vnode *sv, const char *name, uint32_t ino,
 		int *slot);
 int sfs_dir_unlink(struct sfs_vnode *sv, int slot);
@@ -35,10 +35,12 @@
  */
 
 
+#include <limits.h>
 #include <vm.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
 
 
 /*
@@ -68,6 +70,40 @@ page_table {
     struct page_table *next;
 };
 
+/* Shared memory segment attached to an address space */
+struct shmmap {
+    vaddr_t sm_start;
+    unsigned sm_npages;
+    struct shmseg *sm_seg;
+    struct shmmap *sm_next;	/* sorted by sm_start */
+};
+
+/*
+ * User stacks. The main thread's stack is the top USTACK_PAGES pages
+ * below USERSTACK; below that are THREAD_MAX - 1 fixed slots of
+ * UTHREAD_STACKPAGES pages for the stacks of additional threads (see
+ * thread_syscalls.c). Slot 0 is the main stack. All of it is
+ * demand-zero like the heap, and the heap may not grow into it.
+ */
+#define USTACK_PAGES		1024
+#define UTHREAD_STACKPAGES	64
+#define USTACK_ZONE_BOTTOM	(USERSTACK - (USTACK_PAGES + \
+				 (THREAD_MAX - 1) * UTHREAD_STACKPAGES) * PAGE_SIZE)
+
+/* Initial stack pointer (top of stack) for thread stack slot N > 0 */
+#define UTHREAD_STACKTOP(n)	(USERSTACK - (USTACK_PAGES + \
+				 ((n) - 1) * UTHREAD_STACKPAGES) * PAGE_SIZE)
+
+/*
+ * Shared memory segments are attached in the USHM_PAGES pages below
+ * the stacks (see shm_syscalls.c). The heap may not grow into them
+ * either. Pages here are never demand-zero; they belong to segments.
+ */
+#define USHM_PAGES		4096
+#define USHM_ZONE_BOTTOM	(USTACK_ZONE_BOTTOM - USHM_PAGES * PAGE_SIZE)
+#define USHM_INZONE(va)		((va) >= USHM_ZONE_BOTTOM && \
+				 (va) < USTACK_ZONE_BOTTOM)
+
 struct addrspace {
 #if OPT_DUMBVM
     vaddr_t as_vbase1;
@@ -79,10 +115,12 @@ struct addrspace {
     paddr_t as_stackpbase;
 #else
     /* Put stuff here for your VM system */
+    struct lock *as_lock;	/* page table and heap; threads share us */
     struct region *addr_regions;
     vaddr_t heap_start;
     vaddr_t heap_end;
     struct page_table *page_table_entry;
+    struct shmmap *as_shm;	/* attached segments; under as_lock */
 #endif
 };
 
@@ -123,6 +161,15 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_translate - look up the physical address backing a user
+ *                virtual address. Fails with EFAULT if the page isn't
+ *                resident; touch it first (e.g. with copyin) to make
+ *                sure it is.
+ *
+ *    as_pin - as_translate, but also take a reference on the page
+ *                (see page_ref in vm.h), so that it isn't freed even
+ *                if the process unmaps it. Drop it with page_unref.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -141,6 +188,10 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               paddr_t *ret);
+int               as_pin(struct addrspace *as, vaddr_t vaddr,
+                         paddr_t *ret);
 
 
 /*
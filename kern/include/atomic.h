@@ -0,0 +1,38 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic read-modify-write operations on a machine word.
+ *
+ * atomic_cas compares *P with OLD and, if they are equal, stores NEW.
+ * It returns the value that was in *P either way, so the store
+ * happened if and only if the return value is OLD.
+ *
+ * atomic_fetchadd adds DELTA to *P and returns the value from before
+ * the addition. (Pass a negative delta, cast to unsigned, to
+ * subtract.)
+ *
+ * These are atomic with respect to other CPUs and to interrupts but
+ * are *not* memory barriers: they impose no ordering on the loads
+ * and stores around them. Code that publishes or consumes other data
+ * through an atomic variable needs to use membar.h as well, the same
+ * way a lock would.
+ *
+ * Plain loads and stores of an aligned word are already atomic and
+ * don't need anything here.
+ */
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE unsigned atomic_cas(volatile unsigned *p,
+				  unsigned old, unsigned new);
+ATOMIC_INLINE unsigned atomic_fetchadd(volatile unsigned *p,
+				       unsigned delta);
+
+/* Get the implementation. */
+#include <machine/atomic.h>
+
+#endif /* _ATOMIC_H_ */
@@ -50,6 +50,16 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyinstrv copies the strings named by a null-terminated array of
+ * user-space pointers at USERARGV (an argv) into DEST, one after the
+ * other, each null-terminated and padded with nulls to a multiple of
+ * 4 bytes. Each string is charged EXTRA bytes more than it takes up
+ * against the LEN available, so the caller can leave room for
+ * something of its own per string. On success, or ENAMETOOLONG, the
+ * number of strings copied whole is returned in COUNT and the bytes
+ * of DEST they take up in GOT. It costs one fault-handler setup for
+ * the lot, instead of a copyin and a copyinstr per string.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -68,6 +78,8 @@ int copyin(const_userptr_t usersrc, void *dest, size_t len);
 int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
+int copyinstrv(const_userptr_t userargv, char *dest, size_t len, size_t extra,
+	       unsigned *count, size_t *got);
 
 
 #endif /* _COPYINOUT_H_ */
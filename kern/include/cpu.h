@@ -33,8 +33,12 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <workqueue.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+struct proc;
+struct wchan;
+
 extern unsigned num_cpus;
 
 /*
@@ -59,7 +63,6 @@ struct cpu {
 	 * Accessed only by this cpu.
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
-	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
@@ -69,8 +72,34 @@ struct cpu {
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_zombies;	/* List of exited threads */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Destroys the zombies, from a work queue thread.
+	 */
+	struct work c_reapwork;
+
+	/*
+	 * For getting the current thread off this cpu when its
+	 * affinity no longer allows it here; see thread_yield.
+	 * c_movechan is protected by c_movelock.
+	 */
+	struct work c_movework;
+	struct wchan *c_movechan;
+	struct spinlock c_movelock;
+
+	/*
+	 * Dead threads kept, stacks and all, for thread_fork to reuse
+	 * (see thread.c), and counts of how that's going. Protected by
+	 * c_threadcache_lock.
+	 */
+	struct threadlist c_threadcache;
+	struct spinlock c_threadcache_lock;
+	unsigned c_threadcache_hits;	/* forks served from the cache */
+	unsigned c_threadcache_misses;	/* forks that had to allocate */
+	unsigned c_threadcache_frees;	/* dead threads freed; cache full */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -84,10 +113,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_sent counts shootdowns queued for this cpu and
+	 * c_shootdown_done how many of those it has carried out, so a
+	 * sender can wait for its own to be finished.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_sent;
+	volatile unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -116,6 +151,13 @@ void cpu_hatch(unsigned software_number);
  */
 void cpu_identify(char *buf, size_t max);
 
+/*
+ * Read the current CPU's free-running cycle counter. The counter is
+ * 32 bits wide and wraps, so only the difference between two nearby
+ * readings is meaningful.
+ */
+uint32_t cpu_getcycles(void);
+
 /*
  * Hardware-level interrupt on/off, for the current CPU.
  *
@@ -154,6 +196,10 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_proc sends a shootdown to every other CPU that is
+ * running a thread of process P and waits until they have all done
+ * it. Call it with interrupts on: a target may be waiting for us in
+ * the same way.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -168,6 +214,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_proc(struct proc *p, const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,109 @@
+#ifndef _FILETABLE_H_
+#define _FILETABLE_H_
+
+/*
+ * Open files and per-process descriptor tables.
+ *
+ * A file_handle is one open of a vnode: the access mode and the seek
+ * offset. Descriptors that dup, fork, or spawn make share the same
+ * handle, and so the same offset. Handles are reference counted with
+ * atomic operations; the vnode is closed when the last reference
+ * goes.
+ *
+ * The offset is protected by a sleeping "busy" flag in the handle,
+ * taken with fh_acquire, and held across the I/O that moves it. It
+ * costs nothing to set up: a thread that has to wait sleeps on one of
+ * a few wait channels shared by all handles, so opening a file
+ * allocates nothing but the handle itself.
+ *
+ * A filetable maps descriptors to handles. Each descriptor slot holds
+ * one reference. Which descriptors are in use is kept in a bitmap so
+ * that the lowest free one can be found a word at a time. The table
+ * has its own spinlock, held only long enough to change or read a
+ * slot; it is never held while a handle is busy or a vnode is closed.
+ */
+
+#include <spinlock.h>
+#include <limits.h>
+
+struct vnode;
+struct thread;
+
+struct file_handle {
+	struct vnode *fh_vnode;
+	int fh_flags;			/* open flags; O_ACCMODE is fixed */
+	volatile unsigned fh_refcount;	/* atomic */
+	off_t fh_offset;		/* protected by fh_busy */
+	bool fh_busy;			/* offset in use; see fh_acquire */
+	struct thread *fh_owner;	/* who set fh_busy */
+};
+
+#define FT_WORDS	((OPEN_MAX + 31) / 32)
+
+struct filetable {
+	struct spinlock ft_lock;
+	uint32_t ft_used[FT_WORDS];	/* bit N set if ft_files[N] != NULL */
+	struct file_handle *ft_files[OPEN_MAX];
+};
+
+/* Set up the handle wait channels. */
+void filetable_bootstrap(void);
+
+/*
+ * Make a new handle, with one reference, for VN, which has been
+ * opened with FLAGS. On success the handle owns the caller's
+ * reference to VN.
+ */
+int fh_create(struct vnode *vn, int flags, struct file_handle **ret);
+
+/*
+ * Open PATH (which vfs_open destroys) and return a new handle with
+ * one reference.
+ */
+int fh_open(char *path, int flags, mode_t mode, struct file_handle **ret);
+
+/* Take or drop a reference. fh_decref may close the vnode, so sleep. */
+void fh_incref(struct file_handle *fh);
+void fh_decref(struct file_handle *fh);
+
+/* Mark the offset busy, waiting for it if need be, and release it. */
+void fh_acquire(struct file_handle *fh);
+void fh_release(struct file_handle *fh);
+bool fh_do_i_hold(struct file_handle *fh);
+
+/* Set up an empty table, and close everything in one and clean up. */
+void filetable_init(struct filetable *ft);
+void filetable_cleanup(struct filetable *ft);
+
+/* Give DST a reference to each of SRC's files, at the same numbers. */
+void filetable_copy(struct filetable *src, struct filetable *dst);
+
+/* Close every descriptor. */
+void filetable_closeall(struct filetable *ft);
+
+/*
+ * Install FH at the lowest free descriptor, which is returned in
+ * *FD. The caller's reference moves to the table. Fails with EMFILE.
+ */
+int filetable_place(struct filetable *ft, struct file_handle *fh, int *fd);
+
+/*
+ * Install FH at FD, which must be in range, and return whatever was
+ * there before (or NULL) for the caller to drop.
+ */
+struct file_handle *filetable_placeat(struct filetable *ft,
+				      struct file_handle *fh, int fd);
+
+/*
+ * Return the handle at FD with a new reference, or NULL if FD isn't
+ * open or is out of range.
+ */
+struct file_handle *filetable_get(struct filetable *ft, int fd);
+
+/*
+ * Empty FD and return the table's reference to what was there, or
+ * NULL if it wasn't open or is out of range.
+ */
+struct file_handle *filetable_remove(struct filetable *ft, int fd);
+
+#endif /* _FILETABLE_H_ */
@@ -0,0 +1,13 @@
+#ifndef SRC_AFFINITY_SYSCALL_H
+#define SRC_AFFINITY_SYSCALL_H
+
+/* CPU affinity for processes and threads */
+int sys_setaffinity(pid_t, uint32_t, int *);
+
+int sys_getaffinity(pid_t, userptr_t, int *);
+
+int sys_thread_setaffinity(uint32_t, int *);
+
+int sys_thread_getaffinity(userptr_t, int *);
+
+#endif //SRC_AFFINITY_SYSCALL_H
@@ -0,0 +1,39 @@
+#ifndef _KERN_DIRENT_H_
+#define _KERN_DIRENT_H_
+
+/*
+ * Directory entries as returned by getdirentries(), for <dirent.h>.
+ *
+ * Each call fills the buffer with as many whole records as fit. A
+ * record is the fixed header followed by the name and a terminating
+ * null, padded so the next record starts on a 4-byte boundary;
+ * d_reclen is the distance to the next record.
+ */
+
+struct dirent {
+	__u32 d_ino;		/* inode number, or 0 if the fs has none */
+	__u16 d_reclen;		/* length of this record */
+	__u8 d_type;		/* DT_*, or DT_UNKNOWN */
+	__u8 d_namlen;		/* length of d_name, not counting the null */
+	char d_name[];		/* null-terminated name */
+};
+
+/*
+ * File types for d_type: the _S_IF* types from kern/stattypes.h
+ * shifted down. DT_UNKNOWN means the filesystem couldn't tell without
+ * loading the file; use stat.
+ */
+#define DT_UNKNOWN	0
+#define DT_REG		1
+#define DT_DIR		2
+#define DT_LNK		3
+#define DT_FIFO		4
+#define DT_SOCK		5
+#define DT_CHR		6
+#define DT_BLK		7
+
+/* Size of a record with a name of length NAMLEN. */
+#define _DIRENT_RECLEN(namlen) \
+	((sizeof(struct dirent) + (namlen) + 1 + 3) & ~(unsigned)3)
+
+#endif /* _KERN_DIRENT_H_ */
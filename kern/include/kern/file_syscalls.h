@@ -1,16 +1,6 @@
 #ifndef SRC_FILE_SYSCALL_H
 #define SRC_FILE_SYSCALL_H
 
-/* File handle definition */
-struct file_handle {
-
-    struct vnode *fh_vnode;
-    struct lock *fh_lock;
-    mode_t fh_flags;
-    int fh_reference_count;
-    off_t fh_offset;
-};
-
 /* File operation calls */
 int sys_open(char *, int, mode_t, int *);
 
@@ -18,14 +8,49 @@ ssize_t sys_read(int, void *, size_t, int *);
 
 ssize_t sys_write(int, void *, size_t, int *);
 
+ssize_t sys_pread(int, void *, size_t, off_t, int *);
+
+ssize_t sys_pwrite(int, void *, size_t, off_t, int *);
+
+ssize_t sys_readv(int, userptr_t, int, int *);
+
+ssize_t sys_writev(int, userptr_t, int, int *);
+
+ssize_t sys_preadv(int, userptr_t, int, off_t, int *);
+
+ssize_t sys_pwritev(int, userptr_t, int, off_t, int *);
+
+ssize_t sys_copy_file_range(int, userptr_t, int, userptr_t, size_t, unsigned,
+                            int *);
+
 int sys_close(int, int *);
 
 int sys_dup2(int, int, int *);
 
+int sys_pipe(userptr_t, int, int *);
+
+int sys_poll(userptr_t, unsigned, int, int *);
+
+int sys_select(int, userptr_t, userptr_t, userptr_t, userptr_t, int *);
+
 int sys_chdir(char *, int *);
 
 int sys___getcwd(char *, size_t, int *);
 
+ssize_t sys_getdirentry(int, userptr_t, size_t, int *);
+
+ssize_t sys_getdirentries(int, userptr_t, size_t, int *);
+
+int sys_fsync(int, int *);
+
+int sys_fstat(int, userptr_t, int *);
+
+int sys_stat(userptr_t, userptr_t, int *);
+
+int sys_remove(userptr_t, int *);
+
+int sys_rename(userptr_t, userptr_t, int *);
+
 int std_io_init(void);
 
 off_t sys_lseek(int, off_t, int, int *);
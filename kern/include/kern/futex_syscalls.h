@@ -0,0 +1,13 @@
+#ifndef SRC_FUTEX_SYSCALL_H
+#define SRC_FUTEX_SYSCALL_H
+
+/* Userland wait/wake on a memory word */
+void futex_bootstrap(void);
+
+int sys_futex_wait(userptr_t, int, int *);
+
+int sys_futex_wake(userptr_t, int, int *);
+
+void futex_wakeall(void);
+
+#endif //SRC_FUTEX_SYSCALL_H
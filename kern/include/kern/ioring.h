@@ -0,0 +1,74 @@
+#ifndef _KERN_IORING_H_
+#define _KERN_IORING_H_
+
+/*
+ * Submission and completion rings, for batching I/O system calls.
+ *
+ * A process sets aside a block of its own memory, IORING_SIZE(n)
+ * bytes on an 8-byte boundary, and hands it to ioring_setup. The
+ * block is a struct ioring followed by n submission entries and then
+ * n completion entries. To issue requests the process fills in
+ * submission entries at ir_sqtail and advances it, then calls
+ * ioring_enter; a kernel thread takes the entries from ir_sqhead,
+ * carries them out one at a time in order, and for each posts a
+ * completion entry at ir_cqtail. The process reaps completions from
+ * ir_cqhead, which it advances, without having to call in.
+ *
+ * The counters run freely and are taken modulo n, which must be a
+ * power of 2. Each side only ever writes its own two: the process
+ * ir_sqtail and ir_cqhead, the kernel ir_sqhead and ir_cqtail. A
+ * request isn't taken until there is room in the completion ring
+ * for its result, so the completion ring never overflows; if it's
+ * full, reap and enter again.
+ *
+ * Buffers and paths named by requests are read and written when the
+ * request is carried out, not when it's submitted, so they must stay
+ * put until the completion comes back.
+ */
+
+#define IORING_MAXENTRIES	256
+
+/* Request types */
+#define IORING_OP_NOP		0	/* does nothing; result 0 */
+#define IORING_OP_READ		1	/* read(fd, addr, len) */
+#define IORING_OP_WRITE		2	/* write(fd, addr, len) */
+#define IORING_OP_OPEN		3	/* open(addr, flags, len) */
+#define IORING_OP_CLOSE		4	/* close(fd) */
+#define IORING_OP_FSYNC		5	/* fsync(fd) */
+
+/* sqe_off for reads and writes at (and advancing) the file offset */
+#define IORING_OFF_CUR		(-1)
+
+struct ioring_sqe {
+	__u8 sqe_op;		/* IORING_OP_* */
+	__u8 sqe_pad[3];
+	__i32 sqe_fd;
+	__i64 sqe_off;		/* for pread/pwrite, or IORING_OFF_CUR */
+	__u32 sqe_addr;		/* buffer, or path to open */
+	__u32 sqe_len;		/* length, or mode to open with */
+	__u32 sqe_flags;	/* open flags */
+	__u32 sqe_data;		/* handed back in the completion */
+};
+
+struct ioring_cqe {
+	__u32 cqe_data;		/* sqe_data of the request */
+	__i32 cqe_res;		/* what the call returned, or -errno */
+};
+
+struct ioring {
+	__u32 ir_sqhead;	/* next request the kernel will take */
+	__u32 ir_sqtail;	/* next request slot the process fills */
+	__u32 ir_cqhead;	/* next completion the process reaps */
+	__u32 ir_cqtail;	/* next completion slot the kernel fills */
+	__u32 ir_entries;	/* n, set by ioring_setup */
+	__u32 ir_pad[3];
+};
+
+/* The two rings, and the size of the whole block, for N entries */
+#define IORING_SQ(r)	((struct ioring_sqe *)((r) + 1))
+#define IORING_CQ(r)	((struct ioring_cqe *)(IORING_SQ(r) + (r)->ir_entries))
+#define IORING_SIZE(n) \
+	(sizeof(struct ioring) + \
+	 (n) * (sizeof(struct ioring_sqe) + sizeof(struct ioring_cqe)))
+
+#endif /* _KERN_IORING_H_ */
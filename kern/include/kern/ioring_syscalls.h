@@ -0,0 +1,13 @@
+#ifndef SRC_IORING_SYSCALL_H
+#define SRC_IORING_SYSCALL_H
+
+struct proc;
+
+/* Submission/completion rings; see kern/ioring.h */
+int sys_ioring_setup(userptr_t, unsigned, int *);
+
+int sys_ioring_enter(unsigned, int *);
+
+void ioring_destroy(struct proc *);
+
+#endif //SRC_IORING_SYSCALL_H
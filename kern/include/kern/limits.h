@@ -79,15 +79,15 @@
 /* Max value for a process ID (change this to match your implementation) */
 #define __PID_MAX       32767
 
-/* Custom changing the max value for a process ID (change this to match your implementation) */
-#define __PID_MAX_256       256
-
 /* Max open files per process */
 #define __OPEN_MAX      128
 
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
 #define __PIPE_BUF      512
 
+/* Max threads per process, including the main one */
+#define __THREAD_MAX    32
+
 
 /*
  * Not so important parts of the API. (Especially in OS/161 where we
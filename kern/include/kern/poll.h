@@ -0,0 +1,38 @@
+#ifndef _KERN_POLL_H_
+#define _KERN_POLL_H_
+
+/*
+ * Definitions for poll() and select(), for <poll.h> and <sys/select.h>.
+ */
+
+#include <kern/limits.h>
+
+/* One descriptor for poll: what to wait for, and what happened. */
+struct pollfd {
+	int fd;
+	short events;		/* requested */
+	short revents;		/* returned */
+};
+
+/* Event bits. POLLERR, POLLHUP, and POLLNVAL are reported unasked. */
+#define POLLIN		0x0001	/* read won't block */
+#define POLLPRI		0x0002	/* urgent data (never happens here) */
+#define POLLOUT		0x0004	/* write won't block */
+#define POLLERR		0x0008	/* error */
+#define POLLHUP		0x0010	/* other end gone */
+#define POLLNVAL	0x0020	/* fd not open */
+
+/* Timeout meaning "forever". */
+#define INFTIM		(-1)
+
+/*
+ * Descriptor sets for select: one bit per descriptor, up to OPEN_MAX.
+ */
+#define __FD_SETSIZE	__OPEN_MAX
+#define __NFDBITS	32
+
+typedef struct {
+	__u32 fds_bits[(__FD_SETSIZE + __NFDBITS - 1) / __NFDBITS];
+} fd_set;
+
+#endif /* _KERN_POLL_H_ */
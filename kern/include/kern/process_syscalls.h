@@ -2,7 +2,7 @@
 #define SRC_PROC_SYSCALL_H
 
 /* Process System Calls */
-pid_t spawn_pid(struct proc *, int *);
+void exec_bootstrap(void);
 
 pid_t sys_getpid(void);
 
@@ -10,12 +10,18 @@ int sys_execv(char *, char **, int *);
 
 int sys_fork(struct trapframe *, int *);
 
+pid_t sys_vfork(struct trapframe *, int *);
+
+pid_t sys_spawn(char *, char **, userptr_t, int, int *);
+
 void child_forkentry(void *, unsigned long);
 
 pid_t sys_waitpid(pid_t, int *, int, int *);
 
 void sys_exit(int, bool);
 
+void proc_exit(int);
+
 void *sys_sbrk(intptr_t, int *);
 
 #endif //SRC_PROC_SYSCALL_H
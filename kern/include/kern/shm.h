@@ -0,0 +1,21 @@
+#ifndef _KERN_SHM_H_
+#define _KERN_SHM_H_
+
+/*
+ * Definitions for shared memory segments, for <shm.h>.
+ *
+ * A segment is named by a string of up to SHM_NAMELEN - 1 characters
+ * that any process can look up, and is made of up to SHM_MAXSIZE
+ * bytes of zero-filled pages. It stays around, attached or not, until
+ * removed with shmrm; after that nobody new can find or attach it,
+ * and it goes away when the last process detaches it.
+ */
+
+#define SHM_NAMELEN	32
+#define SHM_MAXSIZE	(4 * 1024 * 1024)
+
+/* Flags for shmget */
+#define SHM_CREAT	1	/* create the segment if it doesn't exist */
+#define SHM_EXCL	2	/* with SHM_CREAT, fail if it does */
+
+#endif /* _KERN_SHM_H_ */
@@ -0,0 +1,24 @@
+#ifndef SRC_SHM_SYSCALL_H
+#define SRC_SHM_SYSCALL_H
+
+struct shmseg;
+
+/* Named shared memory segments; see kern/shm.h */
+void shm_bootstrap(void);
+
+int sys_shmget(userptr_t, size_t, int, int *);
+
+void *sys_shmat(int, int *);
+
+int sys_shmdt(userptr_t, int *);
+
+int sys_shmrm(int, int *);
+
+/* For the VM system: attachments and the pages behind them */
+void shm_ref(struct shmseg *);
+
+void shm_release(struct shmseg *);
+
+int shm_getpage(struct shmseg *, unsigned, paddr_t *);
+
+#endif //SRC_SHM_SYSCALL_H
@@ -109,13 +109,13 @@
 #define SYS_close        49
 #define SYS_read         50
 #define SYS_pread        51
-//#define SYS_readv      52
-//#define SYS_preadv     53
+#define SYS_readv        52
+#define SYS_preadv       53
 #define SYS_getdirentry  54
 #define SYS_write        55
 #define SYS_pwrite       56
-//#define SYS_writev     57
-//#define SYS_pwritev    58
+#define SYS_writev       57
+#define SYS_pwritev      58
 #define SYS_lseek        59
 #define SYS_flock        60
 #define SYS_ftruncate    61
@@ -197,6 +197,43 @@
 #define SYS_reboot       119
 //#define SYS___sysctl   120
 
+//                              -- Userland synchronization --
+#define SYS_futex_wait   121
+#define SYS_futex_wake   122
+
+//                              -- User threads --
+#define SYS___thread_create 123
+#define SYS_thread_exit  124
+#define SYS_thread_join  125
+
+//                              -- CPU affinity --
+#define SYS_setaffinity  126
+#define SYS_getaffinity  127
+#define SYS_thread_setaffinity 128
+#define SYS_thread_getaffinity 129
+
+//                              -- Process spawning --
+#define SYS_spawn        130
+
+//                              -- Pipes --
+#define SYS_pipe2        131
+
+//                              -- Bulk directory reads --
+#define SYS_getdirentries 132
+
+//                              -- In-kernel file copy --
+#define SYS_copy_file_range 133
+
+//                              -- Submission/completion rings --
+#define SYS_ioring_setup 134
+#define SYS_ioring_enter 135
+
+//                              -- Shared memory --
+#define SYS_shmget       136
+#define SYS_shmat        137
+#define SYS_shmdt        138
+#define SYS_shmrm        139
+
 /*CALLEND*/
 
 
@@ -0,0 +1,19 @@
+#ifndef SRC_THREAD_SYSCALL_H
+#define SRC_THREAD_SYSCALL_H
+
+/* User thread system calls */
+int sys___thread_create(struct trapframe *, userptr_t, userptr_t, userptr_t,
+                        int *);
+
+void sys_thread_exit(userptr_t);
+
+int sys_thread_join(int, userptr_t, int *);
+
+/* Process exit support */
+void uthread_exit_all(int);
+
+void uthread_leave(userptr_t);
+
+void uthread_checkexit(void);
+
+#endif //SRC_THREAD_SYSCALL_H
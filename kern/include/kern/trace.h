@@ -0,0 +1,29 @@
+#ifndef _KERN_TRACE_H_
+#define _KERN_TRACE_H_
+
+/*
+ * Kernel event trace record types. Shared with the host-side decoder
+ * (trdecode); see <trace.h> in the kernel for how tracing works.
+ *
+ * Each record has the cycle counter, the CPU, the current thread,
+ * two arguments, and a short name whose meaning depends on the type.
+ */
+
+#define TRACE_SWITCH	1	/* a0: next thread  a1: our new state  name: next's */
+#define TRACE_SLEEP	2	/* a0: wchan                           name: wchan's */
+#define TRACE_WAKE	3	/* a0: thread woken                    name: wchan's */
+#define TRACE_SYSENTER	4	/* a0: call number */
+#define TRACE_SYSEXIT	5	/* a0: call number  a1: error, or 0 */
+#define TRACE_VMFAULT	6	/* a0: fault type   a1: fault address */
+#define TRACE_DISKREAD	7	/* a0: disk unit    a1: sector */
+#define TRACE_DISKWRITE	8	/* a0: disk unit    a1: sector */
+#define TRACE_DISKDONE	9	/* a0: disk unit    a1: error, or 0 */
+#define TRACE_IPISEND	10	/* a0: target CPU   a1: IPI number */
+#define TRACE_IPIRECV	11	/* a0: pending IPI bits */
+
+#define TRACE_NTYPES	12
+
+/* Space for the name, including the terminating null. */
+#define TRACE_NAMELEN	12
+
+#endif /* _KERN_TRACE_H_ */
@@ -43,11 +43,11 @@
 #define ARG_MAX         __ARG_MAX
 #define PID_MIN         __PID_MIN
 #define PID_MAX         __PID_MAX
-#define PID_MAX_256     __PID_MAX_256
 #define PIPE_BUF        __PIPE_BUF
 #define NGROUPS_MAX     __NGROUPS_MAX
 #define LOGIN_NAME_MAX  __LOGIN_NAME_MAX
 #define OPEN_MAX        __OPEN_MAX
 #define IOV_MAX         __IOV_MAX
+#define THREAD_MAX      __THREAD_MAX
 
 #endif /* _LIMITS_H_ */
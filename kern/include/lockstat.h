@@ -0,0 +1,63 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics ("lockstat").
+ *
+ * When the kernel is configured with "options lockstat", every sleep
+ * lock, CV, and dynamically initialized spinlock is assigned to a
+ * statistics class keyed by its name and the address of the code
+ * that created it. For each class we count acquisitions, contended
+ * acquisitions, total cycles spent waiting, and the longest hold
+ * time seen. Spinlocks have no name and are all called "spinlock";
+ * statically initialized spinlocks are not tracked.
+ *
+ * For CVs an "acquisition" is a cv_wait, and the wait time is the
+ * time spent asleep; CVs are not held, so there is no hold time.
+ *
+ * All times are in cycles of the CPU cycle counter.
+ *
+ * When the option is off none of this is compiled in and the lock
+ * structures are unchanged.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/* Kinds of lock */
+#define LOCKSTAT_SLEEPLOCK	0
+#define LOCKSTAT_CV		1
+#define LOCKSTAT_SPINLOCK	2
+
+struct lockstat_class;		/* Opaque */
+
+/*
+ * Find or create the class for a lock called NAME created at SITE.
+ * Returns NULL (and the lock goes untracked) if the class table is
+ * full.
+ */
+struct lockstat_class *lockstat_register(const char *name, vaddr_t site,
+					 int kind);
+
+/*
+ * Record an acquisition. CONTENDED is true if the lock was not
+ * immediately available; WAITCYCLES is how long it took to get it.
+ * LSC may be NULL.
+ */
+void lockstat_acquired(struct lockstat_class *lsc, bool contended,
+		       uint32_t waitcycles);
+
+/*
+ * Record a release after holding the lock for HOLDCYCLES.
+ * LSC may be NULL.
+ */
+void lockstat_released(struct lockstat_class *lsc, uint32_t holdcycles);
+
+/* Print the statistics; clear them. Called from the menu. */
+void lockstat_dump(void);
+void lockstat_reset(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
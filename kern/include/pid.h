@@ -0,0 +1,35 @@
+#ifndef _PID_H_
+#define _PID_H_
+
+/*
+ * Process ids.
+ *
+ * Ids run from PID_MIN to PID_MAX. Which ones are in use is kept in
+ * a bitmap, searched a word at a time from a cursor that only moves
+ * forward (wrapping at PID_MAX), so an id that was just freed is not
+ * handed out again until the rest of the range has been tried. The
+ * process for each id is found through a two-level radix table whose
+ * leaves are allocated as the ids they cover come into use, so
+ * lookup is O(1) however many processes there are.
+ */
+
+#include <limits.h>
+
+struct proc;
+
+/*
+ * Give PROC a new id. Returns the id, or -1 with *ERR set to EMPROC
+ * (no ids left) or ENOMEM.
+ */
+pid_t spawn_pid(struct proc *proc, int *err);
+
+/* Give back PID. The process must no longer be findable by it. */
+void pid_free(pid_t pid);
+
+/* The process with id PID, or NULL. PID need not be in range. */
+struct proc *pid_lookup(pid_t pid);
+
+/* Print the number of ids in use and where the cursor is. */
+void pid_printstats(void);
+
+#endif /* _PID_H_ */
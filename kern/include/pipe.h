@@ -0,0 +1,30 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes.
+ *
+ * A pipe is a pair of vnodes, a read end and a write end, sharing a
+ * ring buffer of PIPE_SIZE bytes. Readers wait for data and get EOF
+ * once every write end is closed; writers wait for space and get
+ * EPIPE once every read end is closed. Writes of up to PIPE_BUF
+ * bytes are never interleaved with other writes. With O_NONBLOCK,
+ * an end that would have to wait fails with EAGAIN instead.
+ *
+ * Large writes from page-aligned user buffers skip the ring: the
+ * writer lends its pages to the pipe and sleeps, and readers copy
+ * straight out of them, so the data is copied once instead of twice.
+ */
+
+#define PIPE_PAGES	4
+#define PIPE_SIZE	(PIPE_PAGES * PAGE_SIZE)
+
+struct vnode;
+
+/*
+ * Make a pipe. FLAGS may be O_NONBLOCK. Each end comes back with one
+ * reference.
+ */
+int pipe_create(int flags, struct vnode **readend, struct vnode **writeend);
+
+#endif /* _PIPE_H_ */
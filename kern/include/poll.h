@@ -0,0 +1,103 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Waiting for any of several objects to become ready, for poll and
+ * select.
+ *
+ * Anything that can be polled keeps a pollhead. VOP_POLL on it
+ * reports which of the requested events wouldn't block right now,
+ * and, if given a poller, first hooks that poller onto the pollhead
+ * with pollwait. Whoever later changes the object's state in a way
+ * that might make it ready calls pollwakeup on its pollhead, which
+ * wakes every poller hooked on it. One pollhead can have any number
+ * of pollers on it, and one poller can be on a pollhead per
+ * descriptor it is polling.
+ *
+ * A poll goes like this:
+ *
+ *	poller_init(&pl, nfds, timeout);
+ *	pass = &pl;
+ *	while (1) {
+ *		(VOP_POLL each object with PASS)
+ *		if (anything is ready) break;
+ *		if (poller_sleep(&pl)) break;	// timed out
+ *		pass = NULL;
+ *	}
+ *	poller_cleanup(&pl);
+ *
+ * No wakeup is lost between the check and the sleep: the poller is
+ * on the pollhead before the object's state is looked at, and a
+ * wakeup that comes before poller_sleep makes it return at once.
+ *
+ * pollwakeup only takes spinlocks, so it can be called from
+ * interrupt handlers, and with the object's own lock held.
+ */
+
+#include <spinlock.h>
+#include <timer.h>
+#include <kern/poll.h>
+
+struct poller;
+struct vnode;
+
+struct pollentry {
+	struct pollentry *pe_next;	/* on the pollhead */
+	struct pollentry **pe_pprev;	/* whatever points to us */
+	struct pollhead *pe_head;
+	struct poller *pe_poller;
+};
+
+struct pollhead {
+	struct spinlock ph_lock;
+	struct pollentry *ph_entries;
+};
+
+struct poller {
+	bool pl_woken;			/* protected by the bucket lock */
+	bool pl_expired;		/* ditto */
+	bool pl_timed;			/* pl_timer was started */
+	struct timer pl_timer;
+	unsigned pl_nentries;
+	unsigned pl_maxentries;
+	struct pollentry *pl_entries;
+};
+
+/* Set up the poller wait channels. */
+void poll_bootstrap(void);
+
+/* Set up and clean up a pollhead. It must have no pollers when cleaned. */
+void pollhead_init(struct pollhead *ph);
+void pollhead_cleanup(struct pollhead *ph);
+
+/*
+ * Hook PL onto PH if PL isn't NULL. Called by VOP_POLL before it
+ * looks at the object's state.
+ */
+void pollwait(struct poller *pl, struct pollhead *ph);
+
+/* Wake everyone polling PH. */
+void pollwakeup(struct pollhead *ph);
+
+/*
+ * Set up a poller for polling up to NFDS objects, waiting up to
+ * TIMEOUT milliseconds, or forever if TIMEOUT is negative.
+ */
+int poller_init(struct poller *pl, unsigned nfds, int timeout);
+
+/* Unhook from everything and free. */
+void poller_cleanup(struct poller *pl);
+
+/*
+ * Wait for a wakeup since the last call (or since poller_init).
+ * Returns ETIMEDOUT if the timeout ran out first.
+ */
+int poller_sleep(struct poller *pl);
+
+/*
+ * vop_poll for objects that never block, such as regular files:
+ * everything asked for is ready.
+ */
+int vop_poll_ready(struct vnode *vn, int events, struct poller *pl);
+
+#endif /* _POLL_H_ */
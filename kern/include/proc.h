@@ -38,12 +38,28 @@
 
 #include <spinlock.h>
 #include <limits.h>
+#include <workqueue.h>
+#include <filetable.h>
 #include <mips/trapframe.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
 struct trapframe;
+struct lock;
+struct cv;
+struct ioctx;
+
+/*
+ * A user-level thread of a process (see thread_syscalls.c). The
+ * thread id is the index in p_uthreads, which is also the thread's
+ * user stack slot (see addrspace.h). Id 0 is the main thread.
+ */
+struct uthread {
+	enum { UT_FREE, UT_RUNNING, UT_EXITED } ut_state;
+	struct thread *ut_thread;	/* kernel thread; NULL for id 0 */
+	userptr_t ut_retval;		/* from thread_exit, for the joiner */
+};
 
 /*
  * Process structure.
@@ -81,23 +97,79 @@ struct proc {
 	/* Parent process id */
 	pid_t ppid;
 
-	/* File Table */
-	struct file_handle *file_table[OPEN_MAX];
-
-	struct lock *exitlock;
+	/* Open files; shared with fork and dup (see filetable.h) */
+	struct filetable p_files;
+
+	/*
+	 * Process tree. All of this, and the exit fields below, are
+	 * protected by the global tree lock in proc.c. p_children
+	 * lists every child not yet waited for; those that have
+	 * exited are also queued on p_zombies, oldest first, so
+	 * waitpid(-1) never has to search. exitcv is signalled when a
+	 * child exits. Children whose parent exits are handed to the
+	 * kernel process, which doesn't wait for them (p_orphan): they
+	 * are freed as soon as they exit.
+	 */
+	struct proc *p_parent;
+	struct proc *p_children;	/* first child */
+	struct proc *p_sibling;		/* next child of p_parent */
+	struct proc **p_psibling;	/* whatever points to us */
+	struct proc *p_zombies;		/* first exited child */
+	struct proc **p_zombietail;	/* where to link the next one */
+	struct proc *p_nextzombie;	/* next on p_parent's p_zombies */
+	struct proc **p_pzombie;	/* whatever points to us there */
+	bool p_orphan;
 	struct cv *exitcv;
 
+	/*
+	 * vfork and spawn. While p_vfork is set a thread of the parent
+	 * is waiting in proc_vforkwait for us to exec or exit, which
+	 * sets p_vforkdone; until it has seen that, we aren't queued as
+	 * a zombie. p_sharedas means p_addrspace is the parent's, lent
+	 * to us by vfork; it's handed back rather than destroyed.
+	 * p_execerr is why a spawned program couldn't be started.
+	 */
+	bool p_vfork;
+	bool p_vforkdone;
+	bool p_sharedas;
+	int p_execerr;
+
 	bool exit_flag;
 	int exit_code;
-	int exit_proc_counter;
+
+	/* Frees what's left once the parent has collected the exit code */
+	struct work p_reapwork;
+
+	/*
+	 * User threads. The table and the counts are protected by
+	 * p_uthreadlock; p_uthreadcv is signalled whenever a thread
+	 * leaves. Once p_exiting is set (by _exit, or a fatal fault in
+	 * any thread) every thread leaves the next time it comes
+	 * through the kernel, and the last one out finishes the exit
+	 * with p_exitstatus.
+	 */
+	struct lock *p_uthreadlock;
+	struct cv *p_uthreadcv;
+	struct uthread p_uthreads[THREAD_MAX];
+	unsigned p_nuthreads;		/* threads not yet left */
+	volatile bool p_exiting;
+	int p_exitstatus;
+
+	/*
+	 * CPUs this process's threads may run on (see thread.h).
+	 * Inherited by children; set by proc_setaffinity under
+	 * proc_treelock, read without locking.
+	 */
+	uint32_t p_affinity;
+
+	/* Submission/completion ring, if any; see ioring_syscalls.c */
+	struct ioctx *p_ioring;		/* protected by p_lock */
 };
 
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
-extern struct proc *proc_ids[PID_MAX_256];
-
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
@@ -116,6 +188,37 @@ int proc_addthread(struct proc *proc, struct thread *t);
 /* Detach a thread from its process. */
 void proc_remthread(struct thread *t);
 
+/*
+ * Exit and wait. proc_exited marks P as exited with STATUS, hands
+ * its children to the kernel process, and tells its parent. Called
+ * by the last thread of P to leave, which must already be detached.
+ * proc_waitchild takes an exited child of the current process off
+ * the tree and returns it (see waitpid for PID); if none has exited
+ * yet it sleeps, or with NOHANG returns NULL with *ERR 0. Errors
+ * return NULL with *ERR set. proc_reap frees what proc_waitchild
+ * returned.
+ */
+void proc_exited(struct proc *p, int status);
+struct proc *proc_waitchild(pid_t pid, bool nohang, int *err);
+void proc_reap(struct proc *p);
+
+/*
+ * vfork and spawn. proc_vforkwait waits until CHILD (which has
+ * p_vfork set) has exec'd or exited. If it exited with p_execerr set
+ * it is freed and the error returned; otherwise returns 0. P calls
+ * proc_vforkdone once it has its own program.
+ */
+int proc_vforkwait(struct proc *child);
+void proc_vforkdone(struct proc *p);
+
+/*
+ * Set or fetch the affinity mask of the process PID, which must be
+ * the current process (or 0 for it) or one of its children. Returns
+ * ESRCH or EPERM if it isn't.
+ */
+int proc_setaffinity(pid_t pid, uint32_t mask);
+int proc_getaffinity(pid_t pid, uint32_t *ret);
+
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
 
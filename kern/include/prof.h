@@ -0,0 +1,60 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+/*
+ * Statistical profiler.
+ *
+ * When the kernel is configured with "options prof", each CPU's
+ * clock interrupt can sample the PC it interrupted, kernel or user,
+ * together with the pid of the process that was running. Samples are
+ * counted in a per-CPU hash table keyed by (pid, PC); only the CPU
+ * itself touches its table, from the interrupt, so no locking is
+ * needed. If a table fills up, further new PCs are counted as
+ * dropped.
+ *
+ * Profiling is started, stopped and dumped from the menu (profon,
+ * profoff, profdump). The dump is printed on the console as
+ *
+ *    prof <cpu> <pid> <pc> <count>
+ *
+ * lines, bracketed by prof-begin and prof-end, for the host-side
+ * profsym tool to symbolize against the kernel image.
+ *
+ * When the option is off none of this is compiled in.
+ */
+
+#include "opt-prof.h"
+
+#if OPT_PROF
+
+extern volatile bool prof_enabled;
+
+/*
+ * Record a sample: the clock interrupted PC, which may be a kernel or
+ * a user address. Called from the clock interrupt before hardclock;
+ * use PROF_SAMPLE below.
+ */
+void prof_sample(vaddr_t pc);
+
+#define PROF_SAMPLE(pc) \
+	do { \
+		if (prof_enabled) { \
+			prof_sample(pc); \
+		} \
+	} while (0)
+
+/*
+ * Start profiling afresh (ENOMEM if the tables can't be had), stop,
+ * and print the tables. Called from the menu.
+ */
+int prof_start(void);
+void prof_stop(void);
+void prof_dump(void);
+
+#else
+
+#define PROF_SAMPLE(pc) ((void)0)
+
+#endif /* OPT_PROF */
+
+#endif /* _PROF_H_ */
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include <lockstat.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -57,12 +58,21 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat_class *splk_stat;   /* Statistics class, or NULL */
+	uint32_t splk_holdstart;	    /* Cycle count at acquire */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
+ * (Such spinlocks are not tracked by lockstat.)
  */
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, NULL, 0 }
+#else
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -42,12 +42,22 @@
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * sem_count is updated with atomic operations, so P and V only touch
+ * the spinlock and wchan when somebody has to sleep or be woken.
+ * sem_waiters counts threads in (or on their way into) the wchan; it
+ * is changed only under sem_lock. sem_inflight counts Vs still using
+ * the semaphore, and sem_destroy waits for it to drain, so a
+ * semaphore may be destroyed as soon as the P that waits for the
+ * last V returns.
  */
 struct semaphore {
 	char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
 	volatile unsigned sem_count;
+	volatile unsigned sem_waiters;
+	volatile unsigned sem_inflight;
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -77,6 +87,12 @@ struct lock {
 	struct wchan *lk_wchan;
 	struct spinlock lk_lock;
 	volatile struct thread *lk_thread;
+	struct lock *lk_nextheld;	/* next in holder's t_heldlocks */
+	int lk_waitpri;			/* highest priority lent via us */
+#if OPT_LOCKSTAT
+	struct lockstat_class *lk_stat;
+	uint32_t lk_holdstart;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -91,6 +107,9 @@ void lock_destroy(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
+ * Locks do priority inheritance: while a thread waits for a lock, the
+ * holder runs at no less than the waiter's priority.
+ *
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
@@ -116,6 +135,9 @@ struct cv {
 	char *cv_name;
 	struct wchan *cv_wchan;
 	struct spinlock cv_lock;
+#if OPT_LOCKSTAT
+	struct lockstat_class *cv_stat;
+#endif
 };
 
 struct cv *cv_create(const char *name);
@@ -125,16 +147,20 @@ void cv_destroy(struct cv *);
  * Operations:
  *    cv_wait      - Release the supplied lock, go to sleep, and, after
  *                   waking up again, re-acquire the lock.
+ *    cv_timedwait - Like cv_wait, but give up after the given number of
+ *                   milliseconds. Returns 0 if signalled, ETIMEDOUT if
+ *                   the time ran out. The lock is re-acquired either way.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
  *
- * For all three operations, the current thread must hold the lock passed
+ * For all these operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ms);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
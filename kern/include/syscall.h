@@ -40,6 +40,14 @@ struct trapframe; /* from <machine/trapframe.h> */
 
 void syscall(struct trapframe *tf);
 
+/*
+ * Per-syscall statistics: calls, errors, and cycles. Bootstrap is
+ * called once all CPUs are up; the others are for the menu.
+ */
+void syscall_bootstrap(void);
+void syscall_printstats(void);
+void syscall_resetstats(void);
+
 /*
  * Support functions.
  */
@@ -58,5 +66,6 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t req, userptr_t rem);
 
 #endif /* _SYSCALL_H_ */
@@ -71,6 +71,7 @@ int rwtest2(int, char **);
 int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
+int pitest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -57,6 +58,22 @@ struct cpu;
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
 
+/*
+ * Thread priorities. Higher numbers run first; threads of equal
+ * priority share the CPU round-robin.
+ */
+#define PRI_MIN		0
+#define PRI_DEFAULT	16
+#define PRI_MAX		31
+#define PRI_NONE	(PRI_MIN - 1)	/* for "nothing lent" */
+
+/*
+ * CPU affinity masks: bit N set means the thread may run on CPU N
+ * (the software number, c_number). MAXCPUS must fit in the mask.
+ */
+#define CPUMASK_ALL	0xffffffffU
+#define CPUMASK_BIT(n)	(1U << (n))
+
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,		/* running */
@@ -111,6 +128,24 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Priority fields, protected by the thread system's priority
+	 * lock. t_pri is t_basepri raised by whatever waiters on locks
+	 * we hold have donated (priority inheritance). t_heldlocks is
+	 * only touched by the thread itself.
+	 */
+	int t_basepri;			/* Priority we were given */
+	int t_pri;			/* Priority we run at */
+	struct lock *t_blockedon;	/* Lock we're waiting for */
+	struct lock *t_heldlocks;	/* Locks we hold (lk_nextheld) */
+
+	/*
+	 * CPUs we may run on. Combined with the process's p_affinity
+	 * and the reserved CPU set; see thread_cpumask. Read without
+	 * locking by whoever makes us runnable.
+	 */
+	uint32_t t_affinity;
+
 	/*
 	 * Public fields
 	 */
@@ -154,6 +189,16 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Like thread_fork, but the new thread gets the affinity mask
+ * AFFINITY (see below) instead of its creator's, so it never runs
+ * anywhere else. EINVAL if the mask names no CPU that exists.
+ */
+int thread_fork_affinity(const char *name, struct proc *proc,
+                         uint32_t affinity,
+                         void (*func)(void *, unsigned long),
+                         void *data1, unsigned long data2);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -167,6 +212,57 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Set the current thread's priority (PRI_MIN to PRI_MAX). Threads
+ * inherit their creator's priority.
+ */
+void thread_setpriority(int pri);
+
+/*
+ * CPU affinity.
+ *
+ * A thread runs only on CPUs in both its own affinity mask and its
+ * process's (p_affinity); new threads inherit their creator's mask.
+ * A thread that is running on a CPU it isn't allowed on any more
+ * moves the next time it is made runnable or the CPU considers
+ * migration.
+ *
+ * Some CPUs may also be reserved (a "processor set"): they are kept
+ * for threads whose masks allow nothing else. Everyone else avoids
+ * them.
+ *
+ *    thread_setaffinity  - set the current thread's mask. EINVAL if
+ *                          it names no CPU that exists.
+ *    thread_affinity_ok  - check that MASK names a CPU that exists.
+ *    cpu_reserve         - set the reserved CPUs. EINVAL if that
+ *                          would reserve every CPU or names CPUs that
+ *                          don't exist.
+ *    cpu_reserved        - the reserved CPUs.
+ *    cpu_onlinemask      - the CPUs that exist.
+ */
+int thread_setaffinity(uint32_t mask);
+bool thread_affinity_ok(uint32_t mask);
+int cpu_reserve(uint32_t mask);
+uint32_t cpu_reserved(void);
+uint32_t cpu_onlinemask(void);
+
+/*
+ * Priority inheritance hooks for sleep locks; see synch.c. All are
+ * called with the lock's spinlock held.
+ *
+ *    thread_lock_block   - about to sleep waiting for LOCK: lend our
+ *                          priority to its holder, and to whatever
+ *                          that holder is waiting for, and so on.
+ *    thread_lock_own     - we have just taken LOCK (setting lk_thread).
+ *                          WAITED says whether we called
+ *                          thread_lock_block first.
+ *    thread_lock_disown  - we're about to release LOCK (clearing
+ *                          lk_thread): give back what it lent us.
+ */
+void thread_lock_block(struct lock *lock);
+void thread_lock_own(struct lock *lock, bool waited);
+void thread_lock_disown(struct lock *lock);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -181,4 +277,7 @@ void thread_consider_migration(void);
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
 
+/* Print the thread cache statistics. Called from the menu. */
+void thread_cache_stats(void);
+
 #endif /* _THREAD_H_ */
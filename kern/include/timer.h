@@ -0,0 +1,71 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls a function after a given delay. Timers are kept in a
+ * hierarchical timing wheel that is advanced once per hardclock by
+ * CPU 0, so adding and cancelling are O(1) and the per-tick cost does
+ * not depend on how many timers are pending.
+ *
+ * Delays are given in milliseconds but the wheel only turns HZ times
+ * a second, so they are rounded up to the next tick. A timer never
+ * fires early.
+ *
+ * Timer functions run on CPU 0 in interrupt context (from hardclock)
+ * and must not sleep. They may take spinlocks and wake threads, and
+ * may re-add their own timer.
+ *
+ * The caller supplies the storage for a timer (it is usually embedded
+ * in some other structure or on the stack) and must cancel it before
+ * freeing that storage if it might still be pending.
+ */
+
+struct timer {
+	struct timer *tm_next;		/* wheel slot list */
+	struct timer **tm_pprev;	/* points to whatever points to us */
+	uint32_t tm_expires;		/* tick at which to fire */
+	void (*tm_func)(void *);	/* what to call */
+	void *tm_data;			/* argument for tm_func */
+	bool tm_pending;		/* on the wheel */
+};
+
+/* Called during boot before any timers are used. */
+void timer_bootstrap(void);
+
+/* Advance the wheel one tick. Called by hardclock on CPU 0. */
+void timer_tick(void);
+
+/* Current tick count. Wraps. */
+uint32_t timer_now(void);
+
+/* Convert milliseconds to ticks, rounding up. */
+uint32_t timer_mstoticks(unsigned ms);
+
+/*
+ * Set up a timer to call FUNC(DATA). Does not start it.
+ */
+void timer_init(struct timer *tm, void (*func)(void *), void *data);
+
+/*
+ * Start a timer to fire after TICKS ticks, or MS milliseconds. If
+ * the timer is already pending it is moved to the new time.
+ */
+void timer_add(struct timer *tm, uint32_t ticks);
+void timer_add_ms(struct timer *tm, unsigned ms);
+
+/*
+ * Stop a timer. Returns true if it was pending (and so will now never
+ * fire), false if it had already fired or was never started. If the
+ * timer function is running on another CPU, waits for it to finish,
+ * so on return the timer's storage may be reused.
+ */
+bool timer_cancel(struct timer *tm);
+
+/*
+ * Put the current thread to sleep for at least MS milliseconds.
+ */
+void timer_sleep(unsigned ms);
+
+#endif /* _TIMER_H_ */
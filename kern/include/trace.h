@@ -0,0 +1,56 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/*
+ * Kernel event tracing.
+ *
+ * When the kernel is configured with "options trace", interesting
+ * events (context switches, sleeps and wakeups, system calls, VM
+ * faults, disk I/O, IPIs) can be recorded in per-CPU ring buffers of
+ * fixed-size binary records; see <kern/trace.h> for the list. Each
+ * CPU writes only its own ring, with interrupts off for the few
+ * stores involved, so recording takes no locks. When a ring fills,
+ * the oldest records are overwritten.
+ *
+ * Tracing is off until started from the menu (tron). While off, each
+ * trace point costs one test of trace_enabled. trdump stops tracing
+ * and prints the rings on the console, oldest first, in a line format
+ * the host-side decoder (trdecode) turns into a per-CPU timeline.
+ *
+ * When the option is off none of this is compiled in.
+ */
+
+#include <kern/trace.h>
+#include "opt-trace.h"
+
+#if OPT_TRACE
+
+extern volatile bool trace_enabled;
+
+/* Record an event; use TRACE below. NAME may be NULL. */
+void trace_record(unsigned type, uint32_t a0, uint32_t a1, const char *name);
+
+#define TRACE(type, a0, a1, name) \
+	do { \
+		if (trace_enabled) { \
+			trace_record(type, (uint32_t)(uintptr_t)(a0), \
+				     (uint32_t)(uintptr_t)(a1), name); \
+		} \
+	} while (0)
+
+/*
+ * Start tracing afresh, stop, and print what was recorded. Called
+ * from the menu. trace_start returns ENOMEM if it can't get the
+ * buffers.
+ */
+int trace_start(void);
+void trace_stop(void);
+void trace_dump(void);
+
+#else
+
+#define TRACE(type, a0, a1, name) ((void)0)
+
+#endif /* OPT_TRACE */
+
+#endif /* _TRACE_H_ */
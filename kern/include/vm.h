@@ -46,6 +46,7 @@ struct
 coremap_entry {
     enum states { FREE, DIRTY, FIXED, CLEAN } state;
     int chunk_size;
+    unsigned refcount;	/* mappings of a user page; see page_ref */
 };
 
 extern bool booted;
@@ -80,9 +81,26 @@ void free_kpages(vaddr_t addr);
  */
 unsigned int coremap_used_bytes(void);
 
+/*
+ * Take or drop a reference to the user page at physical address
+ * PADDR. A page comes from the allocator with one reference; it's
+ * freed when page_unref drops the last. Pages shared between page
+ * tables (shared memory segments) carry one per mapping.
+ */
+void page_ref(paddr_t paddr);
+void page_unref(paddr_t paddr);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/*
+ * Remove user pages [START, END) of the current process from every
+ * TLB that might hold them, and wait for that to finish. Call after
+ * taking the pages out of the page table and before freeing them, so
+ * no other thread of the process can still reach the frames.
+ */
+void vm_tlbshootdown_range(vaddr_t start, vaddr_t end);
+
 
 #endif /* _VM_H_ */
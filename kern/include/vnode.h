@@ -33,6 +33,7 @@
 #include <spinlock.h>
 struct uio;
 struct stat;
+struct poller;
 
 
 /*
@@ -95,7 +96,12 @@ struct vnode {
  *                      the offset field is not interpreted outside
  *                      the filesystem and thus need not be a byte
  *                      count. However, the uio_resid field should be
- *                      handled in the normal fashion.
+ *                      handled in the normal fashion. Also set *INO
+ *                      to the entry's inode number (0 if the fs has
+ *                      none) and *TYPE to its file type (_S_IFREG
+ *                      etc.), or to 0 if finding that out would mean
+ *                      loading the file. At the end of the directory,
+ *                      move nothing and return 0.
  *                      On non-directory objects, return ENOTDIR.
  *
  *    vop_write       - Write data from uio to file at offset specified
@@ -132,6 +138,13 @@ struct vnode {
  *                      uio. Need not work on objects that are not
  *                      directories.
  *
+ *    vop_poll        - Return which of EVENTS (POLLIN, POLLOUT; see
+ *                      kern/poll.h) would not block now, plus POLLERR
+ *                      or POLLHUP if they apply. If POLLER is not
+ *                      NULL, first hook it with pollwait onto the one
+ *                      pollhead that is woken when that might change.
+ *                      See poll.h.
+ *
  *****************************************
  *
  *    vop_creat       - Create a regular file named NAME in the passed
@@ -186,7 +199,8 @@ struct vnode_ops {
 
 	int (*vop_read)(struct vnode *file, struct uio *uio);
 	int (*vop_readlink)(struct vnode *link, struct uio *uio);
-	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio);
+	int (*vop_getdirentry)(struct vnode *dir, struct uio *uio,
+			       ino_t *ino, mode_t *type);
 	int (*vop_write)(struct vnode *file, struct uio *uio);
 	int (*vop_ioctl)(struct vnode *object, int op, userptr_t data);
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
@@ -196,6 +210,8 @@ struct vnode_ops {
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
 	int (*vop_namefile)(struct vnode *file, struct uio *uio);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct poller *poller);
 
 
 	int (*vop_creat)(struct vnode *dir,
@@ -230,7 +246,8 @@ struct vnode_ops {
 
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
-#define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
+#define VOP_GETDIRENTRY(vn, uio, ino, type) \
+	(__VOP(vn, getdirentry)(vn, uio, ino, type))
 #define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
@@ -240,6 +257,7 @@ struct vnode_ops {
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
 #define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
+#define VOP_POLL(vn, events, poller)    (__VOP(vn, poll)(vn, events, poller))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
 #define VOP_SYMLINK(vn, name, content)  (__VOP(vn, symlink)(vn, name, content))
@@ -286,6 +304,8 @@ int vopfail_uio_notdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_isdir(struct vnode *vn, struct uio *uio);
 int vopfail_uio_inval(struct vnode *vn, struct uio *uio);
 int vopfail_uio_nosys(struct vnode *vn, struct uio *uio);
+int vopfail_getdirentry_notdir(struct vnode *vn, struct uio *uio,
+			       ino_t *ino, mode_t *type);
 int vopfail_mmap_isdir(struct vnode *vn /* add stuff */);
 int vopfail_mmap_perm(struct vnode *vn /* add stuff */);
 int vopfail_mmap_nosys(struct vnode *vn /* add stuff */);
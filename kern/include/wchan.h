@@ -66,6 +66,12 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Same as wchan_sleep, but wake up anyway if MS milliseconds pass
+ * first. Returns 0 if awakened by someone else, or ETIMEDOUT.
+ */
+int wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ms);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
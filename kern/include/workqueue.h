@@ -0,0 +1,66 @@
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+
+/*
+ * Deferred work.
+ *
+ * Each CPU has a work queue served by its own kernel thread, which
+ * is pinned to that CPU by its affinity mask from the moment it's
+ * forked. Code that has something expensive to do that its caller
+ * doesn't need to wait for (freeing a dead process, writing back
+ * filesystem metadata) can package it as a work item and queue it
+ * instead; the worker runs queued items in order, in an ordinary
+ * thread context where it may sleep.
+ *
+ * A work item is owned by the caller, usually embedded in whatever
+ * structure it works on. An item is "pending" from when it is queued
+ * until its function starts; queueing a pending item does nothing.
+ * Once the function has started it may free the item.
+ *
+ * Delayed work is queued when a timer (see timer.h) expires, on the
+ * CPU that asked for it.
+ */
+
+#include <timer.h>
+
+struct work {
+	struct work *wk_next;		/* queue link */
+	void (*wk_func)(void *);	/* what to call */
+	void *wk_data;			/* argument for wk_func */
+	unsigned wk_cpu;		/* queue to use when delay expires */
+	bool wk_pending;		/* queued or waiting on the timer */
+	struct timer wk_timer;		/* for delayed work */
+};
+
+/* Set up a work item to call FUNC(DATA). */
+void work_init(struct work *wk, void (*func)(void *), void *data);
+
+/*
+ * Queue work on the current CPU, on CPU number CPU, or on the current
+ * CPU after MS milliseconds. Return false if the item was already
+ * pending. May be called from interrupt handlers.
+ */
+bool work_queue(struct work *wk);
+bool work_queue_on(unsigned cpu, struct work *wk);
+bool work_queue_delayed(struct work *wk, unsigned ms);
+
+/*
+ * Take a pending item back. Returns true if it was pending and so
+ * will now not run. Does not wait for a function that has already
+ * started.
+ */
+bool work_cancel(struct work *wk);
+
+/*
+ * Wait until every item queued (on any CPU) before the call has run.
+ * Delayed work whose timer hasn't gone off yet isn't waited for.
+ */
+void work_flush(void);
+
+/*
+ * Create the worker thread for the current CPU. Called by the thread
+ * system as each CPU comes up.
+ */
+void workqueue_start(void);
+
+#endif /* _WORKQUEUE_H_ */
@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <spl.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -48,6 +49,11 @@
 #include <device.h>
 #include <syscall.h>
 #include <test.h>
+#include <kern/futex_syscalls.h>
+#include <kern/process_syscalls.h>
+#include <kern/shm_syscalls.h>
+#include <filetable.h>
+#include <poll.h>
 #include <kern/test161.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
@@ -112,6 +118,12 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	timer_bootstrap();
+	futex_bootstrap();
+	shm_bootstrap();
+	exec_bootstrap();
+	filetable_bootstrap();
+	poll_bootstrap();
 	vfs_bootstrap();
 	kheap_nextgeneration();
 
@@ -129,6 +141,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	syscall_bootstrap();
 	test161_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
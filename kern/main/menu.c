@@ -37,6 +37,7 @@
 #include <clock.h>
 #include <thread.h>
 #include <proc.h>
+#include <pid.h>
 #include <vfs.h>
 #include <sfs.h>
 #include <syscall.h>
@@ -46,10 +47,16 @@
 #include "opt-net.h"
 #include "opt-synchprobs.h"
 #include "opt-automationtest.h"
+#include "opt-lockstat.h"
+#include "opt-trace.h"
+#include "opt-prof.h"
 #include <kern/process_syscalls.h>
 #include <proc.h>
 #include <synch.h>
 #include <current.h>
+#include <lockstat.h>
+#include <trace.h>
+#include <prof.h>
 
 /*
  * In-kernel menu and command dispatcher.
@@ -134,8 +141,6 @@ common_prog(int nargs, char **args)
 		return ENOMEM;
 	}
 
-	proc->ppid = curproc->pid;
-
 	tc = thread_count;
 
 	result = thread_fork(args[0] /* thread name */,
@@ -402,6 +407,54 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_threadcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_cache_stats();
+
+	return 0;
+}
+
+static
+int
+cmd_pidstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	pid_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_sysstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_sysreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	syscall_resetstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapused(int nargs, char **args)
@@ -443,6 +496,173 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for reserving CPUs: with arguments, reserve the CPUs named
+ * (replacing any earlier set), or none; without, show what's
+ * reserved. Threads only run on reserved CPUs if their affinity
+ * allows nothing else (see thread.h), so a benchmark started with
+ * taskset gets them to itself.
+ */
+static
+int
+cmd_cpuset(int nargs, char **args)
+{
+	uint32_t mask, online;
+	unsigned cpu;
+	int i, result;
+
+	if (nargs > 1) {
+		mask = 0;
+		if (nargs != 2 || strcmp(args[1], "none")) {
+			for (i=1; i<nargs; i++) {
+				cpu = atoi(args[i]);
+				if (cpu >= 32) {
+					kprintf("cpuset: %s: Invalid CPU\n",
+						args[i]);
+					return EINVAL;
+				}
+				mask |= CPUMASK_BIT(cpu);
+			}
+		}
+		result = cpu_reserve(mask);
+		if (result) {
+			kprintf("Usage: cpuset [none | cpu...]\n");
+			kprintf("    (at least one CPU must stay free)\n");
+			return result;
+		}
+	}
+
+	online = cpu_onlinemask();
+	mask = cpu_reserved();
+	kprintf("Reserved:");
+	for (cpu=0; cpu<32; cpu++) {
+		if (mask & CPUMASK_BIT(cpu)) {
+			kprintf(" %u", cpu);
+		}
+	}
+	kprintf("%s\nGeneral:", mask == 0 ? " none" : "");
+	for (cpu=0; cpu<32; cpu++) {
+		if ((online & ~mask) & CPUMASK_BIT(cpu)) {
+			kprintf(" %u", cpu);
+		}
+	}
+	kprintf("\n");
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+static
+int
+cmd_lockstatdump(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_dump();
+
+	return 0;
+}
+
+static
+int
+cmd_lockstatreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_reset();
+
+	return 0;
+}
+#endif
+
+#if OPT_TRACE
+static
+int
+cmd_traceon(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = trace_start();
+	if (result) {
+		kprintf("tron: %s\n", strerror(result));
+	}
+
+	return result;
+}
+
+static
+int
+cmd_traceoff(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	trace_stop();
+
+	return 0;
+}
+
+static
+int
+cmd_tracedump(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	trace_dump();
+
+	return 0;
+}
+#endif
+
+#if OPT_PROF
+static
+int
+cmd_profon(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	result = prof_start();
+	if (result) {
+		kprintf("profon: %s\n", strerror(result));
+	}
+
+	return result;
+}
+
+static
+int
+cmd_profoff(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	prof_stop();
+
+	return 0;
+}
+
+static
+int
+cmd_profdump(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	prof_dump();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -483,6 +703,7 @@ static const char *opsmenu[] = {
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
 	"[panic]   Intentional panic         ",
+	"[cpuset]  Reserve CPUs              ",
 	"[q]       Quit and shut down        ",
 	NULL
 };
@@ -528,6 +749,7 @@ static const char *testmenu[] = {
 	"[rwt3] RW lock test 3        (1?)   ",
 	"[rwt4] RW lock test 4        (1?)   ",
 	"[rwt5] RW lock test 5        (1?)   ",
+	"[pit]  Priority inversion test      ",
 #if OPT_SYNCHPROBS
 	"[sp1] Whalemating test       (1)    ",
 	"[sp2] Stoplight test         (1)    ",
@@ -590,6 +812,24 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[tc] Thread cache stats             ",
+	"[pids] Process id stats             ",
+	"[sys] System call stats             ",
+	"[sysreset] Reset system call stats  ",
+#if OPT_LOCKSTAT
+	"[lsdump] Dump lock statistics       ",
+	"[lsreset] Reset lock statistics     ",
+#endif
+#if OPT_TRACE
+	"[tron] Start event tracing          ",
+	"[troff] Stop event tracing          ",
+	"[trdump] Dump event trace           ",
+#endif
+#if OPT_PROF
+	"[profon] Start profiling            ",
+	"[profoff] Stop profiling            ",
+	"[profdump] Dump profile             ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -634,6 +874,7 @@ static struct {
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
 	{ "panic",	cmd_panic },
+	{ "cpuset",	cmd_cpuset },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
 	{ "halt",	cmd_quit },
@@ -643,6 +884,24 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "tc",         cmd_threadcachestats },
+	{ "pids",       cmd_pidstats },
+	{ "sys",        cmd_sysstats },
+	{ "sysreset",   cmd_sysreset },
+#if OPT_LOCKSTAT
+	{ "lsdump",     cmd_lockstatdump },
+	{ "lsreset",    cmd_lockstatreset },
+#endif
+#if OPT_TRACE
+	{ "tron",       cmd_traceon },
+	{ "troff",      cmd_traceoff },
+	{ "trdump",     cmd_tracedump },
+#endif
+#if OPT_PROF
+	{ "profon",     cmd_profon },
+	{ "profoff",    cmd_profoff },
+	{ "profdump",   cmd_profdump },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -676,6 +935,7 @@ static struct {
 	{ "rwt3",	rwtest3 },
 	{ "rwt4",	rwtest4 },
 	{ "rwt5",	rwtest5 },
+	{ "pit",	pitest },
 #if OPT_SYNCHPROBS
 	{ "sp1",	whalemating },
 	{ "sp2",	stoplight },
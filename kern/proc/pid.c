@@ -0,0 +1,186 @@
+/*
+ * Process id allocation and lookup. See pid.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <proc.h>
+#include <pid.h>
+
+#define PID_NIDS	(PID_MAX + 1)
+
+/* Allocation bitmap: bit N of word N/32 is set if id N is in use. */
+#define PID_WORDS	((PID_NIDS + 31) / 32)
+
+/* Radix table: PID_LEAFSIZE ids per leaf. */
+#define PID_LEAFBITS	8
+#define PID_LEAFSIZE	(1 << PID_LEAFBITS)
+#define PID_LEAFMASK	(PID_LEAFSIZE - 1)
+#define PID_NLEAVES	((PID_NIDS + PID_LEAFSIZE - 1) / PID_LEAFSIZE)
+
+struct pid_leaf {
+	struct proc *pl_procs[PID_LEAFSIZE];
+};
+
+/*
+ * Everything is protected by pid_lock. pid_next is where the next
+ * search starts. Leaves are never freed once allocated.
+ */
+static uint32_t pid_bitmap[PID_WORDS];
+static struct pid_leaf *pid_leaves[PID_NLEAVES];
+static pid_t pid_next = PID_MIN;
+static unsigned pid_inuse;
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Find a clear bit at or after START, wrapping around, and set it.
+ * Returns -1 if there are none. Whole words that are full are
+ * skipped at once.
+ */
+static
+pid_t
+pid_findfree(pid_t start)
+{
+	unsigned tried, word, bit;
+	pid_t pid;
+
+	pid = start;
+	tried = 0;
+	while (tried < PID_NIDS) {
+		if (pid > PID_MAX) {
+			tried += PID_NIDS - pid;
+			pid = PID_MIN;
+			continue;
+		}
+		word = pid / 32;
+		bit = pid % 32;
+		if (bit == 0 && pid_bitmap[word] == 0xffffffffU) {
+			pid += 32;
+			tried += 32;
+			continue;
+		}
+		if ((pid_bitmap[word] & (1U << bit)) == 0) {
+			pid_bitmap[word] |= 1U << bit;
+			return pid;
+		}
+		pid++;
+		tried++;
+	}
+	return -1;
+}
+
+pid_t
+spawn_pid(struct proc *proc, int *err)
+{
+	struct pid_leaf *leaf;
+	pid_t pid;
+	unsigned n;
+
+	spinlock_acquire(&pid_lock);
+	pid = pid_findfree(pid_next);
+	if (pid < 0) {
+		spinlock_release(&pid_lock);
+		*err = EMPROC;
+		return -1;
+	}
+	pid_next = pid + 1;
+	pid_inuse++;
+	n = pid >> PID_LEAFBITS;
+	leaf = pid_leaves[n];
+	spinlock_release(&pid_lock);
+
+	/*
+	 * The id is ours now, so nobody else will touch its slot;
+	 * but its leaf may need allocating, which we can't do with
+	 * a spinlock held.
+	 */
+	if (leaf == NULL) {
+		leaf = kmalloc(sizeof(*leaf));
+		if (leaf == NULL) {
+			pid_free(pid);
+			*err = ENOMEM;
+			return -1;
+		}
+		bzero(leaf, sizeof(*leaf));
+
+		spinlock_acquire(&pid_lock);
+		if (pid_leaves[n] == NULL) {
+			pid_leaves[n] = leaf;
+			leaf = NULL;
+		}
+		spinlock_release(&pid_lock);
+
+		/* Someone else got there first. */
+		if (leaf != NULL) {
+			kfree(leaf);
+		}
+	}
+
+	spinlock_acquire(&pid_lock);
+	pid_leaves[n]->pl_procs[pid & PID_LEAFMASK] = proc;
+	spinlock_release(&pid_lock);
+
+	return pid;
+}
+
+void
+pid_free(pid_t pid)
+{
+	struct pid_leaf *leaf;
+
+	KASSERT(pid >= PID_MIN && pid <= PID_MAX);
+
+	spinlock_acquire(&pid_lock);
+	KASSERT(pid_bitmap[pid / 32] & (1U << (pid % 32)));
+	leaf = pid_leaves[pid >> PID_LEAFBITS];
+	if (leaf != NULL) {
+		leaf->pl_procs[pid & PID_LEAFMASK] = NULL;
+	}
+	pid_bitmap[pid / 32] &= ~(1U << (pid % 32));
+	pid_inuse--;
+	spinlock_release(&pid_lock);
+}
+
+struct proc *
+pid_lookup(pid_t pid)
+{
+	struct pid_leaf *leaf;
+	struct proc *proc;
+
+	if (pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
+	}
+
+	proc = NULL;
+	spinlock_acquire(&pid_lock);
+	leaf = pid_leaves[pid >> PID_LEAFBITS];
+	if (leaf != NULL) {
+		proc = leaf->pl_procs[pid & PID_LEAFMASK];
+	}
+	spinlock_release(&pid_lock);
+
+	return proc;
+}
+
+void
+pid_printstats(void)
+{
+	unsigned inuse, leaves, i;
+	pid_t next;
+
+	spinlock_acquire(&pid_lock);
+	inuse = pid_inuse;
+	next = pid_next;
+	leaves = 0;
+	for (i=0; i<PID_NLEAVES; i++) {
+		if (pid_leaves[i] != NULL) {
+			leaves++;
+		}
+	}
+	spinlock_release(&pid_lock);
+
+	kprintf("pids: %u in use, next %d, %u/%u table leaves\n",
+		inuse, (int)next, leaves, (unsigned)PID_NLEAVES);
+}
@@ -46,9 +46,11 @@
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
+#include <thread.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
+#include <pid.h>
 #include <kern/errno.h>
 #include <kern/process_syscalls.h>
 #include <kern/file_syscalls.h>
@@ -58,7 +60,13 @@
  */
 struct proc *kproc;
 
-struct proc *proc_ids[PID_MAX_256];
+/*
+ * Protects the process tree: everyone's parent, child and zombie
+ * links and exit fields. Process ids are given back with this held,
+ * so a process found with pid_lookup while holding it can't be freed
+ * until it's released.
+ */
+static struct lock *proc_treelock;
 
 /*
  * Create a proc structure.
@@ -90,42 +98,391 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
-	/* Assign PID */
-	proc->pid = spawn_pid(proc, &err);
-
 	proc->ppid = -1;
 
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_sibling = NULL;
+	proc->p_psibling = NULL;
+	proc->p_zombies = NULL;
+	proc->p_zombietail = &proc->p_zombies;
+	proc->p_nextzombie = NULL;
+	proc->p_pzombie = NULL;
+	proc->p_orphan = false;
+	proc->p_vfork = false;
+	proc->p_vforkdone = false;
+	proc->p_sharedas = false;
+	proc->p_execerr = 0;
+
     proc->exit_flag = false;
 
     proc->exit_code = -1;
 
-    proc->exit_proc_counter = 0;
+	proc->exitcv = cv_create("exitcv");
+	if (proc->exitcv == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 
-	proc->exitlock = lock_create("exitlock");
-	if (proc->exitlock == NULL) {
+	proc->p_uthreadlock = lock_create("uthreads");
+	if (proc->p_uthreadlock == NULL) {
+		cv_destroy(proc->exitcv);
 		kfree(proc->p_name);
 		kfree(proc);
 		return NULL;
 	}
 
-	proc->exitcv = cv_create("exitcv");
-	if (proc->exitcv == NULL) {
+	proc->p_uthreadcv = cv_create("uthreads");
+	if (proc->p_uthreadcv == NULL) {
+		lock_destroy(proc->p_uthreadlock);
+		cv_destroy(proc->exitcv);
 		kfree(proc->p_name);
 		kfree(proc);
 		return NULL;
 	}
 
-    proc_ids[proc->pid] = proc;
+	/* The thread that runs the process to begin with is id 0. */
+	for (int i = 0; i < THREAD_MAX; i++) {
+		proc->p_uthreads[i].ut_state = UT_FREE;
+		proc->p_uthreads[i].ut_thread = NULL;
+		proc->p_uthreads[i].ut_retval = NULL;
+	}
+	proc->p_uthreads[0].ut_state = UT_RUNNING;
+	proc->p_nuthreads = 1;
+	proc->p_exiting = false;
+	proc->p_exitstatus = 0;
+
+	proc->p_affinity = CPUMASK_ALL;
+	proc->p_ioring = NULL;
 
 	/*
 	 * Initialize File Table
 	 */
-	for(int fd = 0; fd < OPEN_MAX; fd++)
-		proc->file_table[fd] = NULL;
+	filetable_init(&proc->p_files);
+
+	/* Assign PID last; from here on the process can be looked up. */
+	proc->pid = spawn_pid(proc, &err);
+	if (proc->pid < 0) {
+		filetable_cleanup(&proc->p_files);
+		cv_destroy(proc->p_uthreadcv);
+		lock_destroy(proc->p_uthreadlock);
+		cv_destroy(proc->exitcv);
+		kfree(proc->p_name);
+		kfree(proc);
+		return NULL;
+	}
 
 	return proc;
 }
 
+/*
+ * Process tree handling. Call with proc_treelock held.
+ */
+
+/* Make CHILD the newest child of PARENT. */
+static
+void
+proc_link(struct proc *parent, struct proc *child)
+{
+	KASSERT(child->p_parent == NULL);
+
+	child->p_parent = parent;
+	child->ppid = parent->pid;
+	child->p_sibling = parent->p_children;
+	if (child->p_sibling != NULL) {
+		child->p_sibling->p_psibling = &child->p_sibling;
+	}
+	child->p_psibling = &parent->p_children;
+	parent->p_children = child;
+}
+
+/* Take CHILD off its parent's lists. */
+static
+void
+proc_unlink(struct proc *child)
+{
+	struct proc *parent = child->p_parent;
+
+	KASSERT(parent != NULL);
+
+	*child->p_psibling = child->p_sibling;
+	if (child->p_sibling != NULL) {
+		child->p_sibling->p_psibling = child->p_psibling;
+	}
+	child->p_sibling = NULL;
+	child->p_psibling = NULL;
+
+	if (child->p_pzombie != NULL) {
+		*child->p_pzombie = child->p_nextzombie;
+		if (child->p_nextzombie != NULL) {
+			child->p_nextzombie->p_pzombie = child->p_pzombie;
+		}
+		else {
+			parent->p_zombietail = child->p_pzombie;
+		}
+		child->p_nextzombie = NULL;
+		child->p_pzombie = NULL;
+	}
+
+	child->p_parent = NULL;
+}
+
+/* Queue CHILD, which has just exited, for its parent to collect. */
+static
+void
+proc_addzombie(struct proc *child)
+{
+	struct proc *parent = child->p_parent;
+
+	child->p_nextzombie = NULL;
+	child->p_pzombie = parent->p_zombietail;
+	*parent->p_zombietail = child;
+	parent->p_zombietail = &child->p_nextzombie;
+}
+
+/*
+ * Tear down what's left of an exited process. Runs on the work
+ * queue: destroying the address space is slow, and nobody needs to
+ * wait for it.
+ */
+static
+void
+proc_free(void *data)
+{
+	struct proc *p = data;
+
+	cv_destroy(p->exitcv);
+	lock_destroy(p->p_uthreadlock);
+	cv_destroy(p->p_uthreadcv);
+	if (p->p_addrspace != NULL) {
+		as_destroy(p->p_addrspace);
+		p->p_addrspace = NULL;
+	}
+	kfree(p->p_name);
+	kfree(p);
+}
+
+void
+proc_reap(struct proc *p)
+{
+	KASSERT(p->exit_flag);
+	KASSERT(p->p_parent == NULL);
+
+	work_init(&p->p_reapwork, proc_free, p);
+	work_queue(&p->p_reapwork);
+}
+
+void
+proc_exited(struct proc *p, int status)
+{
+	struct proc *child;
+
+	KASSERT(p != kproc);
+
+	/* If we're still in a vfork parent's memory, give it back. */
+	if (p->p_sharedas) {
+		spinlock_acquire(&p->p_lock);
+		p->p_addrspace = NULL;
+		spinlock_release(&p->p_lock);
+		p->p_sharedas = false;
+	}
+
+	lock_acquire(proc_treelock);
+
+	/* Hand our children to the kernel process, which won't wait. */
+	while ((child = p->p_children) != NULL) {
+		proc_unlink(child);
+		if (child->exit_flag) {
+			pid_free(child->pid);
+			proc_reap(child);
+		}
+		else {
+			proc_link(kproc, child);
+			child->p_orphan = true;
+		}
+	}
+
+	p->exit_flag = true;
+	p->exit_code = status;
+
+	if (p->p_parent == NULL || p->p_orphan) {
+		/* Nobody will collect us. */
+		if (p->p_parent != NULL) {
+			proc_unlink(p);
+		}
+		pid_free(p->pid);
+		lock_release(proc_treelock);
+		proc_reap(p);
+		return;
+	}
+
+	/* The parent queues us itself once it's done waiting in vfork. */
+	if (p->p_vfork) {
+		p->p_vforkdone = true;
+	}
+	else {
+		proc_addzombie(p);
+	}
+	cv_broadcast(p->p_parent->exitcv, proc_treelock);
+	lock_release(proc_treelock);
+}
+
+struct proc *
+proc_waitchild(pid_t pid, bool nohang, int *err)
+{
+	struct proc *p = curproc;
+	struct proc *child;
+
+	lock_acquire(proc_treelock);
+	while (1) {
+		if (pid == -1) {
+			/* Whichever exited first. */
+			child = p->p_zombies;
+			if (child == NULL && p->p_children == NULL) {
+				*err = ECHILD;
+				break;
+			}
+		}
+		else {
+			/*
+			 * Look it up afresh each time: another of our
+			 * threads may have collected it while we slept.
+			 */
+			child = pid_lookup(pid);
+			if (child == NULL) {
+				*err = ESRCH;
+				break;
+			}
+			if (child->p_parent != p) {
+				child = NULL;
+				*err = ECHILD;
+				break;
+			}
+			if (!child->exit_flag || child->p_vfork) {
+				child = NULL;
+			}
+		}
+
+		if (child != NULL) {
+			proc_unlink(child);
+			pid_free(child->pid);
+			break;
+		}
+		if (nohang) {
+			*err = 0;
+			break;
+		}
+		cv_wait(p->exitcv, proc_treelock);
+	}
+	lock_release(proc_treelock);
+
+	return child;
+}
+
+int
+proc_vforkwait(struct proc *child)
+{
+	struct proc *p = curproc;
+	int result;
+
+	lock_acquire(proc_treelock);
+	KASSERT(child->p_parent == p);
+	KASSERT(child->p_vfork);
+	while (!child->p_vforkdone) {
+		cv_wait(p->exitcv, proc_treelock);
+	}
+	child->p_vfork = false;
+
+	result = 0;
+	if (child->exit_flag) {
+		if (child->p_execerr) {
+			/* Never got going; nobody else knows about it. */
+			result = child->p_execerr;
+			proc_unlink(child);
+			pid_free(child->pid);
+			lock_release(proc_treelock);
+			proc_reap(child);
+			return result;
+		}
+		proc_addzombie(child);
+		cv_broadcast(p->exitcv, proc_treelock);
+	}
+	lock_release(proc_treelock);
+
+	return result;
+}
+
+void
+proc_vforkdone(struct proc *p)
+{
+	lock_acquire(proc_treelock);
+	if (p->p_vfork && !p->p_vforkdone) {
+		p->p_vforkdone = true;
+		cv_broadcast(p->p_parent->exitcv, proc_treelock);
+	}
+	lock_release(proc_treelock);
+}
+
+/*
+ * Find the process PID names for the affinity calls: the current
+ * process (PID 0 or its own) or one of its children. Call with
+ * proc_treelock held, which keeps a child found this way from being
+ * freed.
+ */
+static
+struct proc *
+proc_affinity_lookup(pid_t pid, int *err)
+{
+	struct proc *p;
+
+	KASSERT(lock_do_i_hold(proc_treelock));
+
+	if (pid == 0 || pid == curproc->pid) {
+		return curproc;
+	}
+	p = pid_lookup(pid);
+	if (p == NULL) {
+		*err = ESRCH;
+		return NULL;
+	}
+	if (p->p_parent != curproc) {
+		*err = EPERM;
+		return NULL;
+	}
+	return p;
+}
+
+int
+proc_setaffinity(pid_t pid, uint32_t mask)
+{
+	struct proc *p;
+	int err = 0;
+
+	lock_acquire(proc_treelock);
+	p = proc_affinity_lookup(pid, &err);
+	if (p != NULL) {
+		p->p_affinity = mask;
+	}
+	lock_release(proc_treelock);
+	return err;
+}
+
+int
+proc_getaffinity(pid_t pid, uint32_t *ret)
+{
+	struct proc *p;
+	int err = 0;
+
+	lock_acquire(proc_treelock);
+	p = proc_affinity_lookup(pid, &err);
+	if (p != NULL) {
+		*ret = p->p_affinity;
+	}
+	lock_release(proc_treelock);
+	return err;
+}
+
 /*
  * Destroy a proc structure.
  *
@@ -158,6 +515,9 @@ proc_destroy(struct proc *proc)
 		proc->p_cwd = NULL;
 	}
 
+	/* Anything still open (only if it never ran) */
+	filetable_cleanup(&proc->p_files);
+
 	/* VM fields */
 	if (proc->p_addrspace) {
 		/*
@@ -207,7 +567,19 @@ proc_destroy(struct proc *proc)
 	}
 
 	KASSERT(proc->p_numthreads == 0);
+
+	lock_acquire(proc_treelock);
+	KASSERT(proc->p_children == NULL);
+	if (proc->p_parent != NULL) {
+		proc_unlink(proc);
+	}
+	pid_free(proc->pid);
+	lock_release(proc_treelock);
+
 	spinlock_cleanup(&proc->p_lock);
+	cv_destroy(proc->exitcv);
+	lock_destroy(proc->p_uthreadlock);
+	cv_destroy(proc->p_uthreadcv);
 
 	kfree(proc->p_name);
 	kfree(proc);
@@ -219,6 +591,11 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_treelock = lock_create("proctree");
+	if (proc_treelock == NULL) {
+		panic("lock_create for proctree failed\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -259,6 +636,10 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	lock_acquire(proc_treelock);
+	proc_link(curproc, newproc);
+	lock_release(proc_treelock);
+
 	return newproc;
 }
 
@@ -370,14 +751,12 @@ proc_create_child(const char *name)
 		return NULL;
 	}
 
-	childproc->ppid = curproc->pid;
-	for(int fd=0;fd<OPEN_MAX;fd++)
-	{
-        childproc->file_table[fd] = curproc->file_table[fd];
-        if(childproc->file_table[fd] != NULL){
-			childproc->file_table[fd]->fh_reference_count++;
-		}
-	}
+	lock_acquire(proc_treelock);
+	proc_link(curproc, childproc);
+	lock_release(proc_treelock);
+
+	childproc->p_affinity = curproc->p_affinity;
+	filetable_copy(&curproc->p_files, &childproc->p_files);
 
 	return childproc;
 }
@@ -0,0 +1,77 @@
+/*
+ * CPU affinity system calls.
+ *
+ * setaffinity(pid, mask) sets the CPUs a process's threads may run
+ * on; pid 0 means the caller. A process may change its own mask and
+ * its children's. thread_setaffinity(mask) narrows that further for
+ * the calling thread alone. Masks have one bit per CPU and must name
+ * at least one CPU that exists. The get calls copy out the current
+ * mask. See thread.h for how the masks are applied.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <limits.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <copyinout.h>
+#include <kern/affinity_syscalls.h>
+
+int
+sys_setaffinity(pid_t pid, uint32_t mask, int *err)
+{
+	if (!thread_affinity_ok(mask)) {
+		*err = EINVAL;
+		return -1;
+	}
+	*err = proc_setaffinity(pid, mask);
+	if (*err) {
+		return -1;
+	}
+
+	/* Get off this CPU now if we have to; others go when they yield. */
+	thread_yield();
+	return 0;
+}
+
+int
+sys_getaffinity(pid_t pid, userptr_t maskp, int *err)
+{
+	uint32_t mask;
+
+	*err = proc_getaffinity(pid, &mask);
+	if (*err) {
+		return -1;
+	}
+	mask &= cpu_onlinemask();
+	*err = copyout(&mask, maskp, sizeof(mask));
+	if (*err) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+sys_thread_setaffinity(uint32_t mask, int *err)
+{
+	*err = thread_setaffinity(mask);
+	if (*err) {
+		return -1;
+	}
+	return 0;
+}
+
+int
+sys_thread_getaffinity(userptr_t maskp, int *err)
+{
+	uint32_t mask;
+
+	mask = curthread->t_affinity & cpu_onlinemask();
+	*err = copyout(&mask, maskp, sizeof(mask));
+	if (*err) {
+		return -1;
+	}
+	return 0;
+}
@@ -1,6 +1,5 @@
 #include <types.h>
 #include <syscall.h>
-#include <synch.h>
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
@@ -9,12 +8,18 @@
 #include <kern/errno.h>
 #include <kern/fcntl.h>
 #include <kern/file_syscalls.h>
+#include <filetable.h>
+#include <pipe.h>
+#include <poll.h>
 #include <uio.h>
 #include <kern/iovec.h>
 #include <copyinout.h>
 #include <vnode.h>
 #include <kern/seek.h>
 #include <kern/stat.h>
+#include <kern/stattypes.h>
+#include <kern/dirent.h>
+#include <kern/time.h>
 
 /* File Open System Call */
 int
@@ -33,6 +38,10 @@ sys_open(char *filename, int flags, mode_t mode, int *err)
     }
 
     char *filename_copy = kmalloc(sizeof(char) * NAME_MAX);
+    if (filename_copy == NULL) {
+        *err = ENOMEM;
+        return -1;
+    }
 
     int response = 0;
     size_t actual = 0;
@@ -45,284 +54,828 @@ sys_open(char *filename, int flags, mode_t mode, int *err)
         return -1;
     }
 
-    int fd = 3;
+    struct file_handle *fh;
+    int fd;
 
-    for (;fd < OPEN_MAX; fd++) {
+    response = fh_open(filename_copy, flags, mode, &fh);
+    kfree(filename_copy);
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-        if (curproc->file_table[fd] != NULL) {
-            continue;
-        }
+    /* Lowest free descriptor */
+    response = filetable_place(&curproc->p_files, fh, &fd);
+    if (response) {
+        fh_decref(fh);
+        *err = response;
+        return -1;
+    }
 
-        /* Claim a file descriptor */
-        curproc->file_table[fd] = kmalloc(sizeof(struct file_handle));
-        if (curproc->file_table[fd] == NULL) {
-            kfree(filename_copy);
-            curproc->file_table[fd] = NULL;
-            *err = ENOMEM;
-            return -1;
-        }
+    return fd;
+}
 
-        curproc->file_table[fd]->fh_lock = lock_create("fd_lock");
-        if (curproc->file_table[fd]->fh_lock == NULL) {
-            kfree(curproc->file_table[fd]);
-            kfree(filename_copy);
-            curproc->file_table[fd] = NULL;
-            *err = ENOMEM;
+/*
+ * Most that one read or write can move: the count has to fit in the
+ * ssize_t return value.
+ */
+#define FILE_RW_MAX	0x7fffffffU
+
+/* readv and friends with this few buffers don't kmalloc */
+#define FILE_FASTIOV	8
+
+/*
+ * Common code for all the read and write calls: move data between
+ * the file open at FD and the NIOV user buffers described by IOV
+ * (which is in kernel memory). Unless POSITIONAL, the I/O starts at
+ * the handle's shared offset, which is held busy throughout and
+ * advanced; otherwise it starts at POS and the offset isn't touched,
+ * so positional I/O through a shared handle doesn't serialize.
+ */
+static ssize_t
+file_rw(int fd, struct iovec *iov, int niov, bool positional, off_t pos,
+        enum uio_rw rw, int *err) {
+
+    struct file_handle *fh;
+    struct uio file_uio;
+    size_t total = 0;
+    int response;
+
+    for (int i = 0; i < niov; i++) {
+        if (iov[i].iov_len > FILE_RW_MAX - total) {
+            *err = EINVAL;
             return -1;
         }
+        total += iov[i].iov_len;
+    }
 
-        curproc->file_table[fd]->fh_offset = 0;
-        curproc->file_table[fd]->fh_flags = flags;
-        curproc->file_table[fd]->fh_reference_count = 1;
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
+    }
 
-        response = vfs_open(filename_copy, flags, mode, &(curproc->file_table[fd]->fh_vnode));
+    /* Access mode */
+    if (rw == UIO_READ ? (fh->fh_flags & O_WRONLY) != 0
+                       : (fh->fh_flags & O_ACCMODE) == 0) {
+        fh_decref(fh);
+        *err = EBADF;
+        return -1;
+    }
 
-        if (response) {
-            lock_destroy(curproc->file_table[fd]->fh_lock);
-            kfree(curproc->file_table[fd]);
-            kfree(filename_copy);
-            curproc->file_table[fd] = NULL;
-            *err = response;
+    if (positional) {
+        if (!VOP_ISSEEKABLE(fh->fh_vnode)) {
+            fh_decref(fh);
+            *err = ESPIPE;
+            return -1;
+        }
+        if (pos < 0) {
+            fh_decref(fh);
+            *err = EINVAL;
             return -1;
         }
+    }
 
-        break;
+    /* flags and references */
+    file_uio.uio_iovcnt = niov;
+    file_uio.uio_iov = iov;
+    file_uio.uio_segflg = UIO_USERSPACE;
+    file_uio.uio_rw = rw;
+    file_uio.uio_space = curproc->p_addrspace;
+    file_uio.uio_resid = total;
+
+    if (positional) {
+        file_uio.uio_offset = pos;
+    }
+    else {
+        /* Claim the offset */
+        fh_acquire(fh);
+        file_uio.uio_offset = fh->fh_offset;
     }
 
-    kfree(filename_copy);
+    if (rw == UIO_READ) {
+        response = VOP_READ(fh->fh_vnode, &file_uio);
+    }
+    else {
+        response = VOP_WRITE(fh->fh_vnode, &file_uio);
+    }
+
+    if (!positional) {
+        /* Update the shared offset */
+        fh->fh_offset = file_uio.uio_offset;
+        fh_release(fh);
+    }
+    fh_decref(fh);
 
-    if (fd >= OPEN_MAX) {
-        *err = EMFILE;
+    if (response) {
+        *err = response;
         return -1;
     }
 
-    return fd;
+    /* uio_resid will have been decremented by the amount transferred */
+    return total - file_uio.uio_resid;
+}
+
+/*
+ * Common code for the vector calls: fetch the user's iovec array and
+ * hand it to file_rw.
+ */
+static ssize_t
+file_rwv(int fd, userptr_t uiov, int iovcnt, bool positional,
+         off_t pos, enum uio_rw rw, int *err) {
+
+    struct iovec fastiov[FILE_FASTIOV];
+    struct iovec *iov;
+    ssize_t ret;
+    int response;
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        *err = EINVAL;
+        return -1;
+    }
+
+    iov = fastiov;
+    if (iovcnt > FILE_FASTIOV) {
+        iov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (iov == NULL) {
+            *err = ENOMEM;
+            return -1;
+        }
+    }
+
+    response = copyin(uiov, iov, iovcnt * sizeof(struct iovec));
+    if (response) {
+        *err = response;
+        ret = -1;
+    }
+    else {
+        ret = file_rw(fd, iov, iovcnt, positional, pos, rw, err);
+    }
+
+    if (iov != fastiov) {
+        kfree(iov);
+    }
+    return ret;
 }
 
 /* File Read System Call */
 ssize_t
 sys_read(int fd, void *buf, size_t buflen, int *err) {
 
+    struct iovec read_iovec;
+
     /* Validations */
-    if (fd < 0 || fd >= OPEN_MAX) {
-        *err = EBADF;
+    if (buf == NULL) {
+        *err = EFAULT;
         return -1;
     }
 
-    if (curproc->file_table[fd] == NULL) {
-        *err = EBADF;
+    if (buflen <= 0) {
+        *err = EFAULT;
         return -1;
     }
 
+    /* data and length */
+    read_iovec.iov_ubase = buf;
+    read_iovec.iov_len = buflen;
+
+    return file_rw(fd, &read_iovec, 1, false, 0, UIO_READ, err);
+}
+
+/* File Write System Call */
+ssize_t
+sys_write(int fd, void *buf, size_t buflen, int *err) {
+
+    struct iovec write_iovec;
+
+    /* Validations */
     if (buf == NULL) {
         *err = EFAULT;
         return -1;
     }
 
-    if (curproc->file_table[fd]->fh_flags & O_WRONLY) {
+    if (buflen <= 0) {
         *err = EBADF;
         return -1;
     }
 
-    if (buflen <= 0) {
-        *err = EFAULT;
-        return -1;
-    }
+    /* data and length */
+    write_iovec.iov_ubase = buf;
+    write_iovec.iov_len = buflen;
+
+    return file_rw(fd, &write_iovec, 1, false, 0, UIO_WRITE, err);
+}
+
+/* Positional read: like read, at POS, leaving the file offset alone */
+ssize_t
+sys_pread(int fd, void *buf, size_t buflen, off_t pos, int *err) {
 
-    int response = 0;
-    struct uio read_uio;
     struct iovec read_iovec;
 
-    /* data and length */
     read_iovec.iov_ubase = buf;
     read_iovec.iov_len = buflen;
 
-    /* flags and references */
-    read_uio.uio_iovcnt = 1;
-    read_uio.uio_iov = &read_iovec;
-    read_uio.uio_segflg = UIO_USERSPACE;
-    read_uio.uio_rw = UIO_READ;
-    read_uio.uio_space = curproc->p_addrspace;
-    read_uio.uio_resid = buflen;
+    return file_rw(fd, &read_iovec, 1, true, pos, UIO_READ, err);
+}
 
-    /* Lock file descriptor */
-    lock_acquire(curproc->file_table[fd]->fh_lock);
+/* Positional write */
+ssize_t
+sys_pwrite(int fd, void *buf, size_t buflen, off_t pos, int *err) {
 
-    read_uio.uio_offset = curproc->file_table[fd]->fh_offset;
-    int residual = read_uio.uio_resid;
+    struct iovec write_iovec;
 
-    response = VOP_READ(curproc->file_table[fd]->fh_vnode, &read_uio);
+    write_iovec.iov_ubase = buf;
+    write_iovec.iov_len = buflen;
 
-    /* uio_resid will have been decremented by the amount transferred */
-    residual -= read_uio.uio_resid;
+    return file_rw(fd, &write_iovec, 1, true, pos, UIO_WRITE, err);
+}
+
+/* Scatter read: fill each of the IOVCNT buffers in IOV in turn */
+ssize_t
+sys_readv(int fd, userptr_t iov, int iovcnt, int *err) {
+    return file_rwv(fd, iov, iovcnt, false, 0, UIO_READ, err);
+}
+
+/* Gather write */
+ssize_t
+sys_writev(int fd, userptr_t iov, int iovcnt, int *err) {
+    return file_rwv(fd, iov, iovcnt, false, 0, UIO_WRITE, err);
+}
 
-    /* Update offset in the current process */
-    curproc->file_table[fd]->fh_offset = read_uio.uio_offset;
+/* Scatter read at POS */
+ssize_t
+sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int *err) {
+    return file_rwv(fd, iov, iovcnt, true, pos, UIO_READ, err);
+}
 
-    /* Release lock file descriptor */
-    lock_release(curproc->file_table[fd]->fh_lock);
+/* Gather write at POS */
+ssize_t
+sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos, int *err) {
+    return file_rwv(fd, iov, iovcnt, true, pos, UIO_WRITE, err);
+}
 
+/*
+ * Kernel buffer for copy_file_range. Each chunk is one VOP_READ and
+ * one VOP_WRITE, so bigger is fewer trips through the file system.
+ */
+#define FILE_COPYBUF	(64 * 1024)
+
+/*
+ * Read one end of a copy_file_range: the offset at UOFF if there is
+ * one (the handle's offset is then left alone), otherwise the
+ * handle's, which the caller holds busy.
+ */
+static int
+file_copy_getpos(struct file_handle *fh, userptr_t uoff, off_t *pos) {
+
+    int response;
+
+    if (uoff == NULL) {
+        *pos = fh->fh_offset;
+        return 0;
+    }
+    if (!VOP_ISSEEKABLE(fh->fh_vnode)) {
+        return ESPIPE;
+    }
+    response = copyin(uoff, pos, sizeof(*pos));
     if (response) {
-        *err = response;
-        return -1;
+        return response;
+    }
+    if (*pos < 0) {
+        return EINVAL;
     }
+    return 0;
+}
 
-    return residual;
+/* And write it back. */
+static int
+file_copy_putpos(struct file_handle *fh, userptr_t uoff, off_t pos) {
+
+    if (uoff == NULL) {
+        fh->fh_offset = pos;
+        return 0;
+    }
+    return copyout(&pos, uoff, sizeof(pos));
 }
 
-/* File Write System Call */
+/*
+ * copy_file_range: copy up to LEN bytes from the file open at INFD to
+ * the one open at OUTFD without passing them through user memory.
+ * Each of INOFF and OUTOFF is either NULL, to use and advance the
+ * handle's offset, or points to an offset to use and advance instead.
+ * Stops early at end of file, or after a short read (from a pipe,
+ * say) or short write. FLAGS must be 0.
+ *
+ * Returns the number of bytes copied. If something goes wrong after
+ * some have been, those are reported and the error is left for the
+ * next call. That includes failing to store the new offset through
+ * INOFF or OUTOFF: the count wins, and the offset is left stale.
+ */
 ssize_t
-sys_write(int fd, void *buf, size_t buflen, int *err) {
-
-    /* Validations */
-    if (fd < 0 || fd >= OPEN_MAX) {
-        *err = EBADF;
+sys_copy_file_range(int infd, userptr_t inoff, int outfd, userptr_t outoff,
+                    size_t len, unsigned flags, int *err) {
+
+    struct file_handle *in, *out, *first, *second;
+    struct iovec iov;
+    struct uio copy_uio;
+    char *kbuf;
+    off_t inpos, outpos;
+    size_t chunk, got, put, done = 0;
+    int response, putresponse;
+
+    if (flags != 0) {
+        *err = EINVAL;
         return -1;
     }
+    if (len > FILE_RW_MAX) {
+        len = FILE_RW_MAX;
+    }
 
-    if (curproc->file_table[fd] == NULL) {
+    in = filetable_get(&curproc->p_files, infd);
+    if (in == NULL) {
         *err = EBADF;
         return -1;
     }
-
-    if (buf == NULL) {
-        *err = EFAULT;
+    out = filetable_get(&curproc->p_files, outfd);
+    if (out == NULL) {
+        fh_decref(in);
+        *err = EBADF;
         return -1;
     }
-
-    if (!(curproc->file_table[fd]->fh_flags & O_ACCMODE)) {
+    if ((in->fh_flags & O_ACCMODE) == O_WRONLY ||
+        (out->fh_flags & O_ACCMODE) == O_RDONLY) {
+        fh_decref(in);
+        fh_decref(out);
         *err = EBADF;
         return -1;
     }
 
-    if (buflen <= 0) {
-        *err = EBADF;
+    kbuf = kmalloc(FILE_COPYBUF);
+    if (kbuf == NULL) {
+        fh_decref(in);
+        fh_decref(out);
+        *err = ENOMEM;
         return -1;
     }
 
-    int response = 0;
-
-    struct uio write_uio;
-    struct iovec write_iovec;
+    /*
+     * Hold both offsets busy, taking them in address order so that
+     * two copies going opposite ways between the same two handles
+     * can't deadlock. If they're the same handle, once is enough.
+     */
+    first = in < out ? in : out;
+    second = in < out ? out : in;
+    fh_acquire(first);
+    if (second != first) {
+        fh_acquire(second);
+    }
 
-    /* data and length */
-    write_iovec.iov_ubase = buf;
-    write_iovec.iov_len = buflen;
+    response = file_copy_getpos(in, inoff, &inpos);
+    if (response == 0) {
+        response = file_copy_getpos(out, outoff, &outpos);
+    }
 
-    /* flags and references */
-    write_uio.uio_iovcnt = 1;
-    write_uio.uio_iov = &write_iovec;
-    write_uio.uio_segflg = UIO_USERSPACE;
-    write_uio.uio_rw = UIO_WRITE;
-    write_uio.uio_space = curproc->p_addrspace;
-    write_uio.uio_resid = buflen;
+    /* Copying a file onto an overlapping part of itself is undefined */
+    if (response == 0 && in->fh_vnode == out->fh_vnode &&
+        inpos < outpos + (off_t)len && outpos < inpos + (off_t)len) {
+        response = EINVAL;
+    }
 
-    /* Lock file descriptor */
-    lock_acquire(curproc->file_table[fd]->fh_lock);
+    while (response == 0 && done < len) {
+        chunk = len - done;
+        if (chunk > FILE_COPYBUF) {
+            chunk = FILE_COPYBUF;
+        }
 
-    write_uio.uio_offset = curproc->file_table[fd]->fh_offset;
-    int residual = write_uio.uio_resid;
+        uio_kinit(&iov, &copy_uio, kbuf, chunk, inpos, UIO_READ);
+        response = VOP_READ(in->fh_vnode, &copy_uio);
+        got = chunk - copy_uio.uio_resid;
+        if (response || got == 0) {
+            break;
+        }
 
-    response = VOP_WRITE(curproc->file_table[fd]->fh_vnode, &write_uio);
+        uio_kinit(&iov, &copy_uio, kbuf, got, outpos, UIO_WRITE);
+        response = VOP_WRITE(out->fh_vnode, &copy_uio);
+        put = got - copy_uio.uio_resid;
 
-    /* uio_resid will have been decremented by the amount transferred */
-    residual = residual - write_uio.uio_resid;
+        /* Whatever was written counts; the rest will be read again */
+        inpos += put;
+        outpos += put;
+        done += put;
+        if (response || put < chunk) {
+            break;
+        }
+    }
 
-    /* Update offset in the current process */
-    curproc->file_table[fd]->fh_offset = write_uio.uio_offset;
+    if (response == 0 || done > 0) {
+        putresponse = file_copy_putpos(in, inoff, inpos);
+        if (putresponse == 0) {
+            putresponse = file_copy_putpos(out, outoff, outpos);
+        }
+        /* If anything was copied, report it; see above */
+        response = done > 0 ? 0 : putresponse;
+    }
 
-    /* Release lock file descriptor */
-    lock_release(curproc->file_table[fd]->fh_lock);
+    if (second != first) {
+        fh_release(second);
+    }
+    fh_release(first);
+    fh_decref(in);
+    fh_decref(out);
+    kfree(kbuf);
 
     if (response) {
         *err = response;
         return -1;
     }
 
-    return residual;
+    return done;
 }
 
 /* File close System Call */
 int sys_close(int fd, int *err) {
 
+    struct file_handle *fh;
+
+    /* Take it out of the table; the vnode goes with the last reference */
+    fh = filetable_remove(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
+    }
+
+    fh_decref(fh);
+
+    return 0;
+}
+
+/* File dup system call */
+int
+sys_dup2(int oldfd, int newfd, int *err) {
+
+    struct file_handle *fh, *old;
+
     /* Validations */
-    if (fd < 0 || fd >= OPEN_MAX) {
+    if (newfd < 0 || newfd >= OPEN_MAX) {
         *err = EBADF;
         return -1;
     }
 
-    if (curproc->file_table[fd] == NULL) {
+    /* This is the reference newfd will hold */
+    fh = filetable_get(&curproc->p_files, oldfd);
+    if (fh == NULL) {
         *err = EBADF;
         return -1;
     }
 
-    /* Lock file descriptor */
-    lock_acquire(curproc->file_table[fd]->fh_lock);
+    if (newfd == oldfd) {
+        fh_decref(fh);
+        return newfd;
+    }
 
-    curproc->file_table[fd]->fh_reference_count--;
+    /* Whatever newfd had open is closed, outside the table lock */
+    old = filetable_placeat(&curproc->p_files, fh, newfd);
+    if (old != NULL) {
+        fh_decref(old);
+    }
 
-    /* Release file descriptor */
-    if (curproc->file_table[fd]->fh_reference_count == 0) {
-        vfs_close(curproc->file_table[fd]->fh_vnode);
+    return newfd;
+}
 
-        lock_release(curproc->file_table[fd]->fh_lock);
-        lock_destroy(curproc->file_table[fd]->fh_lock);
-        kfree(curproc->file_table[fd]);
+/*
+ * pipe: make a pipe and return descriptors for its read and write
+ * ends in FDS[0] and FDS[1]. FLAGS may be O_NONBLOCK (from pipe2).
+ */
+int
+sys_pipe(userptr_t fds, int flags, int *err) {
 
-        curproc->file_table[fd] = NULL;
+    struct vnode *rvn, *wvn;
+    struct file_handle *rfh, *wfh;
+    int kfds[2];
+    int response;
 
-        return 0;
+    if (flags & ~O_NONBLOCK) {
+        *err = EINVAL;
+        return -1;
     }
 
-    /* Release lock file descriptor */
-    lock_release(curproc->file_table[fd]->fh_lock);
+    response = pipe_create(flags, &rvn, &wvn);
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-    return 0;
-}
+    response = fh_create(rvn, O_RDONLY | flags, &rfh);
+    if (response) {
+        vfs_close(rvn);
+        vfs_close(wvn);
+        *err = response;
+        return -1;
+    }
 
-/* File dup system call */
-int
-sys_dup2(int oldfd, int newfd, int *err) {
+    response = fh_create(wvn, O_WRONLY | flags, &wfh);
+    if (response) {
+        fh_decref(rfh);
+        vfs_close(wvn);
+        *err = response;
+        return -1;
+    }
 
-    /* Validations */
-    if (oldfd < 0 || oldfd >= OPEN_MAX) {
-        *err = EBADF;
+    response = filetable_place(&curproc->p_files, rfh, &kfds[0]);
+    if (response) {
+        fh_decref(rfh);
+        fh_decref(wfh);
+        *err = response;
         return -1;
     }
 
-    if (newfd < 0 || newfd >= OPEN_MAX) {
-        *err = EBADF;
+    response = filetable_place(&curproc->p_files, wfh, &kfds[1]);
+    if (response) {
+        fh_decref(filetable_remove(&curproc->p_files, kfds[0]));
+        fh_decref(wfh);
+        *err = response;
         return -1;
     }
 
-    if (curproc->file_table[oldfd] == NULL) {
-        *err = EBADF;
+    response = copyout(kfds, fds, sizeof(kfds));
+    if (response) {
+        fh_decref(filetable_remove(&curproc->p_files, kfds[0]));
+        fh_decref(filetable_remove(&curproc->p_files, kfds[1]));
+        *err = response;
         return -1;
     }
 
-    if (newfd == oldfd) {
-        return newfd;
+    return 0;
+}
+
+/* Longest poll or select timeout, in milliseconds; about 24 days */
+#define FILE_POLL_MAXMS	0x7fffffff
+
+/*
+ * Common code for poll and select: wait up to TIMEOUT milliseconds
+ * (forever if negative) for any of the NFDS descriptors in PFDS, in
+ * kernel memory, to be ready, fill in their revents, and put the
+ * number with nonzero revents in *READY. Negative fds are skipped.
+ *
+ * Each file is held for the duration so it can't be closed out from
+ * under the pollheads we're hooked on.
+ */
+static int
+file_poll(struct pollfd *pfds, unsigned nfds, int timeout, int *ready) {
+
+    struct file_handle **fhs = NULL;
+    struct poller pl, *pass;
+    unsigned i;
+    int events, n = 0;
+    int response;
+
+    if (nfds > 0) {
+        fhs = kmalloc(nfds * sizeof(struct file_handle *));
+        if (fhs == NULL) {
+            return ENOMEM;
+        }
+    }
+    for (i = 0; i < nfds; i++) {
+        fhs[i] = NULL;
+        if (pfds[i].fd >= 0) {
+            fhs[i] = filetable_get(&curproc->p_files, pfds[i].fd);
+        }
     }
 
-    int response = 0;
-    lock_acquire(curproc->file_table[oldfd]->fh_lock);
+    response = poller_init(&pl, nfds, timeout);
+    if (response) {
+        goto out;
+    }
+
+    /* Only the first pass hooks onto anything. */
+    pass = &pl;
+    while (1) {
+        n = 0;
+        for (i = 0; i < nfds; i++) {
+            pfds[i].revents = 0;
+            if (pfds[i].fd < 0) {
+                continue;
+            }
+            if (fhs[i] == NULL) {
+                pfds[i].revents = POLLNVAL;
+                n++;
+                continue;
+            }
+            events = pfds[i].events & (POLLIN | POLLOUT);
+            pfds[i].revents = VOP_POLL(fhs[i]->fh_vnode, events, pass) &
+                              (events | POLLERR | POLLHUP);
+            if (pfds[i].revents != 0) {
+                n++;
+            }
+        }
+        if (n > 0 || timeout == 0) {
+            break;
+        }
+        if (poller_sleep(&pl)) {
+            /* Timed out */
+            break;
+        }
+        pass = NULL;
+    }
+    poller_cleanup(&pl);
+
+ out:
+    for (i = 0; i < nfds; i++) {
+        if (fhs[i] != NULL) {
+            fh_decref(fhs[i]);
+        }
+    }
+    if (fhs != NULL) {
+        kfree(fhs);
+    }
+    *ready = n;
+    return response;
+}
+
+/*
+ * poll: wait up to TIMEOUT milliseconds, or forever if TIMEOUT is
+ * negative, for any of the NFDS descriptors in FDS to be ready.
+ * Returns how many are.
+ */
+int
+sys_poll(userptr_t fds, unsigned nfds, int timeout, int *err) {
+
+    struct pollfd *pfds = NULL;
+    int ready;
+    int response;
 
-    if (curproc->file_table[newfd] != NULL) {
-        response = sys_close(newfd, err);
+    if (nfds > OPEN_MAX) {
+        *err = EINVAL;
+        return -1;
+    }
 
+    if (nfds > 0) {
+        pfds = kmalloc(nfds * sizeof(struct pollfd));
+        if (pfds == NULL) {
+            *err = ENOMEM;
+            return -1;
+        }
+        response = copyin(fds, pfds, nfds * sizeof(struct pollfd));
         if (response) {
-            lock_release(curproc->file_table[oldfd]->fh_lock);
+            kfree(pfds);
             *err = response;
             return -1;
         }
     }
 
-    curproc->file_table[newfd] = curproc->file_table[oldfd];
-    curproc->file_table[oldfd]->fh_reference_count++;
+    response = file_poll(pfds, nfds, timeout, &ready);
+    if (response == 0 && nfds > 0) {
+        response = copyout(pfds, fds, nfds * sizeof(struct pollfd));
+    }
+    if (pfds != NULL) {
+        kfree(pfds);
+    }
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-    lock_release(curproc->file_table[oldfd]->fh_lock);
+    return ready;
+}
 
-    return newfd;
+#define FD_ISSET_K(fd, set) \
+    (((set)->fds_bits[(fd) / __NFDBITS] & (1U << ((fd) % __NFDBITS))) != 0)
+#define FD_SET_K(fd, set) \
+    ((set)->fds_bits[(fd) / __NFDBITS] |= 1U << ((fd) % __NFDBITS))
+
+/*
+ * select: the same as poll, with the descriptors below NFDS given as
+ * bitmaps of those to check for reading, writing, and exceptions
+ * (any of which may be NULL), and the timeout as a timeval (NULL for
+ * forever). The bitmaps are rewritten to show which are ready, and
+ * the total number of bits set is returned.
+ */
+int
+sys_select(int nfds, userptr_t ureadfds, userptr_t uwritefds,
+           userptr_t uexceptfds, userptr_t utimeout, int *err) {
+
+    fd_set sets[3], out[3];
+    userptr_t usets[3] = { ureadfds, uwritefds, uexceptfds };
+    struct pollfd *pfds = NULL;
+    struct file_handle *fh;
+    struct timeval tv;
+    size_t setlen;
+    unsigned npfds = 0;
+    int fd, s, timeout, ready, count = 0;
+    int response;
+
+    if (nfds < 0 || nfds > __FD_SETSIZE) {
+        *err = EINVAL;
+        return -1;
+    }
+    /* Only the words that cover the first NFDS bits are touched */
+    setlen = DIVROUNDUP(nfds, __NFDBITS) * sizeof(__u32);
+
+    for (s = 0; s < 3; s++) {
+        bzero(&sets[s], sizeof(fd_set));
+        bzero(&out[s], sizeof(fd_set));
+        if (usets[s] != NULL) {
+            response = copyin(usets[s], &sets[s], setlen);
+            if (response) {
+                *err = response;
+                return -1;
+            }
+        }
+    }
+
+    timeout = -1;
+    if (utimeout != NULL) {
+        response = copyin(utimeout, &tv, sizeof(tv));
+        if (response) {
+            *err = response;
+            return -1;
+        }
+        if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+            *err = EINVAL;
+            return -1;
+        }
+        if (tv.tv_sec >= FILE_POLL_MAXMS / 1000) {
+            timeout = FILE_POLL_MAXMS;
+        }
+        else {
+            timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+        }
+    }
+
+    /* Like poll's; too big for the stack. */
+    if (nfds > 0) {
+        pfds = kmalloc(nfds * sizeof(struct pollfd));
+        if (pfds == NULL) {
+            *err = ENOMEM;
+            return -1;
+        }
+    }
+
+    for (fd = 0; fd < nfds; fd++) {
+        pfds[npfds].events = 0;
+        if (FD_ISSET_K(fd, &sets[0])) {
+            pfds[npfds].events |= POLLIN;
+        }
+        if (FD_ISSET_K(fd, &sets[1])) {
+            pfds[npfds].events |= POLLOUT;
+        }
+        if (pfds[npfds].events != 0) {
+            pfds[npfds].fd = fd;
+            npfds++;
+        }
+        else if (FD_ISSET_K(fd, &sets[2])) {
+            /* Nothing is ever exceptional, but it has to be open */
+            fh = filetable_get(&curproc->p_files, fd);
+            if (fh == NULL) {
+                response = EBADF;
+                goto out;
+            }
+            fh_decref(fh);
+        }
+    }
+
+    response = file_poll(pfds, npfds, timeout, &ready);
+    if (response) {
+        goto out;
+    }
+
+    for (unsigned i = 0; i < npfds; i++) {
+        fd = pfds[i].fd;
+        if (pfds[i].revents & POLLNVAL) {
+            response = EBADF;
+            goto out;
+        }
+        /* Hangups and errors make reads and writes return at once */
+        if (FD_ISSET_K(fd, &sets[0]) &&
+            (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET_K(fd, &out[0]);
+            count++;
+        }
+        if (FD_ISSET_K(fd, &sets[1]) &&
+            (pfds[i].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            FD_SET_K(fd, &out[1]);
+            count++;
+        }
+    }
+
+    for (s = 0; s < 3; s++) {
+        if (usets[s] != NULL) {
+            response = copyout(&out[s], usets[s], setlen);
+            if (response) {
+                goto out;
+            }
+        }
+    }
+
+ out:
+    if (pfds != NULL) {
+        kfree(pfds);
+    }
+    if (response) {
+        *err = response;
+        return -1;
+    }
+    return count;
 }
 
 int
@@ -397,190 +950,417 @@ sys___getcwd(char *buf, size_t buflen, int *err) {
     return residual;
 }
 
-off_t
-sys_lseek(int fd, off_t pos, int whence, int *err) {
+/*
+ * getdirentry: read the name of the next entry in the directory open
+ * at FD into BUF. Returns the length of the name, or 0 at the end.
+ */
+ssize_t
+sys_getdirentry(int fd, userptr_t buf, size_t buflen, int *err) {
 
-    /* Validations */
+    struct file_handle *fh;
+    struct iovec iov;
+    struct uio dir_uio;
+    ino_t ino;
+    mode_t type;
+    int response;
 
-    if (fd < 0 || fd >= OPEN_MAX) {
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
         *err = EBADF;
         return -1;
     }
-
-    if (curproc->file_table[fd] == NULL) {
+    if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+        fh_decref(fh);
         *err = EBADF;
         return -1;
     }
 
-    int new_position = -1;
+    iov.iov_ubase = buf;
+    iov.iov_len = buflen;
+    dir_uio.uio_iov = &iov;
+    dir_uio.uio_iovcnt = 1;
+    dir_uio.uio_resid = buflen;
+    dir_uio.uio_segflg = UIO_USERSPACE;
+    dir_uio.uio_rw = UIO_READ;
+    dir_uio.uio_space = curproc->p_addrspace;
+
+    fh_acquire(fh);
+    dir_uio.uio_offset = fh->fh_offset;
+    response = VOP_GETDIRENTRY(fh->fh_vnode, &dir_uio, &ino, &type);
+    if (response == 0) {
+        fh->fh_offset = dir_uio.uio_offset;
+    }
+    fh_release(fh);
+    fh_decref(fh);
 
-    switch(whence) {
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-        /* the new position is pos */
-        case SEEK_SET:
+    return buflen - dir_uio.uio_resid;
+}
 
-            if (pos < 0) {
-                *err = EINVAL;
-                return -1;
-            }
+/* Most that one getdirentries call gathers before copying out */
+#define FILE_DIRBUF_MAX	(16 * 1024)
 
-            lock_acquire(curproc->file_table[fd]->fh_lock);
+/*
+ * getdirentries: fill BUF with as many of the next entries in the
+ * directory open at FD as fit, as struct dirent records (see
+ * kern/dirent.h). Returns the number of bytes used, or 0 at the end.
+ * The entries are gathered in the kernel and copied out in one go,
+ * so a listing costs a syscall per bufferful rather than per name.
+ */
+ssize_t
+sys_getdirentries(int fd, userptr_t buf, size_t buflen, int *err) {
+
+    struct file_handle *fh;
+    struct iovec iov;
+    struct uio dir_uio;
+    struct dirent *de;
+    char name[NAME_MAX + 1];
+    char *kbuf;
+    size_t cap, used = 0, namlen, reclen;
+    off_t pos;
+    ino_t ino;
+    mode_t type;
+    int response;
+
+    cap = buflen < FILE_DIRBUF_MAX ? buflen : FILE_DIRBUF_MAX;
+    if (cap < _DIRENT_RECLEN(1)) {
+        *err = EINVAL;
+        return -1;
+    }
 
-            curproc->file_table[fd]->fh_offset = pos;
-            new_position = curproc->file_table[fd]->fh_offset;
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
+    }
+    if ((fh->fh_flags & O_ACCMODE) == O_WRONLY) {
+        fh_decref(fh);
+        *err = EBADF;
+        return -1;
+    }
 
-            if (!VOP_ISSEEKABLE(curproc->file_table[fd]->fh_vnode)) {
-                lock_release(curproc->file_table[fd]->fh_lock);
-                *err = ESPIPE;
-                return -1;
-            }
+    kbuf = kmalloc(cap);
+    if (kbuf == NULL) {
+        fh_decref(fh);
+        *err = ENOMEM;
+        return -1;
+    }
 
-            lock_release(curproc->file_table[fd]->fh_lock);
+    fh_acquire(fh);
+    pos = fh->fh_offset;
+    while (1) {
+        uio_kinit(&iov, &dir_uio, name, NAME_MAX, pos, UIO_READ);
+        response = VOP_GETDIRENTRY(fh->fh_vnode, &dir_uio, &ino, &type);
+        if (response) {
+            break;
+        }
+        namlen = NAME_MAX - dir_uio.uio_resid;
+        if (namlen == 0) {
+            /* End of the directory */
             break;
+        }
+        reclen = _DIRENT_RECLEN(namlen);
+        if (used + reclen > cap) {
+            /* Leave it for next time */
+            if (used == 0) {
+                response = EINVAL;
+            }
+            break;
+        }
 
-            /* the new position is the current position plus pos */
-        case SEEK_CUR:
-            lock_acquire(curproc->file_table[fd]->fh_lock);
+        de = (struct dirent *)(kbuf + used);
+        de->d_ino = ino;
+        de->d_reclen = reclen;
+        de->d_type = (type & _S_IFMT) >> 12;
+        de->d_namlen = namlen;
+        memcpy(de->d_name, name, namlen);
+        /* The null and the padding */
+        bzero(de->d_name + namlen, reclen - sizeof(*de) - namlen);
+
+        used += reclen;
+        pos = dir_uio.uio_offset;
+    }
 
-            curproc->file_table[fd]->fh_offset += pos;
-            new_position = curproc->file_table[fd]->fh_offset;
+    /*
+     * If something went wrong partway, return what we got; the error
+     * will come up again on the next call.
+     */
+    if (used > 0) {
+        response = copyout(kbuf, buf, used);
+        if (response == 0) {
+            fh->fh_offset = pos;
+        }
+    }
+    fh_release(fh);
+    fh_decref(fh);
+    kfree(kbuf);
 
-            if (!VOP_ISSEEKABLE(curproc->file_table[fd]->fh_vnode)) {
-                lock_release(curproc->file_table[fd]->fh_lock);
-                *err = ESPIPE;
-                return -1;
-            }
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-            lock_release(curproc->file_table[fd]->fh_lock);
-            break;
+    return used;
+}
 
-            /* the new position is the position of end-of-file plus pos */
-        case SEEK_END:
-            lock_acquire(curproc->file_table[fd]->fh_lock);
+/*
+ * fsync: write out whatever of the file open at FD is still only in
+ * memory.
+ */
+int
+sys_fsync(int fd, int *err) {
 
-            struct stat statbuf;
-            int response = VOP_STAT(curproc->file_table[fd]->fh_vnode, &statbuf);
-            if (response) {
-                *err = response;
-                lock_release(curproc->file_table[fd]->fh_lock);
-                return -1;
-            }
+    struct file_handle *fh;
+    int response;
 
-            curproc->file_table[fd]->fh_offset = pos + statbuf.st_size;
-            if (!VOP_ISSEEKABLE(curproc->file_table[fd]->fh_vnode)) {
-                lock_release(curproc->file_table[fd]->fh_lock);
-                *err = ESPIPE;
-                return -1;
-            }
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
+    }
 
-            new_position = curproc->file_table[fd]->fh_offset;
+    response = VOP_FSYNC(fh->fh_vnode);
+    fh_decref(fh);
 
-            lock_release(curproc->file_table[fd]->fh_lock);
-            break;
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-        default:
-            *err = EINVAL;
-            return -1;
+    return 0;
+}
+
+/*
+ * fstat: return information about the file open at FD.
+ */
+int
+sys_fstat(int fd, userptr_t statbuf, int *err) {
+
+    struct file_handle *fh;
+    struct stat st;
+    int response;
+
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
     }
 
-    return new_position;
+    response = VOP_STAT(fh->fh_vnode, &st);
+    fh_decref(fh);
+    if (response == 0) {
+        response = copyout(&st, statbuf, sizeof(st));
+    }
+
+    if (response) {
+        *err = response;
+        return -1;
+    }
+
+    return 0;
 }
 
-/* Initialize console file descriptors */
+/*
+ * stat: return information about the file named PATH. This is also
+ * lstat; without symbolic links there's no difference.
+ */
 int
-std_io_init() {
+sys_stat(userptr_t path, userptr_t statbuf, int *err) {
 
-    int console_fd = 0;
-    for(; console_fd < 3; console_fd++) {
+    struct vnode *vn;
+    struct stat st;
+    char *path_copy;
+    int response;
 
-        char io[] = "con:";
+    path_copy = kmalloc(PATH_MAX);
+    if (path_copy == NULL) {
+        *err = ENOMEM;
+        return -1;
+    }
 
-        curproc->file_table[console_fd] = kmalloc(sizeof(struct file_handle));
-        if (curproc->file_table[console_fd] == NULL) {
-            return ENOMEM;
-        }
+    response = copyinstr(path, path_copy, PATH_MAX, NULL);
+    if (response == 0) {
+        /* vfs_lookup may scribble on the path */
+        response = vfs_lookup(path_copy, &vn);
+    }
+    kfree(path_copy);
+    if (response) {
+        *err = response;
+        return -1;
+    }
+
+    response = VOP_STAT(vn, &st);
+    VOP_DECREF(vn);
+    if (response == 0) {
+        response = copyout(&st, statbuf, sizeof(st));
+    }
+
+    if (response) {
+        *err = response;
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+sys_remove(userptr_t path, int *err) {
+
+    char *path_copy;
+    int response;
+
+    path_copy = kmalloc(PATH_MAX);
+    if (path_copy == NULL) {
+        *err = ENOMEM;
+        return -1;
+    }
 
-        curproc->file_table[console_fd]->fh_offset = 0;
-        curproc->file_table[console_fd]->fh_reference_count = 1;
+    response = copyinstr(path, path_copy, PATH_MAX, NULL);
+    if (response == 0) {
+        response = vfs_remove(path_copy);
+    }
+    kfree(path_copy);
 
-        int response = 0;
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-        switch(console_fd) {
-            case 0  :
+    return 0;
+}
 
-                curproc->file_table[console_fd]->fh_flags = O_RDONLY;
-                response = vfs_open(io, O_RDONLY, 0664, &(curproc->file_table[console_fd]->fh_vnode));
+/*
+ * Fails with EXDEV if the two paths are on different file systems;
+ * mv copies instead in that case.
+ */
+int
+sys_rename(userptr_t oldpath, userptr_t newpath, int *err) {
 
-                curproc->file_table[console_fd]->fh_lock = lock_create("read");
-                if (curproc->file_table[console_fd]->fh_lock == NULL) {
-                    response = ENOMEM;
-                }
+    char *old_copy, *new_copy;
+    int response;
 
-                if (response) {
-                    lock_destroy(curproc->file_table[0]->fh_lock);
-                    vfs_close(curproc->file_table[0]->fh_vnode);
-                    kfree(curproc->file_table[0]);
+    old_copy = kmalloc(PATH_MAX);
+    new_copy = kmalloc(PATH_MAX);
+    if (old_copy == NULL || new_copy == NULL) {
+        kfree(old_copy);
+        kfree(new_copy);
+        *err = ENOMEM;
+        return -1;
+    }
 
-                    return response;
-                }
+    response = copyinstr(oldpath, old_copy, PATH_MAX, NULL);
+    if (response == 0) {
+        response = copyinstr(newpath, new_copy, PATH_MAX, NULL);
+    }
+    if (response == 0) {
+        response = vfs_rename(old_copy, new_copy);
+    }
+    kfree(old_copy);
+    kfree(new_copy);
 
-                break;
+    if (response) {
+        *err = response;
+        return -1;
+    }
 
-            case 1  :
+    return 0;
+}
 
-                curproc->file_table[console_fd]->fh_flags = O_WRONLY;
-                response = vfs_open(io, O_WRONLY, 0664, &(curproc->file_table[console_fd]->fh_vnode));
+off_t
+sys_lseek(int fd, off_t pos, int whence, int *err) {
 
-                curproc->file_table[console_fd]->fh_lock = lock_create("write");
-                if (curproc->file_table[console_fd]->fh_lock == NULL) {
-                    response = ENOMEM;
-                }
+    struct file_handle *fh;
+    struct stat statbuf;
+    off_t new_position;
+    int response;
 
-                if (response) {
-                    lock_destroy(curproc->file_table[0]->fh_lock);
-                    lock_destroy(curproc->file_table[1]->fh_lock);
+    /* Validations */
+    if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) {
+        *err = EINVAL;
+        return -1;
+    }
 
-                    vfs_close(curproc->file_table[0]->fh_vnode);
-                    vfs_close(curproc->file_table[1]->fh_vnode);
+    fh = filetable_get(&curproc->p_files, fd);
+    if (fh == NULL) {
+        *err = EBADF;
+        return -1;
+    }
 
-                    kfree(curproc->file_table[0]);
-                    kfree(curproc->file_table[1]);
+    if (!VOP_ISSEEKABLE(fh->fh_vnode)) {
+        fh_decref(fh);
+        *err = ESPIPE;
+        return -1;
+    }
 
-                    return response;
-                }
+    fh_acquire(fh);
 
-                break;
+    switch(whence) {
 
-            case 2 :
+        /* the new position is pos */
+        case SEEK_SET:
+            new_position = pos;
+            break;
+
+            /* the new position is the current position plus pos */
+        case SEEK_CUR:
+            new_position = fh->fh_offset + pos;
+            break;
+
+            /* the new position is the position of end-of-file plus pos */
+        default:
+            response = VOP_STAT(fh->fh_vnode, &statbuf);
+            if (response) {
+                fh_release(fh);
+                fh_decref(fh);
+                *err = response;
+                return -1;
+            }
+            new_position = statbuf.st_size + pos;
+            break;
+    }
 
-                curproc->file_table[console_fd]->fh_flags = O_WRONLY;
-                response = vfs_open(io, O_WRONLY, 0664, &(curproc->file_table[console_fd]->fh_vnode));
+    if (new_position < 0) {
+        fh_release(fh);
+        fh_decref(fh);
+        *err = EINVAL;
+        return -1;
+    }
 
-                curproc->file_table[console_fd]->fh_lock = lock_create("error");
-                if (curproc->file_table[console_fd]->fh_lock == NULL) {
-                    response = ENOMEM;
-                }
+    fh->fh_offset = new_position;
 
-                if (response) {
-                    lock_destroy(curproc->file_table[0]->fh_lock);
-                    lock_destroy(curproc->file_table[1]->fh_lock);
-                    lock_destroy(curproc->file_table[2]->fh_lock);
+    fh_release(fh);
+    fh_decref(fh);
 
-                    vfs_close(curproc->file_table[0]->fh_vnode);
-                    vfs_close(curproc->file_table[1]->fh_vnode);
-                    vfs_close(curproc->file_table[2]->fh_vnode);
+    return new_position;
+}
 
-                    kfree(curproc->file_table[0]);
-                    kfree(curproc->file_table[1]);
-                    kfree(curproc->file_table[2]);
+/* Initialize console file descriptors */
+int
+std_io_init() {
+
+    static const int std_flags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+    struct file_handle *fh, *old;
+    int response;
 
-                    return response;
-                }
+    for (int console_fd = 0; console_fd < 3; console_fd++) {
+
+        char io[] = "con:";
 
-                break;
+        response = fh_open(io, std_flags[console_fd], 0664, &fh);
+        if (response) {
+            filetable_closeall(&curproc->p_files);
+            return response;
         }
 
+        old = filetable_placeat(&curproc->p_files, fh, console_fd);
+        if (old != NULL) {
+            fh_decref(old);
+        }
     }
 
     return 0;
-}
\ No newline at end of file
+}
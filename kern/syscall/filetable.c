@@ -0,0 +1,302 @@
+/*
+ * Open files and descriptor tables. See filetable.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <atomic.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <vfs.h>
+#include <filetable.h>
+
+/*
+ * Threads waiting for a busy handle sleep on one of these, picked by
+ * the handle's address. The bucket lock protects fh_busy and
+ * fh_owner of every handle that hashes to it. Unrelated handles can
+ * share a bucket; their waiters just wake up, see their own handle is
+ * still busy, and go back to sleep.
+ */
+#define FH_NBUCKETS	16
+
+struct fh_bucket {
+	struct spinlock fb_lock;
+	struct wchan *fb_wchan;
+};
+
+static struct fh_bucket fh_buckets[FH_NBUCKETS];
+
+static
+struct fh_bucket *
+fh_bucket(struct file_handle *fh)
+{
+	uintptr_t x = (uintptr_t)fh;
+
+	/* kmalloc hands out handles at multiples of their size */
+	return &fh_buckets[((x >> 5) ^ (x >> 9)) % FH_NBUCKETS];
+}
+
+void
+filetable_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FH_NBUCKETS; i++) {
+		spinlock_init(&fh_buckets[i].fb_lock);
+		fh_buckets[i].fb_wchan = wchan_create("fh_busy");
+		if (fh_buckets[i].fb_wchan == NULL) {
+			panic("filetable_bootstrap: out of memory\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// handles
+
+int
+fh_create(struct vnode *vn, int flags, struct file_handle **ret)
+{
+	struct file_handle *fh;
+
+	fh = kmalloc(sizeof(*fh));
+	if (fh == NULL) {
+		return ENOMEM;
+	}
+
+	fh->fh_vnode = vn;
+	fh->fh_flags = flags;
+	fh->fh_refcount = 1;
+	fh->fh_offset = 0;
+	fh->fh_busy = false;
+	fh->fh_owner = NULL;
+
+	*ret = fh;
+	return 0;
+}
+
+int
+fh_open(char *path, int flags, mode_t mode, struct file_handle **ret)
+{
+	struct vnode *vn;
+	int result;
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = fh_create(vn, flags, ret);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	return 0;
+}
+
+void
+fh_incref(struct file_handle *fh)
+{
+	unsigned old;
+
+	old = atomic_fetchadd(&fh->fh_refcount, 1);
+	KASSERT(old > 0);
+}
+
+void
+fh_decref(struct file_handle *fh)
+{
+	unsigned old;
+
+	old = atomic_fetchadd(&fh->fh_refcount, (unsigned)-1);
+	KASSERT(old > 0);
+	if (old > 1) {
+		return;
+	}
+
+	/* That was the last reference, so nobody can be waiting. */
+	KASSERT(!fh->fh_busy);
+	vfs_close(fh->fh_vnode);
+	kfree(fh);
+}
+
+void
+fh_acquire(struct file_handle *fh)
+{
+	struct fh_bucket *fb = fh_bucket(fh);
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&fb->fb_lock);
+	KASSERT(fh->fh_owner != curthread);
+	while (fh->fh_busy) {
+		wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+	}
+	fh->fh_busy = true;
+	fh->fh_owner = curthread;
+	spinlock_release(&fb->fb_lock);
+}
+
+void
+fh_release(struct file_handle *fh)
+{
+	struct fh_bucket *fb = fh_bucket(fh);
+
+	spinlock_acquire(&fb->fb_lock);
+	KASSERT(fh->fh_owner == curthread);
+	fh->fh_busy = false;
+	fh->fh_owner = NULL;
+	wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+	spinlock_release(&fb->fb_lock);
+}
+
+bool
+fh_do_i_hold(struct file_handle *fh)
+{
+	/* Only we can set or clear it to or from curthread. */
+	return fh->fh_owner == curthread;
+}
+
+////////////////////////////////////////////////////////////
+// descriptor tables
+
+void
+filetable_init(struct filetable *ft)
+{
+	unsigned i;
+
+	spinlock_init(&ft->ft_lock);
+	for (i=0; i<FT_WORDS; i++) {
+		ft->ft_used[i] = 0;
+	}
+	for (i=0; i<OPEN_MAX; i++) {
+		ft->ft_files[i] = NULL;
+	}
+}
+
+void
+filetable_cleanup(struct filetable *ft)
+{
+	filetable_closeall(ft);
+	spinlock_cleanup(&ft->ft_lock);
+}
+
+void
+filetable_copy(struct filetable *src, struct filetable *dst)
+{
+	struct file_handle *fh;
+	unsigned i;
+
+	/* DST is new, so nobody else can see it yet. */
+	spinlock_acquire(&src->ft_lock);
+	for (i=0; i<FT_WORDS; i++) {
+		KASSERT(dst->ft_used[i] == 0);
+		dst->ft_used[i] = src->ft_used[i];
+	}
+	for (i=0; i<OPEN_MAX; i++) {
+		fh = src->ft_files[i];
+		if (fh != NULL) {
+			fh_incref(fh);
+		}
+		dst->ft_files[i] = fh;
+	}
+	spinlock_release(&src->ft_lock);
+}
+
+void
+filetable_closeall(struct filetable *ft)
+{
+	struct file_handle *fh;
+	int fd;
+
+	for (fd=0; fd<OPEN_MAX; fd++) {
+		fh = filetable_remove(ft, fd);
+		if (fh != NULL) {
+			fh_decref(fh);
+		}
+	}
+}
+
+int
+filetable_place(struct filetable *ft, struct file_handle *fh, int *fd)
+{
+	unsigned i, bit;
+	uint32_t free;
+
+	spinlock_acquire(&ft->ft_lock);
+	for (i=0; i<FT_WORDS; i++) {
+		free = ~ft->ft_used[i];
+		if (free == 0) {
+			continue;
+		}
+		for (bit = 0; (free & (1U << bit)) == 0; bit++) {
+			/* nothing */
+		}
+		if (i * 32 + bit >= OPEN_MAX) {
+			break;
+		}
+		ft->ft_used[i] |= 1U << bit;
+		ft->ft_files[i * 32 + bit] = fh;
+		spinlock_release(&ft->ft_lock);
+		*fd = i * 32 + bit;
+		return 0;
+	}
+	spinlock_release(&ft->ft_lock);
+	return EMFILE;
+}
+
+struct file_handle *
+filetable_placeat(struct filetable *ft, struct file_handle *fh, int fd)
+{
+	struct file_handle *old;
+
+	KASSERT(fd >= 0 && fd < OPEN_MAX);
+	KASSERT(fh != NULL);
+
+	spinlock_acquire(&ft->ft_lock);
+	old = ft->ft_files[fd];
+	ft->ft_files[fd] = fh;
+	ft->ft_used[fd / 32] |= 1U << (fd % 32);
+	spinlock_release(&ft->ft_lock);
+
+	return old;
+}
+
+struct file_handle *
+filetable_get(struct filetable *ft, int fd)
+{
+	struct file_handle *fh;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return NULL;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	fh = ft->ft_files[fd];
+	if (fh != NULL) {
+		fh_incref(fh);
+	}
+	spinlock_release(&ft->ft_lock);
+
+	return fh;
+}
+
+struct file_handle *
+filetable_remove(struct filetable *ft, int fd)
+{
+	struct file_handle *fh;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return NULL;
+	}
+
+	spinlock_acquire(&ft->ft_lock);
+	fh = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	ft->ft_used[fd / 32] &= ~(1U << (fd % 32));
+	spinlock_release(&ft->ft_lock);
+
+	return fh;
+}
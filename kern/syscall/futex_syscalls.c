@@ -0,0 +1,213 @@
+/*
+ * Futexes: sleeping and waking on a word of user memory.
+ *
+ * futex_wait(addr, val) goes to sleep if the word at ADDR still
+ * contains VAL; futex_wake(addr, n) wakes up to N threads sleeping
+ * on ADDR. A user-level lock keeps its whole state in the word and
+ * updates it with atomic instructions, calling in here only when it
+ * actually has to sleep or knows there is a sleeper to wake, so the
+ * uncontended case makes no system call at all.
+ *
+ * Sleepers are keyed by the physical address of the word rather than
+ * the virtual one, so processes sharing a page meet no matter where
+ * each has it mapped. Keys hash into a fixed table of buckets, each
+ * with a spinlock, a list of sleepers and a wchan. The value check
+ * and going to sleep happen under the bucket lock and the waker takes
+ * the same lock, so a waker that changes the word and then calls
+ * futex_wake can't slip in between and be missed.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <kern/futex_syscalls.h>
+
+#define FUTEX_BUCKETS	64
+
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	paddr_t fw_key;			/* physical address slept on */
+	bool fw_woken;			/* taken off the list by a waker */
+};
+
+struct futex_bucket {
+	struct spinlock fb_lock;
+	struct futex_waiter *fb_waiters;
+	struct wchan *fb_wchan;
+};
+
+static struct futex_bucket futex_table[FUTEX_BUCKETS];
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		futex_table[i].fb_waiters = NULL;
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+	}
+}
+
+static
+struct futex_bucket *
+futex_hash(paddr_t key)
+{
+	/* Words are aligned, so skip the low bits; fold in the frame. */
+	return &futex_table[((key >> 2) ^ (key >> 12)) % FUTEX_BUCKETS];
+}
+
+/*
+ * Get the key for the user word at UADDR. The copyin checks that it's
+ * a user address and makes sure the page is resident; after that the
+ * kernel can read the word through its physical address without any
+ * risk of faulting, which matters because it does so with a spinlock
+ * held.
+ */
+static
+int
+futex_key(userptr_t uaddr, paddr_t *key)
+{
+	int junk;
+	int result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	result = copyin((const_userptr_t)uaddr, &junk, sizeof(junk));
+	if (result) {
+		return result;
+	}
+	return as_translate(proc_getas(), (vaddr_t)uaddr, key);
+}
+
+/*
+ * Take a sleeper that wasn't woken off its bucket's list.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	struct futex_waiter **pp;
+
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		if (*pp == fw) {
+			*pp = fw->fw_next;
+			return;
+		}
+	}
+	panic("futex_unlink: waiter not on its bucket\n");
+}
+
+int
+sys_futex_wait(userptr_t uaddr, int val, int *err)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw;
+	paddr_t key;
+
+	*err = futex_key(uaddr, &key);
+	if (*err) {
+		return -1;
+	}
+	fb = futex_hash(key);
+
+	spinlock_acquire(&fb->fb_lock);
+	if (*(volatile int *)PADDR_TO_KVADDR(key) != val) {
+		/* Changed already; whatever we were waiting for happened. */
+		spinlock_release(&fb->fb_lock);
+		*err = EAGAIN;
+		return -1;
+	}
+
+	fw.fw_key = key;
+	fw.fw_woken = false;
+	fw.fw_next = fb->fb_waiters;
+	fb->fb_waiters = &fw;
+
+	/*
+	 * Other keys can share the bucket and its wchan, so a wakeup
+	 * might be for someone else; only leave once a waker has
+	 * taken us off the list, or if the process is exiting (see
+	 * futex_wakeall).
+	 */
+	while (!fw.fw_woken && !curproc->p_exiting) {
+		wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+	}
+	if (!fw.fw_woken) {
+		futex_unlink(fb, &fw);
+		spinlock_release(&fb->fb_lock);
+		*err = EINTR;
+		return -1;
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return 0;
+}
+
+int
+sys_futex_wake(userptr_t uaddr, int count, int *err)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **pp, *fw;
+	paddr_t key;
+	int woken;
+
+	*err = futex_key(uaddr, &key);
+	if (*err) {
+		return -1;
+	}
+	fb = futex_hash(key);
+
+	woken = 0;
+	spinlock_acquire(&fb->fb_lock);
+	pp = &fb->fb_waiters;
+	while ((fw = *pp) != NULL && woken < count) {
+		if (fw->fw_key == key) {
+			*pp = fw->fw_next;
+			fw->fw_woken = true;
+			woken++;
+		}
+		else {
+			pp = &fw->fw_next;
+		}
+	}
+	if (woken > 0) {
+		wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return woken;
+}
+
+/*
+ * Wake every sleeper in every bucket so that those belonging to an
+ * exiting process notice and leave. Everyone else just goes back to
+ * sleep.
+ */
+void
+futex_wakeall(void)
+{
+	struct futex_bucket *fb;
+	unsigned i;
+
+	for (i=0; i<FUTEX_BUCKETS; i++) {
+		fb = &futex_table[i];
+		spinlock_acquire(&fb->fb_lock);
+		if (fb->fb_waiters != NULL) {
+			wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
@@ -0,0 +1,481 @@
+/*
+ * Submission and completion rings (see kern/ioring.h).
+ *
+ * Each ring is served by a kernel thread of its own that belongs to
+ * the ring's process: it runs in the process's address space, with
+ * its open files and current directory. So a request is carried out
+ * by the same sys_read, sys_open and so on that the system call
+ * would use, and the ring and the buffers are reached with plain
+ * copyin and copyout. The worker isn't a user thread; it doesn't
+ * count in p_nuthreads and never goes to user mode.
+ *
+ * ioring_enter kicks the worker, which takes every request waiting
+ * (as long as there's room for the results), and then waits, if
+ * asked to, for completions. A batch of requests costs one trap and
+ * one trip through the worker however big it is.
+ *
+ * The ring goes away with ioring_setup(NULL, 0), exec, or exit. Each
+ * waits for the request in progress to finish; a request that never
+ * finishes, like a read from a pipe nobody will write, holds things
+ * up the same way a user thread blocked in read would.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <membar.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <kern/ioring.h>
+#include <kern/file_syscalls.h>
+#include <kern/ioring_syscalls.h>
+
+struct ioctx {
+	unsigned ic_refcount;		/* protected by the proc's p_lock */
+	struct lock *ic_lock;
+	struct cv *ic_workcv;		/* worker waits for a kick */
+	struct cv *ic_donecv;		/* enter waits for completions */
+
+	/* User addresses; never dereferenced */
+	struct ioring *ic_ring;
+	struct ioring_sqe *ic_sq;
+	struct ioring_cqe *ic_cq;
+	unsigned ic_entries;
+
+	/*
+	 * The kernel's counters. The copies in the ring are only ever
+	 * written from these, so the process can't confuse us by
+	 * scribbling on them. Only the worker changes them;
+	 * ic_cqtail is changed under ic_lock for enter's benefit.
+	 */
+	uint32_t ic_sqhead;
+	uint32_t ic_cqtail;
+
+	bool ic_kicked;			/* entered since the worker looked */
+	bool ic_busy;			/* worker is taking requests */
+	volatile bool ic_dying;
+	bool ic_gone;			/* worker has left */
+	int ic_error;			/* the ring itself was unusable */
+};
+
+static
+struct ioctx *
+ioctx_create(userptr_t ring, unsigned entries)
+{
+	struct ioctx *ic;
+
+	ic = kmalloc(sizeof(*ic));
+	if (ic == NULL) {
+		return NULL;
+	}
+	ic->ic_lock = lock_create("ioring");
+	if (ic->ic_lock == NULL) {
+		goto fail1;
+	}
+	ic->ic_workcv = cv_create("ioring-work");
+	if (ic->ic_workcv == NULL) {
+		goto fail2;
+	}
+	ic->ic_donecv = cv_create("ioring-done");
+	if (ic->ic_donecv == NULL) {
+		goto fail3;
+	}
+
+	ic->ic_refcount = 1;
+	ic->ic_ring = (struct ioring *)ring;
+	ic->ic_sq = IORING_SQ(ic->ic_ring);
+	ic->ic_cq = (struct ioring_cqe *)(ic->ic_sq + entries);
+	ic->ic_entries = entries;
+	ic->ic_sqhead = 0;
+	ic->ic_cqtail = 0;
+	ic->ic_kicked = false;
+	ic->ic_busy = false;
+	ic->ic_dying = false;
+	ic->ic_gone = false;
+	ic->ic_error = 0;
+	return ic;
+
+ fail3:
+	cv_destroy(ic->ic_workcv);
+ fail2:
+	lock_destroy(ic->ic_lock);
+ fail1:
+	kfree(ic);
+	return NULL;
+}
+
+static
+void
+ioctx_destroy(struct ioctx *ic)
+{
+	KASSERT(ic->ic_gone);
+	cv_destroy(ic->ic_donecv);
+	cv_destroy(ic->ic_workcv);
+	lock_destroy(ic->ic_lock);
+	kfree(ic);
+}
+
+/* Take a reference to P's ring, if it has one. */
+static
+struct ioctx *
+ioctx_get(struct proc *p)
+{
+	struct ioctx *ic;
+
+	spinlock_acquire(&p->p_lock);
+	ic = p->p_ioring;
+	if (ic != NULL) {
+		ic->ic_refcount++;
+	}
+	spinlock_release(&p->p_lock);
+	return ic;
+}
+
+static
+void
+ioctx_put(struct proc *p, struct ioctx *ic)
+{
+	bool last;
+
+	spinlock_acquire(&p->p_lock);
+	KASSERT(ic->ic_refcount > 0);
+	last = --ic->ic_refcount == 0;
+	spinlock_release(&p->p_lock);
+	if (last) {
+		ioctx_destroy(ic);
+	}
+}
+
+/* Tell the worker to go, and wait until it has. */
+static
+void
+ioctx_stop(struct ioctx *ic)
+{
+	lock_acquire(ic->ic_lock);
+	ic->ic_dying = true;
+	cv_broadcast(ic->ic_workcv, ic->ic_lock);
+	cv_broadcast(ic->ic_donecv, ic->ic_lock);
+	while (!ic->ic_gone) {
+		cv_wait(ic->ic_donecv, ic->ic_lock);
+	}
+	lock_release(ic->ic_lock);
+}
+
+////////////////////////////////////////////////////////////
+// the worker
+
+/* Carry out one request; return what the call did, or -errno. */
+static
+int
+ioring_do(const struct ioring_sqe *sqe)
+{
+	userptr_t addr = (userptr_t)sqe->sqe_addr;
+	ssize_t ret;
+	int err = 0;
+
+	switch (sqe->sqe_op) {
+	    case IORING_OP_NOP:
+		ret = 0;
+		break;
+	    case IORING_OP_READ:
+		if (sqe->sqe_off == IORING_OFF_CUR) {
+			ret = sys_read(sqe->sqe_fd, addr, sqe->sqe_len, &err);
+		}
+		else {
+			ret = sys_pread(sqe->sqe_fd, addr, sqe->sqe_len,
+					sqe->sqe_off, &err);
+		}
+		break;
+	    case IORING_OP_WRITE:
+		if (sqe->sqe_off == IORING_OFF_CUR) {
+			ret = sys_write(sqe->sqe_fd, addr, sqe->sqe_len, &err);
+		}
+		else {
+			ret = sys_pwrite(sqe->sqe_fd, addr, sqe->sqe_len,
+					 sqe->sqe_off, &err);
+		}
+		break;
+	    case IORING_OP_OPEN:
+		ret = sys_open((char *)addr, sqe->sqe_flags, sqe->sqe_len,
+			       &err);
+		break;
+	    case IORING_OP_CLOSE:
+		ret = sys_close(sqe->sqe_fd, &err);
+		break;
+	    case IORING_OP_FSYNC:
+		ret = sys_fsync(sqe->sqe_fd, &err);
+		break;
+	    default:
+		return -EINVAL;
+	}
+	return ret < 0 ? -err : (int)ret;
+}
+
+/*
+ * Take requests until there are none, or no room for their results.
+ * Returns an error only if the ring itself can't be got at.
+ */
+static
+int
+ioring_run(struct ioctx *ic)
+{
+	struct ioring_sqe sqe;
+	struct ioring_cqe cqe;
+	uint32_t sqtail, cqhead, slot, mask = ic->ic_entries - 1;
+	int result;
+
+	while (!ic->ic_dying) {
+		result = copyin((userptr_t)&ic->ic_ring->ir_sqtail,
+				&sqtail, sizeof(sqtail));
+		if (result) {
+			return result;
+		}
+		result = copyin((userptr_t)&ic->ic_ring->ir_cqhead,
+				&cqhead, sizeof(cqhead));
+		if (result) {
+			return result;
+		}
+		if (sqtail == ic->ic_sqhead ||
+		    ic->ic_cqtail - cqhead >= ic->ic_entries) {
+			return 0;
+		}
+		/* Don't read the entries before the tail that covers them */
+		membar_load_load();
+
+		/* Everything queued up to here, as room allows */
+		while (sqtail != ic->ic_sqhead &&
+		       ic->ic_cqtail - cqhead < ic->ic_entries &&
+		       !ic->ic_dying) {
+			slot = ic->ic_sqhead & mask;
+			result = copyin((userptr_t)&ic->ic_sq[slot], &sqe,
+					sizeof(sqe));
+			if (result) {
+				return result;
+			}
+			ic->ic_sqhead++;
+			result = copyout(&ic->ic_sqhead,
+					 (userptr_t)&ic->ic_ring->ir_sqhead,
+					 sizeof(ic->ic_sqhead));
+			if (result) {
+				return result;
+			}
+
+			cqe.cqe_data = sqe.sqe_data;
+			cqe.cqe_res = ioring_do(&sqe);
+
+			slot = ic->ic_cqtail & mask;
+			result = copyout(&cqe, (userptr_t)&ic->ic_cq[slot],
+					 sizeof(cqe));
+			if (result) {
+				return result;
+			}
+			/* The entry goes in before the tail says it's there */
+			membar_store_store();
+
+			lock_acquire(ic->ic_lock);
+			ic->ic_cqtail++;
+			result = copyout(&ic->ic_cqtail,
+					 (userptr_t)&ic->ic_ring->ir_cqtail,
+					 sizeof(ic->ic_cqtail));
+			cv_broadcast(ic->ic_donecv, ic->ic_lock);
+			lock_release(ic->ic_lock);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
+static
+void
+ioring_worker(void *data, unsigned long junk)
+{
+	struct ioctx *ic = data;
+	int result;
+
+	(void)junk;
+
+	lock_acquire(ic->ic_lock);
+	while (!ic->ic_dying) {
+		if (!ic->ic_kicked) {
+			cv_wait(ic->ic_workcv, ic->ic_lock);
+			continue;
+		}
+		ic->ic_kicked = false;
+		ic->ic_busy = true;
+		lock_release(ic->ic_lock);
+
+		result = ioring_run(ic);
+
+		lock_acquire(ic->ic_lock);
+		if (result) {
+			ic->ic_error = result;
+		}
+		ic->ic_busy = false;
+		cv_broadcast(ic->ic_donecv, ic->ic_lock);
+	}
+
+	/*
+	 * Leave the process while ioctx_stop still can't get past the
+	 * lock; once it does, the process may be freed.
+	 */
+	proc_remthread(curthread);
+	ic->ic_gone = true;
+	cv_broadcast(ic->ic_donecv, ic->ic_lock);
+	lock_release(ic->ic_lock);
+
+	thread_exit();
+}
+
+////////////////////////////////////////////////////////////
+// system calls
+
+/*
+ * Set up the ring of ENTRIES entries at RING for the current process,
+ * or, if RING is NULL, tear it down.
+ */
+int
+sys_ioring_setup(userptr_t ring, unsigned entries, int *err)
+{
+	struct proc *p = curproc;
+	struct ioctx *ic;
+	struct ioring hdr;
+	bool busy;
+	int result;
+
+	if (ring == NULL) {
+		if (entries != 0 || p->p_ioring == NULL) {
+			*err = EINVAL;
+			return -1;
+		}
+		ioring_destroy(p);
+		return 0;
+	}
+
+	if (entries == 0 || entries > IORING_MAXENTRIES ||
+	    (entries & (entries - 1)) != 0 || (vaddr_t)ring % 8 != 0) {
+		*err = EINVAL;
+		return -1;
+	}
+	if (p->p_ioring != NULL) {
+		*err = EBUSY;
+		return -1;
+	}
+
+	bzero(&hdr, sizeof(hdr));
+	hdr.ir_entries = entries;
+	result = copyout(&hdr, ring, sizeof(hdr));
+	if (result) {
+		*err = result;
+		return -1;
+	}
+
+	ic = ioctx_create(ring, entries);
+	if (ic == NULL) {
+		*err = ENOMEM;
+		return -1;
+	}
+	result = thread_fork("ioring", p, ioring_worker, ic, 0);
+	if (result) {
+		ic->ic_gone = true;
+		ioctx_destroy(ic);
+		*err = result;
+		return -1;
+	}
+
+	/* Another thread may have got there first */
+	spinlock_acquire(&p->p_lock);
+	busy = p->p_ioring != NULL;
+	if (!busy) {
+		p->p_ioring = ic;
+	}
+	spinlock_release(&p->p_lock);
+	if (busy) {
+		ioctx_stop(ic);
+		ioctx_destroy(ic);
+		*err = EBUSY;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand whatever has been queued to the worker, then wait until at
+ * least MINWAIT completions are ready to reap (or as many as there
+ * will be; it doesn't wait once the worker has nothing left to do).
+ * Returns how many are ready.
+ */
+int
+sys_ioring_enter(unsigned minwait, int *err)
+{
+	struct proc *p = curproc;
+	struct ioctx *ic;
+	uint32_t cqhead;
+	unsigned ready;
+	int result;
+
+	ic = ioctx_get(p);
+	if (ic == NULL) {
+		*err = EINVAL;
+		return -1;
+	}
+
+	result = copyin((userptr_t)&ic->ic_ring->ir_cqhead, &cqhead,
+			sizeof(cqhead));
+	if (result) {
+		ioctx_put(p, ic);
+		*err = result;
+		return -1;
+	}
+	if (minwait > ic->ic_entries) {
+		minwait = ic->ic_entries;
+	}
+
+	lock_acquire(ic->ic_lock);
+	if (!ic->ic_dying) {
+		ic->ic_kicked = true;
+		cv_signal(ic->ic_workcv, ic->ic_lock);
+	}
+	while (ic->ic_cqtail - cqhead < minwait &&
+	       (ic->ic_kicked || ic->ic_busy) &&
+	       !ic->ic_dying && ic->ic_error == 0) {
+		cv_wait(ic->ic_donecv, ic->ic_lock);
+	}
+	result = ic->ic_error;
+	ready = ic->ic_cqtail - cqhead;
+	lock_release(ic->ic_lock);
+
+	ioctx_put(p, ic);
+
+	if (result) {
+		*err = result;
+		return -1;
+	}
+	return ready;
+}
+
+/*
+ * Tear down P's ring, if it has one. Called by exec before the
+ * address space goes, and by the last thread out of an exiting
+ * process.
+ */
+void
+ioring_destroy(struct proc *p)
+{
+	struct ioctx *ic;
+
+	spinlock_acquire(&p->p_lock);
+	ic = p->p_ioring;
+	p->p_ioring = NULL;
+	spinlock_release(&p->p_lock);
+
+	if (ic != NULL) {
+		ioctx_stop(ic);
+		ioctx_put(p, ic);
+	}
+}
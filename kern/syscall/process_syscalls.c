@@ -11,38 +11,18 @@
 #include <vfs.h>
 #include <syscall.h>
 #include <kern/process_syscalls.h>
+#include <kern/thread_syscalls.h>
 #include <proc.h>
+#include <pid.h>
 #include <kern/file_syscalls.h>
+#include <kern/ioring_syscalls.h>
+#include <filetable.h>
 #include <vnode.h>
 #include <addrspace.h>
 #include <mips/tlb.h>
 #include <spl.h>
 
 
-/* Spawning new process ids */
-pid_t
-spawn_pid(struct proc *proc, int *err) {
-
-    int i = PID_MIN;
-    while(proc_ids[i] != NULL && i < PID_MAX_256) {
-        i++;
-    }
-
-    if (i < PID_MAX_256) {
-        proc_ids[i] = proc;
-
-        if(proc_ids[i] == NULL) {
-            *err = ENOMEM;
-            return -1;
-        }
-
-        return i;
-    }
-
-    *err = EMPROC;
-    return -1;
-}
-
 pid_t
 sys_getpid() {
     return curproc->pid;
@@ -73,6 +53,7 @@ sys_fork(struct trapframe* tf, int *err) {
 
     childproc = proc_create_child("child");
     if(childproc == NULL){
+        as_destroy(childaddr);
         kfree(childtf);
         *err = ENOMEM;
         return -1;
@@ -82,7 +63,12 @@ sys_fork(struct trapframe* tf, int *err) {
                          (unsigned long) childaddr);
 
     if(result) {
-        return result;
+        /* Undo proc_create_child, which also unlinks it and drops its files. */
+        proc_destroy(childproc);
+        as_destroy(childaddr);
+        kfree(childtf);
+        *err = result;
+        return -1;
     }
 
     result = childproc->pid;
@@ -113,93 +99,157 @@ child_forkentry(void *data1, unsigned long data2){
     mips_usermode(&st_trapframe);
 };
 
-int
-sys_execv(char *progname, char **args, int *err) {
+/*
+ * Program name and arguments, copied in for execv or spawn.
+ *
+ * The argument strings are staged in ea_buf, each null-terminated and
+ * padded to a multiple of 4, packed from the start. exec_load then
+ * moves them up to make room for the argv pointers in front, so the
+ * buffer holds exactly what goes at the top of the new user stack,
+ * and copies that out in one go. ARG_MAX bounds the whole image,
+ * pointers included.
+ *
+ * There are EXEC_NBUFS of these, allocated at boot, so exec never
+ * allocates anything for its arguments; an exec that finds them all
+ * in use waits for one.
+ */
+#define EXEC_NBUFS      2
+
+struct exec_args {
+    struct exec_args *ea_next;  /* free list */
+    char ea_progname[PATH_MAX];
+    int ea_argc;
+    size_t ea_strsize;          /* bytes of (padded) strings in ea_buf */
+    char ea_buf[ARG_MAX];
+};
 
-    struct addrspace *as;
-    struct vnode *v;
-    vaddr_t entrypoint, stackptr;
-    int result;
+static struct exec_args *exec_freelist;
+static struct spinlock exec_lock = SPINLOCK_INITIALIZER;
+static struct semaphore *exec_sem;
 
-    /* Validations */
-    if (progname == NULL) {
-        *err = EFAULT;
-        return -1;
-    }
+void
+exec_bootstrap(void) {
 
-    if (args == NULL || (int *)args == (int *)0x40000000 || (int *)args == (int *)0x80000000) {
-        *err = EFAULT;
-        return -1;
+    struct exec_args *ea;
+
+    exec_sem = sem_create("exec", EXEC_NBUFS);
+    if (exec_sem == NULL) {
+        panic("exec_bootstrap: out of memory\n");
+    }
+    for (int i = 0; i < EXEC_NBUFS; i++) {
+        ea = kmalloc(sizeof(*ea));
+        if (ea == NULL) {
+            panic("exec_bootstrap: out of memory\n");
+        }
+        ea->ea_next = exec_freelist;
+        exec_freelist = ea;
     }
+}
 
-    /* Count number of arguments and total size of input */
-    int args_count = 0;
-    for (;args_count < ARG_MAX && args[args_count] != NULL; args_count++);
+static struct exec_args *
+exec_get(void) {
 
-    if (args_count > ARG_MAX) {
-        *err = E2BIG;
-        return -1;
-    }
+    struct exec_args *ea;
 
-    /* Copy File name */
-    char *progname_copy = (char *) kmalloc(sizeof(char) * NAME_MAX);
-    size_t actual = 0;
-    result = copyinstr((userptr_t)progname, progname_copy, NAME_MAX, &actual);
+    P(exec_sem);
+    spinlock_acquire(&exec_lock);
+    ea = exec_freelist;
+    KASSERT(ea != NULL);
+    exec_freelist = ea->ea_next;
+    spinlock_release(&exec_lock);
 
-    if (result) {
-        kfree(progname_copy);
-        *err = result;
-        return -1;
-    }
+    ea->ea_argc = 0;
+    ea->ea_strsize = 0;
+    return ea;
+}
 
-    if (strlen(progname_copy) == 0) {
-        kfree(progname_copy);
-        *err = EINVAL;
-        return -1;
-    }
+static void
+exec_put(struct exec_args *ea) {
 
-    /* Allocate Kernel Memory for arguments */
-    char **args_copy = (char **) kmalloc(sizeof(char *) * args_count);
+    spinlock_acquire(&exec_lock);
+    ea->ea_next = exec_freelist;
+    exec_freelist = ea;
+    spinlock_release(&exec_lock);
+    V(exec_sem);
+}
 
-    int c_args_count = 0,
-            arg_size = 0,
-            padded_size = 0;
+/* Space the argv pointers will need, terminating NULL included. */
+#define EXEC_PTRSIZE(argc) (((argc) + 1) * sizeof(userptr_t))
 
-    for (;c_args_count < args_count; c_args_count++) {
-        if ((int *)args[c_args_count] == (int *)0x40000000 || (int *)args[c_args_count] == (int *)0x80000000) {
-            kfree(progname_copy);
-            *err = EFAULT;
-            return -1;
-        }
-    }
+/*
+ * Copy in the program name and arguments from userland. Each string
+ * goes straight into its place in the buffer, and is charged for its
+ * argv pointer too; room is kept for the NULL at the end of argv.
+ */
+static int
+exec_copyin(char *progname, char **args, struct exec_args *ea) {
 
-    c_args_count = 0;
-    /* Calculate total length accounting for padding */
-    for (;c_args_count < args_count; c_args_count++) {
-        arg_size = strlen(args[c_args_count]) + 1;
+    unsigned argc;
+    size_t got;
+    int result;
 
-        args_copy[c_args_count] = (char *) kmalloc(sizeof(char) * arg_size);
-        copyinstr((userptr_t)args[c_args_count], args_copy[c_args_count], arg_size, &actual);
+    result = copyinstr((userptr_t)progname, ea->ea_progname, PATH_MAX, &got);
+    if (result) {
+        return result;
+    }
+    if (ea->ea_progname[0] == 0) {
+        return EINVAL;
+    }
 
-        padded_size += arg_size;
-        if (padded_size % 4) {
-            padded_size += (4 - (padded_size % 4)) % 4;
-        }
+    result = copyinstrv((const_userptr_t)args, ea->ea_buf,
+                        ARG_MAX - EXEC_PTRSIZE(0), sizeof(userptr_t),
+                        &argc, &got);
+    if (result == ENAMETOOLONG) {
+        return E2BIG;
+    }
+    if (result) {
+        return result;
     }
 
-    /* Open the file. */
-    result = vfs_open(progname_copy, O_RDONLY, 0, &v);
+    ea->ea_argc = argc;
+    ea->ea_strsize = got;
+    return 0;
+}
+
+/*
+ * Replace the current process's program with the one in EA. Doesn't
+ * return if it works; EA has been given back by then. Otherwise
+ * returns an error and the caller gives EA back.
+ *
+ * A vforked child is running in its parent's address space, which it
+ * gives back here rather than destroying; if loading fails it goes
+ * back to using it. Once the new program is in place the parent (in
+ * vfork or spawn) is let go.
+ */
+static int
+exec_load(struct exec_args *ea) {
+
+    struct addrspace *as, *oldas;
+    struct vnode *v;
+    vaddr_t entrypoint, stackptr, strbase;
+    userptr_t *argv;
+    size_t ptrsize, imagesize, off;
+    int argc;
+    bool shared;
+    int result;
+
+    /* Open the file. (This destroys ea_progname, which is fine.) */
+    result = vfs_open(ea->ea_progname, O_RDONLY, 0, &v);
     if (result) {
-        kfree(progname_copy);
-        *err = result;
-        return -1;
+        return result;
     }
 
-    /* Destroy the current process's address space to create a new one. */
-    as = curproc->p_addrspace;
-    curproc->p_addrspace = NULL;
+    /* A ring lives in the old address space; its worker goes with it. */
+    ioring_destroy(curproc);
 
-    as_destroy(as);
+    /* Destroy the current process's address space to create a new one. */
+    shared = curproc->p_sharedas;
+    oldas = proc_setas(NULL);
+    curproc->p_sharedas = false;
+    if (!shared && oldas != NULL) {
+        as_destroy(oldas);
+        oldas = NULL;
+    }
 
     /* We should be a new process. */
     KASSERT(proc_getas() == NULL);
@@ -207,10 +257,9 @@ sys_execv(char *progname, char **args, int *err) {
     /* Create a new address space. */
     as = as_create();
     if (as == NULL) {
-        kfree(progname_copy);
         vfs_close(v);
-        *err = ENOMEM;
-        return -1;
+        result = ENOMEM;
+        goto fail;
     }
 
     /* Switch to it and activate it. */
@@ -219,172 +268,350 @@ sys_execv(char *progname, char **args, int *err) {
 
     /* Load the executable. */
     result = load_elf(v, &entrypoint);
-    if (result) {
-        /* p_addrspace will go away when curproc is destroyed */
-        kfree(progname_copy);
-        vfs_close(v);
-        *err = result;
-        return -1;
-    }
 
     /* Done with the file now. */
     vfs_close(v);
 
+    if (result) {
+        goto fail;
+    }
+
     /* Define the user stack in the address space */
     result = as_define_stack(as, &stackptr);
     if (result) {
-        /* p_addrspace will go away when curproc is destroyed */
-        kfree(progname_copy);
-        *err = result;
-        return -1;
+        goto fail;
+    }
+
+    /*
+     * Build the image: argv pointers, then the strings. Keep the
+     * stack pointer 8-aligned.
+     */
+    argc = ea->ea_argc;
+    ptrsize = EXEC_PTRSIZE(argc);
+    imagesize = ROUNDUP(ptrsize + ea->ea_strsize, 8);
+    KASSERT(imagesize <= ARG_MAX);
+
+    stackptr -= imagesize;
+    strbase = stackptr + ptrsize;
+
+    memmove(ea->ea_buf + ptrsize, ea->ea_buf, ea->ea_strsize);
+    bzero(ea->ea_buf + ptrsize + ea->ea_strsize,
+          imagesize - ptrsize - ea->ea_strsize);
+
+    argv = (userptr_t *)ea->ea_buf;
+    off = 0;
+    for (int i = 0; i < argc; i++) {
+        argv[i] = (userptr_t)(strbase + off);
+        off += ROUNDUP(strlen(ea->ea_buf + ptrsize + off) + 1, 4);
+    }
+    argv[argc] = NULL;
+
+    result = copyout(ea->ea_buf, (userptr_t)stackptr, imagesize);
+    if (result) {
+        goto fail;
     }
 
-    stackptr -= padded_size;
-    char **arg_address = (char **) kmalloc(sizeof(char *) * args_count + 1);
+    exec_put(ea);
 
-    /* Copy arguments into user stack */
-    for(int i = 0; i < args_count; i++) {
-        arg_size = strlen(args_copy[i]) + 1;
+    /* No going back now; let a waiting parent carry on. */
+    proc_vforkdone(curproc);
 
-        if (arg_size % 4) {
-            arg_size += (4 - arg_size % 4) % 4;
+    /* Warp to user mode. */
+    enter_new_process(argc /*argc*/, (userptr_t) stackptr /*userspace addr of argv*/,
+                      (userptr_t) stackptr /*userspace addr of environment*/, stackptr, entrypoint);
+
+    /* enter_new_process does not return. */
+    panic("enter_new_process returned\n");
+
+fail:
+    /* p_addrspace will go away when curproc is destroyed, unless it was borrowed. */
+    if (shared) {
+        as = proc_setas(oldas);
+        if (as != NULL) {
+            as_destroy(as);
         }
+        curproc->p_sharedas = true;
+        as_activate();
+    }
+    return result;
+}
 
-        /* Store address of arguments */
-        arg_address[i] = (char *)stackptr;
+int
+sys_execv(char *progname, char **args, int *err) {
+
+    struct exec_args *ea;
+    int result;
 
-        copyoutstr(args_copy[i], (userptr_t)stackptr, arg_size, &actual);
-        stackptr += arg_size;
+    /* The other threads would lose their address space under them. */
+    if (curproc->p_nuthreads > 1) {
+        *err = EBUSY;
+        return -1;
     }
 
-    /* Add Null Pointer at the end */
-    arg_address[args_count] = 0;
+    ea = exec_get();
+    result = exec_copyin(progname, args, ea);
+    if (result == 0) {
+        result = exec_load(ea);
+    }
 
-    stackptr -= padded_size;
-    stackptr -= (args_count + 1) * sizeof(char *);
+    /* Only get here if it failed. */
+    exec_put(ea);
+    *err = result;
+    return -1;
+}
 
-    /* Copy address locations into user stack*/
-    for (int i = 0; i < args_count + 1; i++) {
-        copyout((arg_address + i), (userptr_t)stackptr, sizeof(char *));
-        stackptr += sizeof(char *);
+/*
+ * vfork: like fork, but the child runs in our address space instead
+ * of a copy, and we wait until it has called execv or exited. That
+ * makes it cost the same whatever our size. If we have more than one
+ * thread, the others would be running in the same memory as the child
+ * (and TLB shootdowns for it wouldn't reach them), so fall back to an
+ * ordinary fork.
+ */
+pid_t
+sys_vfork(struct trapframe *tf, int *err) {
+
+    struct trapframe *childtf;
+    struct proc *childproc;
+    pid_t pid;
+    int result;
+
+    if (curproc->p_nuthreads > 1) {
+        return sys_fork(tf, err);
     }
 
-    /* Reset pointer to start of the stack */
-    stackptr -= ((args_count + 1) * sizeof(char *));
+    childtf = kmalloc(sizeof(struct trapframe));
+    if (childtf == NULL) {
+        *err = ENOMEM;
+        return -1;
+    }
+    memcpy(childtf, tf, sizeof(struct trapframe));
 
-    kfree(progname_copy);
+    childproc = proc_create_child("child");
+    if (childproc == NULL) {
+        kfree(childtf);
+        *err = ENOMEM;
+        return -1;
+    }
+
+    childproc->p_cwd = curproc->p_cwd;
+    VOP_INCREF(curproc->p_cwd);
+    childproc->p_sharedas = true;
+    childproc->p_vfork = true;
+    pid = childproc->pid;
 
-    c_args_count = 0;
-    for (;c_args_count < args_count; c_args_count++) {
-        kfree(args_copy[c_args_count]);
+    result = thread_fork("process", childproc, child_forkentry, childtf,
+                         (unsigned long) curproc->p_addrspace);
+    if (result) {
+        childproc->p_addrspace = NULL;
+        proc_destroy(childproc);
+        kfree(childtf);
+        *err = result;
+        return -1;
     }
 
-    kfree(args_copy);
-    kfree(arg_address);
+    /* A vforked child's exec errors are its own business. */
+    (void)proc_vforkwait(childproc);
+    return pid;
+}
+
+/*
+ * First code run by a spawned process. DATA1 is its exec_args.
+ */
+static void
+spawn_entry(void *data1, unsigned long data2) {
 
-    /* Warp to user mode. */
-    enter_new_process(args_count /*argc*/, (userptr_t) stackptr /*userspace addr of argv*/,
-                      (userptr_t) stackptr /*userspace addr of environment*/, stackptr, entrypoint);
+    struct exec_args *ea = data1;
+    int result;
 
-    /* enter_new_process does not return. */
-    panic("enter_new_process returned\n");
+    (void)data2;
 
-    *err = EINVAL;
-    return -1;
+    result = exec_load(ea);
+
+    /* Only get here if it failed; tell the parent why. */
+    exec_put(ea);
+    curproc->p_execerr = result;
+    sys_exit(255, false);
 }
 
+/*
+ * spawn: start PATH with arguments ARGS in a new child process,
+ * without ever copying our address space. If FDMAP is NULL the child
+ * inherits all our open files, as with fork. Otherwise it gets NFDS
+ * descriptors: descriptor i refers to our open file FDMAP[i], or is
+ * left closed if that is -1. Returns the child's pid once the program
+ * is loaded, or fails with the reason it couldn't be.
+ */
 pid_t
-sys_waitpid(pid_t pid, int *status, int options, int *err) {
+sys_spawn(char *path, char **args, userptr_t fdmap, int nfds, int *err) {
 
-    if(status == (int*) 0x0) {
-        return 0;
+    struct exec_args *ea;
+    struct proc *childproc;
+    struct file_handle *fh;
+    int *map = NULL;
+    pid_t pid;
+    int result;
+
+    /* Not on the stack: it can be OPEN_MAX entries. */
+    if (fdmap != NULL) {
+        if (nfds < 0 || nfds > OPEN_MAX) {
+            *err = EINVAL;
+            return -1;
+        }
+        if (nfds > 0) {
+            map = kmalloc(nfds * sizeof(int));
+            if (map == NULL) {
+                *err = ENOMEM;
+                return -1;
+            }
+        }
+        result = copyin(fdmap, map, nfds * sizeof(int));
+        if (result) {
+            kfree(map);
+            *err = result;
+            return -1;
+        }
+        for (int i = 0; i < nfds; i++) {
+            if (map[i] != -1 && (map[i] < 0 || map[i] >= OPEN_MAX)) {
+                kfree(map);
+                *err = EBADF;
+                return -1;
+            }
+        }
     }
 
-    if(status == (int*) 0x40000000 || status == (int*) 0x80000000 || ((int)status & 3) != 0) {
-        *err = EFAULT;
+    ea = exec_get();
+    result = exec_copyin(path, args, ea);
+    if (result) {
+        exec_put(ea);
+        kfree(map);
+        *err = result;
         return -1;
     }
 
-    if(options != 0 && options != WNOHANG && options != WUNTRACED){
-        *err = EINVAL;
+    childproc = proc_create_child(ea->ea_progname);
+    if (childproc == NULL) {
+        exec_put(ea);
+        kfree(map);
+        *err = ENOMEM;
         return -1;
     }
 
-    if(pid < PID_MIN || pid > PID_MAX_256) {
-        *err = ESRCH;
-        return -1;
+    /* Rearrange the descriptors it inherited. */
+    if (fdmap != NULL) {
+        filetable_closeall(&childproc->p_files);
+        for (int fd = 0; fd < nfds; fd++) {
+            if (map[fd] == -1) {
+                continue;
+            }
+            fh = filetable_get(&curproc->p_files, map[fd]);
+            if (fh == NULL) {
+                proc_destroy(childproc);
+                exec_put(ea);
+                kfree(map);
+                *err = EBADF;
+                return -1;
+            }
+            /* The child is new, so nothing was there. */
+            fh = filetable_placeat(&childproc->p_files, fh, fd);
+            KASSERT(fh == NULL);
+        }
     }
+    kfree(map);
 
-    if(curproc->pid != proc_ids[pid]->ppid ){
-        *err = ECHILD;
+    childproc->p_cwd = curproc->p_cwd;
+    VOP_INCREF(curproc->p_cwd);
+    childproc->p_vfork = true;
+    pid = childproc->pid;
+
+    result = thread_fork("process", childproc, spawn_entry, ea, 0);
+    if (result) {
+        proc_destroy(childproc);
+        exec_put(ea);
+        *err = result;
         return -1;
     }
 
-    if(proc_ids[pid] == NULL){
-        *err = ESRCH;
+    /* Wait until it's running the program, or has given up. */
+    result = proc_vforkwait(childproc);
+    if (result) {
+        *err = result;
         return -1;
     }
+    return pid;
+}
+
+pid_t
+sys_waitpid(pid_t pid, int *status, int options, int *err) {
 
-    lock_acquire(proc_ids[pid]->exitlock);
+    struct proc *child;
+    int result;
 
-    if (proc_ids[pid]->exit_flag == false) {
+    if(options != 0 && options != WNOHANG && options != WUNTRACED){
+        *err = EINVAL;
+        return -1;
+    }
 
-        if (options == WNOHANG) {
-            lock_release(proc_ids[pid]->exitlock);
-            return 0;
-        }
-        else {
-            cv_wait(proc_ids[pid]->exitcv, proc_ids[pid]->exitlock);
+    /* pid -1 means any child; proc_waitchild takes it off our lists. */
+    result = 0;
+    child = proc_waitchild(pid, options == WNOHANG, &result);
+    if (child == NULL) {
+        if (result) {
+            *err = result;
+            return -1;
         }
+        /* WNOHANG and nothing has exited yet */
+        return 0;
     }
 
-    *status = proc_ids[pid]->exit_code;
-
-    lock_release(proc_ids[pid]->exitlock);
+    /* The child is off our lists either way, so reap it even if this fails. */
+    result = 0;
+    if (status != NULL) {
+        result = copyout(&child->exit_code, (userptr_t)status, sizeof(int));
+    }
+    pid = child->pid;
 
-    /* Clean Up */
-    lock_destroy(proc_ids[pid]->exitlock);
-    cv_destroy(proc_ids[pid]->exitcv);
-    as_destroy(proc_ids[pid]->p_addrspace);
-    proc_ids[pid]->p_addrspace = NULL;
-    kfree(proc_ids[pid]->p_name);
-    kfree(proc_ids[pid]);
-    proc_ids[pid] = NULL;
+    /* Clean Up. Tearing down the address space is slow; don't make the parent wait for it. */
+    proc_reap(child);
 
+    if (result) {
+        *err = result;
+        return -1;
+    }
     return pid;
 }
 
 void sys_exit(int exitcode, bool is_sig){
 
-    lock_acquire(curproc->exitlock);
-
-    for (int fd = 0; fd < OPEN_MAX; fd++) {
-        int err;
-        sys_close(fd, &err);
-    }
-
-    curproc->exit_flag = true;
+    int status;
 
     if (is_sig) {
-        curproc->exit_code = _MKWAIT_SIG(exitcode);
+        status = _MKWAIT_SIG(exitcode);
     } else {
-        curproc->exit_code = _MKWAIT_EXIT(exitcode);
+        status = _MKWAIT_EXIT(exitcode);
     }
 
-    if (proc_ids[curproc->ppid]->exit_flag == false) {
-        cv_broadcast(curproc->exitcv, curproc->exitlock);
-        lock_release(curproc->exitlock);
-    } else {
-        /* Clean Up */
-        lock_release(curproc->exitlock);
-        cv_destroy(curproc->exitcv);
-        as_destroy(curproc->p_addrspace);
-        kfree(proc_ids[curproc->pid]->p_name);
-        curproc->p_addrspace = NULL;
-        kfree(proc_ids[curproc->pid]);
-        proc_ids[curproc->pid] = NULL;
-        lock_destroy(curproc->exitlock);
-    }
+    /* Stop the other threads; the last one out calls proc_exit. */
+    uthread_exit_all(status);
+    uthread_leave(NULL);
+}
+
+void proc_exit(int status){
+
+    struct proc *p = curproc;
+
+    /* The ring's worker uses our files and may be in the middle of one */
+    ioring_destroy(p);
+    filetable_closeall(&p->p_files);
+
+    /*
+     * Leave the process before anyone can free it: once the parent
+     * hears about this it may reap p while we're still on our way out.
+     */
+    proc_remthread(curthread);
+
+    /* Queue for the parent, or free right away if nobody will wait. */
+    proc_exited(p, status);
 
     thread_exit();
 }
@@ -392,81 +619,70 @@ void sys_exit(int exitcode, bool is_sig){
 void *
 sys_sbrk(intptr_t amount, int *err){
 
-    vaddr_t retval = curproc->p_addrspace->heap_end;
+    struct addrspace *as = curproc->p_addrspace;
+    struct page_table **pp, *pte, *dead;
+    vaddr_t retval, new_end;
 
     if (amount < 0 && amount <= -4096*1024*256) {
         *err = EINVAL;
         return (void *)-1;
     }
 
-    if (curproc->p_addrspace->heap_end + amount < curproc->p_addrspace->heap_start)  {
-        *err = EINVAL;
-        return (void *)-1;
-    }
-
-    if (curproc->p_addrspace->heap_start + amount >= USERSTACK - 1024 * PAGE_SIZE)  {
-        *err = ENOMEM;
-        return (void *)-1;
-    }
-
     /* Align in multiples of 4 */
     if (amount % 4 != 0) {
         *err = EINVAL;
         return (void *)-1;
     }
 
-    int num_pages = (amount < 0) ? (amount * -1)/PAGE_SIZE : amount/PAGE_SIZE;
-
-    if (amount % PAGE_SIZE != 0)
-        num_pages++;
-
-    struct page_table *proc_pg_table = curproc->p_addrspace->page_table_entry;
-    struct page_table *prev_proc_pg_table;
-    struct page_table *free_proc_pg_table;
-
-    if(amount < 0) {
-        for (int i = 1; i <= num_pages; i++) {
-
-            // Page Table removal loop through the page table and remove entries correspondingly.
-
-            proc_pg_table = curproc->p_addrspace->page_table_entry;
-            prev_proc_pg_table = proc_pg_table;
-
-            while(proc_pg_table != NULL) {
-                if (proc_pg_table->vpn < USERSTACK - 1024 * PAGE_SIZE &&
-                    proc_pg_table->vpn >= (curproc->p_addrspace->heap_end + amount)) {
-
-                    prev_proc_pg_table->next = proc_pg_table->next;
-
-                    free_proc_pg_table = proc_pg_table;
-                    kfree((void *)PADDR_TO_KVADDR(free_proc_pg_table->ppn));
-                    kfree(free_proc_pg_table);
+    /* Other threads may be faulting or calling sbrk too. */
+    lock_acquire(as->as_lock);
 
-                    break;
-                }
+    retval = as->heap_end;
+    new_end = as->heap_end + amount;
 
-                prev_proc_pg_table = proc_pg_table;
-                proc_pg_table = proc_pg_table->next;
-            }
+    if (new_end < as->heap_start)  {
+        lock_release(as->as_lock);
+        *err = EINVAL;
+        return (void *)-1;
+    }
 
-        }
+    if (new_end > USHM_ZONE_BOTTOM)  {
+        lock_release(as->as_lock);
+        *err = ENOMEM;
+        return (void *)-1;
+    }
 
-        // TLB cleanup code
-        int spl;
+    as->heap_end = new_end;
 
-        spl = splhigh();
+    if (amount >= 0) {
+        lock_release(as->as_lock);
+        return (void *)retval;
+    }
 
-        for (int i=0; i < NUM_TLB; i++) {
-            tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    /* Unhook the pages wholly above the new break... */
+    dead = NULL;
+    pp = &as->page_table_entry;
+    while ((pte = *pp) != NULL) {
+        if (pte->vpn >= new_end && pte->vpn < USHM_ZONE_BOTTOM) {
+            *pp = pte->next;
+            pte->next = dead;
+            dead = pte;
+        } else {
+            pp = &pte->next;
         }
-
-        splx(spl);
     }
+    lock_release(as->as_lock);
 
-    curproc->p_addrspace->heap_end += amount;
+    /* ...make sure no CPU running one of our threads can still reach them... */
+    vm_tlbshootdown_range(new_end, retval);
 
-    if (amount < 0)
-        as_activate();
+    /* ...and only then give the frames back. */
+    while (dead != NULL) {
+        pte = dead;
+        dead = pte->next;
+        page_unref(pte->ppn);
+        kfree(pte);
+    }
 
     return (void *)retval;
-}
\ No newline at end of file
+}
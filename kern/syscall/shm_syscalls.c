@@ -0,0 +1,384 @@
+/*
+ * Shared memory segments, System V style but named by strings (see
+ * kern/shm.h).
+ *
+ * shmget finds or creates the segment with a given name and hands
+ * back its id; shmat attaches a segment to the calling process and
+ * returns where it is; shmdt detaches it; shmrm takes the name away.
+ *
+ * A segment is an array of physical frames, each filled in with a
+ * zeroed page the first time any process touches it. The segment
+ * holds a coremap reference to each of its frames, and each page
+ * table entry mapping one holds another, so a frame lasts until the
+ * segment and every mapping have let go of it. Segments are attached
+ * in the shared memory zone of the address space (see addrspace.h);
+ * vm_fault looks faults there up in the process's list of
+ * attachments and maps the segment's frame instead of a new zero
+ * page. Fork shares attachments with the child rather than copying
+ * them, and exec and exit detach them with the rest of the address
+ * space.
+ *
+ * Lock order: an address space's as_lock, then shm_lock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <kern/shm.h>
+#include <kern/shm_syscalls.h>
+
+struct shmseg {
+	struct shmseg *ss_next;		/* on shm_segs until removed */
+	char ss_name[SHM_NAMELEN];
+	int ss_id;
+	unsigned ss_npages;
+	paddr_t *ss_pages;		/* 0 until first touched */
+	unsigned ss_refcount;		/* attachments */
+	bool ss_removed;
+};
+
+static struct lock *shm_lock;
+static struct shmseg *shm_segs;		/* segments that have names */
+static int shm_nextid = 1;
+
+void
+shm_bootstrap(void)
+{
+	shm_lock = lock_create("shm");
+	if (shm_lock == NULL) {
+		panic("shm_bootstrap: out of memory\n");
+	}
+	shm_segs = NULL;
+}
+
+static
+struct shmseg *
+shmseg_create(const char *name, size_t size)
+{
+	struct shmseg *seg;
+
+	seg = kmalloc(sizeof(*seg));
+	if (seg == NULL) {
+		return NULL;
+	}
+	seg->ss_npages = DIVROUNDUP(size, PAGE_SIZE);
+	seg->ss_pages = kmalloc(seg->ss_npages * sizeof(paddr_t));
+	if (seg->ss_pages == NULL) {
+		kfree(seg);
+		return NULL;
+	}
+	bzero(seg->ss_pages, seg->ss_npages * sizeof(paddr_t));
+	strcpy(seg->ss_name, name);
+	seg->ss_id = 0;
+	seg->ss_refcount = 0;
+	seg->ss_removed = false;
+	seg->ss_next = NULL;
+	return seg;
+}
+
+static
+void
+shmseg_destroy(struct shmseg *seg)
+{
+	unsigned i;
+
+	KASSERT(seg->ss_refcount == 0);
+	KASSERT(seg->ss_removed);
+
+	for (i=0; i<seg->ss_npages; i++) {
+		if (seg->ss_pages[i] != 0) {
+			page_unref(seg->ss_pages[i]);
+		}
+	}
+	kfree(seg->ss_pages);
+	kfree(seg);
+}
+
+static
+struct shmseg *
+shmseg_byname(const char *name)
+{
+	struct shmseg *seg;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+	for (seg = shm_segs; seg != NULL; seg = seg->ss_next) {
+		if (!strcmp(seg->ss_name, name)) {
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+static
+struct shmseg *
+shmseg_byid(int id)
+{
+	struct shmseg *seg;
+
+	KASSERT(lock_do_i_hold(shm_lock));
+	for (seg = shm_segs; seg != NULL; seg = seg->ss_next) {
+		if (seg->ss_id == id) {
+			return seg;
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+// hooks for the VM system
+
+/* Take another attachment reference, for fork. */
+void
+shm_ref(struct shmseg *seg)
+{
+	lock_acquire(shm_lock);
+	KASSERT(seg->ss_refcount > 0);
+	seg->ss_refcount++;
+	lock_release(shm_lock);
+}
+
+/* Drop an attachment reference; the last frees a removed segment. */
+void
+shm_release(struct shmseg *seg)
+{
+	bool dead;
+
+	lock_acquire(shm_lock);
+	KASSERT(seg->ss_refcount > 0);
+	seg->ss_refcount--;
+	dead = seg->ss_refcount == 0 && seg->ss_removed;
+	lock_release(shm_lock);
+
+	if (dead) {
+		shmseg_destroy(seg);
+	}
+}
+
+/*
+ * Get page INDEX of SEG for a page table, with a reference taken for
+ * it, allocating it if nobody has touched it yet.
+ */
+int
+shm_getpage(struct shmseg *seg, unsigned index, paddr_t *ret)
+{
+	vaddr_t kva;
+
+	KASSERT(index < seg->ss_npages);
+
+	lock_acquire(shm_lock);
+	if (seg->ss_pages[index] == 0) {
+		kva = alloc_kpages(1);
+		if (kva == 0) {
+			lock_release(shm_lock);
+			return ENOMEM;
+		}
+		bzero((void *)kva, PAGE_SIZE);
+		seg->ss_pages[index] = KVADDR_TO_PADDR(kva);
+	}
+	page_ref(seg->ss_pages[index]);
+	*ret = seg->ss_pages[index];
+	lock_release(shm_lock);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// system calls
+
+int
+sys_shmget(userptr_t name, size_t size, int flags, int *err)
+{
+	char kname[SHM_NAMELEN];
+	struct shmseg *seg;
+	size_t got;
+	int id;
+
+	*err = copyinstr(name, kname, sizeof(kname), &got);
+	if (*err) {
+		return -1;
+	}
+	if (kname[0] == 0 || (flags & ~(SHM_CREAT | SHM_EXCL)) != 0) {
+		*err = EINVAL;
+		return -1;
+	}
+
+	lock_acquire(shm_lock);
+	seg = shmseg_byname(kname);
+	if (seg != NULL) {
+		if ((flags & SHM_CREAT) && (flags & SHM_EXCL)) {
+			*err = EEXIST;
+		}
+		else if (size > seg->ss_npages * PAGE_SIZE) {
+			*err = EINVAL;
+		}
+		id = seg->ss_id;
+		lock_release(shm_lock);
+		return *err ? -1 : id;
+	}
+
+	if (!(flags & SHM_CREAT)) {
+		*err = ENOENT;
+	}
+	else if (size == 0 || size > SHM_MAXSIZE) {
+		*err = EINVAL;
+	}
+	else {
+		seg = shmseg_create(kname, size);
+		if (seg == NULL) {
+			*err = ENOMEM;
+		}
+	}
+	if (*err) {
+		lock_release(shm_lock);
+		return -1;
+	}
+
+	id = seg->ss_id = shm_nextid++;
+	seg->ss_next = shm_segs;
+	shm_segs = seg;
+	lock_release(shm_lock);
+	return id;
+}
+
+/*
+ * Attach at the lowest place in the zone with room, keeping the list
+ * of attachments in address order.
+ */
+void *
+sys_shmat(int id, int *err)
+{
+	struct addrspace *as = proc_getas();
+	struct shmseg *seg;
+	struct shmmap *sm, **pp;
+	vaddr_t start;
+	size_t size;
+
+	sm = kmalloc(sizeof(*sm));
+	if (sm == NULL) {
+		*err = ENOMEM;
+		return (void *)-1;
+	}
+
+	lock_acquire(shm_lock);
+	seg = shmseg_byid(id);
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		kfree(sm);
+		*err = EINVAL;
+		return (void *)-1;
+	}
+	seg->ss_refcount++;
+	lock_release(shm_lock);
+	size = seg->ss_npages * PAGE_SIZE;
+
+	lock_acquire(as->as_lock);
+	start = USHM_ZONE_BOTTOM;
+	for (pp = &as->as_shm; *pp != NULL; pp = &(*pp)->sm_next) {
+		if ((*pp)->sm_start - start >= size) {
+			break;
+		}
+		start = (*pp)->sm_start + (*pp)->sm_npages * PAGE_SIZE;
+	}
+	if (USTACK_ZONE_BOTTOM - start < size) {
+		lock_release(as->as_lock);
+		shm_release(seg);
+		kfree(sm);
+		*err = ENOMEM;
+		return (void *)-1;
+	}
+
+	sm->sm_start = start;
+	sm->sm_npages = seg->ss_npages;
+	sm->sm_seg = seg;
+	sm->sm_next = *pp;
+	*pp = sm;
+	lock_release(as->as_lock);
+	return (void *)start;
+}
+
+/*
+ * Detach the segment at ADDR. Its pages come out of the page table
+ * the same way sbrk gives back heap pages.
+ */
+int
+sys_shmdt(userptr_t addr, int *err)
+{
+	struct addrspace *as = proc_getas();
+	struct shmmap *sm, **smp;
+	struct page_table **pp, *pte, *dead;
+	vaddr_t start, end;
+
+	lock_acquire(as->as_lock);
+	for (smp = &as->as_shm; (sm = *smp) != NULL; smp = &sm->sm_next) {
+		if (sm->sm_start == (vaddr_t)addr) {
+			break;
+		}
+	}
+	if (sm == NULL) {
+		lock_release(as->as_lock);
+		*err = EINVAL;
+		return -1;
+	}
+	*smp = sm->sm_next;
+	start = sm->sm_start;
+	end = start + sm->sm_npages * PAGE_SIZE;
+
+	dead = NULL;
+	pp = &as->page_table_entry;
+	while ((pte = *pp) != NULL) {
+		if (pte->vpn >= start && pte->vpn < end) {
+			*pp = pte->next;
+			pte->next = dead;
+			dead = pte;
+		}
+		else {
+			pp = &pte->next;
+		}
+	}
+	lock_release(as->as_lock);
+
+	vm_tlbshootdown_range(start, end);
+
+	while (dead != NULL) {
+		pte = dead;
+		dead = pte->next;
+		page_unref(pte->ppn);
+		kfree(pte);
+	}
+	shm_release(sm->sm_seg);
+	kfree(sm);
+	return 0;
+}
+
+int
+sys_shmrm(int id, int *err)
+{
+	struct shmseg *seg, **pp;
+	bool dead;
+
+	lock_acquire(shm_lock);
+	for (pp = &shm_segs; (seg = *pp) != NULL; pp = &seg->ss_next) {
+		if (seg->ss_id == id) {
+			break;
+		}
+	}
+	if (seg == NULL) {
+		lock_release(shm_lock);
+		*err = EINVAL;
+		return -1;
+	}
+	*pp = seg->ss_next;
+	seg->ss_removed = true;
+	dead = seg->ss_refcount == 0;
+	lock_release(shm_lock);
+
+	if (dead) {
+		shmseg_destroy(seg);
+	}
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * User threads: more than one kernel thread running in the same
+ * process and address space.
+ *
+ * __thread_create starts a new thread at a user entry point with a
+ * fresh stack from one of the fixed stack slots below the main stack
+ * (see addrspace.h); libc wraps it so the new thread calls the
+ * user's function and then thread_exit. thread_join waits for a
+ * thread to exit and collects its return value, which frees its id
+ * and stack slot for reuse.
+ *
+ * _exit (or a fatal fault) in any thread ends the whole process.
+ * Other threads can't be stopped from outside, so instead the process
+ * is marked as exiting and each thread leaves the next time it passes
+ * through the kernel: at the end of a system call or page fault, or
+ * on a timer interrupt if it's running user code. Threads asleep in
+ * futex_wait are woken to notice. The last thread to leave does the
+ * real work of exiting.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <mips/trapframe.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include <kern/futex_syscalls.h>
+#include <kern/process_syscalls.h>
+#include <kern/thread_syscalls.h>
+
+/*
+ * Find the current thread's id. Call with p_uthreadlock held.
+ */
+static
+int
+uthread_self(struct proc *p)
+{
+	int i;
+
+	for (i=1; i<THREAD_MAX; i++) {
+		if (p->p_uthreads[i].ut_thread == curthread) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+/*
+ * First code run by a new user thread. DATA1 is its trapframe,
+ * DATA2 its id.
+ */
+static
+void
+uthread_forkentry(void *data1, unsigned long data2)
+{
+	struct trapframe tf;
+	struct proc *p = curproc;
+
+	/* mips_usermode needs the trapframe on our own stack. */
+	memcpy(&tf, data1, sizeof(tf));
+	kfree(data1);
+
+	lock_acquire(p->p_uthreadlock);
+	p->p_uthreads[data2].ut_thread = curthread;
+	lock_release(p->p_uthreadlock);
+
+	mips_usermode(&tf);
+}
+
+int
+sys___thread_create(struct trapframe *tf, userptr_t entry, userptr_t func,
+		    userptr_t arg, int *err)
+{
+	struct proc *p = curproc;
+	struct trapframe *newtf;
+	int id, result;
+
+	lock_acquire(p->p_uthreadlock);
+	for (id=1; id<THREAD_MAX; id++) {
+		if (p->p_uthreads[id].ut_state == UT_FREE) {
+			break;
+		}
+	}
+	if (id == THREAD_MAX || p->p_exiting) {
+		lock_release(p->p_uthreadlock);
+		*err = EAGAIN;
+		return -1;
+	}
+	p->p_uthreads[id].ut_state = UT_RUNNING;
+	p->p_uthreads[id].ut_thread = NULL;
+	p->p_nuthreads++;
+	lock_release(p->p_uthreadlock);
+
+	newtf = kmalloc(sizeof(*newtf));
+	if (newtf == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	/*
+	 * Start from our own trapframe for the status register and
+	 * gp; the rest is a function call to ENTRY(FUNC, ARG) with
+	 * nowhere to return to. Leave the 16 bytes of argument save
+	 * area the calling convention says the caller provides.
+	 */
+	memcpy(newtf, tf, sizeof(*newtf));
+	newtf->tf_epc = (vaddr_t)entry;
+	newtf->tf_a0 = (uint32_t)func;
+	newtf->tf_a1 = (uint32_t)arg;
+	newtf->tf_sp = UTHREAD_STACKTOP(id) - 16;
+	newtf->tf_ra = 0;
+
+	result = thread_fork(p->p_name, p, uthread_forkentry, newtf, id);
+	if (result) {
+		kfree(newtf);
+		goto fail;
+	}
+	return id;
+
+ fail:
+	lock_acquire(p->p_uthreadlock);
+	p->p_uthreads[id].ut_state = UT_FREE;
+	p->p_nuthreads--;
+	lock_release(p->p_uthreadlock);
+	*err = result;
+	return -1;
+}
+
+void
+sys_thread_exit(userptr_t retval)
+{
+	uthread_leave(retval);
+}
+
+int
+sys_thread_join(int id, userptr_t retvalp, int *err)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+	userptr_t retval;
+	int result;
+
+	if (id < 0 || id >= THREAD_MAX) {
+		*err = ESRCH;
+		return -1;
+	}
+
+	lock_acquire(p->p_uthreadlock);
+	if (id == uthread_self(p)) {
+		lock_release(p->p_uthreadlock);
+		*err = EINVAL;
+		return -1;
+	}
+	ut = &p->p_uthreads[id];
+	while (ut->ut_state == UT_RUNNING && !p->p_exiting) {
+		cv_wait(p->p_uthreadcv, p->p_uthreadlock);
+	}
+	if (ut->ut_state != UT_EXITED) {
+		/* Never started, already joined, or we're going away. */
+		result = ut->ut_state == UT_FREE ? ESRCH : EINTR;
+		lock_release(p->p_uthreadlock);
+		*err = result;
+		return -1;
+	}
+	retval = ut->ut_retval;
+	ut->ut_state = UT_FREE;
+	lock_release(p->p_uthreadlock);
+
+	if (retvalp != NULL) {
+		result = copyout(&retval, retvalp, sizeof(retval));
+		if (result) {
+			*err = result;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Mark the current process as exiting with wait status STATUS, and
+ * get the other threads moving. If it's already exiting, the first
+ * status stands.
+ */
+void
+uthread_exit_all(int status)
+{
+	struct proc *p = curproc;
+	bool others;
+
+	lock_acquire(p->p_uthreadlock);
+	if (!p->p_exiting) {
+		p->p_exitstatus = status;
+		p->p_exiting = true;
+	}
+	others = p->p_nuthreads > 1;
+	cv_broadcast(p->p_uthreadcv, p->p_uthreadlock);
+	lock_release(p->p_uthreadlock);
+
+	if (others) {
+		futex_wakeall();
+	}
+}
+
+/*
+ * The current thread leaves its process for good, leaving RETVAL for
+ * a joiner. If it's the last one, the process exits: with the status
+ * given to _exit if anyone called it, otherwise with 0 as if main had
+ * returned.
+ */
+void
+uthread_leave(userptr_t retval)
+{
+	struct proc *p = curproc;
+	struct uthread *ut;
+	bool last;
+
+	lock_acquire(p->p_uthreadlock);
+	ut = &p->p_uthreads[uthread_self(p)];
+	KASSERT(ut->ut_state == UT_RUNNING);
+	ut->ut_state = UT_EXITED;
+	ut->ut_thread = NULL;
+	ut->ut_retval = retval;
+	KASSERT(p->p_nuthreads > 0);
+	p->p_nuthreads--;
+	last = p->p_nuthreads == 0;
+	if (last && !p->p_exiting) {
+		p->p_exitstatus = _MKWAIT_EXIT(0);
+		p->p_exiting = true;
+	}
+	cv_broadcast(p->p_uthreadcv, p->p_uthreadlock);
+	if (!last) {
+		/*
+		 * Detach while the last thread still can't get past
+		 * the lock; once it does, p may be freed.
+		 */
+		proc_remthread(curthread);
+	}
+	lock_release(p->p_uthreadlock);
+
+	if (last) {
+		proc_exit(p->p_exitstatus);
+	}
+	thread_exit();
+}
+
+/*
+ * Called on the way back to user mode. If the process is exiting,
+ * don't go.
+ */
+void
+uthread_checkexit(void)
+{
+	struct proc *p = curproc;
+
+	if (p != NULL && p != kproc && p->p_exiting) {
+		uthread_leave(NULL);
+	}
+}
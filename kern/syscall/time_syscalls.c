@@ -28,7 +28,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
+#include <timer.h>
 #include <copyinout.h>
 #include <syscall.h>
 
@@ -56,3 +58,40 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in REQ, rounded up to the timer resolution.
+ *
+ * There are no signals, so the sleep is never interrupted and REM is
+ * never written.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	uint64_t ms;
+	unsigned chunk;
+	int result;
+
+	(void)rem;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ms = (uint64_t)ts.tv_sec * 1000 + (ts.tv_nsec + 999999) / 1000000;
+
+	/* Very long sleeps are done in pieces the timer can handle. */
+	while (ms > 0) {
+		chunk = ms > 1000000 ? 1000000 : ms;
+		timer_sleep(chunk);
+		ms -= chunk;
+	}
+
+	return 0;
+}
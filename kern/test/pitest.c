@@ -0,0 +1,249 @@
+/*
+ * pitest - priority inversion latency test.
+ *
+ * A low-priority writer repeatedly takes a lock and does I/O while
+ * holding it: real writes to a file if given a filesystem name
+ * (e.g. "pit lhd0"), otherwise a short sleep standing in for a disk
+ * transfer. One medium-priority spinner per CPU keeps the CPUs busy
+ * in long bursts. A high-priority "interactive" thread wakes up
+ * every few milliseconds, takes the lock, and records how long that
+ * took.
+ *
+ * Without priority inheritance, when the writer's I/O finishes it
+ * can't get a CPU back until a spinner naps, so the interactive
+ * thread's wait includes most of a spinner burst. With it, the
+ * writer runs at the interactive thread's priority while it's being
+ * waited for. The test prints the latency distribution and fails if
+ * the worst case reaches the length of a burst.
+ */
+
+#include <types.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <timer.h>
+#include <uio.h>
+#include <thread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <test.h>
+#include <kern/secret.h>
+#include <kern/test161.h>
+
+#define PIT_SAMPLES	100
+#define PIT_THINK_MS	10	/* interactive thread's sleep per sample */
+#define PIT_HOLD_MS	20	/* simulated I/O time with the lock held */
+#define PIT_BURST_MS	200	/* spinners spin this long... */
+#define PIT_NAP_MS	10	/* ...then sleep this long */
+#define PIT_IOSIZE	4096
+#define PIT_FILESIZE	(64 * PIT_IOSIZE)
+#define PIT_FILENAME	"pitest.tmp"
+
+#define PIT_PRI_LOW	PRI_MIN
+#define PIT_PRI_MID	(PRI_DEFAULT + 4)
+#define PIT_PRI_HIGH	PRI_MAX
+
+static struct lock *pit_lock;
+static struct semaphore *pit_donesem;
+static volatile bool pit_done;
+static const char *pit_fs;
+static uint32_t pit_lat[PIT_SAMPLES];	/* microseconds */
+
+static
+uint32_t
+pit_usecs(const struct timespec *start, const struct timespec *end)
+{
+	struct timespec diff;
+
+	timespec_sub(end, start, &diff);
+	return diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+}
+
+static
+void
+pit_spinner(void *junk, unsigned long num)
+{
+	uint32_t start, burst;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PIT_PRI_MID);
+	burst = timer_mstoticks(PIT_BURST_MS);
+
+	while (!pit_done) {
+		start = timer_now();
+		while (timer_now() - start < burst && !pit_done) {
+			/* spin */
+		}
+		timer_sleep(PIT_NAP_MS);
+	}
+	V(pit_donesem);
+}
+
+static
+void
+pit_writer(void *junk, unsigned long num)
+{
+	struct vnode *vn = NULL;
+	struct iovec iov;
+	struct uio ku;
+	char name[32];
+	char *buf = NULL;
+	off_t pos = 0;
+	int err;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PIT_PRI_LOW);
+
+	if (pit_fs != NULL) {
+		buf = kmalloc(PIT_IOSIZE);
+		if (buf == NULL) {
+			kprintf("pit: out of memory; simulating I/O\n");
+		}
+		else {
+			memset(buf, 'p', PIT_IOSIZE);
+			snprintf(name, sizeof(name), "%s:%s", pit_fs,
+				 PIT_FILENAME);
+			/* vfs_open destroys the string it's passed */
+			err = vfs_open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664,
+				       &vn);
+			if (err) {
+				kprintf("pit: %s:%s: %s; simulating I/O\n",
+					pit_fs, PIT_FILENAME, strerror(err));
+				vn = NULL;
+			}
+		}
+	}
+
+	while (!pit_done) {
+		lock_acquire(pit_lock);
+		if (vn != NULL) {
+			uio_kinit(&iov, &ku, buf, PIT_IOSIZE, pos, UIO_WRITE);
+			err = VOP_WRITE(vn, &ku);
+			if (err) {
+				kprintf("pit: write: %s\n", strerror(err));
+			}
+			pos = (pos + PIT_IOSIZE) % PIT_FILESIZE;
+		}
+		else {
+			timer_sleep(PIT_HOLD_MS);
+		}
+		lock_release(pit_lock);
+	}
+
+	if (vn != NULL) {
+		vfs_close(vn);
+		snprintf(name, sizeof(name), "%s:%s", pit_fs, PIT_FILENAME);
+		vfs_remove(name);
+	}
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	V(pit_donesem);
+}
+
+static
+void
+pit_interactive(void *junk, unsigned long num)
+{
+	struct timespec start, end;
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(PIT_PRI_HIGH);
+
+	for (i=0; i<PIT_SAMPLES; i++) {
+		timer_sleep(PIT_THINK_MS);
+		gettime(&start);
+		lock_acquire(pit_lock);
+		gettime(&end);
+		lock_release(pit_lock);
+		pit_lat[i] = pit_usecs(&start, &end);
+	}
+
+	pit_done = true;
+	V(pit_donesem);
+}
+
+int
+pitest(int nargs, char **args)
+{
+	unsigned i, j, nthreads;
+	uint32_t tmp, total;
+	int result;
+
+	pit_fs = nargs > 1 ? args[1] : NULL;
+	pit_done = false;
+
+	kprintf_n("Starting pit: %u samples, %s I/O under the lock...\n",
+		  PIT_SAMPLES, pit_fs != NULL ? pit_fs : "simulated");
+
+	pit_lock = lock_create("pit_lock");
+	pit_donesem = sem_create("pit_donesem", 0);
+	if (pit_lock == NULL || pit_donesem == NULL) {
+		panic("pit: out of memory\n");
+	}
+
+	/* The writer goes first so it's holding the lock to begin with. */
+	nthreads = 0;
+	result = thread_fork("pit_writer", NULL, pit_writer, NULL, 0);
+	if (result) {
+		panic("pit: thread_fork failed: %s\n", strerror(result));
+	}
+	nthreads++;
+	timer_sleep(PIT_THINK_MS);
+
+	for (i=0; i<num_cpus; i++) {
+		result = thread_fork("pit_spinner", NULL, pit_spinner, NULL, i);
+		if (result) {
+			panic("pit: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		nthreads++;
+	}
+
+	result = thread_fork("pit_interactive", NULL, pit_interactive,
+			     NULL, 0);
+	if (result) {
+		panic("pit: thread_fork failed: %s\n", strerror(result));
+	}
+	nthreads++;
+
+	for (i=0; i<nthreads; i++) {
+		P(pit_donesem);
+	}
+
+	/* Insertion sort; there aren't many. */
+	total = 0;
+	for (i=0; i<PIT_SAMPLES; i++) {
+		tmp = pit_lat[i];
+		total += tmp;
+		for (j=i; j>0 && pit_lat[j-1] > tmp; j--) {
+			pit_lat[j] = pit_lat[j-1];
+		}
+		pit_lat[j] = tmp;
+	}
+
+	kprintf_n("pit: lock wait (usec): min %u median %u p99 %u "
+		  "max %u mean %u\n",
+		  pit_lat[0], pit_lat[PIT_SAMPLES / 2],
+		  pit_lat[PIT_SAMPLES * 99 / 100], pit_lat[PIT_SAMPLES - 1],
+		  total / PIT_SAMPLES);
+
+	lock_destroy(pit_lock);
+	sem_destroy(pit_donesem);
+	pit_lock = NULL;
+	pit_donesem = NULL;
+
+	success(pit_lat[PIT_SAMPLES - 1] < PIT_BURST_MS * 1000 ?
+		TEST161_SUCCESS : TEST161_FAIL, SECRET, "pit");
+
+	return 0;
+}
@@ -32,15 +32,16 @@
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future, with resolution of one
+ * hardclock, are provided by the timer wheel in timer.c, which
+ * hardclock() drives.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -97,6 +98,10 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		/* One CPU turns the timer wheel. */
+		timer_tick();
+	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
@@ -0,0 +1,242 @@
+/*
+ * Lock contention statistics. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <lockstat.h>
+
+/* Size of the class table; must be a power of 2 */
+#define LOCKSTAT_MAXCLASSES	256
+#define LOCKSTAT_NAMELEN	24
+
+/*
+ * One statistics class.
+ *
+ * The counters are protected by lsc_busy, a raw spin word, rather
+ * than by a struct spinlock: updating them happens inside
+ * spinlock_acquire and spinlock_release, so using a spinlock here
+ * would recurse.
+ */
+struct lockstat_class {
+	char lsc_name[LOCKSTAT_NAMELEN];	/* lock name (truncated) */
+	vaddr_t lsc_site;			/* creation site */
+	int lsc_kind;				/* LOCKSTAT_* */
+	bool lsc_inuse;				/* slot is allocated */
+
+	volatile spinlock_data_t lsc_busy;	/* protects the counters */
+	uint64_t lsc_acquires;
+	uint64_t lsc_contended;
+	uint64_t lsc_waitcycles;
+	uint32_t lsc_maxhold;
+};
+
+/*
+ * The class table. Open addressing, never shrinks. Slots are only
+ * claimed under lockstat_lock; once claimed the key fields never
+ * change. lockstat_lock is statically initialized and is therefore
+ * not itself tracked.
+ */
+static struct lockstat_class lockstat_classes[LOCKSTAT_MAXCLASSES];
+static struct spinlock lockstat_lock = SPINLOCK_INITIALIZER;
+
+static const char *const lockstat_kindnames[] = {
+	"lock",
+	"cv",
+	"spin",
+};
+
+static
+unsigned
+lockstat_hash(const char *name, vaddr_t site)
+{
+	unsigned h = 5381;
+
+	while (*name != 0) {
+		h = h*33 + (unsigned char)*name++;
+	}
+	return (h ^ (site >> 2)) & (LOCKSTAT_MAXCLASSES - 1);
+}
+
+struct lockstat_class *
+lockstat_register(const char *name, vaddr_t site, int kind)
+{
+	struct lockstat_class *lsc;
+	char key[LOCKSTAT_NAMELEN];
+	unsigned i, slot;
+
+	/* Names are compared as truncated for the table. */
+	snprintf(key, sizeof(key), "%s", name);
+	slot = lockstat_hash(key, site);
+
+	spinlock_acquire(&lockstat_lock);
+	for (i=0; i<LOCKSTAT_MAXCLASSES; i++) {
+		lsc = &lockstat_classes[(slot + i) & (LOCKSTAT_MAXCLASSES-1)];
+		if (!lsc->lsc_inuse) {
+			strcpy(lsc->lsc_name, key);
+			lsc->lsc_site = site;
+			lsc->lsc_kind = kind;
+			spinlock_data_set(&lsc->lsc_busy, 0);
+			lsc->lsc_inuse = true;
+			spinlock_release(&lockstat_lock);
+			return lsc;
+		}
+		if (lsc->lsc_site == site && lsc->lsc_kind == kind &&
+		    !strcmp(lsc->lsc_name, key)) {
+			spinlock_release(&lockstat_lock);
+			return lsc;
+		}
+	}
+	spinlock_release(&lockstat_lock);
+
+	/* Table full; leave this lock untracked. */
+	return NULL;
+}
+
+/*
+ * Lock and unlock a class's counters. Interrupts must be off so an
+ * interrupt handler on this cpu can't come back and spin on the same
+ * word forever.
+ */
+static
+void
+lockstat_class_lock(struct lockstat_class *lsc)
+{
+	splraise(IPL_NONE, IPL_HIGH);
+	while (spinlock_data_get(&lsc->lsc_busy) != 0 ||
+	       spinlock_data_testandset(&lsc->lsc_busy) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+lockstat_class_unlock(struct lockstat_class *lsc)
+{
+	membar_any_store();
+	spinlock_data_set(&lsc->lsc_busy, 0);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+void
+lockstat_acquired(struct lockstat_class *lsc, bool contended,
+		  uint32_t waitcycles)
+{
+	if (lsc == NULL) {
+		return;
+	}
+
+	lockstat_class_lock(lsc);
+	lsc->lsc_acquires++;
+	if (contended) {
+		lsc->lsc_contended++;
+		lsc->lsc_waitcycles += waitcycles;
+	}
+	lockstat_class_unlock(lsc);
+}
+
+void
+lockstat_released(struct lockstat_class *lsc, uint32_t holdcycles)
+{
+	if (lsc == NULL) {
+		return;
+	}
+
+	lockstat_class_lock(lsc);
+	if (holdcycles > lsc->lsc_maxhold) {
+		lsc->lsc_maxhold = holdcycles;
+	}
+	lockstat_class_unlock(lsc);
+}
+
+/*
+ * Print every class that has been used since the last reset, most
+ * wait time first. Work from a snapshot so we aren't printing with
+ * the counters locked.
+ */
+void
+lockstat_dump(void)
+{
+	struct lockstat_class *snap, *lsc, tmp;
+	unsigned i, j, num;
+
+	snap = kmalloc(sizeof(*snap) * LOCKSTAT_MAXCLASSES);
+	if (snap == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+
+	num = 0;
+	for (i=0; i<LOCKSTAT_MAXCLASSES; i++) {
+		lsc = &lockstat_classes[i];
+		if (!lsc->lsc_inuse) {
+			continue;
+		}
+		lockstat_class_lock(lsc);
+		snap[num] = *lsc;
+		lockstat_class_unlock(lsc);
+		if (snap[num].lsc_acquires > 0) {
+			num++;
+		}
+	}
+
+	/* Insertion sort by total wait time, descending. */
+	for (i=1; i<num; i++) {
+		tmp = snap[i];
+		for (j=i; j>0 && snap[j-1].lsc_waitcycles < tmp.lsc_waitcycles;
+		     j--) {
+			snap[j] = snap[j-1];
+		}
+		snap[j] = tmp;
+	}
+
+	kprintf("%-24s %-4s %-10s %10s %10s %14s %10s\n", "name", "kind",
+		"site", "acquires", "contended", "wait-cycles", "max-hold");
+	for (i=0; i<num; i++) {
+		lsc = &snap[i];
+		kprintf("%-24s %-4s 0x%08lx %10llu %10llu %14llu ",
+			lsc->lsc_name, lockstat_kindnames[lsc->lsc_kind],
+			(unsigned long)lsc->lsc_site,
+			(unsigned long long)lsc->lsc_acquires,
+			(unsigned long long)lsc->lsc_contended,
+			(unsigned long long)lsc->lsc_waitcycles);
+		if (lsc->lsc_kind == LOCKSTAT_CV) {
+			kprintf("%10s\n", "-");
+		}
+		else {
+			kprintf("%10lu\n", (unsigned long)lsc->lsc_maxhold);
+		}
+	}
+	kprintf("%u lock classes active\n", num);
+
+	kfree(snap);
+}
+
+/*
+ * Zero all the counters. Classes themselves stay registered, since
+ * live locks point at them.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat_class *lsc;
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_MAXCLASSES; i++) {
+		lsc = &lockstat_classes[i];
+		if (!lsc->lsc_inuse) {
+			continue;
+		}
+		lockstat_class_lock(lsc);
+		lsc->lsc_acquires = 0;
+		lsc->lsc_contended = 0;
+		lsc->lsc_waitcycles = 0;
+		lsc->lsc_maxhold = 0;
+		lockstat_class_unlock(lsc);
+	}
+}
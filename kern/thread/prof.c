@@ -0,0 +1,166 @@
+/*
+ * Statistical profiler. See prof.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <clock.h>
+#include <membar.h>
+#include <proc.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <prof.h>
+
+/* Table slots per CPU; must be a power of 2 */
+#define PROF_SLOTS	4096
+
+/* How far to probe before giving up on a full table */
+#define PROF_PROBES	16
+
+struct prof_slot {
+	vaddr_t ps_pc;			/* 0 if the slot is free */
+	pid_t ps_pid;
+	uint32_t ps_count;
+};
+
+/*
+ * One CPU's table. Allocated the first time profiling is started and
+ * kept after that.
+ *
+ * pt_busy is set while a sample is being recorded. prof_sample sets
+ * it before checking prof_enabled again, and prof_stop clears
+ * prof_enabled before looking at it, so once prof_stop is done no
+ * CPU is touching its table until profiling starts again.
+ */
+struct prof_table {
+	struct prof_slot *pt_slots;
+	uint32_t pt_samples;
+	uint32_t pt_dropped;
+	volatile bool pt_busy;
+};
+
+static struct prof_table prof_tables[MAXCPUS];
+
+volatile bool prof_enabled;
+
+void
+prof_sample(vaddr_t pc)
+{
+	struct prof_table *pt;
+	struct prof_slot *ps;
+	struct proc *p;
+	pid_t pid;
+	unsigned h, i;
+
+	pt = &prof_tables[curcpu->c_number];
+	pt->pt_busy = true;
+	membar_any_any();
+	if (!prof_enabled || pt->pt_slots == NULL) {
+		goto done;
+	}
+
+	/*
+	 * Kernel samples are charged to the process too, so kernel
+	 * time spent on behalf of fork or exec shows up as such.
+	 */
+	p = curthread->t_proc;
+	pid = p != NULL ? p->pid : 0;
+
+	pt->pt_samples++;
+	h = ((pc >> 2) ^ (pid * 2654435761U)) & (PROF_SLOTS - 1);
+	for (i=0; i<PROF_PROBES; i++) {
+		ps = &pt->pt_slots[(h + i) & (PROF_SLOTS - 1)];
+		if (ps->ps_pc == pc && ps->ps_pid == pid) {
+			ps->ps_count++;
+			goto done;
+		}
+		if (ps->ps_pc == 0) {
+			ps->ps_pc = pc;
+			ps->ps_pid = pid;
+			ps->ps_count = 1;
+			goto done;
+		}
+	}
+	pt->pt_dropped++;
+
+ done:
+	membar_any_store();
+	pt->pt_busy = false;
+}
+
+int
+prof_start(void)
+{
+	struct prof_table *pt;
+	unsigned i;
+
+	prof_stop();
+
+	for (i=0; i<num_cpus; i++) {
+		pt = &prof_tables[i];
+		if (pt->pt_slots == NULL) {
+			pt->pt_slots = kmalloc(PROF_SLOTS * sizeof(*pt->pt_slots));
+			if (pt->pt_slots == NULL) {
+				return ENOMEM;
+			}
+		}
+		bzero(pt->pt_slots, PROF_SLOTS * sizeof(*pt->pt_slots));
+		pt->pt_samples = 0;
+		pt->pt_dropped = 0;
+	}
+
+	membar_store_store();
+	prof_enabled = true;
+	return 0;
+}
+
+/*
+ * Turn profiling off and wait for samples being recorded to be done.
+ */
+void
+prof_stop(void)
+{
+	unsigned i;
+
+	prof_enabled = false;
+	membar_any_any();
+
+	for (i=0; i<num_cpus; i++) {
+		while (prof_tables[i].pt_busy) {
+			/* spin; it's a short probe */
+		}
+	}
+	membar_load_load();
+}
+
+void
+prof_dump(void)
+{
+	struct prof_table *pt;
+	struct prof_slot *ps;
+	uint32_t samples, dropped;
+	unsigned cpu, i;
+
+	prof_stop();
+
+	samples = dropped = 0;
+	kprintf("prof-begin %u %u\n", num_cpus, HZ);
+	for (cpu=0; cpu<num_cpus; cpu++) {
+		pt = &prof_tables[cpu];
+		if (pt->pt_slots == NULL) {
+			continue;
+		}
+		for (i=0; i<PROF_SLOTS; i++) {
+			ps = &pt->pt_slots[i];
+			if (ps->ps_pc != 0) {
+				kprintf("prof %u %d %08x %u\n", cpu,
+					ps->ps_pid, ps->ps_pc, ps->ps_count);
+			}
+		}
+		samples += pt->pt_samples;
+		dropped += pt->pt_dropped;
+	}
+	kprintf("prof-end %u %u\n", samples, dropped);
+}
@@ -30,6 +30,7 @@
 /* Make sure to build out-of-line versions of inline functions */
 #define SPINLOCK_INLINE   /* empty */
 #define MEMBAR_INLINE     /* empty */
+#define ATOMIC_INLINE     /* empty */
 
 #include <types.h>
 #include <lib.h>
@@ -37,6 +38,7 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <membar.h>
+#include <atomic.h>
 #include <current.h>	/* for curcpu */
 
 /*
@@ -52,6 +54,12 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+#if OPT_LOCKSTAT
+	splk->splk_stat = lockstat_register("spinlock",
+			(vaddr_t)__builtin_return_address(0),
+			LOCKSTAT_SPINLOCK);
+	splk->splk_holdstart = 0;
+#endif
 }
 
 /*
@@ -75,6 +83,10 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTAT
+	uint32_t waitstart = 0;
+	bool contended = false;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -90,6 +102,12 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
+#if OPT_LOCKSTAT
+	if (splk->splk_stat != NULL) {
+		waitstart = cpu_getcycles();
+	}
+#endif
+
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -102,9 +120,15 @@ spinlock_acquire(struct spinlock *splk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			contended = true;
+#endif
 			continue;
 		}
 		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+#if OPT_LOCKSTAT
+			contended = true;
+#endif
 			continue;
 		}
 		break;
@@ -112,6 +136,14 @@ spinlock_acquire(struct spinlock *splk)
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
+
+#if OPT_LOCKSTAT
+	if (splk->splk_stat != NULL) {
+		splk->splk_holdstart = cpu_getcycles();
+		lockstat_acquired(splk->splk_stat, contended,
+				  splk->splk_holdstart - waitstart);
+	}
+#endif
 }
 
 /*
@@ -127,6 +159,13 @@ spinlock_release(struct spinlock *splk)
 		curcpu->c_spinlocks--;
 	}
 
+#if OPT_LOCKSTAT
+	if (splk->splk_stat != NULL) {
+		lockstat_released(splk->splk_stat,
+				  cpu_getcycles() - splk->splk_holdstart);
+	}
+#endif
+
 	splk->splk_holder = NULL;
 	membar_any_store();
 	spinlock_data_set(&splk->splk_lock, 0);
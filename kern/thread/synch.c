@@ -35,9 +35,12 @@
 #include <types.h>
 #include <lib.h>
 #include <spinlock.h>
+#include <membar.h>
+#include <atomic.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <cpu.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
@@ -69,6 +72,8 @@ sem_create(const char *name, unsigned initial_count)
 
 	spinlock_init(&sem->sem_lock);
 	sem->sem_count = initial_count;
+	sem->sem_waiters = 0;
+	sem->sem_inflight = 0;
 
 	return sem;
 }
@@ -78,13 +83,45 @@ sem_destroy(struct semaphore *sem)
 {
 	KASSERT(sem != NULL);
 
+	/*
+	 * Wait out a V that's still finishing up; see V. (After a P
+	 * returns, the V that let it through may still be looking at
+	 * sem_waiters or waking someone.)
+	 */
+	while (sem->sem_inflight > 0) {
+		/* spin */
+	}
+	membar_load_load();
+
 	/* wchan_cleanup will assert if anyone's waiting on it */
+	KASSERT(sem->sem_waiters == 0);
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
 	kfree(sem);
 }
 
+/*
+ * Take one count off the semaphore if it has any. Returns true on
+ * success. No lock is needed: the CAS fails if anyone else changed
+ * the count in between, and we look again.
+ */
+static
+bool
+sem_trydown(struct semaphore *sem)
+{
+	unsigned count;
+
+	while ((count = sem->sem_count) > 0) {
+		if (atomic_cas(&sem->sem_count, count, count - 1) == count) {
+			/* Like spinlock_acquire, order what follows after. */
+			membar_store_any();
+			return true;
+		}
+	}
+	return false;
+}
+
 void
 P(struct semaphore *sem)
 {
@@ -98,40 +135,72 @@ P(struct semaphore *sem)
 	 */
 	KASSERT(curthread->t_in_interrupt == false);
 
-	/* Use the semaphore spinlock to protect the wchan as well. */
+	/* Uncontended case: no lock, no wchan. */
+	if (sem_trydown(sem)) {
+		return;
+	}
+
+	/*
+	 * We'll probably have to sleep. Announce ourselves in
+	 * sem_waiters before looking at the count again; V bumps the
+	 * count before looking at sem_waiters. With a full barrier on
+	 * both sides, either we see V's count or V sees us and comes
+	 * to the wchan to wake us. Because we hold sem_lock from the
+	 * check until we're on the wchan, V can't get there in
+	 * between.
+	 *
+	 * Note that we don't maintain strict FIFO ordering of
+	 * threads going through the semaphore; that is, we might
+	 * "get" it on the first try even if other threads are
+	 * waiting, and a thread coming through the fast path can
+	 * take a count out from under one we just woke, which then
+	 * goes back to sleep. Apparently according to some textbooks
+	 * semaphores must for some reason have strict ordering. Too
+	 * bad. :-)
+	 *
+	 * Exercise: how would you implement strict FIFO ordering?
+	 */
 	spinlock_acquire(&sem->sem_lock);
-	while (sem->sem_count == 0) {
-		/*
-		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
-		 */
+	sem->sem_waiters++;
+	membar_any_any();
+	while (!sem_trydown(sem)) {
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
 	}
-	KASSERT(sem->sem_count > 0);
-	sem->sem_count--;
+	sem->sem_waiters--;
 	spinlock_release(&sem->sem_lock);
 }
 
 void
 V(struct semaphore *sem)
 {
-	KASSERT(sem != NULL);
+	unsigned count;
 
-	spinlock_acquire(&sem->sem_lock);
+	KASSERT(sem != NULL);
 
-	sem->sem_count++;
-	KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	/*
+	 * Once the count is up, a P on its lock-free path can take it,
+	 * return, and destroy the semaphore. So count ourselves in
+	 * sem_inflight first, and drop out of it only when we're done
+	 * with the semaphore; sem_destroy waits for that.
+	 */
+	atomic_fetchadd(&sem->sem_inflight, 1);
+
+	/* Like spinlock_release, order what came before first. */
+	membar_any_store();
+	count = atomic_fetchadd(&sem->sem_count, 1) + 1;
+	KASSERT(count > 0);
+
+	/* Pairs with the barrier in P; see there. */
+	membar_any_any();
+	if (sem->sem_waiters > 0) {
+		spinlock_acquire(&sem->sem_lock);
+		wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+		spinlock_release(&sem->sem_lock);
+	}
 
-	spinlock_release(&sem->sem_lock);
+	/* Last touch of the semaphore. */
+	membar_any_store();
+	atomic_fetchadd(&sem->sem_inflight, -1U);
 }
 
 ////////////////////////////////////////////////////////////
@@ -162,8 +231,17 @@ lock_create(const char *name)
 	}
 
 	lock->lk_thread = NULL;
+	lock->lk_nextheld = NULL;
+	lock->lk_waitpri = PRI_NONE;
 	spinlock_init(&lock->lk_lock);
 
+#if OPT_LOCKSTAT
+	lock->lk_stat = lockstat_register(name,
+			(vaddr_t)__builtin_return_address(0),
+			LOCKSTAT_SLEEPLOCK);
+	lock->lk_holdstart = 0;
+#endif
+
 	return lock;
 }
 
@@ -193,15 +271,28 @@ lock_acquire(struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(!lock_do_i_hold(lock));
 
+	bool waited = false;
+#if OPT_LOCKSTAT
+	uint32_t waitstart = cpu_getcycles();
+#endif
+
 	spinlock_acquire(&lock->lk_lock);
 
 	while(true) {
 		if (lock->lk_thread == NULL) {
-			lock->lk_thread = curthread;
+			thread_lock_own(lock, waited);
+#if OPT_LOCKSTAT
+			lock->lk_holdstart = cpu_getcycles();
+			lockstat_acquired(lock->lk_stat, waited,
+					  lock->lk_holdstart - waitstart);
+#endif
 			spinlock_release(&lock->lk_lock);
 			break;
 		}
 
+		/* Lend the holder our priority while we wait */
+		thread_lock_block(lock);
+		waited = true;
 		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
 }
@@ -214,9 +305,15 @@ lock_release(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_lock);
 
+#if OPT_LOCKSTAT
+	lockstat_released(lock->lk_stat, cpu_getcycles() - lock->lk_holdstart);
+#endif
+
+	/* Clears lk_thread and drops anything waiters lent us */
+	thread_lock_disown(lock);
+
 	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
-	lock->lk_thread = NULL;
 	spinlock_release(&lock->lk_lock);
 
 }
@@ -257,6 +354,12 @@ cv_create(const char *name)
 	}
 
 	spinlock_init(&cv->cv_lock);
+
+#if OPT_LOCKSTAT
+	cv->cv_stat = lockstat_register(name,
+			(vaddr_t)__builtin_return_address(0), LOCKSTAT_CV);
+#endif
+
 	return cv;
 }
 
@@ -285,13 +388,54 @@ cv_wait(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
+#if OPT_LOCKSTAT
+	uint32_t waitstart = cpu_getcycles();
+#endif
+
 	spinlock_acquire(&cv->cv_lock);
 
 	lock_release(lock);
 	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
 
 	spinlock_release(&cv->cv_lock);
+
+#if OPT_LOCKSTAT
+	lockstat_acquired(cv->cv_stat, true, cpu_getcycles() - waitstart);
+#endif
+
+	lock_acquire(lock);
+}
+
+/*
+ * Same as cv_wait, but give up after MS milliseconds
+ */
+
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ms)
+{
+	int result;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+#if OPT_LOCKSTAT
+	uint32_t waitstart = cpu_getcycles();
+#endif
+
+	spinlock_acquire(&cv->cv_lock);
+
+	lock_release(lock);
+	result = wchan_sleep_timeout(cv->cv_wchan, &cv->cv_lock, ms);
+
+	spinlock_release(&cv->cv_lock);
+
+#if OPT_LOCKSTAT
+	lockstat_acquired(cv->cv_stat, true, cpu_getcycles() - waitstart);
+#endif
+
 	lock_acquire(lock);
+	return result;
 }
 
 /*
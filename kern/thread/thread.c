@@ -44,12 +44,16 @@
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
+#include <timer.h>
+#include <trace.h>
+#include <workqueue.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <platform/maxcpus.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -75,6 +79,30 @@ unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
 static struct wchan *thread_count_wchan;
 
+static void thread_reap(void *data);
+
+/*
+ * Protects the priority fields and t_blockedon of all threads and the
+ * lk_waitpri and lk_thread fields of all locks (lk_thread is also
+ * changed only under the lock's own spinlock, so either will do for
+ * reading it). Comes after lock spinlocks and before runqueue locks.
+ */
+static struct spinlock thread_pri_lock = SPINLOCK_INITIALIZER;
+
+/* How far along a chain of lock holders to pass a donation. */
+#define PRI_DONATE_DEPTH	8
+
+/* Most dead threads each cpu keeps for reuse. */
+#define THREAD_CACHE_MAX	8
+
+/*
+ * CPUs kept for threads that ask for them; see thread.h. A single
+ * word, read without locking.
+ */
+static volatile uint32_t cpus_reserved;
+
+static void thread_move_wake(void *data);
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -115,25 +143,13 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set up the fields of a new (or recycled) thread. The stack is left
+ * alone.
  */
 static
-struct thread *
-thread_create(const char *name)
+void
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-	if (strlen(name) > MAX_NAME_LENGTH) {
-		return NULL;
-	}
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
-
 	strcpy(thread->t_name, name);
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -141,7 +157,6 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -151,7 +166,39 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Priority fields */
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_pri = PRI_DEFAULT;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
+
+	thread->t_affinity = CPUMASK_ALL;
+
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+	if (strlen(name) > MAX_NAME_LENGTH) {
+		return NULL;
+	}
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	thread_init(thread, name);
+	thread->t_stack = NULL;
 
 	return thread;
 }
@@ -187,9 +234,25 @@ cpu_create(unsigned hardware_number)
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
+	work_init(&c->c_reapwork, thread_reap, c);
+
+	threadlist_init(&c->c_threadcache);
+	spinlock_init(&c->c_threadcache_lock);
+	c->c_threadcache_hits = 0;
+	c->c_threadcache_misses = 0;
+	c->c_threadcache_frees = 0;
+
+	work_init(&c->c_movework, thread_move_wake, c);
+	spinlock_init(&c->c_movelock);
+	c->c_movechan = wchan_create("cpu_move");
+	if (c->c_movechan == NULL) {
+		panic("cpu_create: Out of memory\n");
+	}
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_sent = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -286,22 +349,144 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * The thread cache.
+ *
+ * Creating a thread means two kmallocs (the thread and its stack) and
+ * destroying it two kfrees, which add up for fork-heavy loads. So
+ * instead of destroying dead threads, each cpu keeps a few, with
+ * their stacks, for thread_fork to pick up again. Only threads with
+ * a STACK_SIZE stack of their own qualify, which is all but the boot
+ * cpu's first thread.
+ */
+
+/*
+ * Keep dead thread T on cpu C if there's room. Returns false if the
+ * caller should destroy it instead.
+ */
+static
+bool
+thread_cache_put(struct cpu *c, struct thread *t)
+{
+	bool kept;
+
+	KASSERT(t->t_proc == NULL);
+	if (t->t_stack == NULL) {
+		return false;
+	}
+	thread_checkstack(t);
+
+	spinlock_acquire(&c->c_threadcache_lock);
+	kept = c->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (kept) {
+		threadlistnode_cleanup(&t->t_listnode);
+		thread_machdep_cleanup(&t->t_machdep);
+		t->t_wchan_name = "CACHED";
+		threadlist_addhead(&c->c_threadcache, t);
+	}
+	else {
+		c->c_threadcache_frees++;
+	}
+	spinlock_release(&c->c_threadcache_lock);
+
+	return kept;
+}
+
+/*
+ * Get a thread called NAME, with a stack, from the current cpu's
+ * cache, or NULL if it's empty.
+ */
+static
+struct thread *
+thread_cache_get(const char *name)
+{
+	struct cpu *c = curcpu->c_self;
+	struct thread *t;
+
+	spinlock_acquire(&c->c_threadcache_lock);
+	t = threadlist_remhead(&c->c_threadcache);
+	if (t != NULL) {
+		c->c_threadcache_hits++;
+	}
+	else {
+		c->c_threadcache_misses++;
+	}
+	spinlock_release(&c->c_threadcache_lock);
+
+	if (t != NULL) {
+		thread_init(t, name);
+	}
+	return t;
+}
+
+void
+thread_cache_stats(void)
+{
+	struct cpu *c;
+	unsigned i, cached, hits, misses, frees;
+
+	kprintf("%-6s %8s %10s %10s %10s\n",
+		"cpu", "cached", "hits", "misses", "freed");
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_threadcache_lock);
+		cached = c->c_threadcache.tl_count;
+		hits = c->c_threadcache_hits;
+		misses = c->c_threadcache_misses;
+		frees = c->c_threadcache_frees;
+		spinlock_release(&c->c_threadcache_lock);
+		kprintf("cpu%-3u %8u %10u %10u %10u\n",
+			c->c_number, cached, hits, misses, frees);
+	}
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
  * need to have thread_destroy called on them.)
  *
- * The list of zombies is per-cpu.
+ * The list of zombies is per-cpu and protected by the runqueue lock.
+ * Destroying them is left to the work queue, so it doesn't happen
+ * inside thread_switch with interrupts off. Runs in the work queue
+ * thread; DATA is the cpu.
  */
 static
 void
-exorcise(void)
+thread_reap(void *data)
 {
+	struct cpu *c = data;
+	struct threadlist dead;
 	struct thread *z;
 
-	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
+	threadlist_init(&dead);
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	while ((z = threadlist_remhead(&c->c_zombies)) != NULL) {
+		threadlist_addtail(&dead, z);
+	}
+	spinlock_release(&c->c_runqueue_lock);
+
+	while ((z = threadlist_remhead(&dead)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(c, z)) {
+			thread_destroy(z);
+		}
+	}
+
+	threadlist_cleanup(&dead);
+}
+
+/*
+ * Called after each context switch: if there are zombies, get them
+ * reaped. Peeking at the list without the lock is fine; only this
+ * cpu adds to it, and if we miss one it'll be seen next time.
+ */
+static
+void
+exorcise(void)
+{
+	if (!threadlist_isempty(&curcpu->c_zombies)) {
+		work_queue(&curcpu->c_reapwork);
 	}
 }
 
@@ -390,6 +575,15 @@ thread_bootstrap(void)
 	KASSERT(curthread->t_proc != NULL);
 	KASSERT(curthread->t_proc == kproc);
 
+	/* thread_fork needs this. */
+	thread_count_wchan = wchan_create("thread_count");
+	if (thread_count_wchan == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
+	/* Start the boot cpu's work queue. */
+	workqueue_start();
+
 	/* Done */
 }
 
@@ -410,6 +604,8 @@ cpu_hatch(unsigned software_number)
 	KASSERT(curthread != NULL);
 	KASSERT(curcpu->c_number == software_number);
 
+	workqueue_start();
+
 	spl0();
 	cpu_identify(buf, sizeof(buf));
 
@@ -430,7 +626,6 @@ thread_start_cpus(void)
 	kprintf("cpu0: %s\n", buf);
 
 	cpu_startup_sem = sem_create("cpu_hatch", 0);
-	thread_count_wchan = wchan_create("thread_count");
 	mainbus_start_cpus();
 
 	num_cpus = cpuarray_num(&allcpus);
@@ -452,16 +647,173 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Put a thread on a cpu's run queue behind everything of the same or
+ * higher priority. The run queue lock must be held.
+ */
+static
+void
+thread_runqueue_insert(struct cpu *c, struct thread *t)
+{
+	struct thread *prev;
+
+	THREADLIST_FORALL_REV(prev, c->c_runqueue) {
+		if (prev->t_pri >= t->t_pri) {
+			threadlist_insertafter(&c->c_runqueue, prev, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * CPU affinity.
+ */
+
+uint32_t
+cpu_onlinemask(void)
+{
+	/* Before thread_start_cpus we don't know yet. */
+	if (num_cpus == 0 || num_cpus >= 32) {
+		return CPUMASK_ALL;
+	}
+	return CPUMASK_BIT(num_cpus) - 1;
+}
+
+uint32_t
+cpu_reserved(void)
+{
+	return cpus_reserved;
+}
+
+bool
+thread_affinity_ok(uint32_t mask)
+{
+	return (mask & cpu_onlinemask()) != 0;
+}
+
+/*
+ * The CPUs thread T should run on: its own mask, cut down by its
+ * process's, and kept off the reserved CPUs unless that leaves
+ * nothing.
+ */
+static
+uint32_t
+thread_cpumask(struct thread *t)
+{
+	uint32_t mask, avail;
+
+	mask = t->t_affinity & cpu_onlinemask();
+	if (t->t_proc != NULL) {
+		mask &= t->t_proc->p_affinity;
+	}
+	if (mask == 0) {
+		/* The setters check for this, but don't strand anyone. */
+		mask = cpu_onlinemask();
+	}
+	avail = mask & ~cpus_reserved;
+	return avail != 0 ? avail : mask;
+}
+
+static
+bool
+thread_cpu_ok(struct thread *t, struct cpu *c)
+{
+	return (thread_cpumask(t) & CPUMASK_BIT(c->c_number)) != 0;
+}
+
+/*
+ * Choose a CPU for T: where it is if that's allowed, otherwise the
+ * allowed CPU with the shortest run queue. The queue lengths are
+ * looked at without locking; they only need to be roughly right.
+ */
+static
+struct cpu *
+thread_pickcpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	uint32_t mask;
+	unsigned i;
+
+	mask = thread_cpumask(t);
+	if (mask & CPUMASK_BIT(t->t_cpu->c_number)) {
+		return t->t_cpu;
+	}
+
+	best = NULL;
+	for (i=0; i<num_cpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((mask & CPUMASK_BIT(c->c_number)) == 0) {
+			continue;
+		}
+		if (best == NULL ||
+		    c->c_runqueue.tl_count < best->c_runqueue.tl_count) {
+			best = c;
+		}
+	}
+	return best != NULL ? best : t->t_cpu;
+}
+
+int
+thread_setaffinity(uint32_t mask)
+{
+	if (!thread_affinity_ok(mask)) {
+		return EINVAL;
+	}
+	curthread->t_affinity = mask;
+
+	/* If we can't stay here, this moves us. */
+	thread_yield();
+	return 0;
+}
+
+int
+cpu_reserve(uint32_t mask)
+{
+	uint32_t online = cpu_onlinemask();
+
+	if ((mask & ~online) != 0 || (mask != 0 && (online & ~mask) == 0)) {
+		return EINVAL;
+	}
+	/*
+	 * Threads that must now leave go at their next yield, wakeup,
+	 * or migration check.
+	 */
+	cpus_reserved = mask;
+	return 0;
+}
+
+/*
+ * Work function for c_movework: wake the threads that were running
+ * on CPU DATA and have to leave it. See thread_yield.
+ */
+static
+void
+thread_move_wake(void *data)
+{
+	struct cpu *c = data;
+
+	spinlock_acquire(&c->c_movelock);
+	wchan_wakeall(c->c_movechan, &c->c_movelock);
+	spinlock_release(&c->c_movelock);
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If the target's
+ * affinity doesn't allow its cpu any more it goes elsewhere, unless
+ * it's still curthread there (that cpu went idle after the thread
+ * went to sleep), in which case moving it isn't safe. Migration or
+ * its next yield will see to it.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
-	struct cpu *targetcpu;
+	struct cpu *targetcpu, *newcpu;
 
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
@@ -472,11 +824,21 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		if (targetcpu->c_curthread != target &&
+		    !thread_cpu_ok(target, targetcpu)) {
+			newcpu = thread_pickcpu(target);
+			if (newcpu != targetcpu) {
+				spinlock_release(&targetcpu->c_runqueue_lock);
+				target->t_cpu = newcpu;
+				targetcpu = newcpu;
+				spinlock_acquire(&targetcpu->c_runqueue_lock);
+			}
+		}
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_insert(targetcpu, target);
 
 	if (targetcpu->c_isidle) {
 		/*
@@ -498,28 +860,40 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
  * ENTRYPOINT. DATA1 and DATA2 are passed to ENTRYPOINT.
  *
  * The new thread is created in the process P. If P is null, the
- * process is inherited from the caller. It will start on the same CPU
- * as the caller, unless the scheduler intervenes first.
+ * process is inherited from the caller. It gets the affinity mask
+ * AFFINITY. It will start on the same CPU as the caller, unless the
+ * scheduler intervenes first.
  */
+static
 int
-thread_fork(const char *name,
-	    struct proc *proc,
-	    void (*entrypoint)(void *data1, unsigned long data2),
-	    void *data1, unsigned long data2)
+thread_fork_common(const char *name,
+		   struct proc *proc,
+		   uint32_t affinity,
+		   void (*entrypoint)(void *data1, unsigned long data2),
+		   void *data1, unsigned long data2)
 {
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
+	if (strlen(name) > MAX_NAME_LENGTH) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+	/* Reuse a dead thread and its stack if we can... */
+	newthread = thread_cache_get(name);
+	if (newthread == NULL) {
+		/* ...otherwise start from scratch. */
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
+
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -529,6 +903,9 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_basepri = curthread->t_basepri;
+	newthread->t_pri = curthread->t_basepri;
+	newthread->t_affinity = affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -562,6 +939,30 @@ thread_fork(const char *name,
 	return 0;
 }
 
+int
+thread_fork(const char *name,
+	    struct proc *proc,
+	    void (*entrypoint)(void *data1, unsigned long data2),
+	    void *data1, unsigned long data2)
+{
+	return thread_fork_common(name, proc, curthread->t_affinity,
+				  entrypoint, data1, data2);
+}
+
+int
+thread_fork_affinity(const char *name,
+		     struct proc *proc,
+		     uint32_t affinity,
+		     void (*entrypoint)(void *data1, unsigned long data2),
+		     void *data1, unsigned long data2)
+{
+	if (!thread_affinity_ok(affinity)) {
+		return EINVAL;
+	}
+	return thread_fork_common(name, proc, affinity,
+				  entrypoint, data1, data2);
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -617,6 +1018,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		TRACE(TRACE_SLEEP, wc, 0, wc->wc_name);
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -665,6 +1067,8 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	TRACE(TRACE_SWITCH, next, newstate, next->t_name);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -786,7 +1190,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
  *
  * The parts of the thread structure we don't actually need to run
  * should be cleaned up right away. The rest has to wait until
- * thread_destroy is called from exorcise().
+ * thread_destroy is called from thread_reap().
  *
  * Note that any dynamically-allocated structures that can vary in size from
  * thread to thread should be cleaned up here, not in thread_destroy. This is
@@ -805,10 +1209,12 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process, unless the exit code has done that
+	 * already (see proc_exit and uthread_leave).
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -832,10 +1238,25 @@ thread_exit(void)
 
 /*
  * Yield the cpu to another process, but stay runnable.
+ *
+ * If our affinity no longer allows this cpu we can't just go on the
+ * run queue of one it does allow: that cpu could start running us
+ * while we're still on our stack here. Instead sleep, and have this
+ * cpu's work queue thread, which can only run once we've switched
+ * away, wake us up; thread_make_runnable then puts us somewhere we
+ * may run.
  */
 void
 thread_yield(void)
 {
+	struct cpu *c = curcpu->c_self;
+
+	if (!c->c_isidle && !thread_cpu_ok(curthread, c)) {
+		spinlock_acquire(&c->c_movelock);
+		work_queue_on(c->c_number, &c->c_movework);
+		thread_switch(S_SLEEP, c->c_movechan, &c->c_movelock);
+		return;
+	}
 	thread_switch(S_READY, NULL, NULL);
 }
 
@@ -873,6 +1294,10 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * Threads are only ever sent to CPUs their affinity allows. Before
+ * balancing, ready threads that aren't allowed here any more are
+ * sent off to somewhere they are.
  */
 void
 thread_consider_migration(void)
@@ -881,7 +1306,31 @@ thread_consider_migration(void)
 	unsigned i, numcpus;
 	struct cpu *c;
 	struct threadlist victims;
-	struct thread *t;
+	struct thread *t, *next;
+
+	threadlist_init(&victims);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (t = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	     t != NULL; t = next) {
+		next = t->t_listnode.tln_next->tln_self;
+		/* Not curthread; see below. */
+		if (t != curthread && !thread_cpu_ok(t, curcpu->c_self)) {
+			threadlist_remove(&curcpu->c_runqueue, t);
+			threadlist_addtail(&victims, t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	while ((t = threadlist_remhead(&victims)) != NULL) {
+		c = thread_pickcpu(t);
+		spinlock_acquire(&c->c_runqueue_lock);
+		t->t_cpu = c;
+		thread_runqueue_insert(c, t);
+		if (c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
 
 	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
@@ -901,7 +1350,6 @@ thread_consider_migration(void)
 	}
 
 	to_send = my_count - one_share;
-	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
 		t = threadlist_remtail(&curcpu->c_runqueue);
@@ -944,9 +1392,18 @@ thread_consider_migration(void)
 				to_send--;
 				continue;
 			}
+			/*
+			 * Likewise skip threads that may not run on
+			 * this cpu; they'll stay here.
+			 */
+			if (!thread_cpu_ok(t, c)) {
+				threadlist_addtail(&victims, t);
+				to_send--;
+				continue;
+			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			thread_runqueue_insert(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -970,7 +1427,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			thread_runqueue_insert(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1042,23 +1499,107 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * State shared between wchan_sleep_timeout and its timer.
+ */
+struct wchan_timeout {
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	struct thread *wt_thread;
+	bool wt_expired;
+};
+
+/*
+ * Timer function for wchan_sleep_timeout. Runs in interrupt context.
+ * If the thread is still on the channel, nobody has woken it yet:
+ * take it off and wake it ourselves.
+ */
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *t;
+
+	spinlock_acquire(wt->wt_lock);
+	THREADLIST_FORALL(t, wt->wt_wchan->wc_threads) {
+		if (t == wt->wt_thread) {
+			threadlist_remove(&wt->wt_wchan->wc_threads, t);
+			wt->wt_expired = true;
+			TRACE(TRACE_WAKE, t, 0, wt->wt_wchan->wc_name);
+			thread_make_runnable(t, false);
+			break;
+		}
+	}
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after MS milliseconds. Returns 0 if
+ * woken normally and ETIMEDOUT if the time ran out.
+ */
+int
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, unsigned ms)
+{
+	struct wchan_timeout wt;
+	struct timer tm;
+
+	KASSERT(!curthread->t_in_interrupt);
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_thread = curthread;
+	wt.wt_expired = false;
+
+	/*
+	 * The timer can't get at us before we're on the channel,
+	 * because it needs LK and thread_switch doesn't release it
+	 * until we are.
+	 */
+	timer_init(&tm, wchan_timeout, &wt);
+	timer_add_ms(&tm, ms);
+
+	thread_switch(S_SLEEP, wc, lk);
+
+	/*
+	 * Cancel before relocking: if the timer function is running
+	 * on another CPU it may be waiting for LK, and timer_cancel
+	 * waits for it to finish.
+	 */
+	timer_cancel(&tm);
+	spinlock_acquire(lk);
+
+	return wt.wt_expired ? ETIMEDOUT : 0;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
 void
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
-	struct thread *target;
+	struct thread *target, *t;
 
 	KASSERT(spinlock_do_i_hold(lk));
 
-	/* Grab a thread from the channel */
-	target = threadlist_remhead(&wc->wc_threads);
+	/*
+	 * Grab the highest-priority thread from the channel; the
+	 * first one, if there's a tie.
+	 */
+	target = NULL;
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (target == NULL || t->t_pri > target->t_pri) {
+			target = t;
+		}
+	}
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
 		return;
 	}
+	threadlist_remove(&wc->wc_threads, target);
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1068,6 +1609,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
+	TRACE(TRACE_WAKE, target, 0, wc->wc_name);
 	thread_make_runnable(target, false);
 }
 
@@ -1098,6 +1640,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
+		TRACE(TRACE_WAKE, target, 0, wc->wc_name);
 		thread_make_runnable(target, false);
 	}
 
@@ -1121,6 +1664,188 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Priorities and priority inheritance.
+ *
+ * A thread waiting for a sleep lock lends its priority to the
+ * holder, recording it in the lock's lk_waitpri; if the holder is
+ * itself waiting for a lock, the loan is passed on. A thread's
+ * effective priority is the highest of its base priority and the
+ * lk_waitpri of each lock it holds, and is recomputed when it lets
+ * go of a lock.
+ *
+ * lk_thread and t_blockedon are only ever changed with
+ * thread_pri_lock held, so the walk along a chain of holders in
+ * thread_lock_block sees each link as it is: a thread it finds in
+ * lk_thread still holds that lock and so hasn't exited. Donations
+ * only travel through locks with waiters, so for a lock nobody is
+ * waiting for that's all taking or releasing it does.
+ */
+
+/*
+ * Change a thread's effective priority. If it's sitting on a run
+ * queue, move it to its new place. Call with thread_pri_lock held.
+ */
+static
+void
+thread_setpri(struct thread *t, int pri)
+{
+	struct cpu *c;
+	struct thread *q;
+
+	KASSERT(spinlock_do_i_hold(&thread_pri_lock));
+
+	t->t_pri = pri;
+	if (t == curthread) {
+		return;
+	}
+
+	/*
+	 * If it's being migrated it may not be on this (or any) run
+	 * queue; then it'll be placed properly when it lands.
+	 */
+	c = t->t_cpu;
+	spinlock_acquire(&c->c_runqueue_lock);
+	THREADLIST_FORALL(q, c->c_runqueue) {
+		if (q == t) {
+			threadlist_remove(&c->c_runqueue, t);
+			thread_runqueue_insert(c, t);
+			break;
+		}
+	}
+	spinlock_release(&c->c_runqueue_lock);
+}
+
+/*
+ * Work out what priority the current thread should run at.
+ */
+static
+int
+thread_pri_compute(void)
+{
+	struct lock *lk;
+	int pri;
+
+	pri = curthread->t_basepri;
+	for (lk = curthread->t_heldlocks; lk != NULL; lk = lk->lk_nextheld) {
+		if (lk->lk_waitpri > pri) {
+			pri = lk->lk_waitpri;
+		}
+	}
+	return pri;
+}
+
+void
+thread_setpriority(int pri)
+{
+	KASSERT(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	spinlock_acquire(&thread_pri_lock);
+	curthread->t_basepri = pri;
+	thread_setpri(curthread, thread_pri_compute());
+	spinlock_release(&thread_pri_lock);
+}
+
+void
+thread_lock_block(struct lock *lock)
+{
+	struct thread *donor, *holder;
+	unsigned depth;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	spinlock_acquire(&thread_pri_lock);
+	curthread->t_blockedon = lock;
+
+	donor = curthread;
+	for (depth = 0; lock != NULL && depth < PRI_DONATE_DEPTH; depth++) {
+		holder = (struct thread *)lock->lk_thread;
+		if (holder == NULL || holder == curthread) {
+			/* Free now, or a deadlock; either way, stop. */
+			break;
+		}
+		if (lock->lk_waitpri < donor->t_pri) {
+			lock->lk_waitpri = donor->t_pri;
+		}
+		if (holder->t_pri >= donor->t_pri) {
+			break;
+		}
+		thread_setpri(holder, donor->t_pri);
+
+		donor = holder;
+		lock = holder->t_blockedon;
+	}
+
+	spinlock_release(&thread_pri_lock);
+}
+
+void
+thread_lock_own(struct lock *lock, bool waited)
+{
+	struct thread *t;
+	int pri;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_thread == NULL);
+
+	lock->lk_nextheld = curthread->t_heldlocks;
+	curthread->t_heldlocks = lock;
+
+	spinlock_acquire(&thread_pri_lock);
+	lock->lk_thread = curthread;
+	curthread->t_blockedon = NULL;
+
+	if (!waited && threadlist_isempty(&lock->lk_wchan->wc_threads)) {
+		/* Nobody can be lending through this lock. */
+		spinlock_release(&thread_pri_lock);
+		return;
+	}
+
+	/* Whoever is still waiting now lends to us. */
+	pri = PRI_NONE;
+	THREADLIST_FORALL(t, lock->lk_wchan->wc_threads) {
+		if (t->t_pri > pri) {
+			pri = t->t_pri;
+		}
+	}
+	lock->lk_waitpri = pri;
+	if (pri > curthread->t_pri) {
+		thread_setpri(curthread, pri);
+	}
+	spinlock_release(&thread_pri_lock);
+}
+
+void
+thread_lock_disown(struct lock *lock)
+{
+	struct lock **lkp;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+	KASSERT(lock->lk_thread == curthread);
+
+	for (lkp = &curthread->t_heldlocks; *lkp != lock;
+	     lkp = &(*lkp)->lk_nextheld) {
+		KASSERT(*lkp != NULL);
+	}
+	*lkp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+
+	spinlock_acquire(&thread_pri_lock);
+	lock->lk_thread = NULL;
+
+	if (threadlist_isempty(&lock->lk_wchan->wc_threads)) {
+		/* Nobody waiting, so nothing was lent through this lock. */
+		spinlock_release(&thread_pri_lock);
+		return;
+	}
+
+	lock->lk_waitpri = PRI_NONE;
+	thread_setpri(curthread, thread_pri_compute());
+	spinlock_release(&thread_pri_lock);
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Machine-independent IPI handling
  */
@@ -1133,6 +1858,7 @@ ipi_send(struct cpu *target, int code)
 {
 	KASSERT(code >= 0 && code < 32);
 
+	TRACE(TRACE_IPISEND, target->c_number, code, NULL);
 	spinlock_acquire(&target->c_ipi_lock);
 	target->c_ipi_pending |= (uint32_t)1 << code;
 	mainbus_send_ipi(target);
@@ -1158,6 +1884,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	int n;
 
+	TRACE(TRACE_IPISEND, target->c_number, IPI_TLBSHOOTDOWN, NULL);
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
@@ -1168,6 +1895,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	target->c_shootdown_sent++;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1175,6 +1903,49 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Shoot down a mapping on every CPU that might have it loaded for
+ * process P, and wait for them. The TLB is flushed on context switch,
+ * so that's only the CPUs running one of P's threads at the moment. A
+ * CPU that switches to one of P's threads after we look flushes as it
+ * does so and needs nothing from us.
+ */
+void
+ipi_tlbshootdown_proc(struct proc *p, const struct tlbshootdown *mapping)
+{
+	unsigned i, n;
+	struct cpu *c;
+	struct cpu *targets[MAXCPUS];
+	unsigned want[MAXCPUS];
+	struct thread *t;
+
+	/* Spinning with interrupts off could deadlock against a peer. */
+	KASSERT(curthread->t_curspl == 0);
+
+	n = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		t = c->c_curthread;
+		if (t == NULL || t->t_proc != p) {
+			continue;
+		}
+		ipi_tlbshootdown(c, mapping);
+		spinlock_acquire(&c->c_ipi_lock);
+		want[n] = c->c_shootdown_sent;
+		spinlock_release(&c->c_ipi_lock);
+		targets[n++] = c;
+	}
+
+	for (i=0; i<n; i++) {
+		while ((int)(targets[i]->c_shootdown_done - want[i]) < 0) {
+			/* spin; IPIs sent to us still get through */
+		}
+	}
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1183,6 +1954,7 @@ interprocessor_interrupt(void)
 
 	spinlock_acquire(&curcpu->c_ipi_lock);
 	bits = curcpu->c_ipi_pending;
+	TRACE(TRACE_IPIRECV, bits, 0, NULL);
 
 	if (bits & (1U << IPI_PANIC)) {
 		/* panic on another cpu - just stop dead */
@@ -1216,6 +1988,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_sent;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -0,0 +1,289 @@
+/*
+ * Kernel timers: a hierarchical timing wheel. See timer.h.
+ *
+ * The wheel has five levels. The first has 256 slots of one tick
+ * each; each of the other four has 64 slots, each slot covering a
+ * whole turn of the level below. A timer goes in the lowest level
+ * whose span covers its delay. When a level wraps, the next slot of
+ * the level above is emptied and its timers are redistributed
+ * ("cascaded") downwards. Together the levels cover all 32 bits of
+ * the tick counter.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <timer.h>
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVN_LEVELS	4
+
+/* Slot in upper level N (0-based) for tick T */
+#define TVN_INDEX(t, n)	(((t) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+/* Longest delay we accept; anything longer is clamped. */
+#define TIMER_MAXTICKS	0x7fffffffU
+
+static struct timer *timer_tv1[TVR_SIZE];
+static struct timer *timer_tvn[TVN_LEVELS][TVN_SIZE];
+
+/*
+ * timer_ticks is the next tick the wheel will process. Everything
+ * above is protected by timer_lock. timer_running is the timer whose
+ * function is being called right now, if any, so timer_cancel can
+ * wait for it.
+ */
+static uint32_t timer_ticks;
+static struct timer *volatile timer_running;
+static struct spinlock timer_lock = SPINLOCK_INITIALIZER;
+
+/* For timer_sleep. Nothing ever wakes this; sleepers just time out. */
+static struct wchan *timer_sleepchan;
+static struct spinlock timer_sleeplock;
+
+void
+timer_bootstrap(void)
+{
+	spinlock_init(&timer_sleeplock);
+	timer_sleepchan = wchan_create("timer_sleep");
+	if (timer_sleepchan == NULL) {
+		panic("Couldn't create timer_sleep\n");
+	}
+}
+
+uint32_t
+timer_now(void)
+{
+	return timer_ticks;
+}
+
+uint32_t
+timer_mstoticks(unsigned ms)
+{
+	uint64_t ticks;
+
+	ticks = ((uint64_t)ms * HZ + 999) / 1000;
+	if (ticks > TIMER_MAXTICKS) {
+		ticks = TIMER_MAXTICKS;
+	}
+	return ticks;
+}
+
+void
+timer_init(struct timer *tm, void (*func)(void *), void *data)
+{
+	tm->tm_next = NULL;
+	tm->tm_pprev = NULL;
+	tm->tm_expires = 0;
+	tm->tm_func = func;
+	tm->tm_data = data;
+	tm->tm_pending = false;
+}
+
+/*
+ * Slot list handling. Call with timer_lock held.
+ */
+static
+void
+timer_link(struct timer **slot, struct timer *tm)
+{
+	tm->tm_next = *slot;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_pprev = &tm->tm_next;
+	}
+	tm->tm_pprev = slot;
+	*slot = tm;
+}
+
+static
+void
+timer_unlink(struct timer *tm)
+{
+	*tm->tm_pprev = tm->tm_next;
+	if (tm->tm_next != NULL) {
+		tm->tm_next->tm_pprev = tm->tm_pprev;
+	}
+	tm->tm_next = NULL;
+	tm->tm_pprev = NULL;
+}
+
+/*
+ * Put a timer in the right slot for its expiry time.
+ */
+static
+void
+timer_place(struct timer *tm)
+{
+	uint32_t expires = tm->tm_expires;
+	uint32_t delta = expires - timer_ticks;
+	struct timer **slot;
+	unsigned level;
+
+	if ((int32_t)delta < 0) {
+		/* Already due; run it on the next tick. */
+		slot = &timer_tv1[timer_ticks & TVR_MASK];
+	}
+	else if (delta < TVR_SIZE) {
+		slot = &timer_tv1[expires & TVR_MASK];
+	}
+	else {
+		for (level = 0; level < TVN_LEVELS - 1; level++) {
+			if (delta < (1U << (TVR_BITS + (level+1) * TVN_BITS))) {
+				break;
+			}
+		}
+		slot = &timer_tvn[level][TVN_INDEX(expires, level)];
+	}
+	timer_link(slot, tm);
+}
+
+void
+timer_add(struct timer *tm, uint32_t ticks)
+{
+	KASSERT(tm->tm_func != NULL);
+
+	if (ticks > TIMER_MAXTICKS) {
+		ticks = TIMER_MAXTICKS;
+	}
+
+	spinlock_acquire(&timer_lock);
+	if (tm->tm_pending) {
+		timer_unlink(tm);
+	}
+	/*
+	 * timer_ticks has not been processed yet, so a timer for
+	 * timer_ticks + N fires after the rest of the current tick
+	 * plus N whole ticks: never early.
+	 */
+	tm->tm_expires = timer_ticks + ticks;
+	tm->tm_pending = true;
+	timer_place(tm);
+	spinlock_release(&timer_lock);
+}
+
+void
+timer_add_ms(struct timer *tm, unsigned ms)
+{
+	timer_add(tm, timer_mstoticks(ms));
+}
+
+bool
+timer_cancel(struct timer *tm)
+{
+	bool waspending;
+
+	spinlock_acquire(&timer_lock);
+	/*
+	 * If the function is running on CPU 0, wait for it. (If we
+	 * *are* on CPU 0 and it's running, we're being called from
+	 * the function itself, and waiting would never end.)
+	 */
+	while (timer_running == tm && curcpu->c_number != 0) {
+		spinlock_release(&timer_lock);
+		while (timer_running == tm) {
+			/* spin */
+		}
+		spinlock_acquire(&timer_lock);
+	}
+	waspending = tm->tm_pending;
+	if (waspending) {
+		timer_unlink(tm);
+		tm->tm_pending = false;
+	}
+	spinlock_release(&timer_lock);
+
+	return waspending;
+}
+
+/*
+ * Empty slot INDEX of upper level LEVEL and redistribute its timers.
+ * Returns INDEX, so the caller can tell whether this level wrapped
+ * too and the next one up needs cascading.
+ */
+static
+unsigned
+timer_cascade(unsigned level, unsigned index)
+{
+	struct timer *list, *tm;
+
+	list = timer_tvn[level][index];
+	timer_tvn[level][index] = NULL;
+	if (list != NULL) {
+		list->tm_pprev = &list;
+	}
+
+	while (list != NULL) {
+		tm = list;
+		timer_unlink(tm);
+		timer_place(tm);
+	}
+	return index;
+}
+
+/*
+ * Process one tick.
+ */
+void
+timer_tick(void)
+{
+	struct timer *list, *tm;
+	unsigned index, level;
+
+	spinlock_acquire(&timer_lock);
+
+	index = timer_ticks & TVR_MASK;
+	if (index == 0) {
+		for (level = 0; level < TVN_LEVELS; level++) {
+			if (timer_cascade(level,
+					  TVN_INDEX(timer_ticks, level)) != 0) {
+				break;
+			}
+		}
+	}
+	timer_ticks++;
+
+	/*
+	 * Everything left in this slot is due. Move it to a private
+	 * list first: a timer added while we're calling functions
+	 * could otherwise land in this same slot and fire a whole turn
+	 * early. Drop the lock while calling each function so it can
+	 * add timers. Cancelling a timer still on the private list
+	 * unlinks it from there, which is fine.
+	 */
+	list = timer_tv1[index];
+	timer_tv1[index] = NULL;
+	if (list != NULL) {
+		list->tm_pprev = &list;
+	}
+
+	while ((tm = list) != NULL) {
+		timer_unlink(tm);
+		tm->tm_pending = false;
+		timer_running = tm;
+		spinlock_release(&timer_lock);
+
+		tm->tm_func(tm->tm_data);
+
+		spinlock_acquire(&timer_lock);
+		timer_running = NULL;
+	}
+
+	spinlock_release(&timer_lock);
+}
+
+void
+timer_sleep(unsigned ms)
+{
+	spinlock_acquire(&timer_sleeplock);
+	wchan_sleep_timeout(timer_sleepchan, &timer_sleeplock, ms);
+	spinlock_release(&timer_sleeplock);
+}
@@ -0,0 +1,177 @@
+/*
+ * Kernel event tracing. See trace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <membar.h>
+#include <thread.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <trace.h>
+
+/* Records per CPU; must be a power of 2 */
+#define TRACE_NRECS	1024
+
+/* One record: 32 bytes. */
+struct trace_rec {
+	uint32_t tr_cycles;
+	uint32_t tr_type;
+	uint32_t tr_thread;
+	uint32_t tr_a0;
+	uint32_t tr_a1;
+	char tr_name[TRACE_NAMELEN];
+};
+
+/*
+ * One CPU's ring. Only that CPU writes it, with interrupts off.
+ * tr_next counts records ever written; the slot is tr_next modulo
+ * the ring size. The buffers are allocated the first time tracing
+ * is started and kept after that.
+ *
+ * tr_busy is set while a record is being written. trace_record sets
+ * it before checking trace_enabled again, and trace_quiesce clears
+ * trace_enabled before looking at it, so once trace_quiesce is done
+ * no CPU is writing or will write until tracing starts again.
+ */
+struct trace_ring {
+	struct trace_rec *tr_recs;
+	unsigned tr_next;
+	volatile bool tr_busy;
+};
+
+static struct trace_ring trace_rings[MAXCPUS];
+
+volatile bool trace_enabled;
+
+void
+trace_record(unsigned type, uint32_t a0, uint32_t a1, const char *name)
+{
+	struct trace_ring *ring;
+	struct trace_rec *rec;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	ring = &trace_rings[curcpu->c_number];
+	ring->tr_busy = true;
+	membar_any_any();
+	if (trace_enabled && ring->tr_recs != NULL) {
+		rec = &ring->tr_recs[ring->tr_next & (TRACE_NRECS - 1)];
+		ring->tr_next++;
+
+		rec->tr_cycles = cpu_getcycles();
+		rec->tr_type = type;
+		rec->tr_thread = (uint32_t)(uintptr_t)curthread;
+		rec->tr_a0 = a0;
+		rec->tr_a1 = a1;
+		i = 0;
+		if (name != NULL) {
+			for (; i < TRACE_NAMELEN - 1 && name[i] != 0; i++) {
+				rec->tr_name[i] = name[i];
+			}
+		}
+		rec->tr_name[i] = 0;
+	}
+	membar_any_store();
+	ring->tr_busy = false;
+	splx(spl);
+}
+
+/*
+ * Turn tracing off and wait for records being written to be done.
+ */
+static
+void
+trace_quiesce(void)
+{
+	unsigned i;
+
+	trace_enabled = false;
+	membar_any_any();
+
+	for (i=0; i<num_cpus; i++) {
+		while (trace_rings[i].tr_busy) {
+			/* spin; it's a few stores */
+		}
+	}
+	membar_load_load();
+}
+
+int
+trace_start(void)
+{
+	struct trace_ring *ring;
+	unsigned i;
+
+	trace_quiesce();
+
+	for (i=0; i<num_cpus; i++) {
+		ring = &trace_rings[i];
+		if (ring->tr_recs == NULL) {
+			ring->tr_recs = kmalloc(TRACE_NRECS * sizeof(*ring->tr_recs));
+			if (ring->tr_recs == NULL) {
+				return ENOMEM;
+			}
+		}
+		ring->tr_next = 0;
+	}
+
+	membar_store_store();
+	trace_enabled = true;
+	return 0;
+}
+
+void
+trace_stop(void)
+{
+	trace_quiesce();
+}
+
+/*
+ * Print the rings. Records come out a CPU at a time, oldest first,
+ * as
+ *
+ *    trace <cpu> <cycles> <type> <thread> <a0> <a1> <name>
+ *
+ * with the cycle count, thread and arguments in hex and blanks in
+ * the name replaced so it stays one word. The lines are bracketed by
+ * trace-begin <ncpus> and trace-end so the decoder can pick them out
+ * of a console log.
+ */
+void
+trace_dump(void)
+{
+	struct trace_ring *ring;
+	struct trace_rec *rec;
+	char name[TRACE_NAMELEN];
+	unsigned cpu, n, first, j;
+
+	trace_stop();
+
+	kprintf("trace-begin %u\n", num_cpus);
+	for (cpu=0; cpu<num_cpus; cpu++) {
+		ring = &trace_rings[cpu];
+		if (ring->tr_recs == NULL) {
+			continue;
+		}
+		first = ring->tr_next > TRACE_NRECS ?
+			ring->tr_next - TRACE_NRECS : 0;
+		for (n = first; n != ring->tr_next; n++) {
+			rec = &ring->tr_recs[n & (TRACE_NRECS - 1)];
+			for (j=0; rec->tr_name[j] != 0; j++) {
+				name[j] = rec->tr_name[j] == ' ' ?
+					'_' : rec->tr_name[j];
+			}
+			name[j] = 0;
+			kprintf("trace %u %08x %u %08x %08x %08x %s\n",
+				cpu, rec->tr_cycles, rec->tr_type,
+				rec->tr_thread, rec->tr_a0, rec->tr_a1,
+				j > 0 ? name : "-");
+		}
+	}
+	kprintf("trace-end\n");
+}
@@ -0,0 +1,312 @@
+/*
+ * Deferred work. See workqueue.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <workqueue.h>
+
+/*
+ * One CPU's queue. The list and the worker's sleeping are protected
+ * by wq_lock. The worker is forked on its CPU already pinned there
+ * by its affinity mask, so it is never balanced away, not even before
+ * it first runs.
+ */
+struct workqueue {
+	struct spinlock wq_lock;
+	struct work *wq_head;		/* next item to run */
+	struct work **wq_tailp;		/* where to link the next item */
+	struct wchan *wq_wchan;		/* worker sleeps here */
+	struct wchan *wq_flushchan;	/* work_flush sleeps here */
+	struct thread *wq_worker;
+	bool wq_started;
+};
+
+static struct workqueue workqueues[MAXCPUS];
+
+/*
+ * Pick the queue for CPU. If that CPU hasn't started its worker (this
+ * should only matter early in boot) fall back to CPU 0, which always
+ * has one.
+ */
+static
+struct workqueue *
+workqueue_get(unsigned cpu)
+{
+	KASSERT(cpu < MAXCPUS);
+	if (!workqueues[cpu].wq_started) {
+		cpu = 0;
+	}
+	KASSERT(workqueues[cpu].wq_started);
+	return &workqueues[cpu];
+}
+
+void
+work_init(struct work *wk, void (*func)(void *), void *data)
+{
+	wk->wk_next = NULL;
+	wk->wk_func = func;
+	wk->wk_data = data;
+	wk->wk_cpu = 0;
+	wk->wk_pending = false;
+	timer_init(&wk->wk_timer, NULL, NULL);
+}
+
+/*
+ * Put an item on a queue. The caller has already marked it pending.
+ */
+static
+void
+workqueue_insert(struct workqueue *wq, struct work *wk)
+{
+	spinlock_acquire(&wq->wq_lock);
+	wk->wk_next = NULL;
+	*wq->wq_tailp = wk;
+	wq->wq_tailp = &wk->wk_next;
+	wchan_wakeone(wq->wq_wchan, &wq->wq_lock);
+	spinlock_release(&wq->wq_lock);
+}
+
+/*
+ * Claim an item for queueing, or release it when it comes off its
+ * queue. An idle item isn't on any queue whose lock could protect
+ * wk_pending, so there is one lock for all of them. It's held only
+ * for a test and a store.
+ */
+static struct spinlock work_claimlock = SPINLOCK_INITIALIZER;
+
+static
+bool
+work_claim(struct work *wk, unsigned cpu)
+{
+	bool claimed;
+
+	spinlock_acquire(&work_claimlock);
+	claimed = !wk->wk_pending;
+	if (claimed) {
+		wk->wk_pending = true;
+		wk->wk_cpu = cpu;
+	}
+	spinlock_release(&work_claimlock);
+	return claimed;
+}
+
+static
+void
+work_unclaim(struct work *wk)
+{
+	spinlock_acquire(&work_claimlock);
+	wk->wk_pending = false;
+	spinlock_release(&work_claimlock);
+}
+
+bool
+work_queue_on(unsigned cpu, struct work *wk)
+{
+	struct workqueue *wq;
+
+	wq = workqueue_get(cpu);
+	if (!work_claim(wk, cpu)) {
+		return false;
+	}
+	workqueue_insert(wq, wk);
+	return true;
+}
+
+bool
+work_queue(struct work *wk)
+{
+	return work_queue_on(curcpu->c_number, wk);
+}
+
+/*
+ * Timer function for delayed work.
+ */
+static
+void
+work_timeout(void *data)
+{
+	struct work *wk = data;
+
+	workqueue_insert(workqueue_get(wk->wk_cpu), wk);
+}
+
+bool
+work_queue_delayed(struct work *wk, unsigned ms)
+{
+	if (!work_claim(wk, curcpu->c_number)) {
+		return false;
+	}
+	timer_init(&wk->wk_timer, work_timeout, wk);
+	timer_add_ms(&wk->wk_timer, ms);
+	return true;
+}
+
+bool
+work_cancel(struct work *wk)
+{
+	struct workqueue *wq;
+	struct work **pp;
+	bool found;
+
+	/*
+	 * If it's still waiting on its timer, that's the end of it.
+	 * Otherwise timer_cancel has waited for the timer function,
+	 * so if the item is still pending it's on its queue.
+	 */
+	if (wk->wk_timer.tm_func != NULL && timer_cancel(&wk->wk_timer)) {
+		work_unclaim(wk);
+		return true;
+	}
+
+	wq = workqueue_get(wk->wk_cpu);
+	found = false;
+	spinlock_acquire(&wq->wq_lock);
+	for (pp = &wq->wq_head; *pp != NULL; pp = &(*pp)->wk_next) {
+		if (*pp == wk) {
+			*pp = wk->wk_next;
+			if (wq->wq_tailp == &wk->wk_next) {
+				wq->wq_tailp = pp;
+			}
+			found = true;
+			break;
+		}
+	}
+	spinlock_release(&wq->wq_lock);
+
+	if (found) {
+		work_unclaim(wk);
+	}
+	return found;
+}
+
+/*
+ * The worker thread. DATA2 is the CPU number.
+ */
+static
+void
+workqueue_thread(void *data1, unsigned long data2)
+{
+	struct workqueue *wq = &workqueues[data2];
+	struct work *wk;
+	void (*func)(void *);
+	void *data;
+
+	(void)data1;
+
+	spinlock_acquire(&wq->wq_lock);
+	wq->wq_worker = curthread;
+	while (1) {
+		while (wq->wq_head == NULL) {
+			wchan_sleep(wq->wq_wchan, &wq->wq_lock);
+		}
+		wk = wq->wq_head;
+		wq->wq_head = wk->wk_next;
+		if (wq->wq_head == NULL) {
+			wq->wq_tailp = &wq->wq_head;
+		}
+		spinlock_release(&wq->wq_lock);
+
+		/*
+		 * Once it's no longer pending the function may free
+		 * the item, so take what we need first.
+		 */
+		func = wk->wk_func;
+		data = wk->wk_data;
+		work_unclaim(wk);
+
+		func(data);
+
+		spinlock_acquire(&wq->wq_lock);
+	}
+}
+
+/*
+ * Flushing: queue a marker on each CPU and wait for the workers to
+ * get to it. Queues run in order, so everything ahead of the marker
+ * is done by then.
+ */
+struct work_barrier {
+	struct work wb_work;
+	struct workqueue *wb_wq;
+	bool wb_done;
+};
+
+static
+void
+work_barrier_func(void *data)
+{
+	struct work_barrier *wb = data;
+
+	spinlock_acquire(&wb->wb_wq->wq_lock);
+	wb->wb_done = true;
+	wchan_wakeall(wb->wb_wq->wq_flushchan, &wb->wb_wq->wq_lock);
+	spinlock_release(&wb->wb_wq->wq_lock);
+}
+
+void
+work_flush(void)
+{
+	struct work_barrier wb;
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		if (!workqueues[i].wq_started) {
+			continue;
+		}
+		/* A work function flushing its own queue would hang. */
+		KASSERT(workqueues[i].wq_worker != curthread);
+
+		work_init(&wb.wb_work, work_barrier_func, &wb);
+		wb.wb_wq = &workqueues[i];
+		wb.wb_done = false;
+		work_queue_on(i, &wb.wb_work);
+
+		spinlock_acquire(&wb.wb_wq->wq_lock);
+		while (!wb.wb_done) {
+			wchan_sleep(wb.wb_wq->wq_flushchan, &wb.wb_wq->wq_lock);
+		}
+		spinlock_release(&wb.wb_wq->wq_lock);
+	}
+}
+
+void
+workqueue_start(void)
+{
+	struct workqueue *wq;
+	unsigned cpu;
+	char name[32];
+	int result;
+
+	cpu = curcpu->c_number;
+	KASSERT(cpu < MAXCPUS);
+	wq = &workqueues[cpu];
+	KASSERT(!wq->wq_started);
+
+	spinlock_init(&wq->wq_lock);
+	wq->wq_head = NULL;
+	wq->wq_tailp = &wq->wq_head;
+	wq->wq_wchan = wchan_create("workqueue");
+	wq->wq_flushchan = wchan_create("workflush");
+	if (wq->wq_wchan == NULL || wq->wq_flushchan == NULL) {
+		panic("workqueue_start: out of memory\n");
+	}
+
+	wq->wq_worker = NULL;
+
+	/* Items may be queued before the worker first runs. */
+	wq->wq_started = true;
+
+	snprintf(name, sizeof(name), "workqueue/%u", cpu);
+	result = thread_fork_affinity(name, NULL, CPUMASK_BIT(cpu),
+				      workqueue_thread, NULL, cpu);
+	if (result) {
+		panic("workqueue_start: thread_fork: %s\n", strerror(result));
+	}
+}
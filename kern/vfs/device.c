@@ -42,6 +42,7 @@
 #include <synch.h>
 #include <vnode.h>
 #include <device.h>
+#include <poll.h>
 
 /*
  * Called for each open().
@@ -267,6 +268,22 @@ dev_truncate(struct vnode *v, off_t len)
 	return EINVAL;
 }
 
+/*
+ * Poll. Most devices never make anyone wait long enough to matter,
+ * so they don't bother to say.
+ */
+static
+int
+dev_poll(struct vnode *v, int events, struct poller *pl)
+{
+	struct device *d = v->vn_data;
+
+	if (d->d_ops->devop_poll == NULL) {
+		return vop_poll_ready(v, events, pl);
+	}
+	return DEVOP_POLL(d, events, pl);
+}
+
 /*
  * For namefile (which implements "pwd")
  *
@@ -329,7 +346,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_reclaim = dev_reclaim,
 	.vop_read = dev_read,
 	.vop_readlink = vopfail_uio_inval,
-	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_getdirentry = vopfail_getdirentry_notdir,
 	.vop_write = dev_write,
 	.vop_ioctl = dev_ioctl,
 	.vop_stat = dev_stat,
@@ -339,6 +356,7 @@ static const struct vnode_ops dev_vnode_ops = {
 	.vop_mmap = dev_mmap,
 	.vop_truncate = dev_truncate,
 	.vop_namefile = dev_namefile,
+	.vop_poll = dev_poll,
 	.vop_creat = vopfail_creat_notdir,
 	.vop_symlink = vopfail_symlink_notdir,
 	.vop_mkdir = vopfail_mkdir_notdir,
@@ -0,0 +1,554 @@
+/*
+ * Pipes. See pipe.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stat.h>
+#include <lib.h>
+#include <limits.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <pipe.h>
+#include <poll.h>
+
+/* Most a writer lends at once. */
+#define PIPE_LOANPAGES	16
+
+/*
+ * Everything below the vnodes is protected by pp_lock.
+ *
+ * The ring holds pp_count bytes starting at pp_head. While a writer
+ * has pages on loan (pp_loanlen != 0) the ring is empty and stays
+ * that way, so data comes out in the order it went in; readers take
+ * from the loan until pp_loandone reaches pp_loanlen, and the writer
+ * then takes its pages back.
+ */
+struct pipe {
+	struct vnode pp_rvn;		/* read end */
+	struct vnode pp_wvn;		/* write end */
+	struct lock *pp_lock;
+	struct cv *pp_readcv;		/* data, a loan, or no writers */
+	struct cv *pp_writecv;		/* space, loan done, or no readers */
+	struct pollhead pp_rpoll;	/* same as pp_readcv, for poll */
+	struct pollhead pp_wpoll;	/* same as pp_writecv, for poll */
+	char *pp_buf;
+	size_t pp_head;
+	size_t pp_count;
+	bool pp_rclosed;
+	bool pp_wclosed;
+	bool pp_nonblock;
+	paddr_t pp_loan[PIPE_LOANPAGES];
+	size_t pp_loanlen;
+	size_t pp_loandone;
+};
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	if (pp->pp_buf != NULL) {
+		free_kpages((vaddr_t)pp->pp_buf);
+	}
+	if (pp->pp_writecv != NULL) {
+		cv_destroy(pp->pp_writecv);
+	}
+	if (pp->pp_readcv != NULL) {
+		cv_destroy(pp->pp_readcv);
+	}
+	if (pp->pp_lock != NULL) {
+		lock_destroy(pp->pp_lock);
+	}
+	pollhead_cleanup(&pp->pp_wpoll);
+	pollhead_cleanup(&pp->pp_rpoll);
+	kfree(pp);
+}
+
+/*
+ * Wake whoever is waiting on the read or the write end, whether in
+ * read or write or in poll.
+ */
+static
+void
+pipe_wakereaders(struct pipe *pp)
+{
+	cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	pollwakeup(&pp->pp_rpoll);
+}
+
+static
+void
+pipe_wakewriters(struct pipe *pp)
+{
+	cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	pollwakeup(&pp->pp_wpoll);
+}
+
+/*
+ * Pipes aren't opened by name, so this is never called.
+ */
+static
+int
+pipe_eachopen(struct vnode *vn, int flags)
+{
+	(void)vn;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Called when the last reference to one end goes. Tell whoever is
+ * waiting on the other end, and free the pipe once both are gone.
+ */
+static
+int
+pipe_reclaim(struct vnode *vn)
+{
+	struct pipe *pp = vn->vn_data;
+	bool done;
+
+	lock_acquire(pp->pp_lock);
+	if (vn == &pp->pp_rvn) {
+		pp->pp_rclosed = true;
+		pipe_wakewriters(pp);
+	}
+	else {
+		pp->pp_wclosed = true;
+		pipe_wakereaders(pp);
+	}
+	vnode_cleanup(vn);
+	done = pp->pp_rclosed && pp->pp_wclosed;
+	lock_release(pp->pp_lock);
+
+	if (done) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+/*
+ * Read whatever is there, waiting only if nothing is.
+ */
+static
+int
+pipe_read(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pp = vn->vn_data;
+	size_t len, off;
+	char *page;
+	int result = 0;
+
+	if (vn != &pp->pp_rvn) {
+		return EBADF;
+	}
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	lock_acquire(pp->pp_lock);
+	while (pp->pp_count == 0 && pp->pp_loandone == pp->pp_loanlen) {
+		if (pp->pp_wclosed) {
+			/* EOF */
+			lock_release(pp->pp_lock);
+			return 0;
+		}
+		if (pp->pp_nonblock) {
+			lock_release(pp->pp_lock);
+			return EAGAIN;
+		}
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+	}
+
+	if (pp->pp_count > 0) {
+		while (uio->uio_resid > 0 && pp->pp_count > 0) {
+			len = PIPE_SIZE - pp->pp_head;
+			if (len > pp->pp_count) {
+				len = pp->pp_count;
+			}
+			if (len > uio->uio_resid) {
+				len = uio->uio_resid;
+			}
+			result = uiomove(pp->pp_buf + pp->pp_head, len, uio);
+			if (result) {
+				break;
+			}
+			pp->pp_head = (pp->pp_head + len) % PIPE_SIZE;
+			pp->pp_count -= len;
+		}
+	}
+	else {
+		/* Copy straight from the writer's pages. */
+		while (uio->uio_resid > 0 && pp->pp_loandone < pp->pp_loanlen) {
+			off = pp->pp_loandone % PAGE_SIZE;
+			page = (char *)PADDR_TO_KVADDR(
+				pp->pp_loan[pp->pp_loandone / PAGE_SIZE]);
+			len = PAGE_SIZE - off;
+			if (len > uio->uio_resid) {
+				len = uio->uio_resid;
+			}
+			result = uiomove(page + off, len, uio);
+			if (result) {
+				break;
+			}
+			pp->pp_loandone += len;
+		}
+	}
+
+	pipe_wakewriters(pp);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+/*
+ * Can the writer lend pages for the start of UIO? Only whole pages
+ * of a user buffer, and only if it's big enough that the ring would
+ * have to fill and drain at least once anyway.
+ */
+static
+bool
+pipe_canlend(struct pipe *pp, struct uio *uio)
+{
+	struct iovec *iov = uio->uio_iov;
+
+	return !pp->pp_nonblock &&
+		uio->uio_segflg == UIO_USERSPACE &&
+		uio->uio_resid >= PIPE_SIZE &&
+		iov->iov_len >= PAGE_SIZE &&
+		(vaddr_t)iov->iov_ubase % PAGE_SIZE == 0;
+}
+
+/*
+ * Find the physical pages behind the start of UIO's current buffer,
+ * up to PIPE_LOANPAGES of them. Returns how many bytes that covers.
+ * The page table only lists resident pages, so touch each one first.
+ * Each page found is pinned with a reference of its own, so it stays
+ * put even if another of our threads sbrks or shmdts it away while
+ * we're blocked in write; pipe_lend drops the references.
+ */
+static
+size_t
+pipe_getloan(struct uio *uio, paddr_t *pages)
+{
+	struct iovec *iov = uio->uio_iov;
+	vaddr_t va = (vaddr_t)iov->iov_ubase;
+	unsigned i, n;
+	char junk;
+
+	n = iov->iov_len / PAGE_SIZE;
+	if (n > PIPE_LOANPAGES) {
+		n = PIPE_LOANPAGES;
+	}
+	for (i=0; i<n; i++) {
+		if (copyin((const_userptr_t)(va + i * PAGE_SIZE), &junk, 1)) {
+			break;
+		}
+		if (as_pin(uio->uio_space, va + i * PAGE_SIZE, &pages[i])) {
+			break;
+		}
+	}
+	return i * PAGE_SIZE;
+}
+
+/*
+ * Lend LEN bytes of pages to the pipe and wait for readers to take
+ * them, then account for what they took in UIO. The pages are pinned
+ * by pipe_getloan; unpin them once the loan is over.
+ */
+static
+int
+pipe_lend(struct pipe *pp, struct uio *uio, const paddr_t *pages,
+	  size_t len)
+{
+	struct iovec *iov = uio->uio_iov;
+	size_t done;
+	unsigned i;
+
+	KASSERT(lock_do_i_hold(pp->pp_lock));
+
+	/* Let what's ahead of us drain first. */
+	while ((pp->pp_count > 0 || pp->pp_loanlen > 0) && !pp->pp_rclosed) {
+		cv_wait(pp->pp_writecv, pp->pp_lock);
+	}
+	if (pp->pp_rclosed) {
+		done = 0;
+		goto out;
+	}
+
+	memcpy(pp->pp_loan, pages, DIVROUNDUP(len, PAGE_SIZE) *
+	       sizeof(paddr_t));
+	pp->pp_loanlen = len;
+	pp->pp_loandone = 0;
+	pipe_wakereaders(pp);
+
+	while (pp->pp_loandone < pp->pp_loanlen && !pp->pp_rclosed) {
+		cv_wait(pp->pp_writecv, pp->pp_lock);
+	}
+	done = pp->pp_loandone;
+	pp->pp_loanlen = 0;
+	pp->pp_loandone = 0;
+	/* Other writers may be waiting for the loan to end. */
+	pipe_wakewriters(pp);
+
+	iov->iov_ubase = (userptr_t)((vaddr_t)iov->iov_ubase + done);
+	iov->iov_len -= done;
+	uio->uio_offset += done;
+	uio->uio_resid -= done;
+
+ out:
+	for (i=0; i<DIVROUNDUP(len, PAGE_SIZE); i++) {
+		page_unref(pages[i]);
+	}
+	return done < len ? EPIPE : 0;
+}
+
+/*
+ * Write it all, waiting for space as needed, unless nonblocking.
+ * Writes of up to PIPE_BUF bytes wait until they fit in one go, and
+ * the lock is held from then until they're done, so they're atomic.
+ */
+static
+int
+pipe_write(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *pp = vn->vn_data;
+	paddr_t pages[PIPE_LOANPAGES];
+	size_t start, want, tail, len;
+	int result = 0;
+
+	if (vn != &pp->pp_wvn) {
+		return EBADF;
+	}
+	KASSERT(uio->uio_rw == UIO_WRITE);
+
+	start = uio->uio_resid;
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		if (pp->pp_rclosed) {
+			result = EPIPE;
+			break;
+		}
+
+		if (pipe_canlend(pp, uio)) {
+			lock_release(pp->pp_lock);
+			len = pipe_getloan(uio, pages);
+			lock_acquire(pp->pp_lock);
+			if (len > 0) {
+				result = pipe_lend(pp, uio, pages, len);
+				if (result) {
+					break;
+				}
+				continue;
+			}
+		}
+
+		want = uio->uio_resid <= PIPE_BUF ? uio->uio_resid : 1;
+		if (pp->pp_loanlen > 0 || PIPE_SIZE - pp->pp_count < want) {
+			if (pp->pp_nonblock) {
+				if (uio->uio_resid == start) {
+					result = EAGAIN;
+				}
+				break;
+			}
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+			continue;
+		}
+
+		/* Up to the end of the ring; the next pass wraps. */
+		tail = (pp->pp_head + pp->pp_count) % PIPE_SIZE;
+		len = PIPE_SIZE - pp->pp_count;
+		if (len > PIPE_SIZE - tail) {
+			len = PIPE_SIZE - tail;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(pp->pp_buf + tail, len, uio);
+		if (result) {
+			break;
+		}
+		pp->pp_count += len;
+		pipe_wakereaders(pp);
+	}
+	lock_release(pp->pp_lock);
+
+	/* Report a short write rather than losing what got through. */
+	if (result == EPIPE && uio->uio_resid < start) {
+		result = 0;
+	}
+	return result;
+}
+
+/*
+ * The read end is readable when a read wouldn't wait: there's data,
+ * a loan, or no writer (EOF, which also counts as a hangup). The
+ * write end is writable when there's room for PIPE_BUF bytes and no
+ * loan, and reports an error once there's no reader.
+ */
+static
+int
+pipe_poll(struct vnode *vn, int events, struct poller *pl)
+{
+	struct pipe *pp = vn->vn_data;
+	int ret = 0;
+
+	lock_acquire(pp->pp_lock);
+	if (vn == &pp->pp_rvn) {
+		pollwait(pl, &pp->pp_rpoll);
+		if (pp->pp_count > 0 || pp->pp_loandone < pp->pp_loanlen) {
+			ret |= events & POLLIN;
+		}
+		if (pp->pp_wclosed) {
+			ret |= (events & POLLIN) | POLLHUP;
+		}
+	}
+	else {
+		pollwait(pl, &pp->pp_wpoll);
+		if (pp->pp_rclosed) {
+			ret |= POLLERR;
+		}
+		else if (pp->pp_loanlen == 0 &&
+			 PIPE_SIZE - pp->pp_count >= PIPE_BUF) {
+			ret |= events & POLLOUT;
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	return ret;
+}
+
+static
+int
+pipe_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+static
+int
+pipe_gettype(struct vnode *vn, mode_t *ret)
+{
+	(void)vn;
+	*ret = _S_IFIFO;
+	return 0;
+}
+
+/*
+ * The size is what's waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *vn, struct stat *statbuf)
+{
+	struct pipe *pp = vn->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = pp->pp_count + (pp->pp_loanlen - pp->pp_loandone);
+	lock_release(pp->pp_lock);
+
+	statbuf->st_mode = _S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	statbuf->st_blksize = PIPE_BUF;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EINVAL;
+}
+
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_read,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_getdirentry_notdir,
+	.vop_write = pipe_write,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_nosys,
+	.vop_poll = pipe_poll,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
+
+int
+pipe_create(int flags, struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *pp;
+
+	KASSERT((flags & ~O_NONBLOCK) == 0);
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pollhead_init(&pp->pp_rpoll);
+	pollhead_init(&pp->pp_wpoll);
+	pp->pp_lock = lock_create("pipe");
+	pp->pp_readcv = cv_create("pipe_read");
+	pp->pp_writecv = cv_create("pipe_write");
+	pp->pp_buf = (char *)alloc_kpages(PIPE_PAGES);
+	if (pp->pp_lock == NULL || pp->pp_readcv == NULL ||
+	    pp->pp_writecv == NULL || pp->pp_buf == NULL) {
+		pipe_destroy(pp);
+		return ENOMEM;
+	}
+
+	pp->pp_head = 0;
+	pp->pp_count = 0;
+	pp->pp_rclosed = false;
+	pp->pp_wclosed = false;
+	pp->pp_nonblock = (flags & O_NONBLOCK) != 0;
+	pp->pp_loanlen = 0;
+	pp->pp_loandone = 0;
+
+	vnode_init(&pp->pp_rvn, &pipe_vnode_ops, NULL, pp);
+	vnode_init(&pp->pp_wvn, &pipe_vnode_ops, NULL, pp);
+
+	*readend = &pp->pp_rvn;
+	*writeend = &pp->pp_wvn;
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ * Pollheads and pollers. See poll.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <timer.h>
+#include <vnode.h>
+#include <poll.h>
+
+/*
+ * Pollers sleep on one of these, picked by the poller's address, the
+ * same way busy file handles do (see filetable.c). The bucket lock
+ * protects pl_woken and pl_expired of every poller that hashes to
+ * it. A pollhead's lock is taken before a bucket lock, never after.
+ */
+#define PL_NBUCKETS	16
+
+struct pl_bucket {
+	struct spinlock pb_lock;
+	struct wchan *pb_wchan;
+};
+
+static struct pl_bucket pl_buckets[PL_NBUCKETS];
+
+static
+struct pl_bucket *
+pl_bucket(struct poller *pl)
+{
+	uintptr_t x = (uintptr_t)pl;
+
+	/* pollers live on kernel stacks */
+	return &pl_buckets[((x >> 4) ^ (x >> 12)) % PL_NBUCKETS];
+}
+
+void
+poll_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<PL_NBUCKETS; i++) {
+		spinlock_init(&pl_buckets[i].pb_lock);
+		pl_buckets[i].pb_wchan = wchan_create("poll");
+		if (pl_buckets[i].pb_wchan == NULL) {
+			panic("poll_bootstrap: out of memory\n");
+		}
+	}
+}
+
+/*
+ * Mark PL woken and wake it if it's asleep. Other pollers in the
+ * same bucket wake too, find they weren't, and go back to sleep.
+ */
+static
+void
+poller_wake(struct poller *pl, bool expired)
+{
+	struct pl_bucket *pb = pl_bucket(pl);
+
+	spinlock_acquire(&pb->pb_lock);
+	pl->pl_woken = true;
+	if (expired) {
+		pl->pl_expired = true;
+	}
+	wchan_wakeall(pb->pb_wchan, &pb->pb_lock);
+	spinlock_release(&pb->pb_lock);
+}
+
+/* Timer function; runs in interrupt context. */
+static
+void
+poller_timeout(void *data)
+{
+	poller_wake(data, true);
+}
+
+////////////////////////////////////////////////////////////
+// pollheads
+
+void
+pollhead_init(struct pollhead *ph)
+{
+	spinlock_init(&ph->ph_lock);
+	ph->ph_entries = NULL;
+}
+
+void
+pollhead_cleanup(struct pollhead *ph)
+{
+	KASSERT(ph->ph_entries == NULL);
+	spinlock_cleanup(&ph->ph_lock);
+}
+
+void
+pollwait(struct poller *pl, struct pollhead *ph)
+{
+	struct pollentry *pe;
+
+	if (pl == NULL) {
+		return;
+	}
+
+	/* Each VOP_POLL hooks on at most one pollhead. */
+	KASSERT(pl->pl_nentries < pl->pl_maxentries);
+	pe = &pl->pl_entries[pl->pl_nentries++];
+	pe->pe_head = ph;
+	pe->pe_poller = pl;
+
+	spinlock_acquire(&ph->ph_lock);
+	pe->pe_next = ph->ph_entries;
+	pe->pe_pprev = &ph->ph_entries;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_pprev = &pe->pe_next;
+	}
+	ph->ph_entries = pe;
+	spinlock_release(&ph->ph_lock);
+}
+
+void
+pollwakeup(struct pollhead *ph)
+{
+	struct pollentry *pe;
+
+	spinlock_acquire(&ph->ph_lock);
+	for (pe = ph->ph_entries; pe != NULL; pe = pe->pe_next) {
+		poller_wake(pe->pe_poller, false);
+	}
+	spinlock_release(&ph->ph_lock);
+}
+
+////////////////////////////////////////////////////////////
+// pollers
+
+int
+poller_init(struct poller *pl, unsigned nfds, int timeout)
+{
+	pl->pl_woken = false;
+	pl->pl_expired = false;
+	pl->pl_nentries = 0;
+	pl->pl_maxentries = nfds;
+	pl->pl_entries = NULL;
+	if (nfds > 0) {
+		pl->pl_entries = kmalloc(nfds * sizeof(struct pollentry));
+		if (pl->pl_entries == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	timer_init(&pl->pl_timer, poller_timeout, pl);
+	pl->pl_timed = timeout >= 0;
+	if (pl->pl_timed) {
+		timer_add_ms(&pl->pl_timer, timeout);
+	}
+	return 0;
+}
+
+void
+poller_cleanup(struct poller *pl)
+{
+	struct pollentry *pe;
+	struct pollhead *ph;
+	unsigned i;
+
+	if (pl->pl_timed) {
+		timer_cancel(&pl->pl_timer);
+	}
+
+	for (i=0; i<pl->pl_nentries; i++) {
+		pe = &pl->pl_entries[i];
+		ph = pe->pe_head;
+		spinlock_acquire(&ph->ph_lock);
+		*pe->pe_pprev = pe->pe_next;
+		if (pe->pe_next != NULL) {
+			pe->pe_next->pe_pprev = pe->pe_pprev;
+		}
+		spinlock_release(&ph->ph_lock);
+	}
+	pl->pl_nentries = 0;
+
+	if (pl->pl_entries != NULL) {
+		kfree(pl->pl_entries);
+		pl->pl_entries = NULL;
+	}
+}
+
+int
+poller_sleep(struct poller *pl)
+{
+	struct pl_bucket *pb = pl_bucket(pl);
+	int result;
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&pb->pb_lock);
+	while (!pl->pl_woken) {
+		wchan_sleep(pb->pb_wchan, &pb->pb_lock);
+	}
+	pl->pl_woken = false;
+	result = pl->pl_expired ? ETIMEDOUT : 0;
+	spinlock_release(&pb->pb_lock);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// common vop_poll
+
+int
+vop_poll_ready(struct vnode *vn, int events, struct poller *pl)
+{
+	(void)vn;
+	(void)pl;
+	return events & (POLLIN | POLLOUT);
+}
@@ -46,6 +46,7 @@
 
 ////////////////////////////////////////////////////////////
 // uio ops (read, readlink, getdirentry, write, namefile)
+// (getdirentry has extra arguments, so it gets its own)
 
 int
 vopfail_uio_notdir(struct vnode *vn, struct uio *uio)
@@ -79,6 +80,17 @@ vopfail_uio_nosys(struct vnode *vn, struct uio *uio)
 	return ENOSYS;
 }
 
+int
+vopfail_getdirentry_notdir(struct vnode *vn, struct uio *uio,
+			   ino_t *ino, mode_t *type)
+{
+	(void)vn;
+	(void)uio;
+	(void)ino;
+	(void)type;
+	return ENOTDIR;
+}
+
 ////////////////////////////////////////////////////////////
 // mmap
 
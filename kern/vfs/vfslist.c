@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <workqueue.h>
 
 /*
  * Structure for a single named device.
@@ -91,6 +92,15 @@ static struct knowndevarray *knowndevs;
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
+/*
+ * Background writeback. Dirty filesystem metadata is synced every
+ * VFS_SYNC_INTERVAL milliseconds from the work queue.
+ */
+#define VFS_SYNC_INTERVAL	30000
+static struct work vfs_syncwork;
+
+static void vfs_syncer(void *data);
+
 
 /*
  * Setup function
@@ -111,6 +121,9 @@ vfs_bootstrap(void)
 
 	devnull_create();
 	semfs_bootstrap();
+
+	work_init(&vfs_syncwork, vfs_syncer, NULL);
+	work_queue_delayed(&vfs_syncwork, VFS_SYNC_INTERVAL);
 }
 
 /*
@@ -170,6 +183,19 @@ vfs_sync(void)
 	return 0;
 }
 
+/*
+ * Work function for background writeback. Reschedules itself.
+ */
+static
+void
+vfs_syncer(void *data)
+{
+	(void)data;
+
+	vfs_sync();
+	work_queue_delayed(&vfs_syncwork, VFS_SYNC_INTERVAL);
+}
+
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
  * back an appropriate vnode.
@@ -142,12 +142,35 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Copy a block, a word at a time when both ends are word-aligned.
+ * memcpy only does that when the length is a multiple of 4 too,
+ * which structures and user buffers often aren't; here the odd bytes
+ * at the end are done on their own.
+ */
+static
+void
+copyblock(void *dest, const void *src, size_t len)
+{
+	size_t words;
+
+	if ((vaddr_t)dest % sizeof(uint32_t) == 0 &&
+	    (vaddr_t)src % sizeof(uint32_t) == 0) {
+		words = len & ~(size_t)(sizeof(uint32_t) - 1);
+		memcpy(dest, src, words);
+		dest = (char *)dest + words;
+		src = (const char *)src + words;
+		len -= words;
+	}
+	memcpy(dest, src, len);
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC
- * to kernel address DEST. We can use memcpy because it's protected by
- * the tm_badfaultfunc/copyfail logic.
+ * to kernel address DEST. We can use copyblock because it's protected
+ * by the tm_badfaultfunc/copyfail logic.
  */
 int
 copyin(const_userptr_t usersrc, void *dest, size_t len)
@@ -172,7 +195,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copyblock(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,7 +205,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
+ * user-level address USERDEST. We can use copyblock because it's
  * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -208,7 +231,7 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copyblock((void *)userdest, src, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -229,29 +252,75 @@ copyout(const void *src, userptr_t userdest, size_t len)
  * hit STOPLEN it's because the string has run into the end of
  * userspace. Thus in the latter case we return EFAULT, not
  * ENAMETOOLONG.
+ *
+ * Once SRC is word-aligned the string is read a word at a time,
+ * looking for a null byte in the whole word at once. An aligned word
+ * can't straddle a page, or the end of userspace, so it's safe to
+ * read all of it as long as its first byte is inside the string or
+ * its terminator. Words are stored whole when DEST is aligned too.
  */
+
+/* Nonzero if any byte of W is zero. */
+#define HASZERO(w)	(((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 static
 int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, lim;
+	uint32_t w;
+
+	lim = maxlen < stoplen ? maxlen : stoplen;
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	/* Bytes up to a word boundary in SRC */
+	for (i=0; i<lim && (vaddr_t)(src + i) % sizeof(w) != 0; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
-			if (gotlen != NULL) {
-				*gotlen = i+1;
+			goto found;
+		}
+	}
+
+	/* Whole words with no null in them */
+	if ((vaddr_t)(dest + i) % sizeof(w) == 0) {
+		for (; i + sizeof(w) <= lim; i += sizeof(w)) {
+			w = *(const uint32_t *)(src + i);
+			if (HASZERO(w)) {
+				break;
 			}
-			return 0;
+			*(uint32_t *)(dest + i) = w;
 		}
 	}
+	else {
+		for (; i + sizeof(w) <= lim; i += sizeof(w)) {
+			w = *(const uint32_t *)(src + i);
+			if (HASZERO(w)) {
+				break;
+			}
+			memcpy(dest + i, &w, sizeof(w));
+		}
+	}
+
+	/* The word with the null in it, or what's left at the end */
+	for (; i<lim; i++) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			goto found;
+		}
+	}
+
 	if (stoplen < maxlen) {
 		/* ran into user-kernel boundary */
 		return EFAULT;
 	}
 	/* otherwise just ran out of space */
 	return ENAMETOOLONG;
+
+ found:
+	if (gotlen != NULL) {
+		*gotlen = i+1;
+	}
+	return 0;
 }
 
 /*
@@ -319,3 +388,83 @@ copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *actual)
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return result;
 }
+
+/*
+ * copyinstrv
+ *
+ * Copy the strings named by the null-terminated array of user
+ * pointers at USERARGV into DEST, one after another, as described in
+ * copyinout.h. The whole thing is one protected region: the fault
+ * handler is set up once rather than once per string, and the
+ * pointers are fetched one at a time, so we never read past the end
+ * of the array.
+ */
+int
+copyinstrv(const_userptr_t userargv, char *dest, size_t len, size_t extra,
+	   unsigned *count, size_t *got)
+{
+	const_userptr_t uptr = userargv;
+	const char *str;
+	size_t used = 0, charged = 0, avail, stoplen, n;
+	unsigned i = 0;
+	int result;
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	while (1) {
+		result = copycheck(uptr, sizeof(str), &stoplen);
+		if (result == 0 && stoplen != sizeof(str)) {
+			result = EFAULT;
+		}
+		if (result) {
+			break;
+		}
+		/* The array might not be aligned */
+		copyblock(&str, (const void *)uptr, sizeof(str));
+		if (str == NULL) {
+			break;
+		}
+
+		if (charged + extra >= len) {
+			result = ENAMETOOLONG;
+			break;
+		}
+		avail = len - charged - extra;
+		result = copycheck((const_userptr_t)str, avail, &stoplen);
+		if (result) {
+			break;
+		}
+		result = copystr(dest + used, str, avail, stoplen, &n);
+		if (result) {
+			break;
+		}
+
+		/* Pad with nulls to the next word */
+		while (n % sizeof(uint32_t) != 0) {
+			if (n >= avail) {
+				result = ENAMETOOLONG;
+				break;
+			}
+			dest[used + n++] = 0;
+		}
+		if (result) {
+			break;
+		}
+
+		used += n;
+		charged += n + extra;
+		i++;
+		uptr = (const_userptr_t)((vaddr_t)uptr + sizeof(str));
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	*count = i;
+	*got = used;
+	return result;
+}
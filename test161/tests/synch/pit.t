@@ -0,0 +1,12 @@
+---
+name: "Priority Inversion Test"
+description:
+  Measures how long a high-priority thread waits for a lock held by a
+  low-priority thread doing I/O while medium-priority threads hog the
+  CPUs. Fails if priority inheritance doesn't bound the wait.
+tags: [synch, locks]
+depends: [boot, semaphores, locks]
+sys161:
+  cpus: 4
+---
+pit
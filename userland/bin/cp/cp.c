@@ -28,36 +28,32 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * cp - copy a file.
  * Usage: cp oldfile newfile
+ *
+ * The data is moved with copy_file_range, so it never comes up into
+ * user memory. If the kernel can't do that for these two files, we
+ * fall back to reading and writing.
  */
 
+/* How much to ask copy_file_range for at once. */
+#define COPYCHUNK	(1024*1024)
 
-/* Copy one file to another. */
+/*
+ * Copy the rest of FROMFD to TOFD through a buffer. Used when
+ * copy_file_range doesn't work.
+ */
 static
 void
-copy(const char *from, const char *to)
+copy_rw(int fromfd, int tofd, const char *from, const char *to)
 {
-	int fromfd;
-	int tofd;
 	char buf[1024];
 	int len, wr, wrtot;
 
-	/*
-	 * Open the files, and give up if they won't open
-	 */
-	fromfd = open(from, O_RDONLY);
-	if (fromfd<0) {
-		err(1, "%s", from);
-	}
-	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
-	if (tofd<0) {
-		err(1, "%s", to);
-	}
-
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
@@ -84,6 +80,44 @@ copy(const char *from, const char *to)
 	if (len<0) {
 		err(1, "%s", from);
 	}
+}
+
+/* Copy one file to another. */
+static
+void
+copy(const char *from, const char *to)
+{
+	int fromfd;
+	int tofd;
+	ssize_t len;
+
+	/*
+	 * Open the files, and give up if they won't open
+	 */
+	fromfd = open(from, O_RDONLY);
+	if (fromfd<0) {
+		err(1, "%s", from);
+	}
+	tofd = open(to, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd<0) {
+		err(1, "%s", to);
+	}
+
+	/*
+	 * Zero means EOF. A short count doesn't; the kernel stops early
+	 * for pipes and the like.
+	 */
+	while ((len = copy_file_range(fromfd, NULL, tofd, NULL,
+				      COPYCHUNK, 0)) > 0) {
+		/* nothing */
+	}
+	if (len<0) {
+		if (errno != ENOSYS && errno != EINVAL) {
+			err(1, "%s to %s", from, to);
+		}
+		/* Both offsets are where the kernel left off */
+		copy_rw(fromfd, tofd, from, to);
+	}
 
 	if (close(fromfd) < 0) {
 		err(1, "%s: close", from);
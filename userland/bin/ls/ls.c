@@ -29,6 +29,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -92,17 +93,10 @@ int
 isdir(const char *path)
 {
 	struct stat buf;
-	int fd;
 
-	/* Assume stat() may not be implemented; use fstat */
-	fd = open(path, O_RDONLY);
-	if (fd<0) {
+	if (stat(path, &buf)<0) {
 		err(1, "%s", path);
 	}
-	if (fstat(fd, &buf)<0) {
-		err(1, "%s: fstat", path);
-	}
-	close(fd);
 
 	return S_ISDIR(buf.st_mode);
 }
@@ -139,16 +133,9 @@ print(const char *path)
 	int typech;
 
 	if (lopt || sopt) {
-		int fd;
-
-		fd = open(path, O_RDONLY);
-		if (fd<0) {
+		if (stat(path, &statbuf)<0) {
 			err(1, "%s", path);
 		}
-		if (fstat(fd, &statbuf)<0) {
-			err(1, "%s: fstat", path);
-		}
-		close(fd);
 	}
 
 	file = basename(path);
@@ -185,6 +172,13 @@ print(const char *path)
 	printf("%s\n", file);
 }
 
+/*
+ * Buffer for reading directories. Each getdirentries call fills it
+ * with as many entries as fit, so this many bytes' worth of names
+ * cost one system call.
+ */
+#define DIRBUFSIZE 8192
+
 /*
  * List a directory.
  */
@@ -193,9 +187,10 @@ void
 listdir(const char *path, int showheader)
 {
 	int fd;
-	char buf[1024];
+	char buf[DIRBUFSIZE];
 	char newpath[1024];
-	ssize_t len;
+	struct dirent *de;
+	ssize_t len, pos;
 
 	if (showheader) {
 		printheader(path);
@@ -212,19 +207,22 @@ listdir(const char *path, int showheader)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += de->d_reclen) {
+			de = (struct dirent *)(buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s", path,
+				 de->d_name);
 
-		if (aopt || buf[0]!='.') {
-			/* Print it */
-			print(newpath);
+			if (aopt || de->d_name[0]!='.') {
+				/* Print it */
+				print(newpath);
+			}
 		}
 	}
 	if (len<0) {
-		err(1, "%s: getdirentry", path);
+		err(1, "%s: getdirentries", path);
 	}
 
 	/* Done */
@@ -236,9 +234,10 @@ void
 recursedir(const char *path)
 {
 	int fd;
-	char buf[1024];
+	char buf[DIRBUFSIZE];
 	char newpath[1024];
-	int len;
+	struct dirent *de;
+	ssize_t len, pos;
 
 	/*
 	 * Open it.
@@ -251,29 +250,35 @@ recursedir(const char *path)
 	/*
 	 * List the directory.
 	 */
-	while ((len = getdirentry(fd, buf, sizeof(buf)-1)) > 0) {
-		buf[len] = 0;
+	while ((len = getdirentries(fd, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < len; pos += de->d_reclen) {
+			de = (struct dirent *)(buf + pos);
 
-		/* Assemble the full name of the new item */
-		snprintf(newpath, sizeof(newpath), "%s/%s", path, buf);
+			/* Assemble the full name of the new item */
+			snprintf(newpath, sizeof(newpath), "%s/%s", path,
+				 de->d_name);
 
-		if (!aopt && buf[0]=='.') {
-			/* skip this one */
-			continue;
-		}
+			if (!aopt && de->d_name[0]=='.') {
+				/* skip this one */
+				continue;
+			}
 
-		if (!strcmp(buf, ".") || !strcmp(buf, "..")) {
-			/* always skip these */
-			continue;
-		}
+			if (!strcmp(de->d_name, ".") ||
+			    !strcmp(de->d_name, "..")) {
+				/* always skip these */
+				continue;
+			}
 
-		if (!isdir(newpath)) {
-			continue;
-		}
+			/* Only stat if the directory didn't say */
+			if (de->d_type == DT_UNKNOWN ? !isdir(newpath)
+			    : de->d_type != DT_DIR) {
+				continue;
+			}
 
-		listdir(newpath, 1 /*showheader*/);
-		if (Ropt) {
-			recursedir(newpath);
+			listdir(newpath, 1 /*showheader*/);
+			if (Ropt) {
+				recursedir(newpath);
+			}
 		}
 	}
 	if (len<0) {
@@ -28,27 +28,68 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <err.h>
 
 /*
  * mv - move (rename) files.
  * Usage: mv oldfile newfile
  *
- * Just calls rename() on them. If it fails, we don't attempt to
- * figure out which filename was wrong or what happened.
+ * Calls rename() on them. If that fails because they're on different
+ * file systems, copies the file with copy_file_range and removes the
+ * original, as Unix mv does. Otherwise, we don't attempt to figure
+ * out which filename was wrong or what happened.
  *
- * In certain circumstances, Unix mv will fall back to copying and
- * deleting the old copy. We don't do that.
- *
- * We also don't allow the Unix form of
+ * We don't allow the Unix form of
  *     mv file1 file2 file3 destination-dir
  */
 
+/* How much to ask copy_file_range for at once. */
+#define COPYCHUNK	(1024*1024)
+
+static
+void
+copyremove(const char *oldfile, const char *newfile)
+{
+	int fromfd, tofd;
+	ssize_t len;
+
+	fromfd = open(oldfile, O_RDONLY);
+	if (fromfd<0) {
+		err(1, "%s", oldfile);
+	}
+	tofd = open(newfile, O_WRONLY|O_CREAT|O_TRUNC);
+	if (tofd<0) {
+		err(1, "%s", newfile);
+	}
+	while ((len = copy_file_range(fromfd, NULL, tofd, NULL,
+				      COPYCHUNK, 0)) > 0) {
+		/* nothing */
+	}
+	if (len<0) {
+		err(1, "%s to %s", oldfile, newfile);
+	}
+	if (close(fromfd) < 0) {
+		err(1, "%s: close", oldfile);
+	}
+	if (close(tofd) < 0) {
+		err(1, "%s: close", newfile);
+	}
+
+	if (remove(oldfile)) {
+		err(1, "%s", oldfile);
+	}
+}
+
 static
 void
 dorename(const char *oldfile, const char *newfile)
 {
 	if (rename(oldfile, newfile)) {
+		if (errno == EXDEV) {
+			copyremove(oldfile, newfile);
+			return;
+		}
 		err(1, "%s or %s", oldfile, newfile);
 	}
 }
@@ -69,22 +69,25 @@ struct exitinfo {
 /* set to nonzero if __time syscall seems to work */
 static int timing = 0;
 
+/* most commands in one pipeline */
+#define MAXSTAGES 16
+
 /* array of backgrounded jobs (allows "foregrounding") */
 #define MAXBG 128
 static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for n open slots.
  */
 static
 int
-can_bg(void)
+can_bg(int n)
 {
 	int i;
 
 	for (i = 0; i < MAXBG; i++) {
-		if (bgpids[i] == 0) {
+		if (bgpids[i] == 0 && --n == 0) {
 			return 1;
 		}
 	}
@@ -359,15 +362,19 @@ static struct {
  * docommand
  * tokenizes the command line using strtok.  if there aren't any commands,
  * simply returns.  checks to see if it's a builtin, running it if it is.
- * otherwise, it's a standard command.  check for the '&', try to background
- * the job if possible, otherwise just run it and wait on it.
+ * otherwise, it's a standard command, or a pipeline of them separated by
+ * '|'.  check for the '&', try to background the job if possible, otherwise
+ * just run it and wait on it.
  */
 static
 void
 docommand(char *buf, struct exitinfo *ei)
 {
 	char *args[NARG_MAX + 1];
-	int nargs, i;
+	char **stages[MAXSTAGES];
+	pid_t pids[MAXSTAGES];
+	int nargs, nstages, i;
+	int fds[2], infd;
 	char *s;
 	pid_t pid;
 	int status;
@@ -405,33 +412,67 @@ docommand(char *buf, struct exitinfo *ei)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
-			printf("%s: Too many background jobs; wait for "
-			       "some to finish before starting more\n",
-			       args[0]);
-			exitinfo_exit(ei, 1);
-			return;
-		}
 		nargs--;
 		args[nargs] = NULL;
 		bg = 1;
 	}
 
+	/* split into pipeline stages at each "|" */
+	nstages = 0;
+	stages[nstages++] = args;
+	for (i=0; i<nargs; i++) {
+		if (strcmp(args[i], "|") != 0) {
+			continue;
+		}
+		if (args[i+1] == NULL || stages[nstages-1] == &args[i] ||
+		    nstages >= MAXSTAGES) {
+			printf("%s: Invalid pipeline\n", args[0]);
+			exitinfo_exit(ei, 1);
+			return;
+		}
+		args[i] = NULL;
+		stages[nstages++] = &args[i+1];
+	}
+
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       args[0]);
+		exitinfo_exit(ei, 1);
+		return;
+	}
+
 	if (timing) {
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
-	switch (pid) {
-		case -1:
-			/* error */
-			warn("fork");
-			exitinfo_exit(ei, 255);
-			return;
-		case 0:
+	/*
+	 * Start each stage with its input from the previous one's pipe
+	 * and its output into the next one's. The children only exec,
+	 * so there's no point copying our address space for them.
+	 */
+	infd = -1;
+	for (i=0; i<nstages; i++) {
+		fds[0] = fds[1] = -1;
+		if (i < nstages - 1 && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+
+		pid = vfork();
+		if (pid == 0) {
 			/* child */
-			execvp(args[0], args);
-			warn("%s", args[0]);
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (fds[1] >= 0) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[1]);
+				close(fds[0]);
+			}
+			execvp(stages[i][0], stages[i]);
+			warn("%s", stages[i][0]);
 			/*
 			 * Use _exit() instead of exit() in the child
 			 * process to avoid calling atexit() functions,
@@ -440,25 +481,56 @@ docommand(char *buf, struct exitinfo *ei)
 			 * handling.
 			 */
 			_exit(1);
-		default:
+		}
+
+		/* parent: the children have their own copies of these */
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+
+		if (pid < 0) {
+			warn("vfork");
 			break;
+		}
+		pids[i] = pid;
+	}
+	if (infd >= 0) {
+		close(infd);
+	}
+
+	if (i < nstages) {
+		/* couldn't start them all; clean up the ones we did */
+		while (i-- > 0) {
+			waitpid(pids[i], &status, 0);
+		}
+		exitinfo_exit(ei, 255);
+		return;
 	}
 
 	/* parent */
 	if (bg) {
 		/* background this command */
-		remember_bg(pid);
-		printf("[%d] %s ... &\n", pid, args[0]);
+		for (i=0; i<nstages; i++) {
+			remember_bg(pids[i]);
+		}
+		printf("[%d] %s ... &\n", pids[nstages-1], args[0]);
 		exitinfo_exit(ei, 0);
 		return;
 	}
 
-	if (waitpid(pid, &status, 0) < 0) {
-		warn("waitpid");
-		exitinfo_exit(ei, 255);
-	}
-	else {
-		readstatus(status, ei);
+	/* the pipeline's status is that of its last command */
+	for (i=0; i<nstages; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			exitinfo_exit(ei, 255);
+		}
+		else if (i == nstages - 1) {
+			readstatus(status, ei);
+		}
 	}
 
 	if (timing) {
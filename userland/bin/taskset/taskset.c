@@ -0,0 +1,89 @@
+/*
+ * taskset - run a program on a given set of CPUs.
+ * Usage: taskset
+ *        taskset cpus program [args...]
+ *
+ * CPUS is a list like "1" or "0,2-3". The mask is set for this
+ * process and then the program is exec'd, so it and any children it
+ * forks keep it. With no arguments, prints the current mask.
+ *
+ * Use together with the kernel menu's cpuset command, which keeps
+ * everything that hasn't asked for them off the reserved CPUs, to get
+ * a benchmark a set of CPUs to itself.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+static
+int
+parsecpus(const char *s, unsigned *ret)
+{
+	unsigned mask = 0, lo, hi, i;
+
+	while (*s != '\0') {
+		if (*s < '0' || *s > '9') {
+			return -1;
+		}
+		for (lo = 0; *s >= '0' && *s <= '9'; s++) {
+			lo = lo*10 + (*s - '0');
+		}
+		hi = lo;
+		if (*s == '-') {
+			s++;
+			if (*s < '0' || *s > '9') {
+				return -1;
+			}
+			for (hi = 0; *s >= '0' && *s <= '9'; s++) {
+				hi = hi*10 + (*s - '0');
+			}
+		}
+		if (lo > hi || hi >= 32) {
+			return -1;
+		}
+		for (i=lo; i<=hi; i++) {
+			mask |= 1U << i;
+		}
+		if (*s == ',') {
+			s++;
+		}
+		else if (*s != '\0') {
+			return -1;
+		}
+	}
+	if (mask == 0) {
+		return -1;
+	}
+	*ret = mask;
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned mask, i;
+
+	if (argc == 1) {
+		if (getaffinity(0, &mask)) {
+			err(1, "getaffinity");
+		}
+		printf("cpus:");
+		for (i=0; i<32; i++) {
+			if (mask & (1U << i)) {
+				printf(" %u", i);
+			}
+		}
+		printf("\n");
+		return 0;
+	}
+
+	if (argc < 3 || parsecpus(argv[1], &mask)) {
+		errx(1, "Usage: taskset [cpus program [args...]]");
+	}
+	if (setaffinity(0, mask)) {
+		err(1, "setaffinity");
+	}
+	execv(argv[2], &argv[2]);
+	err(1, "%s", argv[2]);
+}
@@ -0,0 +1,22 @@
+#ifndef _DIRENT_H_
+#define _DIRENT_H_
+
+/*
+ * Reading directories many entries at a time.
+ */
+
+#include <sys/types.h>
+
+/* Get struct dirent and the DT_* types from the kernel */
+#include <kern/dirent.h>
+
+/*
+ * Fill BUF with as many of the next entries of the directory open on
+ * FILEHANDLE as fit, as struct dirent records one after another, each
+ * d_reclen bytes long. Returns the number of bytes filled in, or 0 at
+ * the end of the directory. Fails with EINVAL if BUF is too small
+ * for even the next entry.
+ */
+ssize_t getdirentries(int filehandle, char *buf, size_t buflen);
+
+#endif /* _DIRENT_H_ */
@@ -0,0 +1,35 @@
+#ifndef _IORING_H_
+#define _IORING_H_
+
+/*
+ * Batched asynchronous I/O through rings shared with the kernel.
+ */
+
+#include <sys/types.h>
+
+/* Get the ring layout and the IORING_* constants from the kernel */
+#include <kern/ioring.h>
+
+/*
+ * Set up RING, IORING_SIZE(ENTRIES) bytes of our memory, as this
+ * process's ring; ENTRIES is a power of 2 up to IORING_MAXENTRIES.
+ * With RING NULL and ENTRIES 0, tear the ring down again. A process
+ * has at most one ring; fork doesn't copy it and exec drops it.
+ */
+int ioring_setup(struct ioring *ring, unsigned entries);
+
+/*
+ * Have the kernel start on everything queued, then wait until at
+ * least MINWAIT completions are ready to reap, or until it runs out
+ * of things to do. Returns how many are ready.
+ */
+int ioring_enter(unsigned minwait);
+
+/*
+ * Memory barrier: use after filling in submission entries and before
+ * advancing ir_sqtail, and after seeing ir_cqtail move and before
+ * reading the completions it covers.
+ */
+#define ioring_barrier() __asm volatile("sync" ::: "memory")
+
+#endif /* _IORING_H_ */
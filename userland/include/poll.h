@@ -0,0 +1,21 @@
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Waiting for I/O on several descriptors at once.
+ */
+
+#include <sys/types.h>
+
+/* Get struct pollfd and the POLL* bits from the kernel */
+#include <kern/poll.h>
+
+/*
+ * Wait up to TIMEOUT milliseconds (forever if negative, not at all if
+ * zero) for any of the NFDS descriptors in FDS to be ready for the
+ * events asked for. Fills in each revents and returns how many are
+ * nonzero, or 0 on timeout.
+ */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#endif /* _POLL_H_ */
@@ -0,0 +1,38 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+/*
+ * Shared memory segments named by strings.
+ */
+
+#include <sys/types.h>
+
+/* Get SHM_CREAT, SHM_EXCL, SHM_NAMELEN and SHM_MAXSIZE from the kernel */
+#include <kern/shm.h>
+
+/*
+ * Find the segment called NAME and return its id. With SHM_CREAT in
+ * FLAGS, create it, SIZE bytes of zeros, if there is none; with
+ * SHM_EXCL too, fail with EEXIST if there is. Looking up an existing
+ * segment fails with EINVAL if it's smaller than SIZE.
+ */
+int shmget(const char *name, size_t size, int flags);
+
+/*
+ * Attach segment ID to this process and return where it is, or
+ * (void *)-1 on error. A segment can be attached more than once, at
+ * different places. Children share their parent's attachments; exec
+ * and exit detach everything.
+ */
+void *shmat(int id);
+
+/* Detach the segment attached at ADDR. */
+int shmdt(const void *addr);
+
+/*
+ * Remove segment ID's name. It can't be found or attached after that,
+ * and goes away when the last process detaches it.
+ */
+int shmrm(int id);
+
+#endif /* _SHM_H_ */
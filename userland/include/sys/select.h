@@ -0,0 +1,34 @@
+#ifndef _SYS_SELECT_H_
+#define _SYS_SELECT_H_
+
+/*
+ * select, the bitmap version of poll.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+/* Get fd_set from the kernel, and struct timeval */
+#include <kern/poll.h>
+#include <kern/time.h>
+
+#define FD_SETSIZE	__FD_SETSIZE
+
+#define FD_SET(fd, set) \
+	((set)->fds_bits[(fd) / __NFDBITS] |= 1U << ((fd) % __NFDBITS))
+#define FD_CLR(fd, set) \
+	((set)->fds_bits[(fd) / __NFDBITS] &= ~(1U << ((fd) % __NFDBITS)))
+#define FD_ISSET(fd, set) \
+	(((set)->fds_bits[(fd) / __NFDBITS] & (1U << ((fd) % __NFDBITS))) != 0)
+#define FD_ZERO(set)	bzero((set), sizeof(fd_set))
+
+/*
+ * Wait up to TIMEOUT (forever if NULL) for any of the descriptors
+ * below NFDS in READFDS to be readable or in WRITEFDS to be writable.
+ * The sets are rewritten to show which are; returns how many bits
+ * that leaves set.
+ */
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+	   struct timeval *timeout);
+
+#endif /* _SYS_SELECT_H_ */
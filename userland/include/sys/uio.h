@@ -0,0 +1,26 @@
+#ifndef _SYS_UIO_H_
+#define _SYS_UIO_H_
+
+/*
+ * Scatter/gather I/O.
+ */
+
+#include <sys/types.h>
+
+/* Get struct iovec from the kernel */
+#include <kern/iovec.h>
+
+/*
+ * readv and writev move data between a file and each of IOVCNT
+ * buffers in turn, as if by one read or write. preadv and pwritev do
+ * the same at offset POS, without using or changing the file's seek
+ * position. All return the number of bytes moved.
+ */
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t preadv(int filehandle, const struct iovec *iov, int iovcnt,
+	       off_t pos);
+ssize_t pwritev(int filehandle, const struct iovec *iov, int iovcnt,
+		off_t pos);
+
+#endif /* _SYS_UIO_H_ */
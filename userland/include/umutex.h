@@ -0,0 +1,27 @@
+#ifndef _UMUTEX_H_
+#define _UMUTEX_H_
+
+/*
+ * User-level mutex for threads or processes that share memory.
+ *
+ * The whole state is one word: 0 is unlocked, 1 is locked with no
+ * one waiting, 2 is locked and someone may be sleeping in futex_wait.
+ * Locking an unlocked mutex and unlocking one no one is waiting for
+ * are each a single atomic instruction sequence with no system call.
+ *
+ * A umutex may be placed anywhere in shared memory and needs no
+ * cleanup; initialize it with UMUTEX_INITIALIZER or umutex_init.
+ */
+
+struct umutex {
+	volatile int um_state;
+};
+
+#define UMUTEX_INITIALIZER	{ 0 }
+
+void umutex_init(struct umutex *um);
+int umutex_trylock(struct umutex *um);		/* 0 on success */
+void umutex_lock(struct umutex *um);
+void umutex_unlock(struct umutex *um);
+
+#endif /* _UMUTEX_H_ */
@@ -57,6 +57,19 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     readv:    sys/uio.h
+ *     writev:   sys/uio.h
+ *     preadv:   sys/uio.h
+ *     pwritev:  sys/uio.h
+ *     select:   sys/select.h
+ *     poll:     poll.h
+ *     getdirentries: dirent.h
+ *     ioring_setup: ioring.h
+ *     ioring_enter: ioring.h
+ *     shmget:   shm.h
+ *     shmat:    shm.h
+ *     shmdt:    shm.h
+ *     shmrm:    shm.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -146,10 +159,33 @@ int symlink(const char *target, const char *linkname);
 ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
+int pipe2(int filehandles[2], int flags);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+int futex_wait(volatile int *addr, int val);
+int futex_wake(volatile int *addr, int count);
+__DEAD void thread_exit(void *retval);
+int thread_join(int tid, void **retval);
+int __thread_create(void (*entry)(void *(*)(void *), void *),
+		    void *(*func)(void *), void *arg);
+int setaffinity(pid_t pid, unsigned mask);
+int getaffinity(pid_t pid, unsigned *mask);
+int thread_setaffinity(unsigned mask);
+int thread_getaffinity(unsigned *mask);
+pid_t vfork(void);
+pid_t spawn(const char *path, char *const *args, const int *fdmap, int nfds);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+/* readv, writev, preadv, pwritev - see sys/uio.h */
+/* select - see sys/select.h; poll - see poll.h */
+/* getdirentries - see dirent.h */
+/* ioring_setup, ioring_enter - see ioring.h */
+/* shmget, shmat, shmdt, shmrm - see shm.h */
+ssize_t copy_file_range(int infd, off_t *inpos, int outfd, off_t *outpos,
+			size_t len, unsigned flags);
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
@@ -158,5 +194,6 @@ ssize_t __getcwd(char *buf, size_t buflen);
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int thread_create(void *(*func)(void *), void *arg); /* calls __thread_create */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,24 @@
+#include <unistd.h>
+
+/*
+ * Start a new thread running FUNC(ARG). The kernel starts it in
+ * thread_start with a fresh stack, and thread_start makes sure it
+ * exits with whatever FUNC returns instead of falling off the end.
+ *
+ * Note that most of libc (malloc and stdio in particular) and errno
+ * are shared by all threads and not locked; threads should use their
+ * own locking (see umutex.h) around them.
+ */
+
+static
+void
+thread_start(void *(*func)(void *), void *arg)
+{
+	thread_exit(func(arg));
+}
+
+int
+thread_create(void *(*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, func, arg);
+}
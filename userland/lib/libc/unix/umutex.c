@@ -0,0 +1,103 @@
+/*
+ * User-level mutexes on top of futex_wait/futex_wake. See umutex.h.
+ *
+ * This is the usual three-state futex mutex. The important property
+ * is that the unlocker only makes a system call when the state says
+ * somebody might be asleep, and a locker that has to sleep always
+ * leaves the state at 2 so the eventual unlocker knows to call.
+ */
+
+#include <unistd.h>
+#include <umutex.h>
+
+/*
+ * Compare-and-swap with LL/SC: if *P is OLD, store NEW. Returns what
+ * was in *P. There may be no other memory accesses between the LL
+ * and SC, so the retry loop is all in assembler. The sync instructions
+ * make it a full barrier, which is what a lock needs.
+ */
+static
+int
+umutex_cas(volatile int *p, int old, int new)
+{
+	int prev, tmp;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set noreorder;"	/* we fill the delay slots */
+		"sync;"
+		"1: ll %0, 0(%2);"	/*   prev = *p */
+		"nop;"
+		"bne %0, %3, 2f;"	/*   if (prev != old) give up */
+		"move %1, %4;"		/*   (delay slot) tmp = new */
+		"sc %1, 0(%2);"		/*   *p = tmp; tmp = success? */
+		"beqz %1, 1b;"		/*   lost it; try again */
+		"nop;"			/*   (delay slot) */
+		"2: sync;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (prev), "=&r" (tmp)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	return prev;
+}
+
+/* Store NEW in *P and return the old value. */
+static
+int
+umutex_swap(volatile int *p, int new)
+{
+	int prev;
+
+	do {
+		prev = *p;
+	} while (umutex_cas(p, prev, new) != prev);
+	return prev;
+}
+
+void
+umutex_init(struct umutex *um)
+{
+	um->um_state = 0;
+}
+
+int
+umutex_trylock(struct umutex *um)
+{
+	return umutex_cas(&um->um_state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+umutex_lock(struct umutex *um)
+{
+	int state;
+
+	state = umutex_cas(&um->um_state, 0, 1);
+	if (state == 0) {
+		/* Uncontended. */
+		return;
+	}
+
+	/*
+	 * Mark it contended and sleep until we're the one who moves
+	 * it off unlocked. We take it in state 2 even if no one else
+	 * is waiting any more; that only costs one extra wake call.
+	 * futex_wait returning early (because the word changed) is
+	 * fine; we just go around again.
+	 */
+	if (state != 2) {
+		state = umutex_swap(&um->um_state, 2);
+	}
+	while (state != 0) {
+		futex_wait(&um->um_state, 2);
+		state = umutex_swap(&um->um_state, 2);
+	}
+}
+
+void
+umutex_unlock(struct umutex *um)
+{
+	if (umutex_swap(&um->um_state, 0) == 2) {
+		futex_wake(&um->um_state, 1);
+	}
+}
@@ -0,0 +1,432 @@
+/*
+ * profsym - symbolize a kernel profile.
+ * Usage: host-profsym [-u program] kernel [logfile]
+ *
+ * Runs on the host. Reads a console log (or standard input)
+ * containing the output of the kernel menu's profdump command, looks
+ * the sampled PCs up in the symbol table of KERNEL (the ELF image
+ * that was booted), and prints a flat profile: samples per function,
+ * most first. User-mode PCs are looked up in PROGRAM if one is
+ * given; otherwise they're lumped together per process. Then the
+ * samples are broken down by process, kernel and user.
+ *
+ * If the log holds several dumps the last one is used.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+/* Kernel addresses start here on MIPS; below is user space. */
+#define KSEG0		0x80000000U
+
+/* The bits of ELF we need. */
+#define EI_DATA		5
+#define ELFDATA2MSB	2
+#define SHT_SYMTAB	2
+#define SHF_EXECINSTR	0x4
+#define STT_NOTYPE	0
+#define STT_FUNC	2
+
+struct symbol {
+	uint32_t addr;
+	const char *name;
+};
+
+struct symtab {
+	struct symbol *syms;
+	unsigned num;
+};
+
+struct sample {
+	unsigned pid;
+	uint32_t pc;
+	unsigned count;
+};
+
+/* A row of the flat profile. */
+struct entry {
+	char name[128];
+	unsigned count;
+};
+
+static struct sample *samples;
+static unsigned nsamples, maxsamples;
+static unsigned total, dropped, hz;
+
+////////////////////////////////////////////////////////////
+// ELF symbol tables
+
+static bool bigendian;
+
+static
+uint32_t
+get32(const unsigned char *p)
+{
+	if (bigendian) {
+		return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+	return ((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static
+uint16_t
+get16(const unsigned char *p)
+{
+	if (bigendian) {
+		return (p[0] << 8) | p[1];
+	}
+	return (p[1] << 8) | p[0];
+}
+
+static
+unsigned char *
+readfile(const char *path, size_t *len)
+{
+	FILE *f;
+	unsigned char *buf;
+	long size;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		err(1, "%s", path);
+	}
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0) {
+		err(1, "%s", path);
+	}
+	rewind(f);
+	buf = malloc(size);
+	if (buf == NULL) {
+		err(1, "malloc");
+	}
+	if (fread(buf, 1, size, f) != (size_t)size) {
+		errx(1, "%s: Short read", path);
+	}
+	fclose(f);
+	*len = size;
+	return buf;
+}
+
+static
+int
+symcmp(const void *a, const void *b)
+{
+	const struct symbol *x = a, *y = b;
+
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/*
+ * Load the function symbols of a 32-bit ELF file. The file stays in
+ * memory; the names point into it.
+ */
+static
+void
+loadsyms(const char *path, struct symtab *st)
+{
+	unsigned char *img, *sh, *sym, *strsh, *secsh;
+	size_t len;
+	uint32_t shoff, off, size, stroff, value;
+	unsigned shnum, shentsize, i, j, type, shndx, link;
+
+	img = readfile(path, &len);
+	if (len < 52 || memcmp(img, "\177ELF", 4) != 0 || img[4] != 1) {
+		errx(1, "%s: Not a 32-bit ELF file", path);
+	}
+	bigendian = img[EI_DATA] == ELFDATA2MSB;
+
+	shoff = get32(img + 32);
+	shentsize = get16(img + 46);
+	shnum = get16(img + 48);
+	if (shoff + shnum * shentsize > len) {
+		errx(1, "%s: Bad section headers", path);
+	}
+
+	st->syms = NULL;
+	st->num = 0;
+	for (i=0; i<shnum; i++) {
+		sh = img + shoff + i * shentsize;
+		if (get32(sh + 4) != SHT_SYMTAB) {
+			continue;
+		}
+		off = get32(sh + 16);
+		size = get32(sh + 20);
+		link = get32(sh + 24);
+		if (off + size > len || link >= shnum) {
+			errx(1, "%s: Bad symbol table", path);
+		}
+		strsh = img + shoff + link * shentsize;
+		stroff = get32(strsh + 16);
+
+		st->syms = malloc((size / 16) * sizeof(*st->syms));
+		if (st->syms == NULL) {
+			err(1, "malloc");
+		}
+		for (j=0; j + 16 <= size; j += 16) {
+			sym = img + off + j;
+			value = get32(sym + 4);
+			type = sym[12] & 0xf;
+			shndx = get16(sym + 14);
+			if (value == 0 || shndx == 0 || shndx >= shnum) {
+				continue;
+			}
+			secsh = img + shoff + shndx * shentsize;
+			/* Assembler labels in code count too. */
+			if (type != STT_FUNC &&
+			    !(type == STT_NOTYPE &&
+			      (get32(secsh + 8) & SHF_EXECINSTR))) {
+				continue;
+			}
+			st->syms[st->num].addr = value;
+			st->syms[st->num].name =
+				(const char *)img + stroff + get32(sym);
+			st->num++;
+		}
+		break;
+	}
+	if (st->num == 0) {
+		errx(1, "%s: No symbols", path);
+	}
+	qsort(st->syms, st->num, sizeof(*st->syms), symcmp);
+}
+
+/*
+ * Find the function containing ADDR: the last symbol at or below it.
+ */
+static
+const char *
+lookup(const struct symtab *st, uint32_t addr)
+{
+	unsigned lo, hi, mid;
+
+	if (st->num == 0 || addr < st->syms[0].addr) {
+		return NULL;
+	}
+	lo = 0;
+	hi = st->num;
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (st->syms[mid].addr <= addr) {
+			lo = mid;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return st->syms[lo].name;
+}
+
+////////////////////////////////////////////////////////////
+// The log
+
+static
+void
+readlog(FILE *f)
+{
+	char line[256];
+	struct sample s;
+	unsigned cpu, ncpus;
+	bool in = false;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "prof-begin %u %u", &ncpus, &hz) == 2) {
+			nsamples = 0;
+			in = true;
+			continue;
+		}
+		if (sscanf(line, "prof-end %u %u", &total, &dropped) == 2) {
+			in = false;
+			continue;
+		}
+		if (!in || sscanf(line, "prof %u %u %x %u", &cpu, &s.pid,
+				  &s.pc, &s.count) != 4) {
+			continue;
+		}
+		if (nsamples == maxsamples) {
+			maxsamples = maxsamples ? maxsamples * 2 : 1024;
+			samples = realloc(samples,
+					  maxsamples * sizeof(*samples));
+			if (samples == NULL) {
+				err(1, "realloc");
+			}
+		}
+		samples[nsamples++] = s;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Output
+
+static struct entry *entries;
+static unsigned nentries;
+
+static
+void
+charge(const char *name, unsigned count)
+{
+	unsigned i;
+
+	for (i=0; i<nentries; i++) {
+		if (!strcmp(entries[i].name, name)) {
+			entries[i].count += count;
+			return;
+		}
+	}
+	entries = realloc(entries, (nentries + 1) * sizeof(*entries));
+	if (entries == NULL) {
+		err(1, "realloc");
+	}
+	snprintf(entries[nentries].name, sizeof(entries[nentries].name),
+		 "%s", name);
+	entries[nentries].count = count;
+	nentries++;
+}
+
+static
+int
+entrycmp(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	return x->count > y->count ? -1 : x->count < y->count;
+}
+
+static
+void
+flatprofile(const struct symtab *kst, const struct symtab *ust)
+{
+	const char *fn;
+	char buf[128];
+	unsigned i, sum, cum;
+
+	sum = 0;
+	for (i=0; i<nsamples; i++) {
+		if (samples[i].pc >= KSEG0) {
+			fn = lookup(kst, samples[i].pc);
+			snprintf(buf, sizeof(buf), "%s",
+				 fn != NULL ? fn : "[kernel, unknown]");
+		}
+		else if (ust != NULL &&
+			 (fn = lookup(ust, samples[i].pc)) != NULL) {
+			snprintf(buf, sizeof(buf), "[user] %s", fn);
+		}
+		else {
+			snprintf(buf, sizeof(buf), "[user pid %u]",
+				 samples[i].pid);
+		}
+		charge(buf, samples[i].count);
+		sum += samples[i].count;
+	}
+	qsort(entries, nentries, sizeof(*entries), entrycmp);
+
+	printf("%u samples", sum);
+	if (hz > 0) {
+		printf(" (%.2f CPU-seconds at %u Hz)", (double)sum / hz, hz);
+	}
+	if (dropped > 0) {
+		printf(", %u more dropped for lack of table space", dropped);
+	}
+	printf("\n\n  %%time   cum%%   samples  function\n");
+
+	cum = 0;
+	for (i=0; i<nentries; i++) {
+		cum += entries[i].count;
+		printf(" %6.2f %6.2f %9u  %s\n",
+		       100.0 * entries[i].count / sum, 100.0 * cum / sum,
+		       entries[i].count, entries[i].name);
+	}
+}
+
+static
+void
+byprocess(void)
+{
+	unsigned *pids, *kern, *user;
+	unsigned i, j, n;
+
+	pids = calloc(nsamples + 1, sizeof(*pids));
+	kern = calloc(nsamples + 1, sizeof(*kern));
+	user = calloc(nsamples + 1, sizeof(*user));
+	if (pids == NULL || kern == NULL || user == NULL) {
+		err(1, "calloc");
+	}
+
+	n = 0;
+	for (i=0; i<nsamples; i++) {
+		for (j=0; j<n && pids[j] != samples[i].pid; j++) {
+			/* nothing */
+		}
+		if (j == n) {
+			pids[n++] = samples[i].pid;
+		}
+		if (samples[i].pc >= KSEG0) {
+			kern[j] += samples[i].count;
+		}
+		else {
+			user[j] += samples[i].count;
+		}
+	}
+
+	printf("\n    pid    kernel      user\n");
+	for (j=0; j<n; j++) {
+		printf(" %6u %9u %9u\n", pids[j], kern[j], user[j]);
+	}
+	free(pids);
+	free(kern);
+	free(user);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct symtab kst, ust;
+	const char *userprog = NULL;
+	FILE *f;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "u:")) != -1) {
+		switch (ch) {
+		    case 'u':
+			userprog = optarg;
+			break;
+		    default:
+			errx(1, "Usage: profsym [-u program] kernel [logfile]");
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1 || argc > 2) {
+		errx(1, "Usage: profsym [-u program] kernel [logfile]");
+	}
+
+	loadsyms(argv[0], &kst);
+	if (userprog != NULL) {
+		loadsyms(userprog, &ust);
+	}
+
+	if (argc == 2) {
+		f = fopen(argv[1], "r");
+		if (f == NULL) {
+			err(1, "%s", argv[1]);
+		}
+	}
+	else {
+		f = stdin;
+	}
+	readlog(f);
+	if (f != stdin) {
+		fclose(f);
+	}
+	if (nsamples == 0) {
+		errx(1, "No profile found");
+	}
+
+	flatprofile(&kst, userprog != NULL ? &ust : NULL);
+	byprocess();
+	return 0;
+}
@@ -0,0 +1,408 @@
+/*
+ * trdecode - turn a kernel event trace into a per-CPU timeline.
+ * Usage: host-trdecode [-f cpu-hz] [logfile]
+ *
+ * Runs on the host. Reads a console log (or standard input)
+ * containing the output of the kernel menu's trdump command, and
+ * prints, for each CPU, its events in order with times relative to
+ * the earliest event anywhere, followed by a summary: how long each
+ * thread ran on each CPU, and how many system calls, faults, disk
+ * transfers and IPIs there were. Threads are named from the context
+ * switch records; one never switched to shows up as its address.
+ *
+ * If the log holds several dumps the last one is used. Times assume
+ * the System/161 default clock of 25 MHz unless -f says otherwise.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "kern/trace.h"
+
+#define MAXCPUS		32
+#define MAXTHREADS	512
+
+struct event {
+	uint64_t ev_time;		/* cycles, unwrapped */
+	unsigned ev_type;
+	uint32_t ev_thread;
+	uint32_t ev_a0, ev_a1;
+	char ev_name[TRACE_NAMELEN];
+};
+
+struct cpulog {
+	struct event *events;
+	unsigned num, max;
+	uint32_t lastcycles;
+};
+
+/* Per thread: name, and cycles run on each CPU. */
+struct threadinfo {
+	uint32_t addr;
+	char name[TRACE_NAMELEN];
+	uint64_t run[MAXCPUS];
+};
+
+static struct cpulog cpus[MAXCPUS];
+static unsigned ncpus;
+static bool haveref;
+static uint32_t refcycles;		/* first record's count */
+static struct threadinfo threads[MAXTHREADS];
+static unsigned nthreads;
+static double cpuhz = 25000000.0;
+
+static const char *const statenames[] = {
+	"run", "ready", "sleep", "zombie",
+};
+
+static
+void
+reset(void)
+{
+	unsigned i;
+
+	for (i=0; i<MAXCPUS; i++) {
+		cpus[i].num = 0;
+	}
+	nthreads = 0;
+	haveref = false;
+}
+
+static
+void
+addevent(unsigned cpu, uint32_t cycles, const struct event *proto)
+{
+	struct cpulog *cl;
+	struct event *ev;
+
+	if (cpu >= MAXCPUS) {
+		return;
+	}
+	cl = &cpus[cpu];
+	if (cl->num == cl->max) {
+		cl->max = cl->max ? cl->max * 2 : 1024;
+		cl->events = realloc(cl->events,
+				     cl->max * sizeof(*cl->events));
+		if (cl->events == NULL) {
+			err(1, "realloc");
+		}
+	}
+	ev = &cl->events[cl->num];
+	*ev = *proto;
+	/*
+	 * The counter is 32 bits and wraps; records are close together.
+	 * The CPUs' counters run together, so start each CPU relative
+	 * to the first record of all.
+	 */
+	if (!haveref) {
+		refcycles = cycles;
+		haveref = true;
+	}
+	if (cl->num == 0) {
+		ev->ev_time = ((uint64_t)1 << 32) +
+			(int64_t)(int32_t)(cycles - refcycles);
+	}
+	else {
+		ev->ev_time = cl->events[cl->num - 1].ev_time +
+			(uint32_t)(cycles - cl->lastcycles);
+	}
+	cl->lastcycles = cycles;
+	cl->num++;
+}
+
+static
+struct threadinfo *
+findthread(uint32_t addr)
+{
+	unsigned i;
+
+	for (i=0; i<nthreads; i++) {
+		if (threads[i].addr == addr) {
+			return &threads[i];
+		}
+	}
+	if (nthreads == MAXTHREADS) {
+		return NULL;
+	}
+	memset(&threads[nthreads], 0, sizeof(threads[nthreads]));
+	threads[nthreads].addr = addr;
+	snprintf(threads[nthreads].name, TRACE_NAMELEN, "%08x", addr);
+	return &threads[nthreads++];
+}
+
+static
+const char *
+threadname(uint32_t addr)
+{
+	struct threadinfo *ti;
+
+	ti = findthread(addr);
+	return ti != NULL ? ti->name : "?";
+}
+
+static
+void
+readlog(FILE *f)
+{
+	char line[256];
+	unsigned cpu, type;
+	uint32_t cycles;
+	struct event ev;
+	bool in = false;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "trace-begin %u", &ncpus) == 1) {
+			reset();
+			in = true;
+			continue;
+		}
+		if (!strncmp(line, "trace-end", 9)) {
+			in = false;
+			continue;
+		}
+		if (!in) {
+			continue;
+		}
+		memset(&ev, 0, sizeof(ev));
+		if (sscanf(line, "trace %u %x %u %x %x %x %11s", &cpu,
+			   &cycles, &type, &ev.ev_thread, &ev.ev_a0,
+			   &ev.ev_a1, ev.ev_name) != 7) {
+			continue;
+		}
+		if (!strcmp(ev.ev_name, "-")) {
+			ev.ev_name[0] = 0;
+		}
+		ev.ev_type = type;
+		addevent(cpu, cycles, &ev);
+	}
+	if (ncpus > MAXCPUS) {
+		ncpus = MAXCPUS;
+	}
+}
+
+/*
+ * Learn thread names from the switch records.
+ */
+static
+void
+namethreads(void)
+{
+	struct threadinfo *ti;
+	struct event *ev;
+	unsigned c, i;
+
+	for (c=0; c<ncpus; c++) {
+		for (i=0; i<cpus[c].num; i++) {
+			ev = &cpus[c].events[i];
+			if (ev->ev_type == TRACE_SWITCH && ev->ev_name[0]) {
+				ti = findthread(ev->ev_a0);
+				if (ti != NULL) {
+					strcpy(ti->name, ev->ev_name);
+				}
+			}
+		}
+	}
+}
+
+static
+void
+describe(const struct event *ev, char *buf, size_t len)
+{
+	switch (ev->ev_type) {
+	    case TRACE_SWITCH:
+		snprintf(buf, len, "switch -> %s (old thread %s)",
+			 threadname(ev->ev_a0),
+			 ev->ev_a1 < 4 ? statenames[ev->ev_a1] : "?");
+		break;
+	    case TRACE_SLEEP:
+		snprintf(buf, len, "sleep on %s", ev->ev_name);
+		break;
+	    case TRACE_WAKE:
+		snprintf(buf, len, "wake %s from %s",
+			 threadname(ev->ev_a0), ev->ev_name);
+		break;
+	    case TRACE_SYSENTER:
+		snprintf(buf, len, "syscall %u", ev->ev_a0);
+		break;
+	    case TRACE_SYSEXIT:
+		snprintf(buf, len, "syscall %u returns, error %u",
+			 ev->ev_a0, ev->ev_a1);
+		break;
+	    case TRACE_VMFAULT:
+		snprintf(buf, len, "vm fault type %u at 0x%08x",
+			 ev->ev_a0, ev->ev_a1);
+		break;
+	    case TRACE_DISKREAD:
+	    case TRACE_DISKWRITE:
+		snprintf(buf, len, "lhd%u %s sector %u", ev->ev_a0,
+			 ev->ev_type == TRACE_DISKREAD ? "read" : "write",
+			 ev->ev_a1);
+		break;
+	    case TRACE_DISKDONE:
+		snprintf(buf, len, "lhd%u done, error %u",
+			 ev->ev_a0, ev->ev_a1);
+		break;
+	    case TRACE_IPISEND:
+		snprintf(buf, len, "ipi %u to cpu%u", ev->ev_a1, ev->ev_a0);
+		break;
+	    case TRACE_IPIRECV:
+		snprintf(buf, len, "ipi received, pending 0x%x", ev->ev_a0);
+		break;
+	    default:
+		snprintf(buf, len, "type %u 0x%x 0x%x", ev->ev_type,
+			 ev->ev_a0, ev->ev_a1);
+		break;
+	}
+}
+
+static
+double
+usecs(uint64_t cycles)
+{
+	return cycles * 1000000.0 / cpuhz;
+}
+
+static
+void
+timeline(void)
+{
+	struct threadinfo *ti;
+	struct event *ev;
+	uint64_t start, switchin;
+	uint32_t running;
+	unsigned c, i;
+	char buf[128];
+
+	start = UINT64_MAX;
+	for (c=0; c<ncpus; c++) {
+		if (cpus[c].num > 0 && cpus[c].events[0].ev_time < start) {
+			start = cpus[c].events[0].ev_time;
+		}
+	}
+
+	for (c=0; c<ncpus; c++) {
+		printf("cpu%u: %u events\n", c, cpus[c].num);
+		printf("    %12s  %-11s  %s\n", "usec", "thread", "event");
+		running = 0;
+		switchin = 0;
+		for (i=0; i<cpus[c].num; i++) {
+			ev = &cpus[c].events[i];
+			describe(ev, buf, sizeof(buf));
+			printf("    %12.1f  %-11s  %s\n",
+			       usecs(ev->ev_time - start),
+			       threadname(ev->ev_thread), buf);
+
+			/* Charge the time since the last switch. */
+			if (ev->ev_type == TRACE_SWITCH) {
+				if (running != 0 &&
+				    (ti = findthread(running)) != NULL) {
+					ti->run[c] += ev->ev_time - switchin;
+				}
+				running = ev->ev_a0;
+				switchin = ev->ev_time;
+			}
+		}
+		printf("\n");
+	}
+}
+
+static
+void
+summary(void)
+{
+	unsigned counts[TRACE_NTYPES];
+	struct event *ev;
+	unsigned c, i;
+	bool any;
+
+	printf("Time on each CPU (usec), between context switches:\n");
+	printf("    %-11s", "thread");
+	for (c=0; c<ncpus; c++) {
+		printf(" %10s%u", "cpu", c);
+	}
+	printf("\n");
+	for (i=0; i<nthreads; i++) {
+		any = false;
+		for (c=0; c<ncpus; c++) {
+			any = any || threads[i].run[c] > 0;
+		}
+		if (!any) {
+			continue;
+		}
+		printf("    %-11s", threads[i].name);
+		for (c=0; c<ncpus; c++) {
+			printf(" %11.1f", usecs(threads[i].run[c]));
+		}
+		printf("\n");
+	}
+
+	memset(counts, 0, sizeof(counts));
+	for (c=0; c<ncpus; c++) {
+		for (i=0; i<cpus[c].num; i++) {
+			ev = &cpus[c].events[i];
+			if (ev->ev_type < TRACE_NTYPES) {
+				counts[ev->ev_type]++;
+			}
+		}
+	}
+	printf("\nswitches %u  sleeps %u  wakeups %u  syscalls %u  "
+	       "faults %u\ndisk reads %u  disk writes %u  IPIs %u\n",
+	       counts[TRACE_SWITCH], counts[TRACE_SLEEP], counts[TRACE_WAKE],
+	       counts[TRACE_SYSENTER], counts[TRACE_VMFAULT],
+	       counts[TRACE_DISKREAD], counts[TRACE_DISKWRITE],
+	       counts[TRACE_IPISEND]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *f;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "f:")) != -1) {
+		switch (ch) {
+		    case 'f':
+			cpuhz = atof(optarg);
+			if (cpuhz <= 0) {
+				errx(1, "Invalid clock rate %s", optarg);
+			}
+			break;
+		    default:
+			errx(1, "Usage: trdecode [-f cpu-hz] [logfile]");
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1) {
+		errx(1, "Usage: trdecode [-f cpu-hz] [logfile]");
+	}
+	if (argc == 1) {
+		f = fopen(argv[0], "r");
+		if (f == NULL) {
+			err(1, "%s", argv[0]);
+		}
+	}
+	else {
+		f = stdin;
+	}
+
+	readlog(f);
+	if (f != stdin) {
+		fclose(f);
+	}
+	if (ncpus == 0) {
+		errx(1, "No trace found");
+	}
+
+	namethreads();
+	timeline();
+	summary();
+	return 0;
+}
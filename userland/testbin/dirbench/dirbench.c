@@ -0,0 +1,235 @@
+/*
+ * dirbench - directory listing with getdirentry and getdirentries.
+ *
+ * Creates the given number of empty files (default 1000) in the given
+ * directory (default the current one), then lists the directory once
+ * a name at a time with getdirentry and once in bulk with
+ * getdirentries. Each listing has to find every file exactly once;
+ * the bulk one also has to agree with stat on the inode number and
+ * type it reports. Prints the number of calls and the time each
+ * listing took, then removes the files.
+ *
+ * Usage: dirbench [count] [directory]
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define PREFIX		"dirbench."
+#define BUFSIZE		8192
+
+static char *dir;
+static unsigned count;
+static unsigned char *seen;	/* times each file was listed */
+static char path[1024];
+static char buf[BUFSIZE];
+
+static
+unsigned
+msecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (s1 - s0) * 1000 + ((long)ns1 - (long)ns0) / 1000000;
+}
+
+static
+void
+makepath(unsigned i)
+{
+	snprintf(path, sizeof(path), "%s/%s%u", dir, PREFIX, i);
+}
+
+/* Note NAME as listed if it's one of ours, and return its number. */
+static
+int
+found(const char *name)
+{
+	unsigned i;
+
+	if (memcmp(name, PREFIX, strlen(PREFIX)) != 0) {
+		return -1;
+	}
+	i = atoi(name + strlen(PREFIX));
+	if (i >= count) {
+		return -1;
+	}
+	if (seen[i]++ != 0) {
+		errx(1, "%s listed twice", name);
+	}
+	return i;
+}
+
+static
+void
+checkseen(const char *how)
+{
+	unsigned i;
+
+	for (i=0; i<count; i++) {
+		if (seen[i] != 1) {
+			errx(1, "%s: %s%u never listed", how, PREFIX, i);
+		}
+		seen[i] = 0;
+	}
+}
+
+static
+int
+opendirfd(void)
+{
+	int fd;
+
+	fd = open(dir, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", dir);
+	}
+	return fd;
+}
+
+static
+void
+list_one(void)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned calls = 0;
+	ssize_t len;
+	int fd;
+
+	fd = opendirfd();
+	__time(&s0, &ns0);
+	while (1) {
+		len = getdirentry(fd, buf, sizeof(buf) - 1);
+		calls++;
+		if (len < 0) {
+			err(1, "getdirentry");
+		}
+		if (len == 0) {
+			break;
+		}
+		buf[len] = 0;
+		found(buf);
+	}
+	__time(&s1, &ns1);
+	close(fd);
+
+	checkseen("getdirentry");
+	printf("getdirentry:   %u calls, %u ms\n", calls,
+	       msecs(s0, ns0, s1, ns1));
+}
+
+static
+void
+list_bulk(void)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned calls = 0;
+	struct dirent *de;
+	struct stat st;
+	ssize_t len, pos;
+	int fd, i;
+
+	fd = opendirfd();
+	__time(&s0, &ns0);
+	while (1) {
+		len = getdirentries(fd, buf, sizeof(buf));
+		calls++;
+		if (len < 0) {
+			err(1, "getdirentries");
+		}
+		if (len == 0) {
+			break;
+		}
+		for (pos = 0; pos < len; pos += de->d_reclen) {
+			de = (struct dirent *)(buf + pos);
+			if (de->d_reclen == 0 || pos + de->d_reclen > len ||
+			    de->d_namlen != strlen(de->d_name)) {
+				errx(1, "getdirentries: bad record at %d",
+				     (int)pos);
+			}
+			found(de->d_name);
+		}
+	}
+	__time(&s1, &ns1);
+	close(fd);
+	checkseen("getdirentries");
+	printf("getdirentries: %u calls, %u ms\n", calls,
+	       msecs(s0, ns0, s1, ns1));
+
+	/* Now check what it says against stat, for one bufferful */
+	fd = opendirfd();
+	len = getdirentries(fd, buf, sizeof(buf));
+	if (len < 0) {
+		err(1, "getdirentries");
+	}
+	for (pos = 0; pos < len; pos += de->d_reclen) {
+		de = (struct dirent *)(buf + pos);
+		i = found(de->d_name);
+		if (i < 0) {
+			continue;
+		}
+		makepath(i);
+		if (stat(path, &st) < 0) {
+			err(1, "stat %s", path);
+		}
+		if (de->d_ino != 0 && de->d_ino != st.st_ino) {
+			errx(1, "%s: inode %u, stat says %u", path,
+			     de->d_ino, st.st_ino);
+		}
+		if (de->d_type != DT_UNKNOWN && de->d_type != DT_REG) {
+			errx(1, "%s: type %u, not DT_REG", path, de->d_type);
+		}
+	}
+	close(fd);
+	memset(seen, 0, count);
+	printf("getdirentries: inode numbers and types agree with stat\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned i;
+	int fd;
+
+	count = argc > 1 ? atoi(argv[1]) : 1000;
+	dir = argc > 2 ? argv[2] : (char *)".";
+	if (count == 0) {
+		errx(1, "Usage: dirbench [count] [directory]");
+	}
+
+	seen = malloc(count);
+	if (seen == NULL) {
+		err(1, "malloc");
+	}
+	memset(seen, 0, count);
+
+	printf("Creating %u files in %s...\n", count, dir);
+	for (i=0; i<count; i++) {
+		makepath(i);
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+		if (fd < 0) {
+			err(1, "%s", path);
+		}
+		close(fd);
+	}
+
+	list_one();
+	list_bulk();
+
+	for (i=0; i<count; i++) {
+		makepath(i);
+		if (remove(path) < 0) {
+			err(1, "remove %s", path);
+		}
+	}
+
+	printf("dirbench done.\n");
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * pipebench - pipe correctness and throughput.
+ *
+ * First some quick checks: a nonblocking pipe reports EAGAIN when
+ * empty and when full, and data written in odd-sized pieces through
+ * both the kernel's ring buffer and its page-lending path for large
+ * writes comes out intact and in order.
+ *
+ * Then a child process writes the given number of megabytes (default
+ * 4) into a pipe in chunks of several sizes while the parent reads
+ * it, and the throughput for each chunk size is printed. Chunks of
+ * 64K come from a page-aligned buffer, so the kernel copies them
+ * straight from the writer's pages; the smaller ones go through the
+ * ring.
+ *
+ * Usage: pipebench [megabytes]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGE		4096
+#define BIGCHUNK	65536
+#define CHECKBYTES	(1024 * 1024)
+
+static const size_t chunks[] = { 64, 512, 4096, BIGCHUNK };
+#define NCHUNKS (sizeof(chunks) / sizeof(chunks[0]))
+
+static char *wbuf;		/* page-aligned, BIGCHUNK bytes */
+static char rbuf[BIGCHUNK];
+
+static
+unsigned
+msecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (s1 - s0) * 1000 + ((long)ns1 - (long)ns0) / 1000000;
+}
+
+/* The byte at offset POS of the check stream. */
+static
+char
+pattern(size_t pos)
+{
+	return (char)(pos % 251);
+}
+
+static
+void
+checkwaitpid(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "writer failed");
+	}
+}
+
+static
+void
+test_nonblock(void)
+{
+	int fds[2];
+	size_t total;
+	ssize_t r;
+
+	if (pipe2(fds, O_NONBLOCK) < 0) {
+		err(1, "pipe2");
+	}
+
+	r = read(fds[0], rbuf, 1);
+	if (r != -1 || errno != EAGAIN) {
+		errx(1, "read of empty nonblocking pipe: got %d, not EAGAIN",
+		     (int)r);
+	}
+
+	memset(wbuf, 'x', PAGE);
+	total = 0;
+	while (1) {
+		r = write(fds[1], wbuf, 100);
+		if (r < 0) {
+			if (errno != EAGAIN) {
+				err(1, "write");
+			}
+			break;
+		}
+		total += r;
+		if (total > 1024 * 1024) {
+			errx(1, "nonblocking pipe never filled");
+		}
+	}
+	printf("nonblocking: EAGAIN when empty; full at %u bytes\n",
+	       (unsigned)total);
+
+	close(fds[0]);
+	r = write(fds[1], wbuf, 1);
+	if (r != -1 || errno != EPIPE) {
+		errx(1, "write with no reader: got %d, not EPIPE", (int)r);
+	}
+	close(fds[1]);
+}
+
+/*
+ * Send CHECKBYTES of the check pattern in writes of SIZE bytes and
+ * make sure it all arrives.
+ */
+static
+void
+test_data(size_t size)
+{
+	int fds[2];
+	pid_t pid;
+	size_t pos, len, i;
+	ssize_t r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (pos = 0; pos < CHECKBYTES; pos += len) {
+			len = CHECKBYTES - pos < size ? CHECKBYTES - pos : size;
+			for (i=0; i<len; i++) {
+				wbuf[i] = pattern(pos + i);
+			}
+			r = write(fds[1], wbuf, len);
+			if (r != (ssize_t)len) {
+				warn("write");
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	pos = 0;
+	/* Odd-sized reads, so they don't line up with anything. */
+	while ((r = read(fds[0], rbuf, 3001)) > 0) {
+		for (i=0; i<(size_t)r; i++) {
+			if (rbuf[i] != pattern(pos + i)) {
+				errx(1, "%u-byte writes: wrong data at offset "
+				     "%u", (unsigned)size, (unsigned)(pos + i));
+			}
+		}
+		pos += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (pos != CHECKBYTES) {
+		errx(1, "%u-byte writes: got %u bytes of %u", (unsigned)size,
+		     (unsigned)pos, CHECKBYTES);
+	}
+	close(fds[0]);
+	checkwaitpid(pid);
+	printf("%u-byte writes: data ok\n", (unsigned)size);
+}
+
+/*
+ * Time moving TOTAL bytes in writes of SIZE bytes.
+ */
+static
+void
+bench(size_t size, size_t total)
+{
+	int fds[2];
+	pid_t pid;
+	size_t pos;
+	ssize_t r;
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned ms;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&s0, &ns0);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		for (pos = 0; pos < total; pos += size) {
+			if (write(fds[1], wbuf, size) != (ssize_t)size) {
+				warn("write");
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	close(fds[1]);
+	pos = 0;
+	while ((r = read(fds[0], rbuf, sizeof(rbuf))) > 0) {
+		pos += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	close(fds[0]);
+	checkwaitpid(pid);
+
+	__time(&s1, &ns1);
+
+	if (pos != total) {
+		errx(1, "%u-byte writes: got %u bytes of %u", (unsigned)size,
+		     (unsigned)pos, (unsigned)total);
+	}
+	ms = msecs(s0, ns0, s1, ns1);
+	if (ms == 0) {
+		ms = 1;
+	}
+	printf("%6u-byte writes: %u KB in %u ms, %u KB/s\n",
+	       (unsigned)size, (unsigned)(total / 1024), ms,
+	       (unsigned)(total / 1024 * 1000 / ms));
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t total;
+	unsigned i;
+	char *p;
+
+	total = (argc > 1 ? atoi(argv[1]) : 4) * 1024 * 1024;
+	if (total == 0) {
+		errx(1, "Usage: pipebench [megabytes]");
+	}
+
+	p = malloc(BIGCHUNK + PAGE);
+	if (p == NULL) {
+		err(1, "malloc");
+	}
+	wbuf = (char *)(((unsigned long)p + PAGE - 1) &
+			~(unsigned long)(PAGE - 1));
+
+	test_nonblock();
+	test_data(1000);
+	test_data(BIGCHUNK);
+
+	memset(wbuf, 'p', BIGCHUNK);
+	for (i=0; i<NCHUNKS; i++) {
+		bench(chunks[i], total);
+	}
+
+	printf("pipebench done.\n");
+	return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * polltest - poll and select on pipes and semaphores.
+ *
+ * Checks that an empty pipe isn't readable and that poll then waits
+ * out its timeout; that a pipe becomes readable when written to and
+ * reports a hangup once its writer is gone; that a child writing to
+ * one of several pipes wakes a parent blocked in poll and in select;
+ * that bad descriptors come back as POLLNVAL from poll and EBADF from
+ * select; and that a semfs semaphore is readable exactly when its
+ * count is nonzero.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPIPES		4
+#define SEMNAME		"sem:polltest"
+
+static
+unsigned
+msecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (s1 - s0) * 1000 + ((long)ns1 - (long)ns0) / 1000000;
+}
+
+static
+void
+msleep(unsigned ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+}
+
+static
+void
+checkwaitpid(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+/* Poll one descriptor and return its revents. */
+static
+int
+poll1(int fd, int events, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) {
+		err(1, "poll");
+	}
+	if ((r == 0) != (pfd.revents == 0)) {
+		errx(1, "poll returned %d with revents 0x%x", r, pfd.revents);
+	}
+	return pfd.revents;
+}
+
+static
+void
+test_pipe(void)
+{
+	int fds[2];
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned ms;
+	char ch = 'x';
+	int r;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	__time(&s0, &ns0);
+	r = poll1(fds[0], POLLIN, 200);
+	__time(&s1, &ns1);
+	if (r != 0) {
+		errx(1, "empty pipe: revents 0x%x", r);
+	}
+	ms = msecs(s0, ns0, s1, ns1);
+	if (ms < 190) {
+		errx(1, "poll timed out after only %u ms", ms);
+	}
+	printf("empty pipe: not readable, timed out after %u ms\n", ms);
+
+	r = poll1(fds[1], POLLOUT, 0);
+	if (r != POLLOUT) {
+		errx(1, "empty pipe write end: revents 0x%x", r);
+	}
+
+	if (write(fds[1], &ch, 1) != 1) {
+		err(1, "write");
+	}
+	r = poll1(fds[0], POLLIN, 0);
+	if (r != POLLIN) {
+		errx(1, "pipe with data: revents 0x%x", r);
+	}
+
+	close(fds[1]);
+	r = poll1(fds[0], POLLIN, 0);
+	if ((r & POLLHUP) == 0) {
+		errx(1, "pipe with no writer: revents 0x%x", r);
+	}
+	close(fds[0]);
+
+	r = poll1(fds[0], POLLIN, 0);
+	if (r != POLLNVAL) {
+		errx(1, "closed fd: revents 0x%x", r);
+	}
+	printf("pipe: readable with data, hangup, closed fd ok\n");
+}
+
+/*
+ * Block in poll (or select) on NPIPES pipes while a child writes to
+ * the one numbered WHICH.
+ */
+static
+void
+test_wakeup(bool useselect, int which)
+{
+	int fds[NPIPES][2];
+	struct pollfd pfds[NPIPES];
+	fd_set rset;
+	pid_t pid;
+	int i, r, maxfd = 0;
+	char ch = 'w';
+
+	for (i=0; i<NPIPES; i++) {
+		if (pipe(fds[i]) < 0) {
+			err(1, "pipe");
+		}
+		pfds[i].fd = fds[i][0];
+		pfds[i].events = POLLIN;
+		if (fds[i][0] > maxfd) {
+			maxfd = fds[i][0];
+		}
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		msleep(100);
+		if (write(fds[which][1], &ch, 1) != 1) {
+			warn("write");
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	if (useselect) {
+		FD_ZERO(&rset);
+		for (i=0; i<NPIPES; i++) {
+			FD_SET(fds[i][0], &rset);
+		}
+		r = select(maxfd + 1, &rset, NULL, NULL, NULL);
+		if (r < 0) {
+			err(1, "select");
+		}
+		for (i=0; i<NPIPES; i++) {
+			if (FD_ISSET(fds[i][0], &rset) != (i == which)) {
+				errx(1, "select: pipe %d wrongly %s", i,
+				     i == which ? "not ready" : "ready");
+			}
+		}
+	}
+	else {
+		r = poll(pfds, NPIPES, -1);
+		if (r < 0) {
+			err(1, "poll");
+		}
+		for (i=0; i<NPIPES; i++) {
+			if ((pfds[i].revents != 0) != (i == which)) {
+				errx(1, "poll: pipe %d revents 0x%x", i,
+				     pfds[i].revents);
+			}
+		}
+	}
+	if (r != 1) {
+		errx(1, "%s returned %d, not 1",
+		     useselect ? "select" : "poll", r);
+	}
+
+	checkwaitpid(pid);
+	for (i=0; i<NPIPES; i++) {
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	printf("%s: woken by a write to pipe %d of %d\n",
+	       useselect ? "select" : "poll", which, NPIPES);
+}
+
+static
+void
+test_select_badfd(void)
+{
+	fd_set rset;
+	struct timeval tv;
+	int fd;
+
+	fd = open("null:", O_RDONLY);
+	if (fd < 0) {
+		err(1, "null:");
+	}
+	close(fd);
+
+	FD_ZERO(&rset);
+	FD_SET(fd, &rset);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	if (select(fd + 1, &rset, NULL, NULL, &tv) != -1 || errno != EBADF) {
+		errx(1, "select on a closed fd didn't fail with EBADF");
+	}
+	printf("select: closed fd gives EBADF\n");
+}
+
+static
+void
+test_sem(void)
+{
+	int fd, r;
+	char ch = 0;
+
+	fd = open(SEMNAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", SEMNAME);
+	}
+
+	r = poll1(fd, POLLIN | POLLOUT, 0);
+	if (r != POLLOUT) {
+		errx(1, "semaphore at 0: revents 0x%x", r);
+	}
+	/* V */
+	if (write(fd, &ch, 1) != 1) {
+		err(1, "write");
+	}
+	r = poll1(fd, POLLIN, 0);
+	if (r != POLLIN) {
+		errx(1, "semaphore at 1: revents 0x%x", r);
+	}
+	/* P */
+	if (read(fd, &ch, 1) != 1) {
+		err(1, "read");
+	}
+	r = poll1(fd, POLLIN, 0);
+	if (r != 0) {
+		errx(1, "semaphore back at 0: revents 0x%x", r);
+	}
+
+	close(fd);
+	remove(SEMNAME);
+	printf("semaphore: readable only when nonzero\n");
+}
+
+int
+main(void)
+{
+	test_pipe();
+	test_wakeup(false, 2);
+	test_wakeup(true, 1);
+	test_select_badfd();
+	test_sem();
+	printf("polltest done.\n");
+	return 0;
+}
@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <shm.h>
 
 #ifndef RANDOM_MAX
 /* Note: this is correct for OS/161 but not for some Unix C libraries */
@@ -100,6 +101,12 @@
  * Also note that you can set numprocs and numkeys on the command
  * line, but not WORKNUM.
  *
+ * Each sorted bin goes from the proc that sorted it to the proc that
+ * merges it in a shared memory segment, so the merge works from
+ * memory instead of reading the bins back a key at a time. With -f
+ * the sorted bins are written back to their files and merged from
+ * there instead, which takes no shared memory support.
+ *
  * FUTURE: maybe make a build option to malloc the work space instead
  * of using a static buffer, which would allow choosing WORKNUM on the
  * command line too, at the cost of depending on malloc working.
@@ -125,6 +132,10 @@ static int me = NOBODY;
 
 static const char *progname;
 
+/* Hand sorted bins over in shared memory, named after the director */
+static int useshm = 1;
+static pid_t director;
+
 ////////////////////////////////////////////////////////////
 
 static
@@ -422,6 +433,54 @@ dolseek(const char *name, int fd, off_t offset, int whence)
 	}
 }
 
+static
+int
+doshmget(const char *name, size_t size, int flags)
+{
+	int id;
+
+	id = shmget(name, size, flags);
+	if (id < 0) {
+		complain("%s: shmget", name);
+		exit(1);
+	}
+	return id;
+}
+
+static
+int *
+doshmat(const char *name, int id)
+{
+	void *p;
+
+	p = shmat(id);
+	if (p == (void *)-1) {
+		complain("%s: shmat", name);
+		exit(1);
+	}
+	return p;
+}
+
+static
+void
+doshmdt(const char *name, const void *p)
+{
+	if (shmdt(p) < 0) {
+		complain("%s: shmdt", name);
+		exit(1);
+	}
+}
+
+static
+void
+doshmrm(const char *name, int id)
+{
+	if (shmrm(id) < 0) {
+		complain("%s: shmrm", name);
+		exit(1);
+	}
+}
+
 #if 0 /* let's not require subdirs */
 static
 void
@@ -667,6 +726,15 @@ mergedname(int a)
 	return rv;
 }
 
+static
+const char *
+runname(int a, int b)
+{
+	static char rv[SHM_NAMELEN];
+	snprintf(rv, sizeof(rv), "psort.%d.bin-%d-%d", (int)director, a, b);
+	return rv;
+}
+
 static
 void
 bin(void)
@@ -720,6 +788,25 @@ bin(void)
 	}
 }
 
+/*
+ * Put sorted bin me-B, NUM keys in the workspace, in a shared memory
+ * segment for the merge: the count, then the keys.
+ */
+static
+void
+putrun(int b, int num)
+{
+	const char *name;
+	int id, *run;
+
+	name = runname(me, b);
+	id = doshmget(name, (num + 1) * sizeof(int), SHM_CREAT|SHM_EXCL);
+	run = doshmat(name, id);
+	run[0] = num;
+	memcpy(run + 1, workspace, num * sizeof(int));
+	doshmdt(name, run);
+}
+
 static
 void
 sortbins(void)
@@ -746,8 +833,13 @@ sortbins(void)
 
 		sortints(workspace, binsize/sizeof(int));
 
-		dolseek(name, fd, 0, SEEK_SET);
-		dowrite(name, fd, workspace, binsize);
+		if (useshm) {
+			putrun(i, binsize/sizeof(int));
+		}
+		else {
+			dolseek(name, fd, 0, SEEK_SET);
+			dowrite(name, fd, workspace, binsize);
+		}
 		doclose(name, fd);
 	}
 }
@@ -834,6 +926,68 @@ mergebins(void)
 	}
 }
 
+/*
+ * Like mergebins, but merge the sorted bins straight out of the
+ * segments putrun left them in.
+ */
+static
+void
+mergeruns(void)
+{
+	int *runs[numprocs], places[numprocs];
+	const char *name, *outname;
+	int i, id, outfd;
+	int place, val, worknum;
+
+	outname = mergedname(me);
+	outfd = doopen(outname, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+
+	for (i=0; i<numprocs; i++) {
+		name = runname(i, me);
+		id = doshmget(name, 0, 0);
+		runs[i] = doshmat(name, id);
+		/* Nobody else wants it; it goes away when we detach. */
+		doshmrm(name, id);
+		places[i] = 1;
+	}
+
+	worknum = 0;
+	val = 0;
+
+	while (1) {
+		/* find the smallest */
+		place = -1;
+		for (i=0; i<numprocs; i++) {
+			if (places[i] > runs[i][0]) {
+				continue;
+			}
+			if (place < 0 || runs[i][places[i]] < val) {
+				val = runs[i][places[i]];
+				place = i;
+			}
+		}
+		if (place < 0) {
+			break;
+		}
+		places[place]++;
+
+		workspace[worknum++] = val;
+		if (worknum >= WORKNUM) {
+			assert(worknum == WORKNUM);
+			dowrite(outname, outfd, workspace,
+				worknum * sizeof(int));
+			worknum = 0;
+		}
+	}
+
+	dowrite(outname, outfd, workspace, worknum * sizeof(int));
+	doclose(outname, outfd);
+
+	for (i=0; i<numprocs; i++) {
+		doshmdt(runname(i, me), runs[i]);
+	}
+}
+
 static
 void
 assemble(void)
@@ -927,7 +1081,7 @@ sort(void)
 	/* Step 3: Merge corresponding bins. */
 	complainx("Merging %d bins using %d procs",
 		  numprocs*numprocs, numprocs);
-	doforkall("Merging", mergebins);
+	doforkall("Merging", useshm ? mergeruns : mergebins);
 	checksize_merge();
 	complainx("Done merging the bins.");
 
@@ -1152,7 +1306,8 @@ static
 void
 usage(void)
 {
-	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r]", progname);
+	complain("Usage: %s [-p procs] [-k keys] [-s seed] [-r] [-f]",
+		 progname);
 	exit(1);
 }
 
@@ -1173,6 +1328,7 @@ doargs(int argc, char *argv[])
 		    case 'k': arg = 1; break;
 		    case 's': arg = 1; break;
 		    case 'r': arg = 0; break;
+		    case 'f': arg = 0; break;
 		    default: usage(); return;
 		}
 		if (arg) {
@@ -1198,6 +1354,7 @@ doargs(int argc, char *argv[])
 		else {
 			switch (ch) {
 			    case 'r': randomize(); break;
+			    case 'f': useshm = 0; break;
 			    default: assert(0); break;
 			}
 		}
@@ -1208,6 +1365,7 @@ int
 main(int argc, char *argv[])
 {
 	initprogname(argc > 0 ? argv[0] : NULL);
+	director = getpid();
 
 	doargs(argc, argv);
 	correctsize = (off_t) (numkeys*sizeof(int));
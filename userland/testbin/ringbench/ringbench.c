@@ -0,0 +1,301 @@
+/*
+ * ringbench - small I/O through a submission/completion ring versus
+ * one system call apiece.
+ *
+ * Writes a file in small pieces with pwrite and then with ring
+ * requests in batches, reads it back both ways checking what comes
+ * back, and does the same number of ring NOPs against getpid calls
+ * to show the bare per-call cost. Then opens, fsyncs and closes a
+ * file through the ring. Prints the time per operation for each.
+ *
+ * Usage: ringbench [count] [piece size]
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ioring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#define FILENAME	"ringbench.dat"
+#define ENTRIES		64
+#define MAXPIECE	512
+
+static uint64_t ringmem[IORING_SIZE(ENTRIES) / sizeof(uint64_t)];
+static struct ioring *ring = (struct ioring *)ringmem;
+static unsigned sqnext;		/* where to queue; published by ring_submit */
+
+static unsigned count, piece;
+static char wbuf[MAXPIECE];
+static char rbufs[ENTRIES][MAXPIECE];
+
+static
+unsigned
+usecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (s1 - s0) * 1000000 + ((long)ns1 - (long)ns0) / 1000;
+}
+
+static
+void
+report(const char *what, unsigned us)
+{
+	printf("%-14s %6u ops %8u us  %5u.%02u us/op\n", what, count, us,
+	       us / count, (us % count) * 100 / count);
+}
+
+/* Fill in the next submission entry, without handing it over yet. */
+static
+void
+ring_queue(unsigned op, int fd, off_t off, void *addr, unsigned len,
+	   unsigned flags, unsigned data)
+{
+	struct ioring_sqe *sqe;
+
+	sqe = &IORING_SQ(ring)[sqnext++ % ENTRIES];
+	sqe->sqe_op = op;
+	sqe->sqe_fd = fd;
+	sqe->sqe_off = off;
+	sqe->sqe_addr = (uintptr_t)addr;
+	sqe->sqe_len = len;
+	sqe->sqe_flags = flags;
+	sqe->sqe_data = data;
+}
+
+/* Hand over what has been queued and wait for all the results. */
+static
+void
+ring_submit(void)
+{
+	unsigned n = sqnext - ring->ir_sqtail;
+
+	ioring_barrier();
+	ring->ir_sqtail = sqnext;
+	while (ring->ir_cqtail - ring->ir_cqhead < n) {
+		if (ioring_enter(n) < 0) {
+			err(1, "ioring_enter");
+		}
+	}
+	ioring_barrier();
+}
+
+/* Take the next completion. */
+static
+struct ioring_cqe *
+ring_reap(void)
+{
+	struct ioring_cqe *cqe;
+
+	cqe = &IORING_CQ(ring)[ring->ir_cqhead % ENTRIES];
+	ring->ir_cqhead++;
+	return cqe;
+}
+
+static
+void
+fillpiece(char *buf, unsigned i)
+{
+	unsigned j;
+
+	for (j=0; j<piece; j++) {
+		buf[j] = 'a' + (i + j) % 26;
+	}
+}
+
+static
+void
+checkpiece(const char *buf, unsigned i)
+{
+	unsigned j;
+
+	for (j=0; j<piece; j++) {
+		if (buf[j] != (char)('a' + (i + j) % 26)) {
+			errx(1, "piece %u: wrong data at byte %u", i, j);
+		}
+	}
+}
+
+static
+void
+run_syscalls(int fd)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	unsigned i;
+
+	__time(&s0, &ns0);
+	for (i=0; i<count; i++) {
+		fillpiece(wbuf, i);
+		if (pwrite(fd, wbuf, piece, (off_t)i * piece) != (int)piece) {
+			err(1, "pwrite");
+		}
+	}
+	__time(&s1, &ns1);
+	report("pwrite", usecs(s0, ns0, s1, ns1));
+
+	__time(&s0, &ns0);
+	for (i=0; i<count; i++) {
+		if (pread(fd, rbufs[0], piece, (off_t)i * piece) !=
+		    (int)piece) {
+			err(1, "pread");
+		}
+		checkpiece(rbufs[0], i);
+	}
+	__time(&s1, &ns1);
+	report("pread", usecs(s0, ns0, s1, ns1));
+
+	__time(&s0, &ns0);
+	for (i=0; i<count; i++) {
+		getpid();
+	}
+	__time(&s1, &ns1);
+	report("getpid", usecs(s0, ns0, s1, ns1));
+}
+
+static
+void
+run_ring(int fd)
+{
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	struct ioring_cqe *cqe;
+	unsigned i, j, n;
+
+	/*
+	 * Each batch writes from its own copy of the data, since none
+	 * of it is looked at until the batch is done.
+	 */
+	__time(&s0, &ns0);
+	for (i=0; i<count; i+=n) {
+		n = count - i < ENTRIES ? count - i : ENTRIES;
+		for (j=0; j<n; j++) {
+			fillpiece(rbufs[j], i + j);
+			ring_queue(IORING_OP_WRITE, fd, (off_t)(i + j) * piece,
+				   rbufs[j], piece, 0, i + j);
+		}
+		ring_submit();
+		for (j=0; j<n; j++) {
+			cqe = ring_reap();
+			if (cqe->cqe_res != (int)piece) {
+				errx(1, "ring write %u: result %d",
+				     cqe->cqe_data, cqe->cqe_res);
+			}
+		}
+	}
+	__time(&s1, &ns1);
+	report("ring write", usecs(s0, ns0, s1, ns1));
+
+	__time(&s0, &ns0);
+	for (i=0; i<count; i+=n) {
+		n = count - i < ENTRIES ? count - i : ENTRIES;
+		for (j=0; j<n; j++) {
+			ring_queue(IORING_OP_READ, fd, (off_t)(i + j) * piece,
+				   rbufs[j], piece, 0, j);
+		}
+		ring_submit();
+		for (j=0; j<n; j++) {
+			cqe = ring_reap();
+			if (cqe->cqe_res != (int)piece) {
+				errx(1, "ring read %u: result %d",
+				     i + cqe->cqe_data, cqe->cqe_res);
+			}
+			checkpiece(rbufs[cqe->cqe_data], i + cqe->cqe_data);
+		}
+	}
+	__time(&s1, &ns1);
+	report("ring read", usecs(s0, ns0, s1, ns1));
+
+	__time(&s0, &ns0);
+	for (i=0; i<count; i+=n) {
+		n = count - i < ENTRIES ? count - i : ENTRIES;
+		for (j=0; j<n; j++) {
+			ring_queue(IORING_OP_NOP, -1, 0, NULL, 0, 0, j);
+		}
+		ring_submit();
+		ring->ir_cqhead += n;
+	}
+	__time(&s1, &ns1);
+	report("ring nop", usecs(s0, ns0, s1, ns1));
+}
+
+/* Open, fsync and close a file with ring requests. */
+static
+void
+run_openclose(void)
+{
+	struct ioring_cqe *cqe;
+	int fd;
+
+	ring_queue(IORING_OP_OPEN, -1, 0, (char *)FILENAME, 0, O_RDONLY, 0);
+	ring_submit();
+	cqe = ring_reap();
+	if (cqe->cqe_res < 0) {
+		errx(1, "ring open: error %d", -cqe->cqe_res);
+	}
+	fd = cqe->cqe_res;
+
+	ring_queue(IORING_OP_FSYNC, fd, 0, NULL, 0, 0, 1);
+	ring_queue(IORING_OP_CLOSE, fd, 0, NULL, 0, 0, 2);
+	ring_queue(IORING_OP_CLOSE, fd, 0, NULL, 0, 0, 3);
+	ring_submit();
+
+	/* Completions come back in order */
+	cqe = ring_reap();
+	if (cqe->cqe_data != 1 || cqe->cqe_res != 0) {
+		errx(1, "ring fsync: result %d", cqe->cqe_res);
+	}
+	cqe = ring_reap();
+	if (cqe->cqe_data != 2 || cqe->cqe_res != 0) {
+		errx(1, "ring close: result %d", cqe->cqe_res);
+	}
+	cqe = ring_reap();
+	if (cqe->cqe_data != 3 || cqe->cqe_res >= 0) {
+		errx(1, "second ring close of fd %d didn't fail", fd);
+	}
+	printf("ring open/fsync/close ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd;
+
+	count = argc > 1 ? atoi(argv[1]) : 4096;
+	piece = argc > 2 ? atoi(argv[2]) : 64;
+	if (count == 0 || piece == 0 || piece > MAXPIECE) {
+		errx(1, "Usage: ringbench [count] [piece size <= %d]",
+		     MAXPIECE);
+	}
+
+	if (ioring_setup(ring, ENTRIES) < 0) {
+		err(1, "ioring_setup");
+	}
+	if (ring->ir_entries != ENTRIES) {
+		errx(1, "ioring_setup: ring has %u entries", ring->ir_entries);
+	}
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	printf("%u pieces of %u bytes, rings of %d\n", count, piece, ENTRIES);
+	run_syscalls(fd);
+	run_ring(fd);
+	close(fd);
+
+	run_openclose();
+
+	if (ioring_setup(NULL, 0) < 0) {
+		err(1, "ioring_setup teardown");
+	}
+	if (ioring_enter(0) >= 0) {
+		errx(1, "ioring_enter worked after teardown");
+	}
+	remove(FILENAME);
+	printf("ringbench done.\n");
+	return 0;
+}
@@ -28,82 +28,133 @@
  */
 
 /*
- * Test multiple user level threads inside a process. The program
- * forks 3 threads off 2 to functions, each of which displays a string
- * every once in a while.
+ * Test multiple user level threads inside a process.
  *
- * This won't do much of anything unless you implement user-level
- * threads.
+ * The same fixed amount of arithmetic is done twice: once by the main
+ * thread alone, then split evenly over several threads created with
+ * thread_create. Each thread works on its own data and adds its
+ * result to a shared total under a umutex at the end; the main thread
+ * joins them all and checks the total matches the single-threaded
+ * one. On a multiprocessor sys161 configuration the threaded run
+ * should be faster by close to the number of CPUs, since nothing is
+ * copied and no process is created.
  *
- * It also makes various assumptions about the thread API. In
- * particular, it believes (1) that you create a thread by calling
- * "threadfork()" and passing the address for execution of the new
- * thread to begin at, (2) that if the parent thread exits any child
- * threads will keep running, and (3) child threads will exit if they
- * return from the function they started in. If any or all of these
- * assumptions are not met by your user-level threads, you will need
- * to patch this test accordingly.
- *
- * This is also a rather basic test and you'll probably want to write
- * some more of your own.
+ * Usage: userthreads [nthreads]
  */
 
-
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <err.h>
+#include <umutex.h>
 
-#define NTHREADS  3
-#define MAX       1<<25
+#define DEFTHREADS	4
+#define WORK		(1 << 22)	/* total iterations */
 
-/* counter for the loop in the threads:
-   This variable is shared and incremented by each
-   thread during his computation */
-volatile int count = 0;
+struct job {
+	unsigned start;
+	unsigned count;
+};
 
-/* the 2 threads : */
-void ThreadRunner(void);
-void BladeRunner(void);
+static struct job jobs[THREAD_MAX];
+static struct umutex totallock = UMUTEX_INITIALIZER;
+static unsigned total;
 
-int
-main(int argc, char *argv[])
+/*
+ * Some arithmetic that depends on every iteration, so it can't be
+ * skipped, and whose result doesn't depend on how it's split up.
+ */
+static
+unsigned
+crunch(unsigned start, unsigned count)
 {
-    int i;
+	unsigned i, x, sum;
 
-    (void)argc;
-    (void)argv;
+	sum = 0;
+	for (i = start; i < start + count; i++) {
+		x = i * 2654435761U;
+		x ^= x >> 13;
+		sum += x;
+	}
+	return sum;
+}
 
-    for (i=0; i<NTHREADS; i++) {
-	if (i)
-	    threadfork(ThreadRunner);
-        else
-	    threadfork(BladeRunner);
-    }
+static
+void *
+worker(void *arg)
+{
+	struct job *j = arg;
+	unsigned sum;
 
-    tprintf("Parent has left.\n");
-    return 0;
-}
+	sum = crunch(j->start, j->count);
 
-/* multiple threads will simply print out the global variable.
-   Even though there is no synchronization, we should get some
-   random results.
-*/
+	umutex_lock(&totallock);
+	total += sum;
+	umutex_unlock(&totallock);
 
-void
-BladeRunner()
+	return j;
+}
+
+static
+unsigned
+msecs(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
 {
-    while (count < MAX) {
-	if (count % 500 == 0)
-	    tprintf("Blade ");
-	count++;
-    }
+	return (s1 - s0) * 1000 + ((long)ns1 - (long)ns0) / 1000000;
 }
 
-void
-ThreadRunner()
+int
+main(int argc, char *argv[])
 {
-    while (count < MAX) {
-	if (count % 513 == 0)
-	    tprintf(" Runner\n");
-	count++;
-    }
+	int nthreads, i;
+	int tids[THREAD_MAX];
+	unsigned expect, each, single, multi;
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+	void *ret;
+
+	nthreads = argc > 1 ? atoi(argv[1]) : DEFTHREADS;
+	if (nthreads < 1 || nthreads > THREAD_MAX - 1) {
+		errx(1, "Usage: userthreads [nthreads], at most %d",
+		     THREAD_MAX - 1);
+	}
+
+	__time(&s0, &ns0);
+	expect = crunch(0, WORK);
+	__time(&s1, &ns1);
+	single = msecs(s0, ns0, s1, ns1);
+	printf("1 thread: %u ms\n", single);
+
+	each = WORK / nthreads;
+	__time(&s0, &ns0);
+	for (i=0; i<nthreads; i++) {
+		jobs[i].start = i * each;
+		jobs[i].count = (i == nthreads - 1) ? WORK - i * each : each;
+		tids[i] = thread_create(worker, &jobs[i]);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		if (thread_join(tids[i], &ret) < 0) {
+			err(1, "thread_join");
+		}
+		if (ret != &jobs[i]) {
+			errx(1, "thread %d returned the wrong value", tids[i]);
+		}
+	}
+	__time(&s1, &ns1);
+	multi = msecs(s0, ns0, s1, ns1);
+	printf("%d threads: %u ms", nthreads, multi);
+	if (multi > 0) {
+		printf(" (speedup %u.%02u)", single / multi,
+		       (single * 100 / multi) % 100);
+	}
+	printf("\n");
+
+	if (total != expect) {
+		errx(1, "FAILED: total %u, expected %u", total, expect);
+	}
+	printf("Passed.\n");
+	return 0;
 }